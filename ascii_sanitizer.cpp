@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include "wifilogd/ascii_sanitizer.h"
+
+namespace android {
+namespace wifilogd {
+namespace ascii_sanitizer {
+
+namespace {
+
+// The number of bytes processed by each vector operation.
+constexpr size_t kBlockSize = 16;
+
+#if defined(__SSE2__)
+
+// Returns a mask with 0xff in each lane where |block| holds a printable
+// character, and 0x00 in every other lane.
+__m128i GetPrintableMask(__m128i block) {
+  // SSE2 only provides signed byte comparisons. Flipping the high bit
+  // maps the unsigned range [0x00, 0xff] onto the signed range [-128, 127],
+  // while preserving order.
+  const __m128i flipped = _mm_xor_si128(block, _mm_set1_epi8(-0x80));
+  const __m128i at_least_space =
+      _mm_cmpgt_epi8(flipped, _mm_set1_epi8(' ' - 1 - 0x80));
+  const __m128i at_most_tilde =
+      _mm_cmplt_epi8(flipped, _mm_set1_epi8('~' + 1 - 0x80));
+  const __m128i is_tab = _mm_cmpeq_epi8(block, _mm_set1_epi8('\t'));
+  const __m128i is_newline = _mm_cmpeq_epi8(block, _mm_set1_epi8('\n'));
+  return _mm_or_si128(_mm_and_si128(at_least_space, at_most_tilde),
+                      _mm_or_si128(is_tab, is_newline));
+}
+
+char* CopySanitizedBlocks(const uint8_t* buf, size_t n_blocks,
+                          char replacement, char* out) {
+  const __m128i replacement_block = _mm_set1_epi8(replacement);
+  for (size_t i = 0; i < n_blocks; ++i) {
+    const __m128i block =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(buf));
+    const __m128i printable = GetPrintableMask(block);
+    __m128i sanitized = block;
+    if (_mm_movemask_epi8(printable) != 0xffff) {
+      sanitized = _mm_or_si128(_mm_and_si128(printable, block),
+                               _mm_andnot_si128(printable, replacement_block));
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(out), sanitized);
+    buf += kBlockSize;
+    out += kBlockSize;
+  }
+  return out;
+}
+
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+
+// Returns a mask with 0xff in each lane where |block| holds a printable
+// character, and 0x00 in every other lane.
+uint8x16_t GetPrintableMask(uint8x16_t block) {
+  const uint8x16_t in_range = vandq_u8(vcgeq_u8(block, vdupq_n_u8(' ')),
+                                       vcleq_u8(block, vdupq_n_u8('~')));
+  const uint8x16_t is_tab = vceqq_u8(block, vdupq_n_u8('\t'));
+  const uint8x16_t is_newline = vceqq_u8(block, vdupq_n_u8('\n'));
+  return vorrq_u8(in_range, vorrq_u8(is_tab, is_newline));
+}
+
+// Returns true if every lane of |mask| is 0xff.
+bool IsAllSet(uint8x16_t mask) {
+#if defined(__aarch64__)
+  return vminvq_u8(mask) == 0xff;
+#else
+  uint8x8_t folded = vpmin_u8(vget_low_u8(mask), vget_high_u8(mask));
+  folded = vpmin_u8(folded, folded);
+  folded = vpmin_u8(folded, folded);
+  folded = vpmin_u8(folded, folded);
+  return vget_lane_u8(folded, 0) == 0xff;
+#endif
+}
+
+char* CopySanitizedBlocks(const uint8_t* buf, size_t n_blocks,
+                          char replacement, char* out) {
+  const uint8x16_t replacement_block =
+      vdupq_n_u8(static_cast<uint8_t>(replacement));
+  for (size_t i = 0; i < n_blocks; ++i) {
+    const uint8x16_t block = vld1q_u8(buf);
+    const uint8x16_t printable = GetPrintableMask(block);
+    uint8x16_t sanitized = block;
+    if (!IsAllSet(printable)) {
+      sanitized = vbslq_u8(printable, block, replacement_block);
+    }
+    vst1q_u8(reinterpret_cast<uint8_t*>(out), sanitized);
+    buf += kBlockSize;
+    out += kBlockSize;
+  }
+  return out;
+}
+
+#else
+
+char* CopySanitizedBlocks(const uint8_t* buf, size_t n_blocks,
+                          char replacement, char* out) {
+  return CopySanitizedScalar(buf, n_blocks * kBlockSize, replacement, out);
+}
+
+#endif
+
+}  // namespace
+
+char* CopySanitized(const uint8_t* buf, size_t buf_len, char replacement,
+                    char* out) {
+  const size_t n_blocks = buf_len / kBlockSize;
+  out = CopySanitizedBlocks(buf, n_blocks, replacement, out);
+  return CopySanitizedScalar(buf + n_blocks * kBlockSize,
+                             buf_len % kBlockSize, replacement, out);
+}
+
+char* CopySanitizedScalar(const uint8_t* buf, size_t buf_len,
+                          char replacement, char* out) {
+  return std::replace_copy_if(
+      buf, buf + buf_len, out,
+      [](auto c) { return !local_utils::IsAsciiPrintable(c); }, replacement);
+}
+
+}  // namespace ascii_sanitizer
+}  // namespace wifilogd
+}  // namespace android
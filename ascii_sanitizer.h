@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef ASCII_SANITIZER_H_
+#define ASCII_SANITIZER_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "wifilogd/local_utils.h"
+
+namespace android {
+namespace wifilogd {
+namespace ascii_sanitizer {
+
+// Copies |buf_len| bytes from |buf| to |out|, replacing every byte that is
+// not printable (per local_utils::IsAsciiPrintable()) with |replacement|.
+// Returns a pointer just past the last character written.
+//
+// Uses vector instructions, where available (SSE2 on x86, NEON on ARM).
+// Blocks of input that are entirely printable are stored without being
+// rewritten.
+char* CopySanitized(const uint8_t* buf, size_t buf_len, char replacement,
+                    NONNULL char* out);
+
+// Behaves exactly as CopySanitized(), but processes one byte at a time.
+// This is the fallback for platforms without vector instructions, and the
+// reference implementation for tests.
+char* CopySanitizedScalar(const uint8_t* buf, size_t buf_len,
+                          char replacement, NONNULL char* out);
+
+}  // namespace ascii_sanitizer
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // ASCII_SANITIZER_H_
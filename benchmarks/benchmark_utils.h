@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BENCHMARKS_BENCHMARK_UTILS_H_
+#define BENCHMARKS_BENCHMARK_UTILS_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "benchmark/benchmark.h"
+
+#include "wifilogd/byte_buffer.h"
+#include "wifilogd/os.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+namespace benchmark_utils {
+
+using CommandBuffer = ByteBuffer<protocol::kMaxMessageSize>;
+
+// Returns a kWriteAsciiMessage command, with |tag| and |message|.
+inline CommandBuffer BuildAsciiMessageCommand(const std::string& tag,
+                                              const std::string& message) {
+  const auto ascii_message_header =
+      protocol::AsciiMessage()
+          .set_tag_len(tag.length())
+          .set_data_len(message.length())
+          .set_severity(protocol::MessageSeverity::kError);
+  const auto command =
+      protocol::Command()
+          .set_opcode(protocol::Opcode::kWriteAsciiMessage)
+          .set_payload_len(sizeof(ascii_message_header) + tag.length() +
+                           message.length());
+  return CommandBuffer()
+      .AppendOrDie(&command, sizeof(command))
+      .AppendOrDie(&ascii_message_header, sizeof(ascii_message_header))
+      .AppendOrDie(tag.data(), tag.length())
+      .AppendOrDie(message.data(), message.length());
+}
+
+// Reports the throughput of a benchmark which handled |n_messages| in
+// total, as messages/sec ("items_per_second"), and as the time per message
+// ("time_per_msg", in seconds).
+inline void ReportMessageRate(benchmark::State& state, int64_t n_messages) {
+  state.SetItemsProcessed(n_messages);
+  state.counters["time_per_msg"] =
+      benchmark::Counter(static_cast<double>(n_messages),
+                         benchmark::Counter::kIsRate |
+                             benchmark::Counter::kInvert);
+}
+
+// An Os whose clocks never advance, so that benchmarks can exclude the
+// cost of reading the clocks.
+class FixedClockOs : public Os {
+ public:
+  FixedClockOs() = default;
+
+  Timestamp GetTimestamp(clockid_t /* clock_id */) const override {
+    return Timestamp{1, 0};
+  }
+};
+
+}  // namespace benchmark_utils
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // BENCHMARKS_BENCHMARK_UTILS_H_
@@ -0,0 +1,265 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include "android-base/logging.h"
+#include "android-base/unique_fd.h"
+#include "benchmark/benchmark.h"
+
+#include "wifilogd/benchmarks/benchmark_utils.h"
+#include "wifilogd/command_processor.h"
+#include "wifilogd/log_buffer.h"
+#include "wifilogd/os.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/structured_formats.h"
+#include "wifilogd/structured_message_writer.h"
+#include "wifilogd/timestamper.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using ::android::base::unique_fd;
+using benchmark_utils::BuildAsciiMessageCommand;
+using benchmark_utils::CommandBuffer;
+using benchmark_utils::FixedClockOs;
+using benchmark_utils::ReportMessageRate;
+
+constexpr size_t kBufferSizeBytes = 512 * 1024;
+
+// The clocks used to timestamp messages. (Passed as the benchmark's
+// argument.)
+enum ClockSource : int64_t {
+  kReadAllClocks,       // Real clocks, all read for every message.
+  kDeriveFromBoottime,  // Real clocks, with derived offsets.
+  kFixedClocks,         // Clocks that are never read.
+};
+
+std::unique_ptr<CommandProcessor> MakeCommandProcessor(int64_t clock_source) {
+  switch (clock_source) {
+    case kReadAllClocks:
+      return std::unique_ptr<CommandProcessor>(new CommandProcessor(
+          kBufferSizeBytes, std::unique_ptr<Os>(new Os()),
+          Timestamper::Mode::kReadAllClocks));
+    case kDeriveFromBoottime:
+      return std::unique_ptr<CommandProcessor>(new CommandProcessor(
+          kBufferSizeBytes, std::unique_ptr<Os>(new Os()),
+          Timestamper::Mode::kDeriveFromBoottime));
+    case kFixedClocks:
+      return std::unique_ptr<CommandProcessor>(new CommandProcessor(
+          kBufferSizeBytes, std::unique_ptr<Os>(new FixedClockOs()),
+          Timestamper::Mode::kReadAllClocks));
+  }
+  LOG(FATAL) << "Unknown clock source " << clock_source;
+  return nullptr;
+}
+
+const char* GetClockSourceLabel(int64_t clock_source) {
+  switch (clock_source) {
+    case kReadAllClocks:
+      return "all_clocks";
+    case kDeriveFromBoottime:
+      return "derived_clocks";
+    case kFixedClocks:
+      return "fixed_clocks";
+  }
+  return "unknown";
+}
+
+// Fills the log buffers of |command_processor| with typical messages.
+void FillLog(NONNULL CommandProcessor* command_processor) {
+  const CommandBuffer& command = BuildAsciiMessageCommand(
+      "WifiHAL", "Received scan results: 42 BSSes, 3 hidden");
+  for (size_t i = 0; i < kBufferSizeBytes / command.size(); ++i) {
+    command_processor->ProcessCommand(command.data(), command.size(),
+                                      Os::kInvalidFd);
+  }
+}
+
+// Sends a dump command of |opcode|, with a duplicate of |fd|, and waits
+// for the dump to complete.
+void Dump(NONNULL CommandProcessor* command_processor, protocol::Opcode opcode,
+          int fd) {
+  const auto command = protocol::Command().set_opcode(opcode);
+  const auto buf = CommandBuffer().AppendOrDie(&command, sizeof(command));
+  // ProcessCommand() takes ownership of the fd.
+  CHECK(command_processor->ProcessCommand(buf.data(), buf.size(), dup(fd)));
+  command_processor->WaitForDumps();
+}
+
+// Counts the logged messages, which is the number of messages in a dump.
+size_t GetNumLoggedMessages(const CommandProcessor& command_processor) {
+  const protocol::Stats& stats = command_processor.GetStats();
+  return stats.n_messages_logged - stats.n_messages_evicted;
+}
+
+// Measures the cost of logging a typical message. This covers
+// CommandProcessor::CopyCommandToLog(), including the timestamps.
+void BM_CommandProcessorLogMessage(benchmark::State& state) {
+  const std::unique_ptr<CommandProcessor> command_processor =
+      MakeCommandProcessor(state.range(0));
+  const CommandBuffer& command = BuildAsciiMessageCommand(
+      "WifiHAL", "Received scan results: 42 BSSes, 3 hidden");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(command_processor->ProcessCommand(
+        command.data(), command.size(), Os::kInvalidFd));
+  }
+  state.SetLabel(GetClockSourceLabel(state.range(0)));
+  ReportMessageRate(state, state.iterations());
+}
+BENCHMARK(BM_CommandProcessorLogMessage)
+    ->Arg(kReadAllClocks)
+    ->Arg(kDeriveFromBoottime)
+    ->Arg(kFixedClocks);
+
+// As BM_CommandProcessorLogMessage, but for a structured message with the
+// same content. The "command_bytes" counter shows the size of each message.
+void BM_CommandProcessorLogStructuredMessage(benchmark::State& state) {
+  const std::unique_ptr<CommandProcessor> command_processor =
+      MakeCommandProcessor(state.range(0));
+  StructuredMessageWriter writer(structured_formats::FormatId::kScanResults,
+                                 "WifiHAL", 7,
+                                 protocol::MessageSeverity::kInformational);
+  writer.AddUint32(42).AddUint32(3);
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(command_processor->ProcessCommand(
+        writer.data(), writer.size(), Os::kInvalidFd));
+  }
+  state.SetLabel(GetClockSourceLabel(state.range(0)));
+  state.counters["command_bytes"] = writer.size();
+  ReportMessageRate(state, state.iterations());
+}
+BENCHMARK(BM_CommandProcessorLogStructuredMessage)->Arg(kFixedClocks);
+
+// As BM_CommandProcessorLogMessage, with fixed clocks, for each
+// LogBuffer::Mode. This includes the cost of compressing each block as it
+// seals. The "retained_messages" counter shows how many messages the log
+// buffers held at the end of the run.
+void BM_CommandProcessorLogMessageWithLogBufferMode(benchmark::State& state,
+                                                    LogBuffer::Mode mode) {
+  CommandProcessor command_processor(
+      kBufferSizeBytes, std::unique_ptr<Os>(new FixedClockOs()),
+      Timestamper::Mode::kReadAllClocks, mode);
+  const CommandBuffer& command = BuildAsciiMessageCommand(
+      "WifiHAL", "Received scan results: 42 BSSes, 3 hidden");
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(command_processor.ProcessCommand(
+        command.data(), command.size(), Os::kInvalidFd));
+  }
+  state.counters["retained_messages"] =
+      GetNumLoggedMessages(command_processor);
+  ReportMessageRate(state, state.iterations());
+}
+BENCHMARK_CAPTURE(BM_CommandProcessorLogMessageWithLogBufferMode, uncompressed,
+                  LogBuffer::Mode::kUncompressed);
+BENCHMARK_CAPTURE(BM_CommandProcessorLogMessageWithLogBufferMode, compressed,
+                  LogBuffer::Mode::kCompressed);
+BENCHMARK_CAPTURE(BM_CommandProcessorLogMessageWithLogBufferMode, aligned,
+                  LogBuffer::Mode::kAligned);
+
+// Measures the throughput of dumps to /dev/null, which excludes the cost
+// of a reader.
+void BM_CommandProcessorDumpToDevNull(benchmark::State& state,
+                                      protocol::Opcode opcode) {
+  CommandProcessor command_processor(kBufferSizeBytes);
+  FillLog(&command_processor);
+  unique_fd dev_null(open("/dev/null", O_WRONLY | O_CLOEXEC));
+  CHECK(dev_null.get() >= 0);
+  for (auto _ : state) {
+    Dump(&command_processor, opcode, dev_null.get());
+  }
+  ReportMessageRate(state, state.iterations() *
+                               GetNumLoggedMessages(command_processor));
+}
+BENCHMARK_CAPTURE(BM_CommandProcessorDumpToDevNull, text,
+                  protocol::Opcode::kDumpBuffers)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_CommandProcessorDumpToDevNull, binary,
+                  protocol::Opcode::kDumpBuffersBinary)
+    ->UseRealTime();
+
+// Measures the throughput of binary dumps to /dev/null, for each
+// LogBuffer::Mode. A binary dump does no formatting, so this is dominated
+// by the cost of walking the log buffers.
+void BM_CommandProcessorDumpBinaryWithLogBufferMode(benchmark::State& state,
+                                                    LogBuffer::Mode mode) {
+  CommandProcessor command_processor(
+      kBufferSizeBytes, std::unique_ptr<Os>(new FixedClockOs()),
+      Timestamper::Mode::kReadAllClocks, mode);
+  FillLog(&command_processor);
+  unique_fd dev_null(open("/dev/null", O_WRONLY | O_CLOEXEC));
+  CHECK(dev_null.get() >= 0);
+  for (auto _ : state) {
+    Dump(&command_processor, protocol::Opcode::kDumpBuffersBinary,
+         dev_null.get());
+  }
+  ReportMessageRate(state, state.iterations() *
+                               GetNumLoggedMessages(command_processor));
+}
+BENCHMARK_CAPTURE(BM_CommandProcessorDumpBinaryWithLogBufferMode, uncompressed,
+                  LogBuffer::Mode::kUncompressed)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_CommandProcessorDumpBinaryWithLogBufferMode, compressed,
+                  LogBuffer::Mode::kCompressed)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_CommandProcessorDumpBinaryWithLogBufferMode, aligned,
+                  LogBuffer::Mode::kAligned)
+    ->UseRealTime();
+
+// Measures the throughput of dumps to a pipe, as when the dump is read by
+// another process (e.g., for a bugreport).
+void BM_CommandProcessorDumpToPipe(benchmark::State& state,
+                                   protocol::Opcode opcode) {
+  CommandProcessor command_processor(kBufferSizeBytes);
+  FillLog(&command_processor);
+  int pipe_fds[2];
+  CHECK(pipe2(pipe_fds, O_CLOEXEC) == 0);
+  unique_fd read_end(pipe_fds[0]);
+  unique_fd write_end(pipe_fds[1]);
+  std::thread reader([&read_end]() {
+    std::array<uint8_t, 64 * 1024> buf;
+    while (read(read_end.get(), buf.data(), buf.size()) > 0) {
+    }
+  });
+
+  for (auto _ : state) {
+    Dump(&command_processor, opcode, write_end.get());
+  }
+  ReportMessageRate(state, state.iterations() *
+                               GetNumLoggedMessages(command_processor));
+
+  write_end.reset();  // Lets the reader see EOF.
+  reader.join();
+}
+BENCHMARK_CAPTURE(BM_CommandProcessorDumpToPipe, text,
+                  protocol::Opcode::kDumpBuffers)
+    ->UseRealTime();
+BENCHMARK_CAPTURE(BM_CommandProcessorDumpToPipe, binary,
+                  protocol::Opcode::kDumpBuffersBinary)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,28 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android-base/logging.h"
+#include "benchmark/benchmark.h"
+
+int main(int argc, char** argv) {
+  ::benchmark::Initialize(&argc, argv);
+  // Log to stderr, but skip the per-dump throughput messages, which would
+  // otherwise be interleaved with the results.
+  ::android::base::InitLogging(argv, android::base::StderrLogger);
+  ::android::base::SetMinimumLogSeverity(android::base::WARNING);
+  ::benchmark::RunSpecifiedBenchmarks();
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sched.h>
+#include <sys/socket.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <memory>
+#include <string>
+#include <thread>
+#include <tuple>
+
+#include "android-base/logging.h"
+#include "android-base/unique_fd.h"
+#include "benchmark/benchmark.h"
+
+#include "wifilogd/benchmarks/benchmark_utils.h"
+#include "wifilogd/command_processor.h"
+#include "wifilogd/main_loop.h"
+#include "wifilogd/os.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using ::android::base::unique_fd;
+using benchmark_utils::BuildAsciiMessageCommand;
+using benchmark_utils::CommandBuffer;
+using benchmark_utils::ReportMessageRate;
+
+constexpr size_t kBufferSizeBytes = 512 * 1024;
+constexpr char kSocketName[] = "wifilog";
+
+// An Os whose control socket is one end of a socketpair, rather than a
+// socket created by init.
+class SocketPairOs : public Os {
+ public:
+  explicit SocketPairOs(int control_socket_fd)
+      : control_socket_fd_(control_socket_fd) {}
+
+  std::tuple<int, Errno> GetControlSocket(
+      const std::string& /* socket_name */) override {
+    return std::tuple<int, Errno>{control_socket_fd_, 0};
+  }
+
+ private:
+  const int control_socket_fd_;
+};
+
+// Floods the control socket of a MainLoop, which receives |batch_size|
+// datagrams at a time on |n_receiver_threads| threads (or on its own
+// thread, if zero), with messages, from another thread. Measures the rate
+// at which the MainLoop logs them.
+void RunSocketFlood(benchmark::State& state, size_t batch_size,
+                    size_t n_receiver_threads) {
+  int socket_fds[2];
+  CHECK(socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, socket_fds) == 0);
+  unique_fd control_socket(socket_fds[0]);
+  unique_fd client_socket(socket_fds[1]);
+
+  auto* const command_processor = new CommandProcessor(kBufferSizeBytes);
+  MainLoop main_loop(kSocketName,
+                     std::unique_ptr<Os>(new SocketPairOs(socket_fds[0])),
+                     std::unique_ptr<CommandProcessor>(command_processor),
+                     batch_size, n_receiver_threads);
+
+  std::atomic<bool> stopping(false);
+  std::thread client([&client_socket, &stopping]() {
+    const CommandBuffer& command = BuildAsciiMessageCommand(
+        "WifiHAL", "Received scan results: 42 BSSes, 3 hidden");
+    while (!stopping.load(std::memory_order_relaxed)) {
+      // Don't block, so that we notice |stopping| even if the MainLoop has
+      // stopped receiving.
+      if (send(client_socket.get(), command.data(), command.size(),
+               MSG_DONTWAIT) < 0) {
+        CHECK(errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR);
+        sched_yield();
+      }
+    }
+  });
+
+  for (auto _ : state) {
+    main_loop.RunOnce();
+  }
+  stopping = true;
+  client.join();
+
+  ReportMessageRate(state, command_processor->GetStats().n_messages_logged);
+  state.counters["batch_depth"] = main_loop.GetAverageBatchDepth();
+}
+
+// The argument is the MainLoop's receive batch size.
+void BM_MainLoopSocketFlood(benchmark::State& state) {
+  RunSocketFlood(state, state.range(0), 0);
+}
+BENCHMARK(BM_MainLoopSocketFlood)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(Os::kMaxDatagramBatchSize)
+    ->UseRealTime();
+
+// The argument is the number of receiver threads.
+void BM_MainLoopSocketFloodWithReceiverThreads(benchmark::State& state) {
+  RunSocketFlood(state, 16, state.range(0));
+}
+BENCHMARK(BM_MainLoopSocketFloodWithReceiverThreads)
+    ->Arg(1)
+    ->Arg(2)
+    ->Arg(4)
+    ->UseRealTime();
+
+}  // namespace
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "android-base/unique_fd.h"
+#include "benchmark/benchmark.h"
+
+#include "wifilogd/benchmarks/benchmark_utils.h"
+#include "wifilogd/local_utils.h"
+#include "wifilogd/message_buffer.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using ::android::base::unique_fd;
+using benchmark_utils::ReportMessageRate;
+
+constexpr size_t kBufferSizeBytes = 512 * 1024;
+constexpr size_t kNumMessageSizes = 1024;
+constexpr size_t kMessagesPerBatch = 64;
+
+// The distributions of message sizes that we benchmark. (Passed as the
+// benchmark's argument.)
+enum SizeDistribution : int64_t {
+  kSmall,  // Every message is 32 bytes, like a short status line.
+  kLarge,  // Every message is 1 KiB, like a packet-fate record.
+  kMixed,  // Log-uniform, between 16 bytes and kMaxMessageSize.
+};
+
+const char* GetLabel(int64_t distribution) {
+  switch (distribution) {
+    case kSmall:
+      return "small";
+    case kLarge:
+      return "large";
+    case kMixed:
+      return "mixed";
+  }
+  return "unknown";
+}
+
+// Returns a fixed sequence of message sizes, drawn from |distribution|.
+std::vector<uint16_t> GetMessageSizes(int64_t distribution) {
+  switch (distribution) {
+    case kSmall:
+      return std::vector<uint16_t>(kNumMessageSizes, 32);
+    case kLarge:
+      return std::vector<uint16_t>(kNumMessageSizes, 1024);
+    case kMixed: {
+      // Fix the seed, so that every run benchmarks the same sizes.
+      std::mt19937 generator(0);
+      std::uniform_real_distribution<double> log2_size(4, 12);
+      std::vector<uint16_t> sizes(kNumMessageSizes);
+      for (auto& size : sizes) {
+        size = static_cast<uint16_t>(std::exp2(log2_size(generator)));
+      }
+      return sizes;
+    }
+  }
+  return {};
+}
+
+// Appends to a buffer which is always full, so that every Append() also
+// evicts one or more messages.
+void BM_MessageBufferAppend(benchmark::State& state) {
+  const std::vector<uint16_t> sizes = GetMessageSizes(state.range(0));
+  const std::vector<uint8_t> message(protocol::kMaxMessageSize);
+  MessageBuffer buffer(kBufferSizeBytes);
+  size_t i = 0;
+  while (buffer.CanFitNow(sizes[i])) {
+    buffer.Append(message.data(), sizes[i]);
+    i = (i + 1) % sizes.size();
+  }
+
+  for (auto _ : state) {
+    benchmark::DoNotOptimize(buffer.Append(message.data(), sizes[i]));
+    i = (i + 1) % sizes.size();
+  }
+  state.SetLabel(GetLabel(state.range(0)));
+  ReportMessageRate(state, state.iterations());
+}
+BENCHMARK(BM_MessageBufferAppend)->Arg(kSmall)->Arg(kLarge)->Arg(kMixed);
+
+// Appends a batch of messages, and then consumes them all. This is the
+// pattern of a buffer which is repeatedly filled, and then dumped.
+void BM_MessageBufferAppendAndConsume(benchmark::State& state) {
+  const std::vector<uint16_t> sizes = GetMessageSizes(state.range(0));
+  const std::vector<uint8_t> message(protocol::kMaxMessageSize);
+  MessageBuffer buffer(kBufferSizeBytes);
+  size_t i = 0;
+
+  for (auto _ : state) {
+    for (size_t j = 0; j < kMessagesPerBatch; ++j) {
+      buffer.Append(message.data(), sizes[i]);
+      i = (i + 1) % sizes.size();
+    }
+    while (true) {
+      const auto consumed = buffer.ConsumeNextMessage();
+      if (!std::get<0>(consumed)) {
+        break;
+      }
+      benchmark::DoNotOptimize(std::get<0>(consumed));
+    }
+    buffer.Clear();
+  }
+  state.SetLabel(GetLabel(state.range(0)));
+  ReportMessageRate(state, state.iterations() * kMessagesPerBatch);
+}
+BENCHMARK(BM_MessageBufferAppendAndConsume)
+    ->Arg(kSmall)
+    ->Arg(kLarge)
+    ->Arg(kMixed);
+
+// Fills a buffer with records shaped like CommandProcessor's, and then reads
+// the whole buffer, copying out the TimestampHeader-sized prefix of each
+// record, as a dump does. The arguments are the SizeDistribution, whether
+// the buffer uses Framing::kAligned, and whether the buffer is read with
+// ConsumeNextMessages() (rather than ConsumeNextMessage()).
+void BM_MessageBufferScan(benchmark::State& state) {
+  const std::vector<uint16_t> sizes = GetMessageSizes(state.range(0));
+  const bool aligned = state.range(1);
+  const bool batched = state.range(2);
+  const std::vector<uint8_t> message(protocol::kMaxMessageSize);
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(),
+                       aligned ? MessageBuffer::Framing::kAligned
+                               : MessageBuffer::Framing::kPacked);
+  size_t n_messages = 0;
+  for (size_t i = 0; buffer.CanFitNow(sizes[i]);
+       i = (i + 1) % sizes.size()) {
+    buffer.Append(message.data(), sizes[i]);
+    ++n_messages;
+  }
+
+  struct RecordPrefix {
+    uint64_t fields[3];
+  };
+  std::array<std::tuple<const uint8_t*, size_t>, kMessagesPerBatch> batch;
+  uint64_t sum = 0;
+  for (auto _ : state) {
+    buffer.Rewind();
+    while (true) {
+      size_t n_consumed;
+      if (batched) {
+        n_consumed = buffer.ConsumeNextMessages(batch.data(), batch.size());
+      } else {
+        batch[0] = buffer.ConsumeNextMessage();
+        n_consumed = std::get<0>(batch[0]) ? 1 : 0;
+      }
+      if (!n_consumed) {
+        break;
+      }
+      for (size_t i = 0; i < n_consumed; ++i) {
+        if (std::get<1>(batch[i]) >= sizeof(RecordPrefix)) {
+          sum += local_utils::CopyFromBufferOrDie<RecordPrefix>(
+                     std::get<0>(batch[i]), std::get<1>(batch[i]))
+                     .fields[1];
+        }
+      }
+    }
+    benchmark::DoNotOptimize(sum);
+  }
+  state.SetLabel(std::string(GetLabel(state.range(0))) +
+                 (aligned ? "/aligned" : "/packed") +
+                 (batched ? "/batched" : "/single"));
+  ReportMessageRate(state, state.iterations() * n_messages);
+}
+BENCHMARK(BM_MessageBufferScan)
+    ->Args({kSmall, false, false})
+    ->Args({kSmall, false, true})
+    ->Args({kSmall, true, false})
+    ->Args({kSmall, true, true})
+    ->Args({kMixed, false, false})
+    ->Args({kMixed, true, true});
+
+}  // namespace
+}  // namespace wifilogd
+}  // namespace android
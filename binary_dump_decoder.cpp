@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "android-base/logging.h"
+
+#include "wifilogd/binary_dump_decoder.h"
+#include "wifilogd/log_formatter.h"
+#include "wifilogd/memory_reader.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+namespace binary_dump_decoder {
+
+namespace {
+
+constexpr char kOversizedRecordError[] = "[oversized-record]\n";
+constexpr char kTruncatedRecordError[] = "[truncated-record]\n";
+
+}  // namespace
+
+bool DecodeBinaryDump(const uint8_t* dump, size_t dump_len,
+                      std::string* out) {
+  MemoryReader dump_reader(dump, dump_len);
+  if (dump_reader.size() < sizeof(protocol::BinaryDumpPreamble)) {
+    LOG(ERROR) << "Binary dump is too short for preamble";
+    return false;
+  }
+
+  const auto& preamble =
+      dump_reader.CopyOutOrDie<protocol::BinaryDumpPreamble>();
+  if (preamble.magic != protocol::kBinaryDumpMagic) {
+    LOG(ERROR) << "Binary dump has unexpected magic " << preamble.magic;
+    return false;
+  }
+  if (preamble.version != protocol::kBinaryDumpVersion &&
+      preamble.version != protocol::kBinaryDumpVersionWithoutStats) {
+    LOG(ERROR) << "Binary dump has unsupported version " << preamble.version;
+    return false;
+  }
+
+  if (preamble.version == protocol::kBinaryDumpVersion) {
+    if (dump_reader.size() < sizeof(protocol::Stats)) {
+      LOG(ERROR) << "Binary dump is too short for stats";
+      return false;
+    }
+    const auto& stats = dump_reader.CopyOutOrDie<protocol::Stats>();
+    const size_t stats_start = out->size();
+    out->resize(stats_start + log_formatter::kMaxFormattedStatsLen);
+    const char* const stats_end =
+        log_formatter::FormatStats(stats, &(*out)[stats_start]);
+    out->resize(stats_end - out->data());
+  }
+
+  bool is_well_formed = true;
+  while (dump_reader.size()) {
+    uint16_t record_len;
+    if (dump_reader.size() < sizeof(record_len)) {
+      out->append(kTruncatedRecordError);
+      return false;
+    }
+
+    record_len = dump_reader.CopyOutOrDie<uint16_t>();
+    if (dump_reader.size() < record_len) {
+      out->append(kTruncatedRecordError);
+      return false;
+    }
+
+    const uint8_t* const record = dump_reader.GetBytesOrDie(record_len);
+    if (record_len > log_formatter::kMaxRecordLen) {
+      // The daemon never logs such records. But the length is still
+      // meaningful, so we can continue with the next record.
+      out->append(kOversizedRecordError);
+      is_well_formed = false;
+      continue;
+    }
+
+    const size_t line_start = out->size();
+    out->resize(line_start + log_formatter::kMaxFormattedRecordLen);
+    const char* const line_end = log_formatter::FormatRecord(
+        MemoryReader(record, record_len), &(*out)[line_start]);
+    out->resize(line_end - out->data());
+  }
+
+  return is_well_formed;
+}
+
+}  // namespace binary_dump_decoder
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BINARY_DUMP_DECODER_H_
+#define BINARY_DUMP_DECODER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "wifilogd/local_utils.h"
+
+namespace android {
+namespace wifilogd {
+namespace binary_dump_decoder {
+
+// Converts |dump_len| bytes of |dump|, which were produced in response to
+// protocol::Opcode::kDumpBuffersBinary, into text. The text is appended to
+// |out|, in the same format that protocol::Opcode::kDumpBuffers would have
+// produced for the same records.
+//
+// Dumps of protocol::kBinaryDumpVersionWithoutStats are also accepted. For
+// those, the output omits the stats line that starts a text dump.
+//
+// Returns false if the dump has an invalid preamble or stats (in which
+// case nothing is appended), or if any record is malformed. Malformed
+// records are reported in the text, and the decoder continues with the
+// next record, when the record's length permits.
+//
+// This function is intended for use off-device, at the end of a log
+// collection pipeline.
+bool DecodeBinaryDump(const uint8_t* dump, size_t dump_len,
+                      NONNULL std::string* out);
+
+}  // namespace binary_dump_decoder
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // BINARY_DUMP_DECODER_H_
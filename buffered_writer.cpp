@@ -0,0 +1,126 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/buffered_writer.h"
+#include "wifilogd/profiler.h"
+
+namespace android {
+namespace wifilogd {
+
+constexpr size_t BufferedWriter::kBufferSizeBytes;
+constexpr size_t BufferedWriter::kMaxAttemptsWithoutProgress;
+
+BufferedWriter::BufferedWriter(Os* os, int fd)
+    : os_(os),
+      fd_(fd),
+      buf_(),
+      buf_len_(0),
+      reserved_len_(0),
+      n_bytes_written_(0),
+      failed_(false) {}
+
+bool BufferedWriter::Append(const void* data, size_t data_len) {
+  if (failed_) {
+    return false;
+  }
+
+  if (data_len > buf_.size() - buf_len_ && !Flush()) {
+    return false;
+  }
+
+  if (data_len > buf_.size()) {
+    // Too large to buffer. Since the buffer is now empty, we can write
+    // |data| directly, without reordering any output.
+    return WriteFully(static_cast<const uint8_t*>(data), data_len);
+  }
+
+  std::memcpy(buf_.data() + buf_len_, data, data_len);
+  buf_len_ += data_len;
+  return true;
+}
+
+uint8_t* BufferedWriter::Reserve(size_t max_len) {
+  CHECK(max_len <= buf_.size());
+  if (failed_) {
+    return nullptr;
+  }
+
+  if (max_len > buf_.size() - buf_len_ && !Flush()) {
+    return nullptr;
+  }
+
+  reserved_len_ = max_len;
+  return buf_.data() + buf_len_;
+}
+
+void BufferedWriter::Commit(size_t data_len) {
+  CHECK(data_len <= reserved_len_);
+  buf_len_ += data_len;
+  reserved_len_ = 0;
+}
+
+bool BufferedWriter::Flush() {
+  if (failed_) {
+    return false;
+  }
+
+  const size_t n_bytes_to_write = buf_len_;
+  buf_len_ = 0;
+  return WriteFully(buf_.data(), n_bytes_to_write);
+}
+
+// Private methods below.
+
+bool BufferedWriter::WriteFully(const uint8_t* data, size_t data_len) {
+  WIFILOGD_PROFILE_SCOPE(ProfiledStage::kDumpWrite);
+  size_t n_attempts_without_progress = 0;
+  while (data_len) {
+    size_t n_written;
+    Os::Errno err;
+    std::tie(n_written, err) = os_->Write(fd_, data, data_len);
+    if (err && err != EINTR) {
+      // Any error other than EINTR is considered unrecoverable.
+      LOG(ERROR) << "Terminating write, due to " << std::strerror(err);
+      failed_ = true;
+      return false;
+    }
+
+    CHECK(n_written <= data_len);
+    if (n_written) {
+      n_attempts_without_progress = 0;
+    } else if (++n_attempts_without_progress >= kMaxAttemptsWithoutProgress) {
+      // Guarantee forward progress, even if the writes keep getting
+      // interrupted (or the kernel keeps accepting zero bytes).
+      LOG(ERROR) << "Terminating write, due to lack of progress";
+      failed_ = true;
+      return false;
+    }
+
+    data += n_written;
+    data_len -= n_written;
+    n_bytes_written_ += n_written;
+  }
+  return true;
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef BUFFERED_WRITER_H_
+#define BUFFERED_WRITER_H_
+
+#include <array>
+#include <cstdint>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/os.h"
+
+namespace android {
+namespace wifilogd {
+
+// Accumulates output in a fixed-size buffer, and writes the buffered data
+// to a file descriptor in large chunks. Short writes, and writes interrupted
+// by a signal, are retried until all of the data has been written.
+//
+// The user must ensure that |os| outlives the BufferedWriter. The
+// BufferedWriter does not take ownership of |fd|. Data that has not been
+// flushed is discarded when the BufferedWriter is destroyed.
+class BufferedWriter {
+ public:
+  static constexpr size_t kBufferSizeBytes = 16 * 1024;
+  // The number of consecutive write attempts that may fail to make progress
+  // (e.g. due to EINTR), before we give up.
+  static constexpr size_t kMaxAttemptsWithoutProgress = 8;
+
+  BufferedWriter(NONNULL Os* os, int fd);
+
+  // Buffers |data_len| bytes from |data|, writing out buffered data as
+  // needed. Returns false if an unrecoverable error was encountered. Once
+  // an error has been encountered, all later calls fail.
+  bool Append(NONNULL const void* data, size_t data_len);
+
+  // Reserves |max_len| bytes of buffer space, writing out buffered data as
+  // needed, and returns a pointer to that space. |max_len| must not exceed
+  // kBufferSizeBytes. The caller may format output directly into the
+  // returned space, and should then call Commit(). Returns nullptr if an
+  // unrecoverable error was encountered.
+  uint8_t* Reserve(size_t max_len);
+
+  // Commits the first |data_len| bytes of the outstanding reservation.
+  // |data_len| must not exceed the length passed to Reserve().
+  void Commit(size_t data_len);
+
+  // Writes out all buffered data. Returns false if an unrecoverable error
+  // was encountered.
+  bool Flush();
+
+  // Returns the number of bytes written to |fd| so far. (Buffered data is
+  // not included.)
+  size_t GetBytesWritten() const { return n_bytes_written_; }
+
+ private:
+  // Writes |data_len| bytes from |data| to |fd_|, retrying as needed.
+  bool WriteFully(NONNULL const uint8_t* data, size_t data_len);
+
+  Os* const os_;  // non-owned
+  const int fd_;
+  std::array<uint8_t, kBufferSizeBytes> buf_;
+  size_t buf_len_;
+  size_t reserved_len_;
+  size_t n_bytes_written_;
+  bool failed_;
+
+  DISALLOW_COPY_AND_ASSIGN(BufferedWriter);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // BUFFERED_WRITER_H_
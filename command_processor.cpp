@@ -14,22 +14,31 @@
  * limitations under the License.
  */
 
-#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include <algorithm>
-#include <cinttypes>
+#include <array>
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <memory>
 #include <string>
 #include <tuple>
 #include <utility>
+#include <vector>
 
 #include "android-base/logging.h"
-#include "android-base/stringprintf.h"
 
-#include "wifilogd/byte_buffer.h"
 #include "wifilogd/command_processor.h"
 #include "wifilogd/local_utils.h"
+#include "wifilogd/log_formatter.h"
 #include "wifilogd/memory_reader.h"
+#include "wifilogd/message_buffer.h"
+#include "wifilogd/profiler.h"
 #include "wifilogd/protocol.h"
+#include "wifilogd/record_layout.h"
+#include "wifilogd/timestamp_header.h"
 
 namespace android {
 namespace wifilogd {
@@ -39,103 +48,221 @@ using ::android::base::unique_fd;
 using local_utils::CopyFromBufferOrDie;
 using local_utils::GetMaxVal;
 
+constexpr size_t CommandProcessor::kNumLogBuffers;
+constexpr std::array<size_t, CommandProcessor::kNumLogBuffers>
+    CommandProcessor::kLogBufferShares;
+constexpr size_t CommandProcessor::kLogBufferShareDenominator;
+constexpr size_t CommandProcessor::kMaxSharedRings;
+constexpr size_t CommandProcessor::kMaxSubscribers;
+constexpr size_t CommandProcessor::kMaxSubscriberQueueBytes;
+
 namespace {
 
-uint32_t NsecToUsec(uint32_t nsec);
+constexpr size_t kMaxSeverity =
+    local_utils::CastEnumToInteger(protocol::MessageSeverity::kDump);
+static_assert(CommandProcessor::kNumLogBuffers == kMaxSeverity + 1,
+              "there must be one log buffer per MessageSeverity");
+static_assert(CommandProcessor::kNumLogBuffers ==
+                  protocol::kNumDumpCursorBuffers,
+              "a DumpCursor must track every log buffer");
+// GetLogBufferIndexFor() and TrackSequenceNum() read the tag and severity of
+// both types of message through the AsciiMessage header.
+static_assert(sizeof(protocol::AsciiMessage) ==
+                      sizeof(protocol::StructuredMessage) &&
+                  offsetof(protocol::AsciiMessage, tag_len) ==
+                      offsetof(protocol::StructuredMessage, tag_len) &&
+                  offsetof(protocol::AsciiMessage, severity) ==
+                      offsetof(protocol::StructuredMessage, severity),
+              "StructuredMessage must share the layout of AsciiMessage's "
+              "tag_len and severity");
+// A compressed log buffer must be able to hold any record.
+static_assert(LogBuffer::kBlockSizeBytes - MessageBuffer::GetHeaderSize() >=
+                  log_formatter::kMaxRecordLen,
+              "a maximal record would not fit in a compressed block");
+// The minimal length of a record in a log buffer. (See |log_buffers_|.)
+constexpr size_t kMinRecordLen = RecordHeaderLayout::kSize;
+// The minimal length of a command which has a tag.
+constexpr size_t kMinTaggedCommandLen = TaggedCommandLayout::kSize;
+// The number of messages that ConsumeMessagesInTimestampOrder() reads from
+// a log buffer at a time.
+constexpr size_t kMergeBatchSize = 16;
+// Malformed messages, and messages with an unknown severity, are logged
+// with kInformational messages.
+constexpr size_t kDefaultLogBufferIndex = local_utils::CastEnumToInteger(
+    protocol::MessageSeverity::kInformational);
 
-class TimestampHeader {
- public:
-  TimestampHeader& set_since_boot_awake_only(Os::Timestamp new_value) {
-    since_boot_awake_only = new_value;
-    return *this;
-  }
+// Returns the sum of the first |n_shares| elements of |shares|.
+constexpr size_t SumShares(
+    const std::array<size_t, CommandProcessor::kNumLogBuffers>& shares,
+    size_t n_shares) {
+  return n_shares ? shares[n_shares - 1] + SumShares(shares, n_shares - 1)
+                  : 0;
+}
+static_assert(SumShares(CommandProcessor::kLogBufferShares,
+                        CommandProcessor::kNumLogBuffers) ==
+                  CommandProcessor::kLogBufferShareDenominator,
+              "log buffer shares must sum to the denominator");
 
-  TimestampHeader& set_since_boot_with_sleep(Os::Timestamp new_value) {
-    since_boot_with_sleep = new_value;
-    return *this;
+// Opens the file which backs log buffer |index|, in |dir|. On failure,
+// returns an invalid fd, so that the log buffer is kept in memory.
+unique_fd OpenLogBufferFile(const std::string& dir, size_t index) {
+  const std::string path = dir + "/log_buffer_" + std::to_string(index);
+  unique_fd fd(TEMP_FAILURE_RETRY(
+      open(path.c_str(), O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600)));
+  if (fd.get() < 0) {
+    PLOG(ERROR) << "Failed to open " << path
+                << "; log buffer " << index << " will not persist";
   }
+  return fd;
+}
 
-  TimestampHeader& set_since_epoch(Os::Timestamp new_value) {
-    since_epoch = new_value;
-    return *this;
-  }
+}  // namespace
 
-  // Returns a string with a formatted representation of the timestamps
-  // contained within this header.
-  std::string ToString() const {
-    const auto& awake_time = since_boot_awake_only;
-    const auto& up_time = since_boot_with_sleep;
-    const auto& wall_time = since_epoch;
-    return base::StringPrintf("%" PRIu32 ".%06" PRIu32
-                              " "
-                              "%" PRIu32 ".%06" PRIu32
-                              " "
-                              "%" PRIu32 ".%06" PRIu32,
-                              awake_time.secs, NsecToUsec(awake_time.nsecs),
-                              up_time.secs, NsecToUsec(up_time.nsecs),
-                              wall_time.secs, NsecToUsec(wall_time.nsecs));
-  }
+CommandProcessor::CommandProcessor(size_t buffer_size_bytes)
+    : CommandProcessor(buffer_size_bytes, std::make_unique<Os>()) {}
 
-  Os::Timestamp since_boot_awake_only;
-  Os::Timestamp since_boot_with_sleep;
-  Os::Timestamp since_epoch;  // non-monotonic
-};
+CommandProcessor::CommandProcessor(size_t buffer_size_bytes,
+                                   std::unique_ptr<Os> os)
+    : CommandProcessor(buffer_size_bytes, std::move(os),
+                       Timestamper::Mode::kReadAllClocks) {}
 
-constexpr char kUnprintableCharReplacement = '?';
+CommandProcessor::CommandProcessor(size_t buffer_size_bytes,
+                                   std::unique_ptr<Os> os,
+                                   Timestamper::Mode timestamp_mode)
+    : CommandProcessor(buffer_size_bytes, std::move(os), timestamp_mode,
+                       LogBuffer::Mode::kUncompressed) {}
 
-std::string MakeSanitizedString(const uint8_t* buf, size_t buf_len);
+CommandProcessor::CommandProcessor(size_t buffer_size_bytes,
+                                   std::unique_ptr<Os> os,
+                                   Timestamper::Mode timestamp_mode,
+                                   LogBuffer::Mode log_buffer_mode,
+                                   const std::string& persistent_dir)
+    : log_buffers_(),
+      time_indexes_(),
+      intern_tags_(persistent_dir.empty()),
+      tag_table_(),
+      n_interned_tag_bytes_(0),
+      os_(std::move(os)),
+      timestamper_(os_.get(), timestamp_mode),
+      sequence_tracker_(),
+      ingest_policy_(),
+      coalesce_repeats_(false),
+      repeat_runs_(),
+      stats_(),
+      latencies_(),
+      dump_worker_(os_.get()),
+      shared_rings_(),
+      shared_rings_pending_(false),
+      subscribers_(),
+      unpublished_records_() {
+  CHECK(persistent_dir.empty() ||
+        log_buffer_mode != LogBuffer::Mode::kCompressed);
+  for (size_t i = 0; i < kNumLogBuffers; ++i) {
+    log_buffers_[i] = std::make_unique<LogBuffer>(
+        buffer_size_bytes * kLogBufferShares[i] / kLogBufferShareDenominator,
+        log_buffer_mode,
+        persistent_dir.empty() ? unique_fd()
+                               : OpenLogBufferFile(persistent_dir, i));
+    log_buffers_[i]->SetEvictionHandler(
+        [this](const uint8_t* record, size_t record_len) {
+          ReleaseInternedTag(record, record_len);
+        });
+    if (log_buffers_[i]->GetNumRecovered()) {
+      CheckRecoveredMessages(log_buffers_[i].get());
+    }
+  }
+}
 
-std::string GetStringFromMemoryReader(NONNULL MemoryReader* buffer_reader,
-                                      const size_t desired_len) {
-  constexpr char kBufferOverrunError[] = "[buffer-overrun]";
-  constexpr char kZeroLengthError[] = "[empty]";
-  if (!desired_len) {
-    // TODO(b/32098735): Increment stats counter.
-    return kZeroLengthError;
+CommandProcessor::~CommandProcessor() {
+  for (const auto& ring : shared_rings_) {
+    os_->UnmapSharedMemory(ring.mapping, ring.mapping_len);
   }
+}
 
-  auto effective_len = desired_len;
-  if (buffer_reader->size() < effective_len) {
-    // TODO(b/32098735): Increment stats counter.
-    effective_len = buffer_reader->size();
+bool CommandProcessor::ProcessCommand(const void* input_buffer,
+                                      size_t n_bytes_read, int fd) {
+  return DispatchCommand(input_buffer, n_bytes_read, unique_fd(fd), nullptr);
+}
+
+bool CommandProcessor::ProcessTimestampedCommand(
+    const TimestampHeader& tstamp_header, const void* input_buffer,
+    size_t n_bytes_read, int fd) {
+  return DispatchCommand(input_buffer, n_bytes_read, unique_fd(fd),
+                         &tstamp_header);
+}
+
+size_t CommandProcessor::ProcessCommands(const uint8_t* input_bufs,
+                                         size_t buf_stride,
+                                         const size_t* command_lens,
+                                         const int* command_fds,
+                                         size_t n_commands) {
+  size_t n_succeeded = 0;
+  for (size_t i = 0; i < n_commands; ++i) {
+    CHECK(command_lens[i] <= buf_stride);
+    if (ProcessCommand(input_bufs + i * buf_stride, command_lens[i],
+                       command_fds[i])) {
+      ++n_succeeded;
+    }
   }
+  return n_succeeded;
+}
 
-  auto out = MakeSanitizedString(buffer_reader->GetBytesOrDie(effective_len),
-                                 effective_len);
-  if (effective_len < desired_len) {
-    out += kBufferOverrunError;
+bool CommandProcessor::DoIdleWork() {
+  if (shared_rings_pending_) {
+    DrainSharedRings();
   }
+  if (!subscribers_.empty()) {
+    FlushSubscribers();
+  }
+  return shared_rings_pending_;
+}
 
-  return out;
+void CommandProcessor::WaitForDumps() { dump_worker_.WaitUntilIdle(); }
+
+protocol::Stats CommandProcessor::GetStats() const {
+  protocol::Stats stats = stats_;
+  for (const auto& log_buffer : log_buffers_) {
+    stats.n_messages_evicted += log_buffer->GetNumEvicted();
+  }
+  return stats;
 }
 
-std::string MakeSanitizedString(const uint8_t* buf, size_t buf_len) {
-  std::string out(buf_len, '\0');
-  std::replace_copy_if(buf, buf + buf_len, &out.front(),
-                       [](auto c) { return !local_utils::IsAsciiPrintable(c); },
-                       kUnprintableCharReplacement);
-  return out;
+void CommandProcessor::CountTruncatedDatagram() {
+  ++stats_.n_datagrams_truncated;
 }
 
-uint32_t NsecToUsec(uint32_t nsec) { return nsec / 1000; }
+void CommandProcessor::CountRetriedReceiveError(Os::Errno err) {
+  if (err == ENOMEM) {
+    ++stats_.n_receive_enomem_errors;
+  } else if (err == EINTR) {
+    ++stats_.n_receive_eintr_errors;
+  }
+}
 
-}  // namespace
+void CommandProcessor::EnableIngestPolicy() {
+  ingest_policy_ = std::make_unique<IngestPolicy>();
+}
 
-CommandProcessor::CommandProcessor(size_t buffer_size_bytes)
-    : current_log_buffer_(buffer_size_bytes), os_(new Os()) {}
+uint64_t CommandProcessor::GetNumMessagesSuppressed() const {
+  return ingest_policy_ ? ingest_policy_->GetNumSuppressed() : 0;
+}
 
-CommandProcessor::CommandProcessor(size_t buffer_size_bytes,
-                                   std::unique_ptr<Os> os)
-    : current_log_buffer_(buffer_size_bytes), os_(std::move(os)) {}
+void CommandProcessor::EnableRepeatCoalescing() { coalesce_repeats_ = true; }
 
-CommandProcessor::~CommandProcessor() {}
+void CommandProcessor::ShrinkBuffers() {
+  for (auto& log_buffer : log_buffers_) {
+    log_buffer->Shrink(log_buffer->GetUsedSize() / 2);
+  }
+}
 
-bool CommandProcessor::ProcessCommand(const void* input_buffer,
-                                      size_t n_bytes_read, int fd) {
-  unique_fd wrapped_fd(fd);
+// Private methods below.
 
+bool CommandProcessor::DispatchCommand(const void* input_buffer,
+                                       size_t n_bytes_read,
+                                       unique_fd wrapped_fd,
+                                       const TimestampHeader* tstamp_header) {
   if (n_bytes_read < sizeof(protocol::Command)) {
-    // TODO(b/32098735): Increment stats counter.
+    ++stats_.n_commands_rejected;
     return false;
   }
 
@@ -144,6 +271,7 @@ bool CommandProcessor::ProcessCommand(const void* input_buffer,
   switch (command_header.opcode) {
     using protocol::Opcode;
     case Opcode::kWriteAsciiMessage:
+    case Opcode::kWriteStructuredMessage:
       // Copy the entire command to the log. This defers the cost of
       // validating the rest of the CommandHeader until we dump the
       // message.
@@ -151,21 +279,49 @@ bool CommandProcessor::ProcessCommand(const void* input_buffer,
       // Note that most messages will be written but never read. So, in
       // the common case, the validation cost is actually eliminated,
       // rather than just deferred.
-      return CopyCommandToLog(input_buffer, n_bytes_read);
+      return CopyCommandToLog(input_buffer, n_bytes_read, tstamp_header);
     case Opcode::kDumpBuffers:
-      return Dump(std::move(wrapped_fd));
+      return StartDump(std::move(wrapped_fd), DumpWorker::Format::kText);
+    case Opcode::kDumpBuffersBinary:
+      return StartDump(std::move(wrapped_fd), DumpWorker::Format::kBinary);
+    case Opcode::kDumpStats:
+      return StartDump(std::move(wrapped_fd), DumpWorker::Format::kStats);
+    case Opcode::kDumpBuffersSince:
+      return StartDumpSince(input_buffer, n_bytes_read, std::move(wrapped_fd));
+    case Opcode::kDumpBuffersQuery:
+      return StartDumpQuery(input_buffer, n_bytes_read, std::move(wrapped_fd));
+    case Opcode::kSubscribe:
+      return Subscribe(std::move(wrapped_fd));
+    case Opcode::kRegisterSharedRing:
+      return RegisterSharedRing(input_buffer, n_bytes_read,
+                                std::move(wrapped_fd));
+    case Opcode::kDrainSharedRings:
+      DrainSharedRings();
+      return true;
+    case Opcode::kRepeatedMessage:
+      // Only we may write these records.
+      break;
   }
 
   LOG(DEBUG) << "Received unexpected opcode "
              << local_utils::CastEnumToInteger(command_header.opcode);
-  // TODO(b/32098735): Increment stats counter.
+  ++stats_.n_commands_rejected;
   return false;
 }
 
-// Private methods below.
-
 bool CommandProcessor::CopyCommandToLog(const void* command_buffer,
-                                        size_t command_len_in) {
+                                        size_t command_len,
+                                        const TimestampHeader* tstamp_header) {
+  if (ingest_policy_ && !AdmitCommand(command_buffer, command_len)) {
+    return true;
+  }
+  return AppendCommandToLog(command_buffer, command_len, tstamp_header);
+}
+
+bool CommandProcessor::AppendCommandToLog(
+    const void* command_buffer, size_t command_len_in,
+    const TimestampHeader* received_tstamp_header) {
+  WIFILOGD_PROFILE_SCOPE(ProfiledStage::kCopyCommandToLog);
   const uint16_t command_len =
       SAFELY_CLAMP(command_len_in, uint16_t, 0, protocol::kMaxMessageSize);
 
@@ -174,98 +330,915 @@ bool CommandProcessor::CopyCommandToLog(const void* command_buffer,
                     GetMaxVal(total_size) - sizeof(TimestampHeader) >=
                         protocol::kMaxMessageSize,
                 "total_size cannot represent some input messages");
-  total_size = sizeof(TimestampHeader) + command_len;
-  CHECK(current_log_buffer_.CanFitEver(total_size));
-
-  if (!current_log_buffer_.CanFitNow(total_size)) {
-    // TODO(b/31867689):
-    // 1. compress current buffer
-    // 2. move old buffer to linked list
-    // 3. prune old buffers, if needed
-    current_log_buffer_.Clear();
-  }
-  CHECK(current_log_buffer_.CanFitNow(total_size));
-
-  const auto tstamp_header =
-      TimestampHeader()
-          .set_since_boot_awake_only(os_->GetTimestamp(CLOCK_MONOTONIC))
-          .set_since_boot_with_sleep(os_->GetTimestamp(CLOCK_BOOTTIME))
-          .set_since_epoch(os_->GetTimestamp(CLOCK_REALTIME));
-  const auto message_buf =
-      ByteBuffer<sizeof(TimestampHeader) + protocol::kMaxMessageSize>()
-          .AppendOrDie(&tstamp_header, sizeof(tstamp_header))
-          .AppendOrDie(command_buffer, command_len);
-  bool did_write = current_log_buffer_.Append(
-      message_buf.data(),
-      SAFELY_CLAMP(message_buf.size(), uint16_t, 0, GetMaxVal<uint16_t>()));
-  if (!did_write) {
-    // Given that we checked for enough free space, Append() should
+  const auto* const command_bytes =
+      static_cast<const uint8_t*>(command_buffer);
+  const size_t log_buffer_index =
+      GetLogBufferIndexFor(command_buffer, command_len);
+  LogBuffer* const log_buffer = log_buffers_[log_buffer_index].get();
+  TimestampHeader tstamp_header;
+  if (received_tstamp_header) {
+    tstamp_header = *received_tstamp_header;
+  } else {
+    const auto& timestamps = timestamper_.GetTimestamps();
+    tstamp_header
+        .set_since_boot_awake_only(timestamps.since_boot_awake_only)
+        .set_since_boot_with_sleep(timestamps.since_boot_with_sleep)
+        .set_since_epoch(timestamps.since_epoch);
+  }
+  if (coalesce_repeats_ && CoalesceRepeat(log_buffer_index, command_bytes,
+                                          command_len, tstamp_header)) {
+    ++stats_.n_messages_logged;
+    TrackSequenceNum(command_buffer, command_len);
+    RecordLatency(command_buffer, command_len,
+                  tstamp_header.since_boot_with_sleep);
+    return true;
+  }
+
+  // Intern the tag, if the command has a (complete) tag. The tag is
+  // acquired before we Reserve(), so that evicting the tag's other
+  // messages cannot free its ID.
+  uint16_t tag_id = TagTable::kNoTagId;
+  size_t interned_tag_len = 0;
+  if (intern_tags_ && command_len >= kMinTaggedCommandLen) {
+    const size_t tag_len =
+        TaggedCommandLayout::ReadFieldOrDie<1>(command_bytes, command_len)
+            .tag_len;
+    if (tag_len <= command_len - kMinTaggedCommandLen) {
+      tag_id =
+          tag_table_.Acquire(command_bytes + kMinTaggedCommandLen, tag_len);
+      interned_tag_len = tag_id == TagTable::kNoTagId ? 0 : tag_len;
+    }
+  }
+
+  total_size = sizeof(TimestampHeader) + command_len - interned_tag_len;
+  CHECK(log_buffer->CanFitEver(total_size));
+
+  // Write the message directly into the log buffer, rather than staging
+  // the message in a local buffer (which would cost us an extra copy).
+  //
+  // If the buffer is full, Reserve() evicts the oldest messages to make room.
+  uint8_t* const message_start = log_buffer->Reserve(total_size);
+  if (!message_start) {
+    // Given that we checked that the message can fit, Reserve() should
     // have succeeded. Hence, a failure here indicates a logic error,
     // rather than a runtime error.
-    LOG(FATAL) << "Unexpected failure to Append()";
+    LOG(FATAL) << "Unexpected failure to Reserve()";
+  }
+  auto command_header =
+      TaggedCommandLayout::ReadFieldOrDie<0>(command_bytes, command_len);
+  command_header.reserved = tag_id == TagTable::kNoTagId ? 0 : tag_id + 1;
+  uint8_t* out = RecordHeaderLayout::WriteOrDie(message_start, total_size,
+                                                tstamp_header, command_header);
+  const uint8_t* in = command_bytes + sizeof(command_header);
+  if (interned_tag_len) {
+    std::memcpy(out, in, sizeof(protocol::AsciiMessage));
+    out += sizeof(protocol::AsciiMessage);
+    in += sizeof(protocol::AsciiMessage) + interned_tag_len;
+  }
+  std::memcpy(out, in, command_bytes + command_len - in);
+  CommitRecord(log_buffer_index, total_size, tstamp_header);
+  n_interned_tag_bytes_ += interned_tag_len;
+  repeat_runs_[log_buffer_index].repeated_record = nullptr;
+
+  ++stats_.n_messages_logged;
+  TrackSequenceNum(command_buffer, command_len);
+  RecordLatency(command_buffer, command_len,
+                tstamp_header.since_boot_with_sleep);
+
+  return true;
+}
+
+bool CommandProcessor::CoalesceRepeat(size_t log_buffer_index,
+                                      const uint8_t* command_bytes,
+                                      size_t command_len,
+                                      const TimestampHeader& tstamp_header) {
+  LogBuffer* const log_buffer = log_buffers_[log_buffer_index].get();
+  RepeatRun& run = repeat_runs_[log_buffer_index];
+  uint8_t* last_record;
+  size_t last_record_len;
+  std::tie(last_record, last_record_len) = log_buffer->GetLastMessage();
+  if (!last_record || last_record_len < kMinRecordLen) {
+    return false;
+  }
+
+  const auto& command_header =
+      TaggedCommandLayout::ReadFieldOrDie<0>(command_bytes, command_len);
+  const uint8_t* const payload = command_bytes + sizeof(protocol::Command);
+  const size_t payload_len = command_len - sizeof(protocol::Command);
+  if (last_record == run.repeated_record) {
+    // Compare the lengths first, as that rules out most messages.
+    if (payload_len != run.payload.size() ||
+        command_header.opcode != run.opcode ||
+        std::memcmp(payload, run.payload.data(), payload_len)) {
+      return false;
+    }
+    auto repeated_message_header =
+        RepeatedRecordHeaderLayout::ReadFieldOrDie<2>(last_record,
+                                                      last_record_len);
+    if (repeated_message_header.n_repeats ==
+        GetMaxVal(repeated_message_header.n_repeats)) {
+      return false;
+    }
+    ++repeated_message_header.n_repeats;
+    RepeatedRecordHeaderLayout::WriteFieldOrDie<0>(
+        last_record, last_record_len, tstamp_header);
+    RepeatedRecordHeaderLayout::WriteFieldOrDie<2>(
+        last_record, last_record_len, repeated_message_header);
+    PublishRecord(last_record, last_record_len);
+    return true;
+  }
+
+  if (!IsSameMessage(last_record, last_record_len, command_bytes,
+                     command_len)) {
+    return false;
+  }
+
+  // Start a run, with a record that counts this first repeat. The record
+  // carries the tag, for the sake of dumps, in which the messages of other
+  // log buffers may come between the original and the record.
+  size_t tag_len = 0;
+  if (command_len >= kMinTaggedCommandLen) {
+    tag_len = std::min<size_t>(
+        TaggedCommandLayout::ReadFieldOrDie<1>(command_bytes, command_len)
+            .tag_len,
+        command_len - kMinTaggedCommandLen);
+  }
+  const auto repeated_message_header =
+      protocol::RepeatedMessage().set_n_repeats(1).set_tag_len(tag_len);
+  const uint16_t payload_out_len = sizeof(repeated_message_header) + tag_len;
+  const auto repeat_command_header =
+      protocol::Command()
+          .set_opcode(protocol::Opcode::kRepeatedMessage)
+          .set_payload_len(payload_out_len);
+  const uint16_t record_len = RecordHeaderLayout::kSize + payload_out_len;
+  uint8_t* out = log_buffer->Reserve(record_len);
+  if (!out) {
+    // The record is no larger than the message it repeats, which fit.
+    LOG(FATAL) << "Unexpected failure to Reserve()";
+  }
+  out = RepeatedRecordHeaderLayout::WriteOrDie(out, record_len, tstamp_header,
+                                               repeat_command_header,
+                                               repeated_message_header);
+  if (tag_len) {
+    std::memcpy(out, payload + sizeof(protocol::AsciiMessage), tag_len);
   }
+  CommitRecord(log_buffer_index, record_len, tstamp_header);
 
+  run.repeated_record = std::get<0>(log_buffer->GetLastMessage());
+  run.opcode = command_header.opcode;
+  run.payload.assign(payload, payload + payload_len);
   return true;
 }
 
-bool CommandProcessor::Dump(unique_fd dump_fd) {
-  MessageBuffer::ScopedRewinder rewinder(&current_log_buffer_);
-  while (auto buffer_reader =
-             MemoryReader(current_log_buffer_.ConsumeNextMessage())) {
-    const auto& tstamp_header = buffer_reader.CopyOutOrDie<TimestampHeader>();
-    const auto& command_header =
-        buffer_reader.CopyOutOrDie<protocol::Command>();
-
-    // TOOO(b/32256098): validate |buffer_reader.size()| against payload_len,
-    // and use a smaller size if necessary. Update a stats counter if
-    // payload_len and
-    // buflen do not match.
-
-    std::string output_string = tstamp_header.ToString();
-    switch (command_header.opcode) {
-      using protocol::Opcode;
-      case Opcode::kWriteAsciiMessage:
-        output_string += ' ' + FormatAsciiMessage(buffer_reader);
+bool CommandProcessor::IsSameMessage(const uint8_t* record,
+                                     size_t record_len,
+                                     const uint8_t* command_bytes,
+                                     size_t command_len) const {
+  MemoryReader record_reader(record, record_len);
+  const auto record_header = std::get<1>(
+      record_reader.CopyOutLayoutOrDie<RecordHeaderLayout>());
+  const auto& command_header =
+      TaggedCommandLayout::ReadFieldOrDie<0>(command_bytes, command_len);
+  if (record_header.opcode != command_header.opcode) {
+    return false;
+  }
+
+  const uint8_t* payload = command_bytes + sizeof(protocol::Command);
+  size_t payload_len = command_len - sizeof(protocol::Command);
+  if (intern_tags_ && record_header.reserved) {
+    // The record omits its tag (see |log_buffers_|), so compare the
+    // AsciiMessage header and the tag separately from the rest.
+    constexpr size_t kHeaderLen = sizeof(protocol::AsciiMessage);
+    const uint8_t* tag;
+    size_t tag_len;
+    std::tie(tag, tag_len) = tag_table_.GetTag(record_header.reserved - 1);
+    if (payload_len < kHeaderLen + tag_len ||
+        std::memcmp(record_reader.GetBytesOrDie(kHeaderLen), payload,
+                    kHeaderLen) ||
+        std::memcmp(tag, payload + kHeaderLen, tag_len)) {
+      return false;
+    }
+    payload += kHeaderLen + tag_len;
+    payload_len -= kHeaderLen + tag_len;
+  }
+  return record_reader.size() == payload_len &&
+         (!payload_len ||
+          !std::memcmp(record_reader.GetBytesOrDie(payload_len), payload,
+                       payload_len));
+}
+
+bool CommandProcessor::AdmitCommand(const void* command_buffer,
+                                    size_t command_len) {
+  // The coarse clock is much cheaper to read than the clocks used for
+  // timestamps, and is precise enough for rate limiting.
+  const int64_t now_nsec =
+      os_->GetTimestamp(CLOCK_MONOTONIC_COARSE).ToNsec();
+  bool admitted = true;
+  if (command_len >= kMinTaggedCommandLen) {
+    const auto* const command_bytes =
+        static_cast<const uint8_t*>(command_buffer);
+    const auto& ascii_message_header =
+        TaggedCommandLayout::ReadFieldOrDie<1>(command_bytes, command_len);
+    // As in TrackSequenceNum(), a truncated tag is treated as a tag of its
+    // own.
+    const size_t tag_len = std::min<size_t>(
+        ascii_message_header.tag_len, command_len - kMinTaggedCommandLen);
+    admitted =
+        ingest_policy_->Admit(command_bytes + kMinTaggedCommandLen, tag_len,
+                              ascii_message_header.severity, now_nsec);
+  }
+  if (ingest_policy_->IsSummaryDue(now_nsec)) {
+    LogSuppressionSummaries(now_nsec);
+  }
+  return admitted;
+}
+
+void CommandProcessor::LogSuppressionSummaries(int64_t now_nsec) {
+  constexpr char kSummaryTag[] = "wifilogd";
+  constexpr size_t kSummaryTagLen = sizeof(kSummaryTag) - 1;
+  for (const auto& summary : ingest_policy_->TakeSummaries(now_nsec)) {
+    const std::string text = std::to_string(summary.n_suppressed) +
+                             " messages suppressed from tag " + summary.tag;
+    const size_t data_len = std::min(
+        text.size(),
+        protocol::kMaxMessageSize - kMinTaggedCommandLen - kSummaryTagLen);
+    const auto ascii_message_header =
+        protocol::AsciiMessage()
+            .set_data_len(data_len)
+            .set_tag_len(kSummaryTagLen)
+            .set_severity(protocol::MessageSeverity::kWarning);
+    const auto command_header =
+        protocol::Command()
+            .set_opcode(protocol::Opcode::kWriteAsciiMessage)
+            .set_payload_len(sizeof(ascii_message_header) + kSummaryTagLen +
+                             data_len);
+    std::vector<uint8_t> command(kMinTaggedCommandLen + kSummaryTagLen +
+                                 data_len);
+    uint8_t* out = command.data();
+    std::memcpy(out, &command_header, sizeof(command_header));
+    out += sizeof(command_header);
+    std::memcpy(out, &ascii_message_header, sizeof(ascii_message_header));
+    out += sizeof(ascii_message_header);
+    std::memcpy(out, kSummaryTag, kSummaryTagLen);
+    out += kSummaryTagLen;
+    std::memcpy(out, text.data(), data_len);
+    AppendCommandToLog(command.data(), command.size(), nullptr);
+  }
+}
+
+void CommandProcessor::CommitRecord(size_t log_buffer_index,
+                                    uint16_t record_len,
+                                    const TimestampHeader& tstamp_header) {
+  LogBuffer* const log_buffer = log_buffers_[log_buffer_index].get();
+  log_buffer->Commit(record_len);
+  TimeIndex* const time_index = &time_indexes_[log_buffer_index];
+  time_index->Add(log_buffer->GetNumAppended() - 1,
+                  tstamp_header.since_boot_with_sleep.ToNsec());
+  time_index->EvictBefore(log_buffer->GetNumEvicted());
+  if (!subscribers_.empty()) {
+    uint8_t* record;
+    size_t committed_len;
+    std::tie(record, committed_len) = log_buffer->GetLastMessage();
+    PublishRecord(record, committed_len);
+  }
+}
+
+template <typename ConsumerT>
+bool CommandProcessor::ConsumeMessagesInTimestampOrder(size_t n_log_buffers,
+                                                       ConsumerT consume) {
+  // Rewind every buffer on exit, so that the next dump sees every message.
+  class Rewinder {
+   public:
+    explicit Rewinder(decltype(log_buffers_)* buffers) : buffers_(buffers) {}
+    ~Rewinder() {
+      for (auto& buffer : *buffers_) {
+        buffer->Rewind();
+      }
+    }
+
+   private:
+    decltype(log_buffers_)* const buffers_;
+  } rewinder(&log_buffers_);
+
+  // A k-way merge. With only a handful of buffers, a linear scan for the
+  // oldest head is cheaper than maintaining a heap.
+  //
+  // Each buffer is read a batch at a time, so that the merge touches each
+  // buffer's bookkeeping once per batch, rather than once per message.
+  std::array<std::array<std::tuple<const uint8_t*, size_t>, kMergeBatchSize>,
+             kNumLogBuffers>
+      batches;
+  std::array<size_t, kNumLogBuffers> batch_lens{};
+  std::array<size_t, kNumLogBuffers> batch_positions{};
+  std::array<std::tuple<const uint8_t*, size_t>, kNumLogBuffers> heads;
+  std::array<int64_t, kNumLogBuffers> head_times;
+  const auto advance = [this, &batches, &batch_lens, &batch_positions, &heads,
+                        &head_times](size_t i) {
+    if (batch_positions[i] == batch_lens[i]) {
+      batch_lens[i] = log_buffers_[i]->ConsumeNextMessages(batches[i].data(),
+                                                           kMergeBatchSize);
+      batch_positions[i] = 0;
+    }
+    if (batch_positions[i] < batch_lens[i]) {
+      heads[i] = batches[i][batch_positions[i]++];
+    } else {
+      heads[i] = std::make_tuple(nullptr, 0);
+    }
+    if (std::get<0>(heads[i])) {
+      head_times[i] = CopyFromBufferOrDie<TimestampHeader>(
+                          std::get<0>(heads[i]), std::get<1>(heads[i]))
+                          .since_boot_with_sleep.ToNsec();
+    }
+  };
+  for (size_t i = 0; i < kNumLogBuffers; ++i) {
+    if (i < n_log_buffers) {
+      advance(i);
+    } else {
+      heads[i] = {nullptr, 0};
+    }
+  }
+
+  while (true) {
+    size_t oldest = kNumLogBuffers;
+    for (size_t i = 0; i < kNumLogBuffers; ++i) {
+      if (std::get<0>(heads[i]) &&
+          (oldest == kNumLogBuffers || head_times[i] < head_times[oldest])) {
+        oldest = i;
+      }
+    }
+    if (oldest == kNumLogBuffers) {
+      return true;
+    }
+
+    if (!consume(oldest, MemoryReader(heads[oldest]))) {
+      return false;
+    }
+    advance(oldest);
+  }
+}
+
+void CommandProcessor::DrainSharedRings() {
+  shared_rings_pending_ = false;
+  for (auto it = shared_rings_.begin(); it != shared_rings_.end();) {
+    if (DrainSharedRing(it->reader.get())) {
+      ++it;
+      continue;
+    }
+    LOG(DEBUG) << "Unregistering corrupt shared ring";
+    // TODO(b/32098735): Increment stats counter.
+    os_->UnmapSharedMemory(it->mapping, it->mapping_len);
+    it = shared_rings_.erase(it);
+  }
+}
+
+bool CommandProcessor::DrainSharedRing(SharedRingReader* ring) {
+  // The client can modify a record while we read it. So we copy each record
+  // to local storage, before validating it. This keeps the client from
+  // slipping an unsupported opcode into the log buffers.
+  std::array<uint8_t, protocol::kMaxMessageSize> record_copy;
+
+  // Bound the work done per drain, so that a client which writes as fast as
+  // we drain cannot starve the socket. If we stop early, the rest of the
+  // ring is drained by DoIdleWork().
+  size_t n_bytes_remaining = ring->GetDataLen();
+  while (true) {
+    while (n_bytes_remaining) {
+      const uint8_t* record;
+      size_t record_len;
+      std::tie(record, record_len) = ring->ConsumeNextRecord();
+      if (!record) {
         break;
-      case Opcode::kDumpBuffers:
-        LOG(FATAL) << "Unexpected DumpBuffers command in log";
+      }
+      n_bytes_remaining -= std::min(record_len, n_bytes_remaining);
+
+      // As with datagrams, oversized records are truncated.
+      record_len = std::min(record_len, record_copy.size());
+      if (record_len < sizeof(protocol::Command)) {
+        ++stats_.n_ring_records_dropped;
+        continue;
+      }
+
+      std::memcpy(record_copy.data(), record, record_len);
+      const auto& command_header = CopyFromBufferOrDie<protocol::Command>(
+          record_copy.data(), record_len);
+      if (command_header.opcode != protocol::Opcode::kWriteAsciiMessage &&
+          command_header.opcode !=
+              protocol::Opcode::kWriteStructuredMessage) {
+        ++stats_.n_ring_records_dropped;
+        continue;
+      }
+      CopyCommandToLog(record_copy.data(), record_len, nullptr);
     }
-    output_string += '\n';
 
-    size_t n_written;
+    if (ring->ArmWakeup()) {
+      break;
+    }
+    if (!n_bytes_remaining) {
+      shared_rings_pending_ = true;
+      break;
+    }
+  }
+  return !ring->IsCorrupt();
+}
+
+bool CommandProcessor::StartDumpSince(const void* command_buffer,
+                                      size_t command_len, unique_fd dump_fd) {
+  if (command_len <
+      sizeof(protocol::Command) + sizeof(protocol::DumpCursor)) {
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+  if (!dump_worker_.CanEnqueue()) {
+    LOG(ERROR) << "Too many dumps in progress; rejecting dump request";
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+
+  const auto& since = CopyFromBufferOrDie<protocol::DumpCursor>(
+      static_cast<const uint8_t*>(command_buffer) + sizeof(protocol::Command),
+      command_len - sizeof(protocol::Command));
+  DumpWorker::Cursor cursor;
+  std::vector<uint8_t> snapshot = TakeSnapshot(since, &cursor);
+  // The reader now has the newest record of each log buffer, so that
+  // record must not change. (See protocol::DumpCursor.)
+  for (auto& run : repeat_runs_) {
+    run.repeated_record = nullptr;
+  }
+  dump_worker_.EnqueueSince(std::move(snapshot), cursor, std::move(dump_fd));
+  return true;
+}
+
+bool CommandProcessor::StartDumpQuery(const void* command_buffer,
+                                      size_t command_len, unique_fd dump_fd) {
+  constexpr size_t kMinQueryCommandLen =
+      sizeof(protocol::Command) + sizeof(protocol::DumpQuery);
+  if (command_len < kMinQueryCommandLen) {
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+  const auto* const command_bytes =
+      static_cast<const uint8_t*>(command_buffer);
+  const auto& query = CopyFromBufferOrDie<protocol::DumpQuery>(
+      command_bytes + sizeof(protocol::Command),
+      command_len - sizeof(protocol::Command));
+  if (local_utils::CastEnumToInteger(query.min_severity) > kMaxSeverity ||
+      query.tag_len > command_len - kMinQueryCommandLen) {
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+  if (!dump_worker_.CanEnqueue()) {
+    LOG(ERROR) << "Too many dumps in progress; rejecting dump request";
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+
+  std::vector<uint8_t> snapshot = TakeQuerySnapshot(
+      query, command_bytes + kMinQueryCommandLen, query.tag_len);
+  dump_worker_.Enqueue(std::move(snapshot), GetStats(), latencies_,
+                       std::move(dump_fd), DumpWorker::Format::kText);
+  return true;
+}
+
+bool CommandProcessor::RegisterSharedRing(const void* command_buffer,
+                                          size_t command_len,
+                                          unique_fd ring_fd) {
+  if (ring_fd.get() < 0 ||
+      command_len < sizeof(protocol::Command) +
+                        sizeof(protocol::SharedRingRegistration)) {
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+
+  const auto& registration =
+      CopyFromBufferOrDie<protocol::SharedRingRegistration>(
+          static_cast<const uint8_t*>(command_buffer) +
+              sizeof(protocol::Command),
+          command_len - sizeof(protocol::Command));
+  const size_t mapping_len = registration.mapping_len;
+  if (mapping_len < sizeof(protocol::SharedRingHeader) +
+                        protocol::kMinSharedRingDataLen ||
+      mapping_len > sizeof(protocol::SharedRingHeader) +
+                        protocol::kMaxSharedRingDataLen) {
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+
+  void* mapping;
+  Os::Errno err;
+  std::tie(mapping, err) = os_->MapSharedMemory(ring_fd.get(), mapping_len);
+  if (err) {
+    LOG(DEBUG) << "Failed to map shared ring: " << std::strerror(err);
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+
+  std::unique_ptr<SharedRingReader> reader =
+      SharedRingReader::Create(mapping, mapping_len);
+  if (!reader) {
+    ++stats_.n_commands_rejected;
+    os_->UnmapSharedMemory(mapping, mapping_len);
+    return false;
+  }
+
+  // The client may have written records before registering the ring.
+  if (!DrainSharedRing(reader.get())) {
+    ++stats_.n_commands_rejected;
+    os_->UnmapSharedMemory(mapping, mapping_len);
+    return false;
+  }
+
+  if (shared_rings_.size() == kMaxSharedRings) {
+    // TODO(b/32098735): Increment stats counter.
+    os_->UnmapSharedMemory(shared_rings_.front().mapping,
+                           shared_rings_.front().mapping_len);
+    shared_rings_.erase(shared_rings_.begin());
+  }
+  shared_rings_.push_back({std::move(reader), mapping, mapping_len});
+  return true;
+}
+
+bool CommandProcessor::Subscribe(unique_fd subscriber_fd) {
+  if (subscriber_fd.get() < 0) {
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+
+  // Writing must not block, lest a subscriber that stops reading stall
+  // ingest.
+  const Os::Errno err = os_->SetNonBlocking(subscriber_fd.get());
+  if (err) {
+    LOG(DEBUG) << "Failed to make subscriber non-blocking: "
+               << std::strerror(err);
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+
+  // Records logged before now belong only to the existing subscribers.
+  if (!unpublished_records_.empty()) {
+    FlushSubscribers();
+  }
+  if (subscribers_.size() == kMaxSubscribers) {
+    subscribers_.erase(subscribers_.begin());
+  }
+  subscribers_.push_back({std::move(subscriber_fd), std::vector<uint8_t>()});
+  return true;
+}
+
+void CommandProcessor::PublishRecord(const uint8_t* record,
+                                     size_t record_len) {
+  if (subscribers_.empty()) {
+    return;
+  }
+  AppendRecordToSnapshot(MemoryReader(record, record_len),
+                         &unpublished_records_);
+  // A burst (e.g. a large shared ring drain) could otherwise queue an
+  // unbounded number of records before the next DoIdleWork().
+  if (unpublished_records_.size() >= kMaxSubscriberQueueBytes) {
+    FlushSubscribers();
+  }
+}
+
+void CommandProcessor::FlushSubscribers() {
+  // Format each record once, however many subscribers there are.
+  std::vector<char> line(log_formatter::kMaxFormattedRecordLen);
+  MemoryReader records(unpublished_records_.data(),
+                       unpublished_records_.size());
+  while (records) {
+    const auto record_len = records.CopyOutOrDie<uint16_t>();
+    const char* const line_start = line.data();
+    const char* const line_end = log_formatter::FormatRecord(
+        MemoryReader(records.GetBytesOrDie(record_len), record_len),
+        line.data());
+    const size_t line_len = line_end - line_start;
+    for (auto& subscriber : subscribers_) {
+      if (subscriber.fd.get() < 0) {
+        continue;
+      }
+      if (subscriber.queue.size() + line_len > kMaxSubscriberQueueBytes) {
+        // Mark the subscriber for detachment. It would otherwise miss
+        // records, without knowing.
+        subscriber.fd.reset();
+        continue;
+      }
+      subscriber.queue.insert(subscriber.queue.end(), line_start, line_end);
+    }
+  }
+  unpublished_records_.clear();
+
+  const auto detach = [this](Subscriber& subscriber) {
+    if (subscriber.fd.get() < 0 || !WriteToSubscriber(&subscriber)) {
+      LOG(INFO) << "Detaching subscriber";
+      return true;
+    }
+    return false;
+  };
+  subscribers_.erase(
+      std::remove_if(subscribers_.begin(), subscribers_.end(), detach),
+      subscribers_.end());
+}
+
+bool CommandProcessor::WriteToSubscriber(Subscriber* subscriber) {
+  std::vector<uint8_t>& queue = subscriber->queue;
+  size_t n_written = 0;
+  while (n_written < queue.size()) {
+    size_t write_len;
     Os::Errno err;
-    std::tie(n_written, err) =
-        os_->Write(dump_fd, output_string.data(), output_string.size());
+    std::tie(write_len, err) =
+        os_->Write(subscriber->fd.get(), queue.data() + n_written,
+                   queue.size() - n_written);
     if (err == EINTR) {
-      // The next write will probably succeed. We dont't retry the current
-      // message, however, because we want to guarantee forward progress.
-      //
-      // TODO(b/32098735): Increment a counter, and attempt to output that
-      // counter after we've dumped all the log messages.
-    } else if (err) {
-      // Any error other than EINTR is considered unrecoverable.
-      LOG(ERROR) << "Terminating log dump, due to " << strerror(err);
+      continue;
+    }
+    if (err == EAGAIN || (!err && !write_len)) {
+      // The subscriber is behind. Keep the rest for the next flush.
+      break;
+    }
+    if (err) {
+      LOG(DEBUG) << "Failed to write to subscriber: " << std::strerror(err);
       return false;
     }
+    n_written += write_len;
   }
-
+  queue.erase(queue.begin(), queue.begin() + n_written);
   return true;
 }
 
-std::string CommandProcessor::FormatAsciiMessage(MemoryReader buffer_reader) {
-  constexpr char kShortHeaderError[] = "[truncated-header]";
-  if (buffer_reader.size() < sizeof(protocol::AsciiMessage)) {
+void CommandProcessor::TrackSequenceNum(const void* command_buffer,
+                                        size_t command_len) {
+  // As in GetLogBufferIndexFor(), we need only handle AsciiMessage (whose
+  // layout StructuredMessage shares).
+  constexpr size_t kMinAsciiMessageLen = TaggedCommandLayout::kSize;
+  if (command_len < kMinAsciiMessageLen) {
+    return;
+  }
+
+  const auto* const command_bytes =
+      static_cast<const uint8_t*>(command_buffer);
+  protocol::Command command_header;
+  protocol::AsciiMessage ascii_message_header;
+  std::tie(command_header, ascii_message_header) =
+      TaggedCommandLayout::ReadOrDie(command_buffer, command_len);
+  // The tag may be truncated. We still track it, since the writer will
+  // (presumably) truncate it the same way every time.
+  const size_t tag_len = std::min<size_t>(ascii_message_header.tag_len,
+                                          command_len - kMinAsciiMessageLen);
+  stats_.n_messages_missing +=
+      sequence_tracker_.Track(command_bytes + kMinAsciiMessageLen, tag_len,
+                              command_header.sequence_num);
+}
+
+void CommandProcessor::RecordLatency(const void* command_buffer,
+                                     size_t command_len,
+                                     const Os::Timestamp& boottime) {
+  const auto& command_header =
+      CopyFromBufferOrDie<protocol::Command>(command_buffer, command_len);
+  const int64_t now_nsec = boottime.ToNsec();
+  // Clients which don't measure latency leave |src_boottime_nsec| as zero.
+  // A timestamp from the future can only come from a confused client, so we
+  // ignore that as well.
+  if (!command_header.src_boottime_nsec ||
+      command_header.src_boottime_nsec > static_cast<uint64_t>(now_nsec)) {
+    return;
+  }
+  latencies_[command_header.opcode].Record(now_nsec -
+                                           command_header.src_boottime_nsec);
+}
+
+size_t CommandProcessor::GetLogBufferIndexFor(const void* command_buffer,
+                                              size_t command_len) const {
+  // Only kWriteAsciiMessage and kWriteStructuredMessage commands are logged.
+  // StructuredMessage shares the layout of AsciiMessage's tag and severity,
+  // so we only need to handle AsciiMessage here.
+  if (command_len < TaggedCommandLayout::kSize) {
     // TODO(b/32098735): Increment stats counter.
-    return kShortHeaderError;
+    return kDefaultLogBufferIndex;
   }
 
   const auto& ascii_message_header =
-      buffer_reader.CopyOutOrDie<protocol::AsciiMessage>();
-  const std::string& formatted_tag =
-      GetStringFromMemoryReader(&buffer_reader, ascii_message_header.tag_len);
-  const std::string& formatted_msg =
-      GetStringFromMemoryReader(&buffer_reader, ascii_message_header.data_len);
-  return formatted_tag + ' ' + formatted_msg;
+      TaggedCommandLayout::ReadFieldOrDie<1>(command_buffer, command_len);
+  const auto severity =
+      local_utils::CastEnumToInteger(ascii_message_header.severity);
+  if (severity > kMaxSeverity) {
+    // TODO(b/32098735): Increment stats counter.
+    return kDefaultLogBufferIndex;
+  }
+  return severity;
+}
+
+bool CommandProcessor::StartDump(unique_fd dump_fd,
+                                 DumpWorker::Format format) {
+  if (!dump_worker_.CanEnqueue()) {
+    LOG(ERROR) << "Too many dumps in progress; rejecting dump request";
+    ++stats_.n_commands_rejected;
+    return false;
+  }
+  // Take the snapshot first, so that the stats describe the state of the
+  // buffers after the snapshot's messages were logged.
+  std::vector<uint8_t> snapshot;
+  if (format != DumpWorker::Format::kStats) {
+    DumpWorker::Cursor unused_cursor;
+    snapshot = TakeSnapshot(protocol::DumpCursor(), &unused_cursor);
+  }
+  dump_worker_.Enqueue(std::move(snapshot), GetStats(), latencies_,
+                       std::move(dump_fd), format);
+  return true;
+}
+
+size_t CommandProcessor::GetMaxSnapshotLen() const {
+  // Each log buffer record carries a header at least as large as the
+  // length we prefix to each record in the snapshot. So the uncompressed
+  // size of the log buffers bounds the size of the snapshot.
+  size_t max_snapshot_len = n_interned_tag_bytes_;
+  for (const auto& log_buffer : log_buffers_) {
+    max_snapshot_len += log_buffer->GetUncompressedSize();
+  }
+  static_assert(MessageBuffer::GetHeaderSize() >= sizeof(uint16_t),
+                "snapshot may be larger than the log buffers");
+  return max_snapshot_len;
+}
+
+std::vector<uint8_t> CommandProcessor::TakeSnapshot(
+    const protocol::DumpCursor& since, DumpWorker::Cursor* cursor) {
+  for (size_t i = 0; i < kNumLogBuffers; ++i) {
+    LogBuffer* const log_buffer = log_buffers_[i].get();
+    const uint64_t first_record = log_buffer->GetNumEvicted();
+    const uint64_t end_record = log_buffer->GetNumAppended();
+    uint64_t next_record = since.next_record[i];
+    if (next_record > end_record) {
+      // The cursor is past the newest record (e.g., it was from an earlier
+      // run of wifilogd). Read from the oldest record.
+      next_record = 0;
+    }
+    if (next_record > first_record) {
+      const uint64_t n_to_skip = next_record - first_record;
+      CHECK(log_buffer->SkipMessages(n_to_skip) == n_to_skip);
+    }
+    (*cursor)[i].next_record = end_record;
+    (*cursor)[i].n_missed =
+        next_record < first_record ? first_record - next_record : 0;
+  }
+
+  std::vector<uint8_t> snapshot;
+  snapshot.reserve(GetMaxSnapshotLen());
+  ConsumeMessagesInTimestampOrder(
+      kNumLogBuffers,
+      [this, &snapshot](size_t /* log_buffer_index */, MemoryReader record) {
+        AppendRecordToSnapshot(record, &snapshot);
+        return true;
+      });
+  return snapshot;
+}
+
+std::vector<uint8_t> CommandProcessor::TakeQuerySnapshot(
+    const protocol::DumpQuery& query, const uint8_t* tag, size_t tag_len) {
+  const size_t n_log_buffers =
+      local_utils::CastEnumToInteger(query.min_severity) + 1;
+  const int64_t min_boottime_nsec = SAFELY_CLAMP(
+      query.min_boottime_nsec, int64_t, 0, GetMaxVal<int64_t>());
+  for (size_t i = 0; i < n_log_buffers; ++i) {
+    // Seek past the records which the index shows to be too old.
+    LogBuffer* const log_buffer = log_buffers_[i].get();
+    const uint64_t first_record = log_buffer->GetNumEvicted();
+    time_indexes_[i].EvictBefore(first_record);
+    const uint64_t n_to_skip =
+        time_indexes_[i].Seek(min_boottime_nsec, first_record) - first_record;
+    CHECK(log_buffer->SkipMessages(n_to_skip) == n_to_skip);
+  }
+
+  const uint64_t max_boottime_nsec =
+      query.max_boottime_nsec ? query.max_boottime_nsec : GetMaxVal<uint64_t>();
+  const uint64_t max_realtime_nsec =
+      query.max_realtime_nsec ? query.max_realtime_nsec : GetMaxVal<uint64_t>();
+  std::vector<uint8_t> snapshot;
+  ConsumeMessagesInTimestampOrder(
+      n_log_buffers, [&](size_t /* log_buffer_index */, MemoryReader record) {
+        const auto tstamp_header =
+            MemoryReader(record).CopyOutOrDie<TimestampHeader>();
+        const uint64_t boottime_nsec =
+            tstamp_header.since_boot_with_sleep.ToNsec();
+        if (boottime_nsec > max_boottime_nsec) {
+          // Messages are merged in order of boottime, so no more match.
+          return false;
+        }
+        const uint64_t realtime_nsec = tstamp_header.since_epoch.ToNsec();
+        if (boottime_nsec >= query.min_boottime_nsec &&
+            realtime_nsec >= query.min_realtime_nsec &&
+            realtime_nsec <= max_realtime_nsec &&
+            (!tag_len || RecordHasTag(record, tag, tag_len))) {
+          AppendRecordToSnapshot(record, &snapshot);
+        }
+        return true;
+      });
+  return snapshot;
+}
+
+bool CommandProcessor::RecordHasTag(MemoryReader record, const uint8_t* tag,
+                                    size_t tag_len) const {
+  // The messages have not been validated, so any part of the tag may be
+  // missing. (See |log_buffers_|.)
+  const auto command_header =
+      std::get<1>(record.CopyOutLayoutOrDie<RecordHeaderLayout>());
+  const uint8_t* record_tag;
+  size_t record_tag_len;
+  if (command_header.opcode == protocol::Opcode::kRepeatedMessage) {
+    if (record.size() < sizeof(protocol::RepeatedMessage)) {
+      return false;
+    }
+    record_tag_len = record.CopyOutOrDie<protocol::RepeatedMessage>().tag_len;
+  } else if (intern_tags_ && command_header.reserved) {
+    std::tie(record_tag, record_tag_len) =
+        tag_table_.GetTag(command_header.reserved - 1);
+    return record_tag_len == tag_len &&
+           !std::memcmp(record_tag, tag, tag_len);
+  } else {
+    // Both types of message share the layout of AsciiMessage.
+    if (record.size() < sizeof(protocol::AsciiMessage)) {
+      return false;
+    }
+    record_tag_len = record.CopyOutOrDie<protocol::AsciiMessage>().tag_len;
+  }
+  if (record_tag_len != tag_len || record.size() < tag_len) {
+    return false;
+  }
+  record_tag = record.GetBytesOrDie(tag_len);
+  return !std::memcmp(record_tag, tag, tag_len);
+}
+
+void CommandProcessor::AppendRecordToSnapshot(
+    MemoryReader record, std::vector<uint8_t>* snapshot) const {
+  const auto append = [snapshot](const void* data, size_t len) {
+    const auto* const bytes = static_cast<const uint8_t*>(data);
+    snapshot->insert(snapshot->end(), bytes, bytes + len);
+  };
+
+  // Every record starts with a TimestampHeader and a Command. (See
+  // |log_buffers_|.)
+  TimestampHeader tstamp_header;
+  protocol::Command command_header;
+  std::tie(tstamp_header, command_header) =
+      record.CopyOutLayoutOrDie<RecordHeaderLayout>();
+  const uint8_t* tag = nullptr;
+  size_t tag_len = 0;
+  if (intern_tags_ && command_header.reserved) {
+    std::tie(tag, tag_len) = tag_table_.GetTag(command_header.reserved - 1);
+    command_header.reserved = 0;
+  }
+
+  uint16_t record_len;
+  static_assert(GetMaxVal(record_len) >= log_formatter::kMaxRecordLen,
+                "record_len cannot represent some records");
+  record_len = RecordHeaderLayout::kSize + tag_len + record.size();
+  append(&record_len, sizeof(record_len));
+  uint8_t headers[RecordHeaderLayout::kSize];
+  RecordHeaderLayout::WriteOrDie(headers, sizeof(headers), tstamp_header,
+                                 command_header);
+  append(headers, sizeof(headers));
+  if (tag) {
+    append(record.GetBytesOrDie(sizeof(protocol::AsciiMessage)),
+           sizeof(protocol::AsciiMessage));
+    append(tag, tag_len);
+  }
+  const size_t payload_len = record.size();
+  append(record.GetBytesOrDie(payload_len), payload_len);
+}
+
+void CommandProcessor::ReleaseInternedTag(const uint8_t* record,
+                                          size_t record_len) {
+  if (!intern_tags_) {
+    return;
+  }
+  const auto command_header =
+      RecordHeaderLayout::ReadFieldOrDie<1>(record, record_len);
+  if (!command_header.reserved) {
+    return;
+  }
+  n_interned_tag_bytes_ -=
+      AsciiRecordHeaderLayout::ReadFieldOrDie<2>(record, record_len).tag_len;
+  tag_table_.Release(command_header.reserved - 1);
+}
+
+void CommandProcessor::CheckRecoveredMessages(LogBuffer* log_buffer) {
+  const size_t n_recovered = log_buffer->GetNumRecovered();
+  bool all_valid = true;
+  while (true) {
+    const auto& message = log_buffer->ConsumeNextMessage();
+    if (!std::get<0>(message)) {
+      break;
+    }
+    if (std::get<1>(message) < kMinRecordLen) {
+      all_valid = false;
+      break;
+    }
+  }
+  log_buffer->Rewind();
+
+  if (!all_valid) {
+    LOG(WARNING) << "Discarding " << n_recovered
+                 << " recovered messages, which include a malformed message";
+    log_buffer->Shrink(0);
+    return;
+  }
+  LOG(INFO) << "Recovered " << n_recovered << " messages";
 }
 
 }  // namespace wifilogd
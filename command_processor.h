@@ -17,23 +17,62 @@
 #ifndef COMMAND_PROCESSOR_H_
 #define COMMAND_PROCESSOR_H_
 
+#include <array>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "android-base/macros.h"
 #include "android-base/unique_fd.h"
 
+#include "wifilogd/dump_worker.h"
+#include "wifilogd/ingest_policy.h"
+#include "wifilogd/latency_histogram.h"
 #include "wifilogd/local_utils.h"
+#include "wifilogd/log_buffer.h"
 #include "wifilogd/memory_reader.h"
-#include "wifilogd/message_buffer.h"
 #include "wifilogd/os.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/sequence_tracker.h"
+#include "wifilogd/shared_ring_reader.h"
+#include "wifilogd/tag_table.h"
+#include "wifilogd/time_index.h"
+#include "wifilogd/timestamp_header.h"
+#include "wifilogd/timestamper.h"
 
 namespace android {
 namespace wifilogd {
 
 class CommandProcessor {
  public:
-  // Constructs a CommandProcessor with a buffer of |buffer_size_bytes|.
+  // The number of log buffers. Messages are assigned to a buffer based on
+  // their protocol::MessageSeverity, so that a flood of (e.g.) kTrace
+  // messages cannot evict the rarer (and more important) kError messages.
+  static constexpr size_t kNumLogBuffers = 5;
+
+  // The share of the total buffer space that is given to the log buffer for
+  // each severity, in units of 1/kLogBufferShareDenominator. Indexed by
+  // protocol::MessageSeverity.
+  static constexpr std::array<size_t, kNumLogBuffers> kLogBufferShares{
+      {3, 3, 4, 4, 2}};
+  static constexpr size_t kLogBufferShareDenominator = 16;
+
+  // The maximal number of shared rings which may be registered at once.
+  // Registering another ring unregisters the oldest.
+  static constexpr size_t kMaxSharedRings = 16;
+
+  // The maximal number of subscribers (see protocol::Opcode::kSubscribe)
+  // which may be attached at once. Another subscription detaches the
+  // oldest subscriber.
+  static constexpr size_t kMaxSubscribers = 4;
+
+  // The maximal number of bytes which may be queued for a subscriber. A
+  // subscriber which falls further behind is detached.
+  static constexpr size_t kMaxSubscriberQueueBytes = 64 * 1024;
+
+  // Constructs a CommandProcessor with |buffer_size_bytes| of buffer space,
+  // divided among the log buffers per kLogBufferShares. Each log buffer
+  // must be large enough to hold a maximal message.
   explicit CommandProcessor(size_t buffer_size_bytes);
 
   // Constructs a CommandProcessor with a buffer of |buffer_size_bytes|.
@@ -41,13 +80,36 @@ class CommandProcessor {
   // This method allows tests to provide a MockOs.
   CommandProcessor(size_t buffer_size_bytes, std::unique_ptr<Os> os);
 
+  // Constructs a CommandProcessor with a buffer of |buffer_size_bytes|.
+  // The CommandProcessor will use |os| to call into operating system services,
+  // and will timestamp messages as described for |timestamp_mode|.
+  CommandProcessor(size_t buffer_size_bytes, std::unique_ptr<Os> os,
+                   Timestamper::Mode timestamp_mode);
+
+  // Constructs a CommandProcessor as above, whose log buffers store
+  // messages as described for |log_buffer_mode|. In
+  // LogBuffer::Mode::kCompressed, each log buffer must be at least
+  // LogBuffer::GetMinCompressedSize().
+  //
+  // If |persistent_dir| is non-empty, each log buffer is backed by a file
+  // in |persistent_dir|, and the messages left in those files by a previous
+  // CommandProcessor (e.g., before a crash) are recovered. Tags are not
+  // interned, since the TagTable does not persist. Persistence cannot be
+  // combined with LogBuffer::Mode::kCompressed. A log buffer whose file
+  // cannot be opened is kept in memory instead.
+  CommandProcessor(size_t buffer_size_bytes, std::unique_ptr<Os> os,
+                   Timestamper::Mode timestamp_mode,
+                   LogBuffer::Mode log_buffer_mode,
+                   const std::string& persistent_dir = std::string());
+
   virtual ~CommandProcessor();
 
   // Processes the given command, with the given file descriptor. The effect of
   // this call depends on the contents of |input_buf|. In particular, depending
   // on the command, |fd| may be used for reading or writing, or |fd| may be
   // ignored. However, |fd| is guaranteed to be closed before ProcessCommand()
-  // returns, in all cases.
+  // returns, in all cases, except that a kSubscribe command which succeeds
+  // keeps |fd| until the subscriber is detached.
   //
   // (Ideally, we might want to take |fd| as a unique_fd. Unfortunately,
   // GoogleMock doesn't deal well with move-only parameters.
@@ -55,35 +117,333 @@ class CommandProcessor {
   virtual bool ProcessCommand(NONNULL const void* input_buf,
                               size_t n_bytes_read, int fd);
 
+  // Processes the given command, as ProcessCommand() does, except that a
+  // message is logged as received at |tstamp_header|, rather than at the
+  // current time. (This is for commands which were received, and
+  // timestamped, on another thread. See ParallelReceiver.)
+  virtual bool ProcessTimestampedCommand(const TimestampHeader& tstamp_header,
+                                         NONNULL const void* input_buf,
+                                         size_t n_bytes_read, int fd);
+
+  // Processes |n_commands| commands, which were received as a single batch.
+  // The i-th command occupies the first |command_lens[i]| bytes of the
+  // |buf_stride| bytes starting at |input_bufs + i * buf_stride|, and is
+  // processed with the file descriptor |command_fds[i]|, as described for
+  // ProcessCommand(). Returns the number of commands that were processed
+  // successfully.
+  virtual size_t ProcessCommands(NONNULL const uint8_t* input_bufs,
+                                 size_t buf_stride,
+                                 NONNULL const size_t* command_lens,
+                                 NONNULL const int* command_fds,
+                                 size_t n_commands);
+
+  // Performs work which was deferred to keep ingest latency low (e.g.
+  // draining a shared ring which had more records than one drain would
+  // take, or writing new records to subscribers). Should be called when no
+  // commands are waiting. Returns true if more deferred work remains.
+  // (Output queued for a subscriber that cannot accept it yet does not
+  // count. It is retried by the next call, rather than by polling.)
+  virtual bool DoIdleWork();
+
+  // Starts a dump of all of the logged messages to |dump_fd|, in |format|.
+  // (This is how the kDumpBuffers commands are handled. It is public so
+  // that dumps can also be started without a command.)
+  // The messages are copied out of the log buffers immediately, and are
+  // formatted and written by |dump_worker_|. Returns false if the dump
+  // could not be started.
+  bool StartDump(::android::base::unique_fd dump_fd,
+                 DumpWorker::Format format);
+
+  // Returns the counts of events which cost us log messages. (See
+  // protocol::Stats.)
+  protocol::Stats GetStats() const;
+
+  // Returns the latencies measured so far, from the client sending a command
+  // to the command being logged.
+  const OpcodeLatencies& GetLatencies() const { return latencies_; }
+
+  // Counts a datagram which was truncated to protocol::kMaxMessageSize.
+  void CountTruncatedDatagram();
+
+  // Counts a failed receive, which will be retried. Only ENOMEM and EINTR
+  // are counted, as other errors are not retried.
+  void CountRetriedReceiveError(Os::Errno err);
+
+  // Blocks until every dump which has been started has been written. (Dumps
+  // are written on a separate thread, so ProcessCommand() may return before
+  // a dump is complete.)
+  void WaitForDumps();
+
+  // Starts filtering messages through an IngestPolicy, before they are
+  // timestamped. Suppressed messages are not logged. Instead, at most once
+  // per IngestPolicy::kSummaryIntervalNsec, a kWarning message notes how
+  // many messages were suppressed for each tag. (Summaries are logged as
+  // messages arrive, so the last summary of a burst waits for the next
+  // message.)
+  void EnableIngestPolicy();
+
+  // Returns the number of messages suppressed by the IngestPolicy, if any.
+  uint64_t GetNumMessagesSuppressed() const;
+
+  // Starts coalescing repeated messages. A message which repeats the newest
+  // message in its log buffer (in everything but the fields of its
+  // protocol::Command, other than |opcode|) is counted by a
+  // protocol::RepeatedMessage record which follows the original, rather
+  // than being logged again. (Hence, a run of repeats is broken by any
+  // other message which is logged to the same log buffer.)
+  void EnableRepeatCoalescing();
+
+  // Returns the number of attached subscribers.
+  size_t GetNumSubscribers() const { return subscribers_.size(); }
+
+  // Reduces memory usage, in response to memory pressure. Evicts the older
+  // half (by size) of the messages in each log buffer, and returns the
+  // memory that held them to the system.
+  virtual void ShrinkBuffers();
+
  private:
-  // Copies |command_buffer| into the log buffer. Returns true if the
+  // A shared ring, as registered by a client.
+  struct SharedRing {
+    std::unique_ptr<SharedRingReader> reader;
+    void* mapping;
+    size_t mapping_len;
+  };
+
+  // A client which streams records, as described for
+  // protocol::Opcode::kSubscribe.
+  struct Subscriber {
+    ::android::base::unique_fd fd;
+    // Text which the subscriber has yet to read.
+    std::vector<uint8_t> queue;
+  };
+
+  // The run of repeats, if any, at the end of a log buffer.
+  struct RepeatRun {
+    // The protocol::RepeatedMessage record which counts the repeats, or
+    // nullptr if there is no run. Valid while it is the newest record in
+    // the log buffer.
+    uint8_t* repeated_record;
+    // The repeated message, less its protocol::Command. (The run's original
+    // may have been evicted, so we keep a copy to compare against.)
+    protocol::Opcode opcode;
+    std::vector<uint8_t> payload;
+  };
+
+  // Processes the command in |input_buffer|, with |fd|, as described for
+  // ProcessCommand(). If |tstamp_header| is non-null, a message is logged
+  // as received at |*tstamp_header|.
+  bool DispatchCommand(NONNULL const void* input_buffer, size_t n_bytes_read,
+                       ::android::base::unique_fd fd,
+                       const TimestampHeader* tstamp_header);
+
+  // Copies |command_buffer| into the log buffer, unless the ingest policy
+  // suppresses it. Returns true if the command was copied or suppressed.
+  // The command is timestamped as for AppendCommandToLog().
+  bool CopyCommandToLog(NONNULL const void* command_buffer, size_t command_len,
+                        const TimestampHeader* tstamp_header);
+
+  // Copies |command_buffer| into the log buffer, with |*tstamp_header|, or
+  // (if |tstamp_header| is null) the current time. Returns true if the
   // command was copied. If |command_len| exceeds protocol::kMaxMessageSize,
   // copies the first protocol::kMaxMessageSize of |command_buffer|, and returns
   // true.
-  bool CopyCommandToLog(NONNULL const void* command_buffer, size_t command_len);
+  bool AppendCommandToLog(NONNULL const void* command_buffer,
+                          size_t command_len,
+                          const TimestampHeader* tstamp_header);
+
+  // If the command in |command_buffer| repeats the newest message in
+  // |log_buffers_[log_buffer_index]|, counts the repeat (as having been
+  // received at |tstamp_header|), rather than logging the command, and
+  // returns true. Otherwise, returns false.
+  bool CoalesceRepeat(size_t log_buffer_index,
+                      NONNULL const uint8_t* command_bytes, size_t command_len,
+                      const TimestampHeader& tstamp_header);
+
+  // Returns true if |record| (a record from a log buffer, other than a
+  // protocol::RepeatedMessage) holds the same message as |command_bytes|,
+  // as described for EnableRepeatCoalescing().
+  bool IsSameMessage(NONNULL const uint8_t* record, size_t record_len,
+                     NONNULL const uint8_t* command_bytes,
+                     size_t command_len) const;
+
+  // Returns true if |ingest_policy_| admits the command in |command_buffer|.
+  // Commands too short to have a tag are always admitted. Logs a summary of
+  // suppressed messages, if one is due.
+  bool AdmitCommand(NONNULL const void* command_buffer, size_t command_len);
+
+  // Logs a kWarning message for each tag with messages suppressed by
+  // |ingest_policy_|, as of |now_nsec|.
+  void LogSuppressionSummaries(int64_t now_nsec);
+
+  // Commits the record of |record_len| bytes reserved in the log buffer
+  // with index |log_buffer_index|, and notes the record in the buffer's
+  // TimeIndex.
+  void CommitRecord(size_t log_buffer_index, uint16_t record_len,
+                    const TimestampHeader& tstamp_header);
+
+  // Calls |consume| with the index of the log buffer holding each unread
+  // message, and the message, as a MemoryReader. Only the first
+  // |n_log_buffers| log buffers (i.e., those for the most severe messages)
+  // are read. Messages are merged across the log buffers, in increasing
+  // order of their TimestampHeader::since_boot_with_sleep. Stops, and returns
+  // false, if |consume| returns false. Otherwise, returns true. Either way,
+  // rewinds every log buffer.
+  template <typename ConsumerT>
+  bool ConsumeMessagesInTimestampOrder(size_t n_log_buffers,
+                                       ConsumerT consume);
+
+  // Returns an upper bound on the size of a snapshot.
+  size_t GetMaxSnapshotLen() const;
+
+  // Returns a copy of the messages logged from |since| onwards, in timestamp
+  // order, in the format described for DumpWorker, and fills |cursor| with
+  // the position to be read from next. (See protocol::DumpCursor.) Interned
+  // tags are restored, so the snapshot holds each command as it was
+  // received.
+  std::vector<uint8_t> TakeSnapshot(const protocol::DumpCursor& since,
+                                    NONNULL DumpWorker::Cursor* cursor);
+
+  // Returns a copy of the messages which match |query|, and (if |tag_len|
+  // is non-zero) have the tag of |tag_len| bytes at |tag|, as for
+  // TakeSnapshot().
+  std::vector<uint8_t> TakeQuerySnapshot(const protocol::DumpQuery& query,
+                                         const uint8_t* tag, size_t tag_len);
+
+  // Returns true if |record| (a record from a log buffer) has the tag of
+  // |tag_len| bytes at |tag|.
+  bool RecordHasTag(MemoryReader record, NONNULL const uint8_t* tag,
+                    size_t tag_len) const;
+
+  // Appends |record| (a record from a log buffer) to |snapshot|, restoring
+  // its tag if the tag was interned.
+  void AppendRecordToSnapshot(MemoryReader record,
+                              NONNULL std::vector<uint8_t>* snapshot) const;
 
-  // Dumps all of the logged messages to |dump_fd|. Returns true unless
-  // an unrecoverable error was encountered.
-  bool Dump(::android::base::unique_fd dump_fd);
+  // Releases the interned tag, if any, of |record|, which is being evicted
+  // from a log buffer.
+  void ReleaseInternedTag(NONNULL const uint8_t* record, size_t record_len);
 
-  // Returns a human-friendly string representation of the AsciiMessage
-  // contained at the head of the memory referenced by |memory_reader|.
-  // Validates that |memory_reader| has enough bytes to contain an AsciiMessage
-  // header, and the payload described by that header. Reports any errors in
-  // the returned string.
-  std::string FormatAsciiMessage(MemoryReader memory_reader);
+  // Checks the messages that |log_buffer| recovered from its backing file.
+  // Those messages were not validated as described for |log_buffers_|, so
+  // if any message is too short to hold a TimestampHeader and a
+  // protocol::Command, discards every recovered message.
+  static void CheckRecoveredMessages(NONNULL LogBuffer* log_buffer);
 
-  // The MessageBuffer is inlined, since there's not much value to mocking
-  // simple data objects. See Testing on the Toilet Episode 173.
+  // Copies the records in every registered shared ring into the log
+  // buffers, as if each record had been received as a separate
+  // kWriteAsciiMessage (or kWriteStructuredMessage) command. Unregisters any
+  // ring that is corrupt.
+  void DrainSharedRings();
+
+  // Copies the records in |ring| into the log buffers. Returns false if
+  // |ring| is corrupt. Sets |shared_rings_pending_| if records remain.
+  bool DrainSharedRing(NONNULL SharedRingReader* ring);
+
+  // Starts a dump of the messages logged since the protocol::DumpCursor in
+  // |command_buffer|, to |dump_fd|. (This is how kDumpBuffersSince is
+  // handled.) Returns false if the dump could not be started.
+  bool StartDumpSince(NONNULL const void* command_buffer, size_t command_len,
+                      ::android::base::unique_fd dump_fd);
+
+  // Starts a dump of the messages which match the protocol::DumpQuery in
+  // |command_buffer|, to |dump_fd|. (This is how kDumpBuffersQuery is
+  // handled.) Returns false if the dump could not be started.
+  bool StartDumpQuery(NONNULL const void* command_buffer, size_t command_len,
+                      ::android::base::unique_fd dump_fd);
+
+  // Attaches a subscriber that streams records to |subscriber_fd|, as
+  // described for protocol::Opcode::kSubscribe. Returns true if the
+  // subscriber was attached.
+  bool Subscribe(::android::base::unique_fd subscriber_fd);
+
+  // Queues |record| (a record from a log buffer) to be written to every
+  // subscriber, if there are any.
+  void PublishRecord(NONNULL const uint8_t* record, size_t record_len);
+
+  // Formats the records queued by PublishRecord(), appends the text to the
+  // queue of each subscriber, and writes as much of each queue as can be
+  // written without blocking. Detaches any subscriber whose queue would
+  // overflow, or whose fd returns an error.
+  void FlushSubscribers();
+
+  // Writes as much of |subscriber|'s queue as can be written without
+  // blocking. Returns false if |subscriber| should be detached.
+  bool WriteToSubscriber(NONNULL Subscriber* subscriber);
+
+  // Maps the shared ring in |ring_fd|, as described by the
+  // protocol::SharedRingRegistration in |command_buffer|, and drains
+  // any records already in the ring. Returns true if the ring was
+  // registered.
+  bool RegisterSharedRing(NONNULL const void* command_buffer,
+                          size_t command_len,
+                          ::android::base::unique_fd ring_fd);
+
+  // Checks the sequence number of |command_buffer| (an AsciiMessage
+  // command) for gaps, and counts any messages that went missing.
+  void TrackSequenceNum(NONNULL const void* command_buffer,
+                        size_t command_len);
+
+  // Records the latency of the command in |command_buffer|, from the time
+  // the client sent it (per Command::src_boottime_nsec), to |boottime|.
+  void RecordLatency(NONNULL const void* command_buffer, size_t command_len,
+                     const Os::Timestamp& boottime);
+
+  // Returns the index of the log buffer which should hold the command in
+  // |command_buffer|.
+  size_t GetLogBufferIndexFor(NONNULL const void* command_buffer,
+                              size_t command_len) const;
+
+  // The LogBuffers are owned directly, since there's not much value to
+  // mocking simple data objects. See Testing on the Toilet Episode 173.
   //
-  // Note that the messages in |current_log_buffer_| have not been validated,
+  // Note that the messages in |log_buffers_| have not been validated,
   // expect to ensure that:
   // a) each message starts with a TimestampHeader, and
   // b) each message is large enough for a protocol::Command to follow the
   //    TimestampHeader,and
-  // c) the protocol::Command::opcode for each message is a supported opcode.
-  MessageBuffer current_log_buffer_;
+  // c) the protocol::Command::opcode for each message is a supported opcode
+  //    (or protocol::Opcode::kRepeatedMessage, for a record which we
+  //    wrote).
+  //
+  // To save space, a message whose tag is interned in |tag_table_| is
+  // stored without the bytes of its tag. Such a message has the ID of its
+  // tag, plus one, in protocol::Command::reserved. For other messages,
+  // protocol::Command::reserved is zero.
+  std::array<std::unique_ptr<LogBuffer>, kNumLogBuffers> log_buffers_;
+  // Indexed as |log_buffers_|. Records recovered from a backing file are
+  // not indexed, so queries read them all.
+  std::array<TimeIndex, kNumLogBuffers> time_indexes_;
+  // False if the log buffers persist, in which case no tags are interned.
+  const bool intern_tags_;
+  // Holds a reference for each message in |log_buffers_| with an interned
+  // tag.
+  TagTable tag_table_;
+  // The number of tag bytes omitted from the messages in |log_buffers_|.
+  size_t n_interned_tag_bytes_;
   const std::unique_ptr<Os> os_;
+  Timestamper timestamper_;
+  SequenceTracker sequence_tracker_;
+  // Null unless EnableIngestPolicy() has been called.
+  std::unique_ptr<IngestPolicy> ingest_policy_;
+  bool coalesce_repeats_;
+  // Indexed as |log_buffers_|.
+  std::array<RepeatRun, kNumLogBuffers> repeat_runs_;
+  // Counts for everything but |n_messages_evicted|, which the log buffers
+  // count for us.
+  protocol::Stats stats_;
+  OpcodeLatencies latencies_;
+  // Must be declared after |os_|, so that the worker stops before |os_| is
+  // destroyed.
+  DumpWorker dump_worker_;
+  // Ordered from oldest to newest registration.
+  std::vector<SharedRing> shared_rings_;
+  // True if the last drain left records in some ring.
+  bool shared_rings_pending_;
+  // Ordered from oldest to newest subscription.
+  std::vector<Subscriber> subscribers_;
+  // Records which have yet to be written to |subscribers_|, in the format
+  // described for DumpWorker. Empty unless there are subscribers.
+  std::vector<uint8_t> unpublished_records_;
 
   DISALLOW_COPY_AND_ASSIGN(CommandProcessor);
 };
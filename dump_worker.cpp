@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <utility>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/dump_worker.h"
+#include "wifilogd/log_formatter.h"
+#include "wifilogd/memory_reader.h"
+#include "wifilogd/profiler.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+
+using ::android::base::unique_fd;
+
+constexpr size_t DumpWorker::kMaxPendingDumps;
+
+namespace {
+
+constexpr int64_t kNsecPerUsec = 1000;
+constexpr int64_t kNsecPerSec = 1000 * 1000 * 1000;
+
+static_assert(log_formatter::kMaxFormattedRecordLen <=
+                  BufferedWriter::kBufferSizeBytes,
+              "a formatted record might not fit in the BufferedWriter");
+static_assert(log_formatter::kMaxFormattedStatsLen <=
+                  BufferedWriter::kBufferSizeBytes,
+              "formatted stats might not fit in the BufferedWriter");
+static_assert(log_formatter::kMaxFormattedCursorLen <=
+                  BufferedWriter::kBufferSizeBytes,
+              "a formatted cursor might not fit in the BufferedWriter");
+static_assert(log_formatter::kMaxFormattedLatencyLen <=
+                  BufferedWriter::kBufferSizeBytes,
+              "a formatted latency might not fit in the BufferedWriter");
+static_assert(log_formatter::kMaxFormattedStageProfileLen <=
+                  BufferedWriter::kBufferSizeBytes,
+              "a formatted profile might not fit in the BufferedWriter");
+
+// Logs the throughput of a dump which started at |start_time|, and has
+// written |n_bytes| via |os|.
+void LogDumpThroughput(NONNULL const Os* os, const Os::Timestamp& start_time,
+                       size_t n_bytes) {
+  const int64_t elapsed_nsec =
+      os->GetTimestamp(CLOCK_MONOTONIC).ToNsec() - start_time.ToNsec();
+  if (n_bytes && elapsed_nsec > 0) {
+    LOG(INFO) << "Dumped " << n_bytes << " bytes in "
+              << elapsed_nsec / kNsecPerUsec << " usec ("
+              << n_bytes * kNsecPerSec / elapsed_nsec << " bytes/sec)";
+  }
+}
+
+// Calls |consume| with each record in |snapshot|, as a MemoryReader. Stops,
+// and returns false, if |consume| returns false. Otherwise, returns true.
+template <typename ConsumerT>
+bool ConsumeSnapshotRecords(const std::vector<uint8_t>& snapshot,
+                            ConsumerT consume) {
+  MemoryReader snapshot_reader(snapshot.data(), snapshot.size());
+  while (snapshot_reader) {
+    const auto record_len = snapshot_reader.CopyOutOrDie<uint16_t>();
+    if (!consume(MemoryReader(snapshot_reader.GetBytesOrDie(record_len),
+                              record_len))) {
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+DumpWorker::DumpWorker(Os* os)
+    : os_(os),
+      mutex_(),
+      work_available_(),
+      dump_completed_(),
+      dumps_(),
+      stopping_(false),
+      thread_() {}
+
+DumpWorker::~DumpWorker() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  work_available_.notify_one();
+  if (thread_.joinable()) {
+    thread_.join();
+  }
+}
+
+bool DumpWorker::CanEnqueue() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  return dumps_.size() < kMaxPendingDumps;
+}
+
+void DumpWorker::Enqueue(std::vector<uint8_t> snapshot,
+                         const protocol::Stats& stats,
+                         const OpcodeLatencies& latencies, unique_fd dump_fd,
+                         Format format) {
+  CHECK(format != Format::kTextSince);
+  EnqueueDump({std::move(snapshot), stats, latencies, std::move(dump_fd),
+               format, Cursor()});
+}
+
+void DumpWorker::EnqueueSince(std::vector<uint8_t> snapshot,
+                              const Cursor& cursor, unique_fd dump_fd) {
+  EnqueueDump({std::move(snapshot), protocol::Stats(), OpcodeLatencies(),
+               std::move(dump_fd), Format::kTextSince, cursor});
+}
+
+void DumpWorker::WaitUntilIdle() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  dump_completed_.wait(lock, [this]() { return dumps_.empty(); });
+}
+
+// Private methods below.
+
+void DumpWorker::EnqueueDump(Dump dump) {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    CHECK(dumps_.size() < kMaxPendingDumps);
+    dumps_.push_back(std::move(dump));
+    if (!thread_.joinable()) {
+      thread_ = std::thread(&DumpWorker::Run, this);
+    }
+  }
+  work_available_.notify_one();
+}
+
+void DumpWorker::Run() {
+  std::unique_lock<std::mutex> lock(mutex_);
+  while (true) {
+    work_available_.wait(lock,
+                         [this]() { return stopping_ || !dumps_.empty(); });
+    if (dumps_.empty()) {
+      return;
+    }
+
+    // The main thread only appends to |dumps_|, which leaves references to
+    // existing elements valid. So we can write the dump without holding
+    // the lock.
+    const Dump& dump = dumps_.front();
+    lock.unlock();
+    if (!WriteDump(dump)) {
+      LOG(ERROR) << "Terminating log dump";
+    }
+    lock.lock();
+    dumps_.pop_front();  // Closes the dump's fd.
+    dump_completed_.notify_all();
+  }
+}
+
+bool DumpWorker::WriteDump(const Dump& dump) {
+  const Os::Timestamp start_time = os_->GetTimestamp(CLOCK_MONOTONIC);
+  BufferedWriter writer(os_, dump.fd);
+  bool wrote_all_records = false;
+  switch (dump.format) {
+    case Format::kText:
+      wrote_all_records = WriteStats(dump.stats, dump.latencies, &writer) &&
+                          WriteText(dump.snapshot, &writer);
+      break;
+    case Format::kBinary:
+      wrote_all_records = WriteBinary(dump.stats, dump.snapshot, &writer);
+      break;
+    case Format::kStats:
+      wrote_all_records = WriteStats(dump.stats, dump.latencies, &writer);
+      break;
+    case Format::kTextSince:
+      wrote_all_records = WriteCursor(dump.cursor, &writer) &&
+                          WriteText(dump.snapshot, &writer);
+      break;
+  }
+  if (!wrote_all_records || !writer.Flush()) {
+    return false;
+  }
+
+  LogDumpThroughput(os_, start_time, writer.GetBytesWritten());
+  return true;
+}
+
+bool DumpWorker::WriteStats(const protocol::Stats& stats,
+                            const OpcodeLatencies& latencies,
+                            BufferedWriter* writer) {
+  uint8_t* line_start = writer->Reserve(log_formatter::kMaxFormattedStatsLen);
+  if (!line_start) {
+    return false;
+  }
+  const char* line_end =
+      log_formatter::FormatStats(stats, reinterpret_cast<char*>(line_start));
+  writer->Commit(reinterpret_cast<const uint8_t*>(line_end) - line_start);
+
+  for (const auto& opcode_and_histogram : latencies) {
+    line_start = writer->Reserve(log_formatter::kMaxFormattedLatencyLen);
+    if (!line_start) {
+      return false;
+    }
+    line_end = log_formatter::FormatLatency(
+        opcode_and_histogram.first, opcode_and_histogram.second,
+        reinterpret_cast<char*>(line_start));
+    writer->Commit(reinterpret_cast<const uint8_t*>(line_end) - line_start);
+  }
+
+#if defined(WIFILOGD_PROFILING)
+  const Profiler* const profiler = Profiler::GetInstance();
+  for (size_t i = 0; i < kNumProfiledStages; ++i) {
+    const auto stage = static_cast<ProfiledStage>(i);
+    line_start = writer->Reserve(log_formatter::kMaxFormattedStageProfileLen);
+    if (!line_start) {
+      return false;
+    }
+    line_end = log_formatter::FormatStageProfile(
+        stage, profiler->GetStageProfile(stage),
+        reinterpret_cast<char*>(line_start));
+    writer->Commit(reinterpret_cast<const uint8_t*>(line_end) - line_start);
+  }
+#endif
+  return true;
+}
+
+bool DumpWorker::WriteCursor(const Cursor& cursor, BufferedWriter* writer) {
+  for (size_t i = 0; i < cursor.size(); ++i) {
+    uint8_t* const line_start =
+        writer->Reserve(log_formatter::kMaxFormattedCursorLen);
+    if (!line_start) {
+      return false;
+    }
+    const char* const line_end = log_formatter::FormatCursor(
+        i, cursor[i].next_record, cursor[i].n_missed,
+        reinterpret_cast<char*>(line_start));
+    writer->Commit(reinterpret_cast<const uint8_t*>(line_end) - line_start);
+  }
+  return true;
+}
+
+bool DumpWorker::WriteText(const std::vector<uint8_t>& snapshot,
+                           BufferedWriter* writer) {
+  return ConsumeSnapshotRecords(snapshot, [writer](MemoryReader record) {
+    // Format the line directly into the writer's buffer, so that the
+    // cost of formatting scales with the size of the output, rather
+    // than with the number of allocations.
+    uint8_t* const line_start =
+        writer->Reserve(log_formatter::kMaxFormattedRecordLen);
+    if (!line_start) {
+      return false;
+    }
+
+    WIFILOGD_PROFILE_SCOPE(ProfiledStage::kDumpFormat);
+    const char* const line_end = log_formatter::FormatRecord(
+        record, reinterpret_cast<char*>(line_start));
+    writer->Commit(reinterpret_cast<const uint8_t*>(line_end) - line_start);
+    return true;
+  });
+}
+
+bool DumpWorker::WriteBinary(const protocol::Stats& stats,
+                             const std::vector<uint8_t>& snapshot,
+                             BufferedWriter* writer) {
+  const auto preamble = protocol::BinaryDumpPreamble()
+                            .set_magic(protocol::kBinaryDumpMagic)
+                            .set_version(protocol::kBinaryDumpVersion);
+  // The records in a snapshot are already framed as the binary format
+  // requires. Formatting is left to the reader (see binary_dump_decoder.h).
+  return writer->Append(&preamble, sizeof(preamble)) &&
+         writer->Append(&stats, sizeof(stats)) &&
+         (snapshot.empty() ||
+          writer->Append(snapshot.data(), snapshot.size()));
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,158 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef DUMP_WORKER_H_
+#define DUMP_WORKER_H_
+
+#include <array>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "android-base/macros.h"
+#include "android-base/unique_fd.h"
+
+#include "wifilogd/buffered_writer.h"
+#include "wifilogd/latency_histogram.h"
+#include "wifilogd/local_utils.h"
+#include "wifilogd/os.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+
+// Formats and writes log dumps on a dedicated thread, so that a slow
+// reader does not keep the main loop from receiving messages.
+//
+// Each dump works from a snapshot: a copy of the logged records, taken on
+// the main thread when the dump was requested. Records logged (or evicted)
+// after that point do not affect the dump. A snapshot is a sequence of
+// records, each preceded by its length as a uint16_t, in host byte order.
+// (This is the same framing as the records in a binary dump.) Each dump
+// also carries the protocol::Stats and command latencies at the time of the
+// snapshot, which are written ahead of the records.
+//
+// The thread is started when the first dump is enqueued. The user must
+// ensure that |os| outlives the DumpWorker.
+class DumpWorker {
+ public:
+  // kStats writes only the stats line, which begins every text dump.
+  // kTextSince writes the lines for a Cursor, followed by the records.
+  enum class Format { kText, kBinary, kStats, kTextSince };
+
+  // The position of a kTextSince dump in one log buffer, as described for
+  // protocol::DumpCursor.
+  struct CursorPosition {
+    uint64_t next_record;
+    uint64_t n_missed;
+  };
+  using Cursor = std::array<CursorPosition, protocol::kNumDumpCursorBuffers>;
+
+  // The maximal number of dumps which may be queued or running at once.
+  // Each dump holds its own snapshot, so this bounds the memory used for
+  // snapshots.
+  static constexpr size_t kMaxPendingDumps = 4;
+
+  explicit DumpWorker(NONNULL Os* os);
+
+  // Finishes any pending dumps, and then stops the thread.
+  ~DumpWorker();
+
+  // Returns true if another dump may be enqueued.
+  bool CanEnqueue() const;
+
+  // Queues a dump of |stats|, |latencies| and |snapshot| to |dump_fd|, in
+  // |format|. CanEnqueue() must be true. |dump_fd| is closed once the dump
+  // completes.
+  void Enqueue(std::vector<uint8_t> snapshot, const protocol::Stats& stats,
+               const OpcodeLatencies& latencies,
+               ::android::base::unique_fd dump_fd, Format format);
+
+  // Queues a kTextSince dump of |cursor| and |snapshot| to |dump_fd|.
+  // CanEnqueue() must be true. |dump_fd| is closed once the dump completes.
+  void EnqueueSince(std::vector<uint8_t> snapshot, const Cursor& cursor,
+                    ::android::base::unique_fd dump_fd);
+
+  // Blocks until all of the enqueued dumps have completed.
+  void WaitUntilIdle();
+
+ private:
+  struct Dump {
+    std::vector<uint8_t> snapshot;
+    protocol::Stats stats;
+    OpcodeLatencies latencies;
+    ::android::base::unique_fd fd;
+    Format format;
+    Cursor cursor;  // Used only for kTextSince.
+  };
+
+  // Queues |dump|, and starts |thread_| if need be.
+  void EnqueueDump(Dump dump);
+
+  // The body of |thread_|. Runs dumps until |stopping_| is set, and no
+  // dumps remain.
+  void Run();
+
+  // Writes |dump|. Returns true unless an unrecoverable error was
+  // encountered.
+  bool WriteDump(const Dump& dump);
+
+  // Writes |stats| to |writer|, as a single line of text, followed by a
+  // line for each histogram in |latencies|. Profiling builds also write a
+  // line for each ProfiledStage.
+  static bool WriteStats(const protocol::Stats& stats,
+                         const OpcodeLatencies& latencies,
+                         NONNULL BufferedWriter* writer);
+
+  // Writes a line for each log buffer's position in |cursor| to |writer|.
+  static bool WriteCursor(const Cursor& cursor,
+                          NONNULL BufferedWriter* writer);
+
+  // Writes the records in |snapshot| to |writer|, as text.
+  static bool WriteText(const std::vector<uint8_t>& snapshot,
+                        NONNULL BufferedWriter* writer);
+
+  // Writes |stats|, and the records in |snapshot|, to |writer|, in the
+  // binary format described for protocol::kBinaryDumpVersion. (The binary
+  // format does not include latencies. Those can be recomputed from the
+  // records, which include both Command::src_boottime_nsec and the time at
+  // which the command was logged.)
+  static bool WriteBinary(const protocol::Stats& stats,
+                          const std::vector<uint8_t>& snapshot,
+                          NONNULL BufferedWriter* writer);
+
+  Os* const os_;  // non-owned
+  mutable std::mutex mutex_;
+  // Signalled when a dump is queued, or when |stopping_| is set.
+  std::condition_variable work_available_;
+  // Signalled when a dump completes.
+  std::condition_variable dump_completed_;
+  // Guarded by |mutex_|. The dump at the front is the one being written,
+  // if any.
+  std::deque<Dump> dumps_;
+  bool stopping_;  // Guarded by |mutex_|.
+  std::thread thread_;
+
+  DISALLOW_COPY_AND_ASSIGN(DumpWorker);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // DUMP_WORKER_H_
@@ -0,0 +1,213 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <string>
+#include <utility>
+
+#include "wifilogd/ingest_policy.h"
+
+namespace android {
+namespace wifilogd {
+
+using protocol::MessageSeverity;
+
+constexpr int64_t IngestPolicy::kTagBurstMessages;
+constexpr int64_t IngestPolicy::kTagMessagesPerSec;
+constexpr size_t IngestPolicy::kNumSeverities;
+constexpr std::array<int64_t, IngestPolicy::kNumSeverities>
+    IngestPolicy::kSeverityMessagesPerSec;
+constexpr size_t IngestPolicy::kMaxTrackedTags;
+constexpr char IngestPolicy::kOtherTagsName[];
+constexpr int64_t IngestPolicy::kLoadWindowNsec;
+constexpr size_t IngestPolicy::kHighLoadMessagesPerWindow;
+constexpr size_t IngestPolicy::kLowLoadMessagesPerWindow;
+constexpr int64_t IngestPolicy::kSummaryIntervalNsec;
+
+namespace {
+
+constexpr int64_t kNsecPerSec = 1000 * 1000 * 1000;
+constexpr int64_t kTagCostNsec = kNsecPerSec / IngestPolicy::kTagMessagesPerSec;
+constexpr int64_t kTagCapacityNsec =
+    IngestPolicy::kTagBurstMessages * kTagCostNsec;
+static_assert(
+    IngestPolicy::kNumSeverities ==
+        local_utils::CastEnumToInteger(MessageSeverity::kDump) + 1,
+    "there must be one token bucket per MessageSeverity");
+// Load never suppresses messages this severe, or more so.
+constexpr auto kMaxMinSeverity =
+    local_utils::CastEnumToInteger(MessageSeverity::kWarning);
+constexpr auto kMinMinSeverity =
+    local_utils::CastEnumToInteger(MessageSeverity::kDump);
+
+// Returns the 64-bit FNV-1a hash of |len| bytes at |data|.
+uint64_t HashTag(const uint8_t* data, size_t len) {
+  constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+  constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+  uint64_t hash = kFnvOffsetBasis;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ data[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+// Returns the index of |severity| in the per-severity arrays. Unknown
+// severities are treated as kInformational.
+size_t GetSeverityIndex(MessageSeverity severity) {
+  const auto index = local_utils::CastEnumToInteger(severity);
+  return index < IngestPolicy::kNumSeverities
+             ? index
+             : local_utils::CastEnumToInteger(MessageSeverity::kInformational);
+}
+
+// Returns the credit that one message takes from the bucket for
+// |severity_index|.
+int64_t GetSeverityCostNsec(size_t severity_index) {
+  return kNsecPerSec / IngestPolicy::kSeverityMessagesPerSec[severity_index];
+}
+
+}  // namespace
+
+IngestPolicy::IngestPolicy()
+    : tag_states_(),
+      other_tags_state_{kOtherTagsName, {kTagCapacityNsec, 0}, 0},
+      severity_buckets_(),
+      min_severity_(MessageSeverity::kDump),
+      load_window_start_nsec_(0),
+      n_messages_in_load_window_(0),
+      next_summary_nsec_(0),
+      n_unsummarized_(0),
+      n_suppressed_(0) {
+  tag_states_.reserve(kMaxTrackedTags);
+  for (size_t i = 0; i < kNumSeverities; ++i) {
+    severity_buckets_[i] = {
+        kSeverityMessagesPerSec[i] * GetSeverityCostNsec(i), 0};
+  }
+}
+
+bool IngestPolicy::Admit(const uint8_t* tag, size_t tag_len,
+                         MessageSeverity severity, int64_t now_nsec) {
+  UpdateLoad(now_nsec);
+  TagState* const tag_state = GetTagState(tag, tag_len, now_nsec);
+  const size_t severity_index = GetSeverityIndex(severity);
+  if (severity_index > local_utils::CastEnumToInteger(min_severity_)) {
+    Suppress(tag_state);
+    return false;
+  }
+
+  // Check both buckets before taking from either, so that a message which
+  // is suppressed does not use up the other bucket's tokens.
+  TokenBucket* const severity_bucket = &severity_buckets_[severity_index];
+  const int64_t severity_cost_nsec = GetSeverityCostNsec(severity_index);
+  Refill(severity_bucket,
+         kSeverityMessagesPerSec[severity_index] * severity_cost_nsec,
+         now_nsec);
+  Refill(&tag_state->bucket, kTagCapacityNsec, now_nsec);
+  if (severity_bucket->credit_nsec < severity_cost_nsec ||
+      tag_state->bucket.credit_nsec < kTagCostNsec) {
+    Suppress(tag_state);
+    return false;
+  }
+  severity_bucket->credit_nsec -= severity_cost_nsec;
+  tag_state->bucket.credit_nsec -= kTagCostNsec;
+  return true;
+}
+
+std::vector<IngestPolicy::Suppression> IngestPolicy::TakeSummaries(
+    int64_t now_nsec) {
+  std::vector<Suppression> summaries;
+  for (auto& hash_and_state : tag_states_) {
+    TagState& tag_state = hash_and_state.second;
+    if (tag_state.n_suppressed) {
+      summaries.push_back({tag_state.tag, tag_state.n_suppressed});
+      tag_state.n_suppressed = 0;
+    }
+  }
+  std::sort(summaries.begin(), summaries.end(),
+            [](const Suppression& a, const Suppression& b) {
+              return a.tag < b.tag;
+            });
+  if (other_tags_state_.n_suppressed) {
+    summaries.push_back(
+        {other_tags_state_.tag, other_tags_state_.n_suppressed});
+    other_tags_state_.n_suppressed = 0;
+  }
+  n_unsummarized_ = 0;
+  next_summary_nsec_ = now_nsec + kSummaryIntervalNsec;
+  return summaries;
+}
+
+// Private methods below.
+
+void IngestPolicy::Refill(TokenBucket* bucket, int64_t capacity_nsec,
+                          int64_t now_nsec) {
+  const int64_t elapsed_nsec = now_nsec - bucket->last_refill_nsec;
+  if (elapsed_nsec <= 0) {
+    return;
+  }
+  bucket->credit_nsec = elapsed_nsec >= capacity_nsec - bucket->credit_nsec
+                            ? capacity_nsec
+                            : bucket->credit_nsec + elapsed_nsec;
+  bucket->last_refill_nsec = now_nsec;
+}
+
+void IngestPolicy::UpdateLoad(int64_t now_nsec) {
+  const int64_t elapsed_nsec = now_nsec - load_window_start_nsec_;
+  if (elapsed_nsec >= kLoadWindowNsec) {
+    auto min_severity = local_utils::CastEnumToInteger(min_severity_);
+    // If a whole window passed without messages, load is clearly low.
+    const bool window_was_quiet = elapsed_nsec >= 2 * kLoadWindowNsec;
+    if (!window_was_quiet &&
+        n_messages_in_load_window_ > kHighLoadMessagesPerWindow &&
+        min_severity > kMaxMinSeverity) {
+      --min_severity;
+    } else if ((window_was_quiet ||
+                n_messages_in_load_window_ < kLowLoadMessagesPerWindow) &&
+               min_severity < kMinMinSeverity) {
+      ++min_severity;
+    }
+    min_severity_ = static_cast<MessageSeverity>(min_severity);
+    load_window_start_nsec_ = now_nsec;
+    n_messages_in_load_window_ = 0;
+  }
+  ++n_messages_in_load_window_;
+}
+
+IngestPolicy::TagState* IngestPolicy::GetTagState(const uint8_t* tag,
+                                                  size_t tag_len,
+                                                  int64_t now_nsec) {
+  const uint64_t tag_hash = HashTag(tag, tag_len);
+  const auto it = tag_states_.find(tag_hash);
+  if (it != tag_states_.end()) {
+    return &it->second;
+  }
+  if (tag_states_.size() == kMaxTrackedTags) {
+    return &other_tags_state_;
+  }
+  TagState new_state{std::string(reinterpret_cast<const char*>(tag), tag_len),
+                     {kTagCapacityNsec, now_nsec},
+                     0};
+  return &tag_states_.emplace(tag_hash, std::move(new_state)).first->second;
+}
+
+void IngestPolicy::Suppress(TagState* tag_state) {
+  ++tag_state->n_suppressed;
+  ++n_unsummarized_;
+  ++n_suppressed_;
+}
+
+}  // namespace wifilogd
+}  // namespace android
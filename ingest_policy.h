@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef INGEST_POLICY_H_
+#define INGEST_POLICY_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+
+// Decides, as each message arrives, whether the message is worth logging.
+// This keeps a writer which floods us with messages from evicting the
+// messages of every other writer, and lets us reject such messages before
+// paying to timestamp and copy them.
+//
+// A message is suppressed if
+// a) its severity is below the current minimal severity, or
+// b) its tag has exhausted its token bucket, or
+// c) its severity has exhausted its token bucket.
+//
+// The minimal severity adapts to load: while more than
+// kHighLoadMessagesPerWindow messages arrive per kLoadWindowNsec, the least
+// important severity still admitted stops being admitted, one severity per
+// window. Once load falls below kLowLoadMessagesPerWindow, severities are
+// readmitted in the same way. kError and kWarning messages are never
+// suppressed on this basis.
+//
+// Suppressed messages are counted for each tag, so that the user can be
+// told what was lost (see TakeSummaries()).
+//
+// As in SequenceTracker, tags are identified by a 64-bit hash.
+class IngestPolicy {
+ public:
+  // The number of messages a tag may send at once, and the rate at which
+  // the tag may send messages after that.
+  static constexpr int64_t kTagBurstMessages = 200;
+  static constexpr int64_t kTagMessagesPerSec = 100;
+  // As above, for all of the messages of each severity. Indexed by
+  // protocol::MessageSeverity. The burst for each severity is one second
+  // of messages.
+  static constexpr size_t kNumSeverities = 5;
+  static constexpr std::array<int64_t, kNumSeverities> kSeverityMessagesPerSec{
+      {1000, 1000, 2000, 2000, 1000}};
+  // The maximal number of tags which are tracked separately. Once this
+  // many tags are tracked, the messages of any other tag share a single
+  // token bucket, and are summarized under kOtherTagsName.
+  static constexpr size_t kMaxTrackedTags = 128;
+  static constexpr char kOtherTagsName[] = "<other tags>";
+  // The period over which load is measured, and the thresholds at which
+  // the minimal severity is raised or lowered.
+  static constexpr int64_t kLoadWindowNsec = 1000 * 1000 * 1000;
+  static constexpr size_t kHighLoadMessagesPerWindow = 4000;
+  static constexpr size_t kLowLoadMessagesPerWindow = 1000;
+  // The minimal time between summaries of suppressed messages.
+  static constexpr int64_t kSummaryIntervalNsec = 5LL * 1000 * 1000 * 1000;
+
+  // The count of messages suppressed for one tag.
+  struct Suppression {
+    std::string tag;
+    uint64_t n_suppressed;
+  };
+
+  IngestPolicy();
+
+  // Returns true if a message with the |tag_len| bytes at |tag|, and with
+  // |severity|, should be logged. |now_nsec| is the time at which the
+  // message arrived, per CLOCK_MONOTONIC. A message with an unknown severity
+  // is treated as kInformational (as it would be logged).
+  bool Admit(NONNULL const uint8_t* tag, size_t tag_len,
+             protocol::MessageSeverity severity, int64_t now_nsec);
+
+  // Returns true if messages have been suppressed since the last summary,
+  // and the last summary was at least kSummaryIntervalNsec before
+  // |now_nsec|.
+  bool IsSummaryDue(int64_t now_nsec) const {
+    return n_unsummarized_ && now_nsec >= next_summary_nsec_;
+  }
+
+  // Returns the counts of messages suppressed since the last summary, for
+  // each tag with suppressed messages, in order of tag. Resets the counts.
+  std::vector<Suppression> TakeSummaries(int64_t now_nsec);
+
+  // Returns the number of messages suppressed over the life of this
+  // IngestPolicy.
+  uint64_t GetNumSuppressed() const { return n_suppressed_; }
+
+  // Returns the least important severity which is currently admitted.
+  protocol::MessageSeverity GetMinSeverity() const { return min_severity_; }
+
+ private:
+  // A token bucket, which holds its tokens as the time over which those
+  // tokens would accrue. This keeps the arithmetic in integers.
+  struct TokenBucket {
+    int64_t credit_nsec;
+    int64_t last_refill_nsec;
+  };
+
+  struct TagState {
+    std::string tag;
+    TokenBucket bucket;
+    uint64_t n_suppressed;
+  };
+
+  // Adds the credit that |bucket| accrued between its last refill and
+  // |now_nsec|, up to |capacity_nsec|.
+  static void Refill(NONNULL TokenBucket* bucket, int64_t capacity_nsec,
+                     int64_t now_nsec);
+
+  // Counts a message which arrived at |now_nsec|, and adjusts
+  // |min_severity_| if a load window has ended.
+  void UpdateLoad(int64_t now_nsec);
+
+  // Returns the state for the given tag, adding the tag if possible.
+  TagState* GetTagState(NONNULL const uint8_t* tag, size_t tag_len,
+                        int64_t now_nsec);
+
+  // Counts a message from |tag_state| which was suppressed.
+  void Suppress(NONNULL TagState* tag_state);
+
+  std::unordered_map<uint64_t, TagState> tag_states_;
+  TagState other_tags_state_;
+  std::array<TokenBucket, kNumSeverities> severity_buckets_;
+  protocol::MessageSeverity min_severity_;
+  int64_t load_window_start_nsec_;
+  size_t n_messages_in_load_window_;
+  int64_t next_summary_nsec_;
+  uint64_t n_unsummarized_;
+  uint64_t n_suppressed_;
+
+  DISALLOW_COPY_AND_ASSIGN(IngestPolicy);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // INGEST_POLICY_H_
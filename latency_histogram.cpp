@@ -0,0 +1,90 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/latency_histogram.h"
+
+namespace android {
+namespace wifilogd {
+
+constexpr size_t LatencyHistogram::kNumBuckets;
+
+namespace {
+
+constexpr uint64_t kNsecPerUsec = 1000;
+constexpr unsigned int kMaxPercentile = 100;
+
+static_assert(LatencyHistogram::kNumBuckets < 64,
+              "bucket limits must fit in a uint64_t");
+
+}  // namespace
+
+LatencyHistogram::LatencyHistogram()
+    : bucket_counts_(), n_samples_(0), max_nsec_(0) {}
+
+void LatencyHistogram::Record(uint64_t latency_nsec) {
+  ++bucket_counts_[GetBucketFor(latency_nsec)];
+  ++n_samples_;
+  max_nsec_ = std::max(max_nsec_, latency_nsec);
+}
+
+uint64_t LatencyHistogram::GetBucketCount(size_t bucket) const {
+  CHECK(bucket < kNumBuckets);
+  return bucket_counts_[bucket];
+}
+
+uint64_t LatencyHistogram::GetPercentileNsec(unsigned int percentile) const {
+  CHECK(percentile <= kMaxPercentile);
+  if (!n_samples_) {
+    return 0;
+  }
+
+  // The rank of the sample at |percentile|, counting from 1. (Round up, so
+  // that, e.g., the 99th percentile of 10 samples is the last sample.)
+  const uint64_t rank = std::max<uint64_t>(
+      1, (n_samples_ * percentile + kMaxPercentile - 1) / kMaxPercentile);
+  uint64_t n_samples_seen = 0;
+  for (size_t i = 0; i < kNumBuckets - 1; ++i) {
+    n_samples_seen += bucket_counts_[i];
+    if (n_samples_seen >= rank) {
+      return std::min(GetBucketLimitNsec(i), max_nsec_);
+    }
+  }
+  return max_nsec_;
+}
+
+uint64_t LatencyHistogram::GetBucketLimitNsec(size_t bucket) {
+  CHECK(bucket < kNumBuckets - 1);
+  return (uint64_t{1} << bucket) * kNsecPerUsec;
+}
+
+// Private methods below.
+
+size_t LatencyHistogram::GetBucketFor(uint64_t latency_nsec) {
+  uint64_t latency_usec = latency_nsec / kNsecPerUsec;
+  size_t bucket = 0;
+  while (latency_usec && bucket < kNumBuckets - 1) {
+    latency_usec >>= 1;
+    ++bucket;
+  }
+  return bucket;
+}
+
+}  // namespace wifilogd
+}  // namespace android
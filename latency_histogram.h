@@ -0,0 +1,75 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LATENCY_HISTOGRAM_H_
+#define LATENCY_HISTOGRAM_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+
+// Counts latency samples in log-scale buckets, so that the histogram has
+// a fixed size, no matter how many samples are recorded.
+//
+// Bucket 0 counts latencies under 1 usec. Bucket i (for i > 0) counts
+// latencies of at least 2^(i-1) usec, and under 2^i usec. The last bucket
+// also counts everything longer.
+class LatencyHistogram {
+ public:
+  static constexpr size_t kNumBuckets = 32;
+
+  LatencyHistogram();
+
+  void Record(uint64_t latency_nsec);
+
+  // Returns the number of samples counted in |bucket|.
+  uint64_t GetBucketCount(size_t bucket) const;
+
+  uint64_t GetNumSamples() const { return n_samples_; }
+  uint64_t GetMaxNsec() const { return max_nsec_; }
+
+  // Returns an upper bound for the |percentile|-th percentile of the
+  // recorded latencies. The bound is the limit of the bucket holding that
+  // percentile, or the maximal latency, whichever is smaller. Returns zero
+  // if no samples have been recorded. |percentile| must be at most 100.
+  uint64_t GetPercentileNsec(unsigned int percentile) const;
+
+  // Returns the (exclusive) upper limit of the latencies counted in
+  // |bucket|, other than the last one.
+  static uint64_t GetBucketLimitNsec(size_t bucket);
+
+ private:
+  // Returns the bucket which counts |latency_nsec|.
+  static size_t GetBucketFor(uint64_t latency_nsec);
+
+  std::array<uint64_t, kNumBuckets> bucket_counts_;
+  uint64_t n_samples_;
+  uint64_t max_nsec_;
+};
+
+// Latency histograms, keyed by the opcode of the commands measured.
+using OpcodeLatencies = std::map<protocol::Opcode, LatencyHistogram>;
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // LATENCY_HISTOGRAM_H_
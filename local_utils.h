@@ -19,6 +19,8 @@
 #ifndef LOCAL_UTILS_H_
 #define LOCAL_UTILS_H_
 
+#include <cstddef>
+#include <cstdint>
 #include <limits>
 #include <type_traits>
 
@@ -105,6 +107,67 @@ inline bool IsAsciiPrintable(uint8_t c) {
   return (c == '\t' || c == '\n' || (c >= ' ' && c <= '~'));
 }
 
+// The maximal number of characters written by FormatDecimal().
+constexpr size_t kMaxFormattedDecimalLen = 10;  // "4294967295"
+
+// The maximal number of characters written by FormatDecimal64().
+constexpr size_t kMaxFormattedDecimal64Len = 20;  // "18446744073709551615"
+
+namespace internal {
+
+// Implements FormatDecimal() and FormatDecimal64(). |MaxLen| must be the
+// number of digits in the largest value of |T|.
+template <typename T, size_t MaxLen>
+char* FormatDecimal(T value, NONNULL char* out) {
+  static_assert(std::is_unsigned<T>::value, "value must be unsigned");
+  char digits[MaxLen];
+  size_t n_digits = 0;
+  do {
+    digits[n_digits++] = '0' + value % 10;
+    value /= 10;
+  } while (value);
+
+  while (n_digits) {
+    *out++ = digits[--n_digits];
+  }
+  return out;
+}
+
+}  // namespace internal
+
+// Writes the decimal representation of |value| to |out|, without leading
+// zeros, and returns a pointer just past the last character written. |out|
+// must have room for kMaxFormattedDecimalLen characters. No terminating
+// NUL is written.
+//
+// As compared to snprintf(), this avoids parsing a format string, and
+// dealing with locales.
+inline char* FormatDecimal(uint32_t value, NONNULL char* out) {
+  return internal::FormatDecimal<uint32_t, kMaxFormattedDecimalLen>(value,
+                                                                    out);
+}
+
+// As FormatDecimal(), but for 64-bit values. |out| must have room for
+// kMaxFormattedDecimal64Len characters.
+inline char* FormatDecimal64(uint64_t value, NONNULL char* out) {
+  return internal::FormatDecimal<uint64_t, kMaxFormattedDecimal64Len>(value,
+                                                                      out);
+}
+
+// Writes the decimal representation of |value| to |out|, zero-padded to
+// exactly |width| digits, and returns a pointer just past the last character
+// written. If |value| has more than |width| digits, only the low-order
+// |width| digits are written. No terminating NUL is written.
+inline char* FormatZeroPaddedDecimal(uint32_t value, size_t width,
+                                     NONNULL char* out) {
+  char* const end = out + width;
+  for (char* digit = end; digit != out;) {
+    *--digit = '0' + value % 10;
+    value /= 10;
+  }
+  return end;
+}
+
 namespace internal {
 
 // Implements the functionality documented for the SAFELY_CLAMP macro.
@@ -0,0 +1,437 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <utility>
+
+#include "android-base/logging.h"
+#include "lz4.h"
+
+#include "wifilogd/log_buffer.h"
+
+namespace android {
+namespace wifilogd {
+
+using ::android::base::unique_fd;
+using local_utils::CopyFromBufferOrDie;
+
+constexpr size_t LogBuffer::kBlockSizeBytes;
+
+namespace {
+
+// Returns the size of the MessageBuffer which holds the messages (in
+// kUncompressed and kAligned modes), or the sealed blocks (in kCompressed
+// mode), of a LogBuffer of |size| bytes.
+size_t GetSealedBlocksSize(size_t size, LogBuffer::Mode mode) {
+  if (mode != LogBuffer::Mode::kCompressed) {
+    return size;
+  }
+  CHECK(size >= LogBuffer::GetMinCompressedSize());
+  return size - 2 * LogBuffer::kBlockSizeBytes;
+}
+
+// Returns a block of kBlockSizeBytes, or nullptr if |mode| does not use
+// blocks.
+uint8_t* MaybeAllocateBlock(LogBuffer::Mode mode) {
+  return mode == LogBuffer::Mode::kCompressed
+             ? new uint8_t[LogBuffer::kBlockSizeBytes]
+             : nullptr;
+}
+
+// Returns the framing of the MessageBuffer which holds the messages, or
+// the sealed blocks, of a LogBuffer in |mode|.
+MessageBuffer::Framing GetSealedBlocksFraming(LogBuffer::Mode mode) {
+  return mode == LogBuffer::Mode::kAligned ? MessageBuffer::Framing::kAligned
+                                           : MessageBuffer::Framing::kPacked;
+}
+
+}  // namespace
+
+LogBuffer::LogBuffer(size_t size, Mode mode)
+    : LogBuffer(size, mode, unique_fd()) {}
+
+LogBuffer::LogBuffer(size_t size, Mode mode, unique_fd backing_file)
+    : mode_(mode),
+      sealed_blocks_(GetSealedBlocksSize(size, mode), std::move(backing_file),
+                     GetSealedBlocksFraming(mode)),
+      active_block_(MaybeAllocateBlock(mode)),
+      active_block_len_(0),
+      n_active_messages_(0),
+      last_active_offset_(0),
+      reserved_len_(0),
+      scratch_block_(MaybeAllocateBlock(mode)),
+      eviction_block_(scratch_block_.get()),
+      read_block_(nullptr),
+      read_block_compressed_len_(0),
+      read_block_len_(0),
+      scratch_holds_read_block_(false),
+      reading_active_block_(false),
+      read_offset_(0),
+      n_uncompressed_bytes_(0),
+      n_evicted_(0),
+      n_appended_(sealed_blocks_.GetNumRecovered()),
+      eviction_handler_() {
+  if (mode_ == Mode::kCompressed) {
+    // Recovering compressed blocks would require validating their
+    // contents, which is not supported.
+    CHECK(!sealed_blocks_.GetGeneration());
+    CHECK(sealed_blocks_.CanFitEver(sizeof(BlockHeader) + kBlockSizeBytes));
+    sealed_blocks_.SetEvictionHandler(
+        [this](const uint8_t* block, size_t block_len) {
+          EvictBlock(block, block_len);
+        });
+  }
+}
+
+LogBuffer::~LogBuffer() {}
+
+void LogBuffer::SetEvictionHandler(EvictionHandler handler) {
+  if (mode_ != Mode::kCompressed) {
+    sealed_blocks_.SetEvictionHandler(std::move(handler));
+  } else {
+    eviction_handler_ = std::move(handler);
+  }
+}
+
+uint8_t* LogBuffer::Reserve(uint16_t data_len) {
+  if (mode_ != Mode::kCompressed) {
+    return sealed_blocks_.Reserve(data_len);
+  }
+
+  CHECK(data_len);
+  CHECK(!reserved_len_);
+  if (!CanFitEver(data_len)) {
+    return nullptr;
+  }
+  if (kBlockSizeBytes - active_block_len_ < sizeof(LengthHeader) + data_len) {
+    SealActiveBlock();
+  }
+  reserved_len_ = data_len;
+  return active_block_.get() + active_block_len_ + sizeof(LengthHeader);
+}
+
+void LogBuffer::Commit(uint16_t data_len) {
+  if (mode_ != Mode::kCompressed) {
+    sealed_blocks_.Commit(data_len);
+    ++n_appended_;
+    return;
+  }
+
+  CHECK(reserved_len_);
+  CHECK(data_len);
+  CHECK(data_len <= reserved_len_);
+  LengthHeader header;
+  header.payload_len = data_len;
+  std::memcpy(active_block_.get() + active_block_len_, &header,
+              sizeof(header));
+  last_active_offset_ = active_block_len_;
+  active_block_len_ += sizeof(header) + data_len;
+  ++n_active_messages_;
+  ++n_appended_;
+  reserved_len_ = 0;
+}
+
+bool LogBuffer::CanFitEver(uint16_t length) const {
+  if (mode_ != Mode::kCompressed) {
+    return sealed_blocks_.CanFitEver(length);
+  }
+  return kBlockSizeBytes - sizeof(LengthHeader) >= length;
+}
+
+std::tuple<const uint8_t*, size_t> LogBuffer::ConsumeNextMessage() {
+  if (mode_ != Mode::kCompressed) {
+    return sealed_blocks_.ConsumeNextMessage();
+  }
+
+  while (!reading_active_block_) {
+    if (!read_block_) {
+      // Note that |read_offset_| is left as is. It is non-zero only if the
+      // next block was sealed while we were reading it as the active block.
+      std::tie(read_block_, read_block_compressed_len_) =
+          sealed_blocks_.ConsumeNextMessage();
+      scratch_holds_read_block_ = false;
+      if (!read_block_) {
+        reading_active_block_ = true;
+        read_offset_ = 0;
+        break;
+      }
+    }
+    if (!scratch_holds_read_block_) {
+      read_block_len_ = DecodeBlock(read_block_, read_block_compressed_len_,
+                                    scratch_block_.get());
+      scratch_holds_read_block_ = true;
+    }
+    if (read_offset_ < read_block_len_) {
+      return ReadMessage(scratch_block_.get(), read_block_len_, &read_offset_);
+    }
+    read_block_ = nullptr;
+    read_offset_ = 0;
+  }
+
+  if (read_offset_ < active_block_len_) {
+    return ReadMessage(active_block_.get(), active_block_len_, &read_offset_);
+  }
+  return {nullptr, 0};
+}
+
+size_t LogBuffer::ConsumeNextMessages(
+    std::tuple<const uint8_t*, size_t>* messages, size_t max_messages) {
+  if (mode_ != Mode::kCompressed) {
+    return sealed_blocks_.ConsumeNextMessages(messages, max_messages);
+  }
+
+  // Stop at the end of a sealed block, since decompressing the next block
+  // would overwrite the messages already returned.
+  size_t n_messages = 0;
+  while (n_messages < max_messages) {
+    const bool block_has_next =
+        reading_active_block_ ? read_offset_ < active_block_len_
+                              : read_block_ && scratch_holds_read_block_ &&
+                                    read_offset_ < read_block_len_;
+    if (n_messages && !block_has_next) {
+      break;
+    }
+    messages[n_messages] = ConsumeNextMessage();
+    if (!std::get<0>(messages[n_messages])) {
+      break;
+    }
+    ++n_messages;
+  }
+  return n_messages;
+}
+
+uint64_t LogBuffer::SkipMessages(uint64_t n_messages) {
+  uint64_t n_skipped = 0;
+  if (mode_ == Mode::kCompressed) {
+    // Skip whole blocks, using their headers, until the remaining messages
+    // end within a block. (A block that we have started reading, or the
+    // active block, must be skipped message by message.)
+    while (n_skipped < n_messages && !reading_active_block_ && !read_block_ &&
+           !read_offset_) {
+      std::tie(read_block_, read_block_compressed_len_) =
+          sealed_blocks_.ConsumeNextMessage();
+      scratch_holds_read_block_ = false;
+      if (!read_block_) {
+        reading_active_block_ = true;
+        break;
+      }
+      const auto header = CopyFromBufferOrDie<BlockHeader>(
+          read_block_, read_block_compressed_len_);
+      if (header.n_messages > n_messages - n_skipped) {
+        break;
+      }
+      n_skipped += header.n_messages;
+      read_block_ = nullptr;
+    }
+  }
+
+  while (n_skipped < n_messages && std::get<0>(ConsumeNextMessage())) {
+    ++n_skipped;
+  }
+  return n_skipped;
+}
+
+size_t LogBuffer::GetUsedSize() const {
+  return sealed_blocks_.GetUsedSize() + active_block_len_;
+}
+
+size_t LogBuffer::GetUncompressedSize() const {
+  if (mode_ != Mode::kCompressed) {
+    return sealed_blocks_.GetUsedSize();
+  }
+  return n_uncompressed_bytes_ + active_block_len_;
+}
+
+uint64_t LogBuffer::GetNumEvicted() const {
+  if (mode_ != Mode::kCompressed) {
+    return sealed_blocks_.GetNumEvicted();
+  }
+  return n_evicted_;
+}
+
+std::tuple<uint8_t*, size_t> LogBuffer::GetLastMessage() {
+  if (mode_ != Mode::kCompressed) {
+    return sealed_blocks_.GetLastMessage();
+  }
+  if (!n_active_messages_) {
+    return {nullptr, 0};
+  }
+
+  uint8_t* const record = active_block_.get() + last_active_offset_;
+  const auto header = CopyFromBufferOrDie<LengthHeader>(
+      record, active_block_len_ - last_active_offset_);
+  return {record + sizeof(header), header.payload_len};
+}
+
+void LogBuffer::Shrink(size_t max_retained_bytes) {
+  if (mode_ != Mode::kCompressed) {
+    sealed_blocks_.Shrink(max_retained_bytes);
+    return;
+  }
+
+  CHECK(!reserved_len_);
+  // Sealed blocks hold older messages than the active block, so they go
+  // first.
+  sealed_blocks_.Shrink(max_retained_bytes > active_block_len_
+                            ? max_retained_bytes - active_block_len_
+                            : 0);
+  if (active_block_len_ > max_retained_bytes) {
+    EvictActiveMessages(max_retained_bytes);
+  }
+}
+
+void LogBuffer::Rewind() {
+  sealed_blocks_.Rewind();
+  read_block_ = nullptr;
+  scratch_holds_read_block_ = false;
+  reading_active_block_ = false;
+  read_offset_ = 0;
+}
+
+// Private methods below.
+
+void LogBuffer::SealActiveBlock() {
+  CHECK(n_active_messages_);
+  BlockHeader header;
+  header.encoding = BlockEncoding::kLz4;
+  header.n_messages = n_active_messages_;
+  header.uncompressed_len = active_block_len_;
+
+  // Keep the compressed block only if it is smaller than the original.
+  const int compressed_len = LZ4_compress_default(
+      reinterpret_cast<const char*>(active_block_.get()),
+      reinterpret_cast<char*>(scratch_block_.get()), active_block_len_,
+      active_block_len_ - 1);
+  scratch_holds_read_block_ = false;
+  const uint8_t* payload;
+  size_t payload_len;
+  if (compressed_len > 0) {
+    payload = scratch_block_.get();
+    payload_len = compressed_len;
+    // Messages in the active block are already compressed, so the active
+    // block can hold the blocks that we evict to make room.
+    eviction_block_ = active_block_.get();
+  } else {
+    header.encoding = BlockEncoding::kRaw;
+    payload = active_block_.get();
+    payload_len = active_block_len_;
+  }
+
+  const size_t block_len = sizeof(header) + payload_len;
+  uint8_t* const block = sealed_blocks_.Reserve(block_len);
+  // The constructor checked that |sealed_blocks_| can fit any block.
+  CHECK(block);
+  std::memcpy(block, &header, sizeof(header));
+  std::memcpy(block + sizeof(header), payload, payload_len);
+  sealed_blocks_.Commit(block_len);
+  eviction_block_ = scratch_block_.get();
+
+  n_uncompressed_bytes_ += active_block_len_;
+  active_block_len_ = 0;
+  n_active_messages_ = 0;
+  if (reading_active_block_) {
+    // The messages that we were reading are now in the newest sealed block.
+    // Keep |read_offset_|, so that we resume from the same message.
+    reading_active_block_ = false;
+    read_block_ = nullptr;
+  }
+}
+
+void LogBuffer::EvictBlock(const uint8_t* block, size_t block_len) {
+  const auto header = CopyFromBufferOrDie<BlockHeader>(block, block_len);
+  n_evicted_ += header.n_messages;
+  n_uncompressed_bytes_ -= header.uncompressed_len;
+  if (block == read_block_) {
+    // |sealed_blocks_| resumes reading from the oldest remaining block.
+    read_block_ = nullptr;
+    read_offset_ = 0;
+  }
+  if (!eviction_handler_) {
+    return;
+  }
+
+  if (eviction_block_ == scratch_block_.get()) {
+    scratch_holds_read_block_ = false;
+  }
+  const size_t messages_len = DecodeBlock(block, block_len, eviction_block_);
+  size_t offset = 0;
+  while (offset < messages_len) {
+    const auto& message = ReadMessage(eviction_block_, messages_len, &offset);
+    eviction_handler_(std::get<0>(message), std::get<1>(message));
+  }
+}
+
+size_t LogBuffer::DecodeBlock(const uint8_t* block, size_t block_len,
+                              uint8_t* out) {
+  const auto header = CopyFromBufferOrDie<BlockHeader>(block, block_len);
+  const uint8_t* const payload = block + sizeof(header);
+  const size_t payload_len = block_len - sizeof(header);
+  switch (header.encoding) {
+    case BlockEncoding::kRaw:
+      CHECK(payload_len == header.uncompressed_len);
+      std::memcpy(out, payload, payload_len);
+      break;
+    case BlockEncoding::kLz4: {
+      const int decoded_len = LZ4_decompress_safe(
+          reinterpret_cast<const char*>(payload), reinterpret_cast<char*>(out),
+          payload_len, kBlockSizeBytes);
+      // We wrote the block ourselves, so a failure here indicates a logic
+      // error (or memory corruption), rather than bad input.
+      CHECK(decoded_len == header.uncompressed_len);
+      break;
+    }
+    default:
+      LOG(FATAL) << "Unexpected block encoding "
+                 << static_cast<int>(header.encoding);
+  }
+  return header.uncompressed_len;
+}
+
+void LogBuffer::EvictActiveMessages(size_t max_retained_bytes) {
+  size_t evicted_len = 0;
+  while (active_block_len_ - evicted_len > max_retained_bytes) {
+    const auto& message =
+        ReadMessage(active_block_.get(), active_block_len_, &evicted_len);
+    if (eviction_handler_) {
+      eviction_handler_(std::get<0>(message), std::get<1>(message));
+    }
+    --n_active_messages_;
+    ++n_evicted_;
+  }
+  std::memmove(active_block_.get(), active_block_.get() + evicted_len,
+               active_block_len_ - evicted_len);
+  active_block_len_ -= evicted_len;
+  if (n_active_messages_) {
+    last_active_offset_ -= evicted_len;
+  }
+  if (reading_active_block_) {
+    read_offset_ = read_offset_ > evicted_len ? read_offset_ - evicted_len : 0;
+  }
+}
+
+std::tuple<const uint8_t*, size_t> LogBuffer::ReadMessage(
+    const uint8_t* messages, size_t len, size_t* offset) {
+  const auto header =
+      CopyFromBufferOrDie<LengthHeader>(messages + *offset, len - *offset);
+  const uint8_t* const payload = messages + *offset + sizeof(header);
+  *offset += sizeof(header);
+  CHECK(header.payload_len <= len - *offset);
+  *offset += header.payload_len;
+  return {payload, header.payload_len};
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,236 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOG_BUFFER_H_
+#define LOG_BUFFER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <tuple>
+
+#include "android-base/macros.h"
+#include "android-base/unique_fd.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/message_buffer.h"
+
+namespace android {
+namespace wifilogd {
+
+// A FIFO of messages, which evicts the oldest messages when full (as with
+// MessageBuffer), and which can optionally store its messages compressed.
+//
+// In kCompressed mode, new messages are appended to an uncompressed active
+// block. When a message does not fit in the active block, the block is
+// sealed: its messages are compressed with LZ4, as a unit, and the
+// compressed block is appended to a MessageBuffer. (A block which does not
+// compress is stored as-is.) Blocks are evicted whole, oldest first. Reads
+// decompress one block at a time.
+//
+// kAligned mode stores messages uncompressed, as kUncompressed mode does,
+// but starts each message on a MessageBuffer::kRecordAlignment boundary (see
+// MessageBuffer::Framing::kAligned). That trades some capacity for cheaper
+// reads of the messages' headers.
+//
+// In every mode, |size| bounds the memory used by the LogBuffer. In
+// kCompressed mode, that includes the active block, and a scratch block
+// that is used for compression and decompression.
+class LogBuffer {
+ public:
+  enum class Mode { kUncompressed, kCompressed, kAligned };
+
+  // The capacity of the active block, in kCompressed mode. Large enough
+  // for a maximal message from CommandProcessor, while small enough that
+  // each of CommandProcessor's log buffers can be compressed at the default
+  // buffer size.
+  static constexpr size_t kBlockSizeBytes = 5 * 1024;
+
+  // Called with each message, just before the message is evicted.
+  using EvictionHandler = MessageBuffer::EvictionHandler;
+
+  // Constructs a buffer of |size| bytes. In kCompressed mode, |size| must
+  // be at least GetMinCompressedSize().
+  LogBuffer(size_t size, Mode mode);
+
+  // Constructs a buffer of |size| bytes, as above, whose messages are
+  // stored in |backing_file| (as described for MessageBuffer), if
+  // |backing_file| is valid. A backing file cannot be used in kCompressed
+  // mode.
+  LogBuffer(size_t size, Mode mode, ::android::base::unique_fd backing_file);
+  ~LogBuffer();
+
+  // Returns the smallest |size| with which a kCompressed LogBuffer may be
+  // constructed.
+  static constexpr size_t GetMinCompressedSize() {
+    return 2 * kBlockSizeBytes + MessageBuffer::GetHeaderSize() +
+           sizeof(BlockHeader) + kBlockSizeBytes;
+  }
+
+  // Sets the handler to be called when messages are evicted, whether to make
+  // room for new messages, or by Shrink(). In kCompressed mode, evicting a
+  // block calls the handler once for each message in the block.
+  void SetEvictionHandler(EvictionHandler handler);
+
+  // Reserves space for a single message of up to |data_len| bytes, as
+  // described for MessageBuffer::Reserve().
+  uint8_t* Reserve(uint16_t data_len);
+
+  // Commits the message in the outstanding reservation, as described for
+  // MessageBuffer::Commit().
+  void Commit(uint16_t data_len);
+
+  // Returns true if the buffer is large enough to hold |length| bytes of user
+  // data, when the buffer is empty.
+  bool CanFitEver(uint16_t length) const;
+
+  // Returns the first unread message in the buffer, or {nullptr, 0} if there
+  // is no such message. The message's storage remains valid until the next
+  // call to a non-const method. Messages appended while a read is in
+  // progress (i.e., before Rewind()) may be skipped by that read.
+  std::tuple<const uint8_t*, size_t> ConsumeNextMessage();
+
+  // Advances past up to |n_messages| unread messages, as if they had been
+  // read with ConsumeNextMessage(). Returns the number of messages skipped,
+  // which is less than |n_messages| only if the unread messages ran out. In
+  // kCompressed mode, a sealed block whose messages are all skipped is not
+  // decompressed.
+  uint64_t SkipMessages(uint64_t n_messages);
+
+  // Consumes up to |max_messages| unread messages, as if by repeated calls
+  // to ConsumeNextMessage(), and stores them in |messages|. Returns the
+  // number of messages stored. All of the messages' storage remains valid
+  // until the next call to a non-const method. In kCompressed mode, a batch
+  // ends with the last message of a sealed block, so fewer than
+  // |max_messages| messages may be returned while unread messages remain.
+  // Returns zero only once the unread messages have run out.
+  size_t ConsumeNextMessages(
+      NONNULL std::tuple<const uint8_t*, size_t>* messages,
+      size_t max_messages);
+
+  // Returns the newest message in the buffer, for modification in place, as
+  // described for MessageBuffer::GetLastMessage(). In kCompressed mode,
+  // returns {nullptr, 0} unless the newest message is in the active block,
+  // since sealed blocks cannot be modified.
+  std::tuple<uint8_t*, size_t> GetLastMessage();
+
+  // Returns the memory occupied by messages, including overheads. (In
+  // kCompressed mode, sealed blocks count at their compressed size.)
+  size_t GetUsedSize() const;
+
+  // Returns the number of bytes that the messages in the buffer would
+  // occupy, including overheads, if they were not compressed.
+  size_t GetUncompressedSize() const;
+
+  // Returns the number of messages which were recovered from the backing
+  // file, when the buffer was constructed.
+  size_t GetNumRecovered() const { return sealed_blocks_.GetNumRecovered(); }
+
+  // Returns the number of messages which have been evicted, over the life
+  // of the buffer.
+  uint64_t GetNumEvicted() const;
+
+  // Returns the number of messages which have been appended, over the life
+  // of the buffer (counting those recovered from the backing file). Hence,
+  // messages may be numbered from zero, in the order they were appended,
+  // with the oldest message in the buffer numbered GetNumEvicted().
+  uint64_t GetNumAppended() const { return n_appended_; }
+
+  // Evicts the oldest messages, until no more than |max_retained_bytes|
+  // are in use (per GetUsedSize()), and releases unused memory to the
+  // system, as described for MessageBuffer::Shrink().
+  void Shrink(size_t max_retained_bytes);
+
+  // Resets the read pointer to the oldest message in the buffer.
+  void Rewind();
+
+ private:
+  enum class BlockEncoding : uint8_t { kRaw, kLz4 };
+
+  // Precedes each sealed block, in |sealed_blocks_|.
+  struct BlockHeader {
+    BlockEncoding encoding;
+    uint16_t n_messages;
+    // The length of the block's messages (with their headers), before
+    // compression.
+    uint16_t uncompressed_len;
+  };
+
+  // Framing for each message within a block. (This matches the framing
+  // used by MessageBuffer.)
+  struct LengthHeader {
+    uint16_t payload_len;
+  };
+
+  // Compresses the active block, appends it to |sealed_blocks_|, and
+  // empties the active block.
+  void SealActiveBlock();
+
+  // Handles the eviction of |block| from |sealed_blocks_|.
+  void EvictBlock(NONNULL const uint8_t* block, size_t block_len);
+
+  // Decompresses |block| into |out|, which must have room for
+  // kBlockSizeBytes. Returns the length of the decompressed messages.
+  static size_t DecodeBlock(NONNULL const uint8_t* block, size_t block_len,
+                            NONNULL uint8_t* out);
+
+  // Evicts the oldest messages in the active block, until no more than
+  // |max_retained_bytes| of the active block are in use.
+  void EvictActiveMessages(size_t max_retained_bytes);
+
+  // Returns the message at |offset| in the |len| bytes of messages at
+  // |messages|, and advances |offset| past that message.
+  static std::tuple<const uint8_t*, size_t> ReadMessage(
+      NONNULL const uint8_t* messages, size_t len, NONNULL size_t* offset);
+
+  const Mode mode_;
+  MessageBuffer sealed_blocks_;
+  // The members below are used only in kCompressed mode.
+  const std::unique_ptr<uint8_t[]> active_block_;
+  size_t active_block_len_;
+  size_t n_active_messages_;
+  // The offset of the newest message in the active block. Valid if
+  // |n_active_messages_| is non-zero.
+  size_t last_active_offset_;
+  uint16_t reserved_len_;  // Zero if there is no outstanding reservation.
+  // Holds the block being read, or compressed output during a seal.
+  const std::unique_ptr<uint8_t[]> scratch_block_;
+  // Where EvictBlock() decompresses blocks for the eviction handler. Points
+  // at whichever of |active_block_| or |scratch_block_| is not in use.
+  uint8_t* eviction_block_;
+  // The read position: the block in |sealed_blocks_| being read (nullptr
+  // once the sealed blocks are exhausted), and the offset of the next
+  // message in that block, or in the active block. |read_block_len_| is the
+  // decompressed length of |read_block_|, and is valid only if
+  // |scratch_holds_read_block_|.
+  const uint8_t* read_block_;
+  size_t read_block_compressed_len_;
+  size_t read_block_len_;
+  bool scratch_holds_read_block_;
+  bool reading_active_block_;
+  size_t read_offset_;
+  size_t n_uncompressed_bytes_;  // Uncompressed length of sealed blocks.
+  uint64_t n_evicted_;           // Messages in evicted blocks.
+  uint64_t n_appended_;
+  EvictionHandler eviction_handler_;  // May be empty.
+
+  DISALLOW_COPY_AND_ASSIGN(LogBuffer);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // LOG_BUFFER_H_
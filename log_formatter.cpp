@@ -0,0 +1,480 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+#include <limits>
+#include <tuple>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/ascii_sanitizer.h"
+#include "wifilogd/log_formatter.h"
+#include "wifilogd/record_layout.h"
+
+namespace android {
+namespace wifilogd {
+namespace log_formatter {
+
+namespace {
+
+constexpr char kUnprintableCharReplacement = '?';
+constexpr uint32_t kNsecPerUsec = 1000;
+constexpr size_t kUsecDigits = 6;
+constexpr char kBufferOverrunError[] = "[buffer-overrun]";
+constexpr char kZeroLengthError[] = "[empty]";
+constexpr char kShortHeaderError[] = "[truncated-header]";
+constexpr char kShortRecordError[] = "[truncated-record]";
+constexpr char kUnsupportedOpcodeError[] = "[unsupported-opcode]";
+constexpr char kUnknownFormatError[] = "[unknown-format=";
+constexpr char kMalformedArgError[] = "[malformed-arg]";
+constexpr char kTooManyArgsError[] = "[too-many-args]";
+constexpr char kPlaceholder[] = "{}";
+constexpr char kRepeatedPrefix[] = "last message repeated ";
+constexpr char kRepeatedSuffix[] = " times";
+constexpr char kHexDigits[] = "0123456789abcdef";
+constexpr char kStatsPrefix[] = "# stats";
+constexpr char kCursorPrefix[] = "# cursor";
+constexpr char kLatencyPrefix[] = "# latency";
+constexpr char kProfilePrefix[] = "# profile stage=";
+
+static_assert(kMaxFormattedTimestampsLen ==
+                  3 * (local_utils::kMaxFormattedDecimalLen + 1 +
+                       kUsecDigits) + 2,
+              "kMaxFormattedTimestampsLen does not match kUsecDigits");
+// A formatted AsciiMessage contains the sanitized tag and message (which
+// are no larger than the command itself), separated by a space. Either
+// of them may be followed by an error marker.
+static_assert(
+    protocol::kMaxMessageSize + 2 * (sizeof(kBufferOverrunError) - 1) + 1 <=
+            kMaxFormattedAsciiMessageLen &&
+        sizeof(kShortHeaderError) - 1 <= kMaxFormattedAsciiMessageLen &&
+        sizeof(kShortRecordError) - 1 <= kMaxFormattedAsciiMessageLen &&
+        sizeof(kUnsupportedOpcodeError) - 1 <= kMaxFormattedAsciiMessageLen,
+    "kMaxFormattedAsciiMessageLen is too small");
+// A formatted RepeatedMessage contains the sanitized tag (which may be
+// followed by an error marker), a space, and the count of repeats.
+static_assert(std::numeric_limits<uint8_t>::max() +
+                      sizeof(kBufferOverrunError) - 1 + 1 +
+                      sizeof(kRepeatedPrefix) - 1 +
+                      local_utils::kMaxFormattedDecimalLen +
+                      sizeof(kRepeatedSuffix) - 1 <=
+                  kMaxFormattedAsciiMessageLen,
+              "kMaxFormattedAsciiMessageLen is too small");
+// A formatted StructuredMessage contains the sanitized tag (which may be
+// followed by an error marker), a space, the format string (or, for an
+// unknown format, a marker with the format ID), the arguments, and at most
+// one more error marker. Each argument is preceded by at most one space,
+// and is no longer than a maximal kBytes argument.
+static_assert(
+    std::numeric_limits<uint8_t>::max() + sizeof(kBufferOverrunError) - 1 +
+            1 +
+            std::max(structured_formats::kMaxFormatStringLen,
+                     sizeof(kUnknownFormatError) - 1 +
+                         local_utils::kMaxFormattedDecimalLen + 1) +
+            protocol::kMaxStructuredArgs *
+                (1 + std::max<size_t>(std::numeric_limits<uint8_t>::max(),
+                                      local_utils::kMaxFormattedDecimal64Len +
+                                          1)) +
+            std::max(sizeof(kMalformedArgError), sizeof(kTooManyArgsError)) -
+            1 <=
+        kMaxFormattedStructuredMessageLen,
+    "kMaxFormattedStructuredMessageLen is too small");
+
+template <size_t N>
+char* CopyString(const char (&str)[N], NONNULL char* out) {
+  std::memcpy(out, str, N - 1);  // Omit the NUL.
+  return out + N - 1;
+}
+
+// Copies |desired_len| bytes out of |buffer_reader| to |out|, replacing any
+// unprintable characters. Returns a pointer just past the last character
+// written.
+char* CopyStringFromMemoryReader(NONNULL MemoryReader* buffer_reader,
+                                 const size_t desired_len, NONNULL char* out) {
+  if (!desired_len) {
+    // TODO(b/32098735): Increment stats counter.
+    return CopyString(kZeroLengthError, out);
+  }
+
+  auto effective_len = desired_len;
+  if (buffer_reader->size() < effective_len) {
+    // TODO(b/32098735): Increment stats counter.
+    effective_len = buffer_reader->size();
+  }
+
+  out = ascii_sanitizer::CopySanitized(
+      buffer_reader->GetBytesOrDie(effective_len), effective_len,
+      kUnprintableCharReplacement, out);
+  if (effective_len < desired_len) {
+    out = CopyString(kBufferOverrunError, out);
+  }
+
+  return out;
+}
+
+// Writes " |label|=|value|" to |out|, and returns a pointer just past the
+// last character written.
+template <size_t N>
+char* FormatStat(const char (&label)[N], uint64_t value, NONNULL char* out) {
+  *out++ = ' ';
+  out = CopyString(label, out);
+  *out++ = '=';
+  return local_utils::FormatDecimal64(value, out);
+}
+
+// Returns the maximal number of characters written by FormatStat(), for
+// a label of |label_size| bytes (including the NUL).
+constexpr size_t GetMaxFormattedStatLen(size_t label_size) {
+  return 1 + label_size - 1 + 1 + local_utils::kMaxFormattedDecimal64Len;
+}
+
+// Writes |timestamp| to |out|, as seconds and (zero-padded) microseconds,
+// and returns a pointer just past the last character written.
+char* FormatTimestamp(const Os::Timestamp& timestamp, NONNULL char* out) {
+  out = local_utils::FormatDecimal(timestamp.secs, out);
+  *out++ = '.';
+  return local_utils::FormatZeroPaddedDecimal(timestamp.nsecs / kNsecPerUsec,
+                                              kUsecDigits, out);
+}
+
+// Writes |value| to |out|, in decimal, and returns a pointer just past the
+// last character written.
+char* FormatSignedDecimal64(int64_t value, NONNULL char* out) {
+  uint64_t magnitude = value;
+  if (value < 0) {
+    *out++ = '-';
+    magnitude = 0 - magnitude;  // Well-defined, even for the minimal value.
+  }
+  return local_utils::FormatDecimal64(magnitude, out);
+}
+
+// Writes the protocol::kMacAddressLen bytes at |mac_address| to |out|, in
+// the usual colon-separated hex, and returns a pointer just past the last
+// character written.
+char* FormatMacAddress(NONNULL const uint8_t* mac_address, NONNULL char* out) {
+  for (size_t i = 0; i < protocol::kMacAddressLen; ++i) {
+    if (i) {
+      *out++ = ':';
+    }
+    *out++ = kHexDigits[mac_address[i] >> 4];
+    *out++ = kHexDigits[mac_address[i] & 0xf];
+  }
+  return out;
+}
+
+// Writes the argument at the head of |buffer_reader| to |out|, and returns
+// a pointer just past the last character written. Returns nullptr, having
+// written nothing, if the argument is malformed.
+char* FormatStructuredArg(NONNULL MemoryReader* buffer_reader,
+                          NONNULL char* out) {
+  using protocol::StructuredArgType;
+  const auto type = buffer_reader->CopyOutOrDie<StructuredArgType>();
+  switch (type) {
+    case StructuredArgType::kInt32:
+      if (buffer_reader->size() < sizeof(int32_t)) {
+        return nullptr;
+      }
+      return FormatSignedDecimal64(buffer_reader->CopyOutOrDie<int32_t>(),
+                                   out);
+    case StructuredArgType::kUint32:
+      if (buffer_reader->size() < sizeof(uint32_t)) {
+        return nullptr;
+      }
+      return local_utils::FormatDecimal(
+          buffer_reader->CopyOutOrDie<uint32_t>(), out);
+    case StructuredArgType::kInt64:
+      if (buffer_reader->size() < sizeof(int64_t)) {
+        return nullptr;
+      }
+      return FormatSignedDecimal64(buffer_reader->CopyOutOrDie<int64_t>(),
+                                   out);
+    case StructuredArgType::kUint64:
+      if (buffer_reader->size() < sizeof(uint64_t)) {
+        return nullptr;
+      }
+      return local_utils::FormatDecimal64(
+          buffer_reader->CopyOutOrDie<uint64_t>(), out);
+    case StructuredArgType::kMacAddress:
+      if (buffer_reader->size() < protocol::kMacAddressLen) {
+        return nullptr;
+      }
+      return FormatMacAddress(
+          buffer_reader->GetBytesOrDie(protocol::kMacAddressLen), out);
+    case StructuredArgType::kBytes: {
+      if (buffer_reader->size() < sizeof(uint8_t)) {
+        return nullptr;
+      }
+      const auto len = buffer_reader->CopyOutOrDie<uint8_t>();
+      if (buffer_reader->size() < len) {
+        return nullptr;
+      }
+      return ascii_sanitizer::CopySanitized(buffer_reader->GetBytesOrDie(len),
+                                            len, kUnprintableCharReplacement,
+                                            out);
+    }
+  }
+  // An unknown type, which may come from a newer client. We can't know
+  // the length of its value, so we can't skip over it.
+  return nullptr;
+}
+
+}  // namespace
+
+char* FormatTimestamps(const TimestampHeader& tstamp_header, char* out) {
+  out = FormatTimestamp(tstamp_header.since_boot_awake_only, out);
+  *out++ = ' ';
+  out = FormatTimestamp(tstamp_header.since_boot_with_sleep, out);
+  *out++ = ' ';
+  return FormatTimestamp(tstamp_header.since_epoch, out);
+}
+
+char* FormatAsciiMessage(MemoryReader buffer_reader, char* out) {
+  CHECK(buffer_reader.size() <= protocol::kMaxMessageSize);
+  if (buffer_reader.size() < sizeof(protocol::AsciiMessage)) {
+    // TODO(b/32098735): Increment stats counter.
+    return CopyString(kShortHeaderError, out);
+  }
+
+  const auto& ascii_message_header =
+      buffer_reader.CopyOutOrDie<protocol::AsciiMessage>();
+  out = CopyStringFromMemoryReader(&buffer_reader,
+                                   ascii_message_header.tag_len, out);
+  *out++ = ' ';
+  return CopyStringFromMemoryReader(&buffer_reader,
+                                    ascii_message_header.data_len, out);
+}
+
+char* FormatStructuredMessage(MemoryReader buffer_reader, char* out) {
+  CHECK(buffer_reader.size() <= protocol::kMaxMessageSize);
+  if (buffer_reader.size() < sizeof(protocol::StructuredMessage)) {
+    return CopyString(kShortHeaderError, out);
+  }
+
+  const auto& structured_message_header =
+      buffer_reader.CopyOutOrDie<protocol::StructuredMessage>();
+  out = CopyStringFromMemoryReader(&buffer_reader,
+                                   structured_message_header.tag_len, out);
+  *out++ = ' ';
+
+  size_t n_args = 0;
+  bool malformed = false;
+  // Formats the next argument, if there is one. Returns false otherwise.
+  const auto format_next_arg = [&buffer_reader, &n_args, &malformed, &out]() {
+    if (malformed || !buffer_reader ||
+        n_args == protocol::kMaxStructuredArgs) {
+      return false;
+    }
+    char* const arg_end = FormatStructuredArg(&buffer_reader, out);
+    if (!arg_end) {
+      malformed = true;
+      return false;
+    }
+    out = arg_end;
+    ++n_args;
+    return true;
+  };
+
+  const char* format =
+      structured_formats::GetFormatString(structured_message_header.format_id);
+  if (!format) {
+    out = CopyString(kUnknownFormatError, out);
+    out = local_utils::FormatDecimal(structured_message_header.format_id, out);
+    *out++ = ']';
+    format = "";
+  }
+  while (*format) {
+    if (format[0] == '{' && format[1] == '}') {
+      // A missing argument leaves the placeholder as is.
+      if (!format_next_arg()) {
+        out = CopyString(kPlaceholder, out);
+      }
+      format += 2;
+    } else {
+      *out++ = *format++;
+    }
+  }
+  while (buffer_reader && !malformed &&
+         n_args < protocol::kMaxStructuredArgs) {
+    *out++ = ' ';
+    format_next_arg();
+  }
+
+  if (malformed) {
+    out = CopyString(kMalformedArgError, out);
+  } else if (buffer_reader) {
+    out = CopyString(kTooManyArgsError, out);
+  }
+  return out;
+}
+
+char* FormatRepeatedMessage(MemoryReader buffer_reader, char* out) {
+  CHECK(buffer_reader.size() <= protocol::kMaxMessageSize);
+  if (buffer_reader.size() < sizeof(protocol::RepeatedMessage)) {
+    return CopyString(kShortHeaderError, out);
+  }
+
+  const auto& repeated_message_header =
+      buffer_reader.CopyOutOrDie<protocol::RepeatedMessage>();
+  out = CopyStringFromMemoryReader(&buffer_reader,
+                                   repeated_message_header.tag_len, out);
+  *out++ = ' ';
+  out = CopyString(kRepeatedPrefix, out);
+  out = local_utils::FormatDecimal(repeated_message_header.n_repeats, out);
+  return CopyString(kRepeatedSuffix, out);
+}
+
+char* FormatRecord(MemoryReader buffer_reader, char* out) {
+  CHECK(buffer_reader.size() <= kMaxRecordLen);
+  if (buffer_reader.size() < RecordHeaderLayout::kSize) {
+    // A record which has its timestamps, but not its command, still has
+    // its timestamps formatted.
+    if (buffer_reader.size() >= sizeof(TimestampHeader)) {
+      out = FormatTimestamps(buffer_reader.CopyOutOrDie<TimestampHeader>(),
+                             out);
+      *out++ = ' ';
+    }
+    // TODO(b/32098735): Increment stats counter.
+    out = CopyString(kShortRecordError, out);
+    *out++ = '\n';
+    return out;
+  }
+
+  // TOOO(b/32256098): validate |buffer_reader.size()| against payload_len,
+  // and use a smaller size if necessary. Update a stats counter if
+  // payload_len and
+  // buflen do not match.
+  TimestampHeader tstamp_header;
+  protocol::Command command_header;
+  std::tie(tstamp_header, command_header) =
+      buffer_reader.CopyOutLayoutOrDie<RecordHeaderLayout>();
+  out = FormatTimestamps(tstamp_header, out);
+  *out++ = ' ';
+  switch (command_header.opcode) {
+    using protocol::Opcode;
+    case Opcode::kWriteAsciiMessage:
+      out = FormatAsciiMessage(buffer_reader, out);
+      break;
+    case Opcode::kWriteStructuredMessage:
+      out = FormatStructuredMessage(buffer_reader, out);
+      break;
+    case Opcode::kRepeatedMessage:
+      out = FormatRepeatedMessage(buffer_reader, out);
+      break;
+    default:
+      // Only the commands handled above are logged. So this indicates
+      // a corrupt (or newer) record.
+      // TODO(b/32098735): Increment stats counter.
+      out = CopyString(kUnsupportedOpcodeError, out);
+      break;
+  }
+  *out++ = '\n';
+  return out;
+}
+
+char* FormatStats(const protocol::Stats& stats, char* out) {
+  // Keep these labels in sync with the static_assert below.
+  out = CopyString(kStatsPrefix, out);
+  out = FormatStat("logged", stats.n_messages_logged, out);
+  out = FormatStat("evicted", stats.n_messages_evicted, out);
+  out = FormatStat("missing", stats.n_messages_missing, out);
+  out = FormatStat("truncated", stats.n_datagrams_truncated, out);
+  out = FormatStat("rejected", stats.n_commands_rejected, out);
+  out = FormatStat("ring_dropped", stats.n_ring_records_dropped, out);
+  out = FormatStat("enomem", stats.n_receive_enomem_errors, out);
+  out = FormatStat("eintr", stats.n_receive_eintr_errors, out);
+  static_assert(
+      sizeof(kStatsPrefix) - 1 + GetMaxFormattedStatLen(sizeof("logged")) +
+              GetMaxFormattedStatLen(sizeof("evicted")) +
+              GetMaxFormattedStatLen(sizeof("missing")) +
+              GetMaxFormattedStatLen(sizeof("truncated")) +
+              GetMaxFormattedStatLen(sizeof("rejected")) +
+              GetMaxFormattedStatLen(sizeof("ring_dropped")) +
+              GetMaxFormattedStatLen(sizeof("enomem")) +
+              GetMaxFormattedStatLen(sizeof("eintr")) + 1 <=
+          kMaxFormattedStatsLen,
+      "kMaxFormattedStatsLen is too small");
+  *out++ = '\n';
+  return out;
+}
+
+char* FormatCursor(size_t log_buffer, uint64_t next_record, uint64_t n_missed,
+                   char* out) {
+  // Keep these labels in sync with the static_assert below.
+  out = CopyString(kCursorPrefix, out);
+  out = FormatStat("buffer", log_buffer, out);
+  out = FormatStat("next", next_record, out);
+  out = FormatStat("missed", n_missed, out);
+  static_assert(sizeof(kCursorPrefix) - 1 +
+                        GetMaxFormattedStatLen(sizeof("buffer")) +
+                        GetMaxFormattedStatLen(sizeof("next")) +
+                        GetMaxFormattedStatLen(sizeof("missed")) + 1 <=
+                    kMaxFormattedCursorLen,
+                "kMaxFormattedCursorLen is too small");
+  *out++ = '\n';
+  return out;
+}
+
+char* FormatLatency(protocol::Opcode opcode, const LatencyHistogram& histogram,
+                    char* out) {
+  // Keep these labels in sync with the static_assert below.
+  out = CopyString(kLatencyPrefix, out);
+  out = FormatStat("opcode", local_utils::CastEnumToInteger(opcode), out);
+  out = FormatStat("samples", histogram.GetNumSamples(), out);
+  out = FormatStat("p50_usec", histogram.GetPercentileNsec(50) / kNsecPerUsec,
+                   out);
+  out = FormatStat("p90_usec", histogram.GetPercentileNsec(90) / kNsecPerUsec,
+                   out);
+  out = FormatStat("p99_usec", histogram.GetPercentileNsec(99) / kNsecPerUsec,
+                   out);
+  out = FormatStat("max_usec", histogram.GetMaxNsec() / kNsecPerUsec, out);
+  static_assert(
+      sizeof(kLatencyPrefix) - 1 + GetMaxFormattedStatLen(sizeof("opcode")) +
+              GetMaxFormattedStatLen(sizeof("samples")) +
+              GetMaxFormattedStatLen(sizeof("p50_usec")) +
+              GetMaxFormattedStatLen(sizeof("p90_usec")) +
+              GetMaxFormattedStatLen(sizeof("p99_usec")) +
+              GetMaxFormattedStatLen(sizeof("max_usec")) + 1 <=
+          kMaxFormattedLatencyLen,
+      "kMaxFormattedLatencyLen is too small");
+  *out++ = '\n';
+  return out;
+}
+
+char* FormatStageProfile(ProfiledStage stage, const StageProfile& profile,
+                         char* out) {
+  // Keep these labels in sync with the static_assert below.
+  out = CopyString(kProfilePrefix, out);
+  const char* const stage_name = GetProfiledStageName(stage);
+  const size_t stage_name_len = strnlen(stage_name, kMaxProfiledStageNameLen);
+  std::memcpy(out, stage_name, stage_name_len);
+  out += stage_name_len;
+  out = FormatStat("calls", profile.n_calls, out);
+  out = FormatStat("total_nsec", profile.total_nsec, out);
+  out = FormatStat("max_nsec", profile.max_nsec, out);
+  static_assert(sizeof(kProfilePrefix) - 1 + kMaxProfiledStageNameLen +
+                        GetMaxFormattedStatLen(sizeof("calls")) +
+                        GetMaxFormattedStatLen(sizeof("total_nsec")) +
+                        GetMaxFormattedStatLen(sizeof("max_nsec")) + 1 <=
+                    kMaxFormattedStageProfileLen,
+                "kMaxFormattedStageProfileLen is too small");
+  *out++ = '\n';
+  return out;
+}
+
+}  // namespace log_formatter
+}  // namespace wifilogd
+}  // namespace android
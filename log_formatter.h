@@ -0,0 +1,160 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef LOG_FORMATTER_H_
+#define LOG_FORMATTER_H_
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+#include "wifilogd/latency_histogram.h"
+#include "wifilogd/local_utils.h"
+#include "wifilogd/memory_reader.h"
+#include "wifilogd/profiler.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/structured_formats.h"
+#include "wifilogd/timestamp_header.h"
+
+namespace android {
+namespace wifilogd {
+namespace log_formatter {
+
+// Functions which convert logged records into human-friendly text. These
+// are shared between the daemon (for protocol::Opcode::kDumpBuffers), and
+// the host-side decoder for binary dumps (see binary_dump_decoder.h), so
+// that both produce identical output.
+//
+// Each function writes into caller-provided memory, and returns a pointer
+// just past the last character written. No terminating NUL is written.
+
+// The maximal size of a logged record: a TimestampHeader, followed by a
+// command.
+constexpr size_t kMaxRecordLen =
+    sizeof(TimestampHeader) + protocol::kMaxMessageSize;
+
+// The maximal number of characters written by FormatTimestamps(). (Three
+// "secs.usecs" values, separated by spaces.)
+constexpr size_t kMaxFormattedTimestampsLen =
+    3 * (local_utils::kMaxFormattedDecimalLen + 1 + 6) + 2;
+
+// The maximal number of characters written by FormatAsciiMessage(). This
+// allows for the message itself, and for markers describing any formatting
+// errors.
+constexpr size_t kMaxFormattedAsciiMessageLen = protocol::kMaxMessageSize + 64;
+
+// The maximal number of characters written by FormatStructuredMessage().
+// This allows for the tag, the format string, kMaxStructuredArgs maximal
+// arguments (each preceded by a space, if the format string has no place
+// for it), and markers describing any formatting errors.
+constexpr size_t kMaxFormattedStructuredMessageLen =
+    std::numeric_limits<uint8_t>::max() + 32 +
+    structured_formats::kMaxFormatStringLen +
+    protocol::kMaxStructuredArgs *
+        (1 + std::numeric_limits<uint8_t>::max()) +
+    32;
+
+// The maximal number of characters written by FormatRecord().
+constexpr size_t kMaxFormattedRecordLen =
+    kMaxFormattedTimestampsLen + 1 +
+    std::max(kMaxFormattedAsciiMessageLen,
+             kMaxFormattedStructuredMessageLen) +
+    1;
+
+// The maximal number of characters written by FormatStats().
+constexpr size_t kMaxFormattedStatsLen = 320;
+
+// The maximal number of characters written by FormatCursor().
+constexpr size_t kMaxFormattedCursorLen = 96;
+
+// The maximal number of characters written by FormatLatency().
+constexpr size_t kMaxFormattedLatencyLen = 192;
+
+// The maximal number of characters written by FormatStageProfile().
+constexpr size_t kMaxFormattedStageProfileLen = 128;
+
+// Writes the timestamps in |tstamp_header| to |out|, which must have room
+// for kMaxFormattedTimestampsLen characters. Each timestamp is written as
+// seconds, and zero-padded microseconds.
+char* FormatTimestamps(const TimestampHeader& tstamp_header,
+                       NONNULL char* out);
+
+// Writes a human-friendly representation of the AsciiMessage contained
+// at the head of the memory referenced by |memory_reader| to |out|, which
+// must have room for kMaxFormattedAsciiMessageLen characters.
+// |memory_reader| must hold no more than protocol::kMaxMessageSize bytes.
+// Validates that |memory_reader| has enough bytes to contain an AsciiMessage
+// header, and the payload described by that header. Reports any errors in
+// the formatted output.
+char* FormatAsciiMessage(MemoryReader memory_reader, NONNULL char* out);
+
+// Writes a human-friendly representation of the StructuredMessage
+// contained at the head of the memory referenced by |memory_reader| to
+// |out|, which must have room for kMaxFormattedStructuredMessageLen
+// characters. The message is written as its tag, followed by its format
+// string, with each "{}" replaced by the next argument. Arguments beyond
+// those called for by the format string (e.g., for a format that is unknown
+// to this version) are appended, separated by spaces. |memory_reader| must
+// hold no more than protocol::kMaxMessageSize bytes. Reports any errors in
+// the formatted output.
+char* FormatStructuredMessage(MemoryReader memory_reader, NONNULL char* out);
+
+// Writes a human-friendly representation of the RepeatedMessage contained
+// at the head of the memory referenced by |memory_reader| to |out|, which
+// must have room for kMaxFormattedAsciiMessageLen characters. The message
+// is written as its tag, followed by a note of the number of repeats.
+// |memory_reader| must hold no more than protocol::kMaxMessageSize bytes.
+// Reports any errors in the formatted output.
+char* FormatRepeatedMessage(MemoryReader memory_reader, NONNULL char* out);
+
+// Writes a single line describing the record (a TimestampHeader, followed
+// by a protocol::Command) referenced by |memory_reader| to |out|, which must
+// have room for kMaxFormattedRecordLen characters. |memory_reader| must hold
+// no more than kMaxRecordLen bytes. Reports any errors in the formatted
+// output.
+char* FormatRecord(MemoryReader memory_reader, NONNULL char* out);
+
+// Writes a single line summarizing |stats| to |out|, which must have room
+// for kMaxFormattedStatsLen characters. The line starts with '#', so that
+// it can be told apart from formatted records.
+char* FormatStats(const protocol::Stats& stats, NONNULL char* out);
+
+// Writes a single line giving the position of a kDumpBuffersSince dump in
+// the log buffer with index |log_buffer|, to |out|, which must have room for
+// kMaxFormattedCursorLen characters. (See protocol::DumpCursor.) As with
+// FormatStats(), the line starts with '#'.
+char* FormatCursor(size_t log_buffer, uint64_t next_record, uint64_t n_missed,
+                   NONNULL char* out);
+
+// Writes a single line summarizing |histogram|, which measures the latency
+// of commands with |opcode|, to |out|. |out| must have room for
+// kMaxFormattedLatencyLen characters. As with FormatStats(), the line
+// starts with '#'. Latencies are reported in microseconds.
+char* FormatLatency(protocol::Opcode opcode, const LatencyHistogram& histogram,
+                    NONNULL char* out);
+
+// Writes a single line summarizing |profile|, the time spent in |stage|, to
+// |out|, which must have room for kMaxFormattedStageProfileLen characters.
+// As with FormatStats(), the line starts with '#'.
+char* FormatStageProfile(ProfiledStage stage, const StageProfile& profile,
+                         NONNULL char* out);
+
+}  // namespace log_formatter
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // LOG_FORMATTER_H_
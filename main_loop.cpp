@@ -14,65 +14,332 @@
  * limitations under the License.
  */
 
-#include <array>
+#include <algorithm>
 #include <cstdint>
 #include <cstring>
 #include <memory>
+#include <string>
+#include <tuple>
 #include <utility>
 
 #include "android-base/logging.h"
+#include "android-base/properties.h"
 
+#include "wifilogd/local_utils.h"
+#include "wifilogd/log_buffer.h"
 #include "wifilogd/main_loop.h"
 #include "wifilogd/protocol.h"
+#include "wifilogd/timestamper.h"
 
 namespace android {
 namespace wifilogd {
 
 namespace {
-constexpr auto kMainBufferSizeBytes = 128 * 1024;
+// The name of the system property which configures the buffer size, in KiB.
+// The size can be tuned per-device (e.g. smaller for low-RAM devices, and
+// larger for debugging).
+constexpr char kBufferSizeProperty[] = "persist.wifilogd.buffer_size_kb";
+// The name of the system property which enables compression of the log
+// buffers. Compression trades CPU time, when a block of messages fills, for
+// more history in the same amount of memory.
+constexpr char kCompressBuffersProperty[] =
+    "persist.wifilogd.compress_buffers";
+// The name of the system property which enables aligned storage of
+// uncompressed log buffers (see LogBuffer::Mode::kAligned). Alignment trades
+// some capacity for faster dumps.
+constexpr char kAlignBuffersProperty[] = "persist.wifilogd.align_buffers";
+// The name of the system property which names the directory in which the
+// log buffers persist.
+constexpr char kBufferDirProperty[] = "persist.wifilogd.buffer_dir";
+// The name of the system property which enables rate limiting of messages
+// as they arrive (see IngestPolicy).
+constexpr char kIngestPolicyProperty[] = "persist.wifilogd.ingest_policy";
+// The name of the system property which controls whether repeats of a
+// message are logged as a count, rather than as copies of the message.
+constexpr char kCoalesceRepeatsProperty[] =
+    "persist.wifilogd.coalesce_repeats";
+// The name of the system property which configures the number of threads
+// which receive commands (see ParallelReceiver).
+constexpr char kReceiverThreadsProperty[] =
+    "persist.wifilogd.receiver_threads";
+constexpr size_t kBytesPerKiB = 1024;
+constexpr size_t kDefaultBufferSizeBytes = 128 * kBytesPerKiB;
+// Each log buffer must be able to hold a maximal message.
+constexpr size_t kMinBufferSizeBytes = 64 * kBytesPerKiB;
+constexpr size_t kMaxBufferSizeBytes = 64 * 1024 * kBytesPerKiB;
+// TODO(b/32840641): Tune the batch size.
+constexpr size_t kReceiveBatchSize = 16;
 // TODO(b/32840641): Tune the sleep time.
 constexpr auto kTransientErrorSleepTimeNsec = 100 * 1000;  // 100 usec
+constexpr int64_t kNsecPerMsec = 1000 * 1000;
 }
 
 MainLoop::MainLoop(const std::string& socket_name)
+    : MainLoop(socket_name, GetConfiguredBufferSizeBytes()) {}
+
+MainLoop::MainLoop(const std::string& socket_name, size_t buffer_size_bytes)
     : MainLoop(socket_name, std::make_unique<Os>(),
-               std::make_unique<CommandProcessor>(kMainBufferSizeBytes)) {}
+               std::make_unique<CommandProcessor>(
+                   buffer_size_bytes, std::make_unique<Os>(),
+                   Timestamper::Mode::kDeriveFromBoottime,
+                   GetConfiguredLogBufferMode(buffer_size_bytes),
+                   GetConfiguredBufferDir()),
+               kReceiveBatchSize, GetConfiguredReceiverThreads()) {
+  CHECK(buffer_size_bytes >= kMinBufferSizeBytes);
+  if (base::GetBoolProperty(kIngestPolicyProperty, false)) {
+    command_processor_->EnableIngestPolicy();
+  }
+  if (base::GetBoolProperty(kCoalesceRepeatsProperty, true)) {
+    command_processor_->EnableRepeatCoalescing();
+  }
+}
+
+size_t MainLoop::GetConfiguredBufferSizeBytes() {
+  const size_t size_kib = base::GetUintProperty<size_t>(
+      kBufferSizeProperty, kDefaultBufferSizeBytes / kBytesPerKiB,
+      kMaxBufferSizeBytes / kBytesPerKiB);
+  return std::max(size_kib * kBytesPerKiB, kMinBufferSizeBytes);
+}
+
+LogBuffer::Mode MainLoop::GetConfiguredLogBufferMode(size_t buffer_size_bytes) {
+  const LogBuffer::Mode uncompressed_mode =
+      base::GetBoolProperty(kAlignBuffersProperty, false)
+          ? LogBuffer::Mode::kAligned
+          : LogBuffer::Mode::kUncompressed;
+  if (!base::GetBoolProperty(kCompressBuffersProperty, false)) {
+    return uncompressed_mode;
+  }
+  if (!GetConfiguredBufferDir().empty()) {
+    LOG(WARNING) << "Persistent log buffers cannot be compressed; storing "
+                    "uncompressed";
+    return uncompressed_mode;
+  }
+  const size_t min_share = *std::min_element(
+      CommandProcessor::kLogBufferShares.begin(),
+      CommandProcessor::kLogBufferShares.end());
+  if (buffer_size_bytes * min_share /
+          CommandProcessor::kLogBufferShareDenominator <
+      LogBuffer::GetMinCompressedSize()) {
+    LOG(WARNING) << "Buffer size " << buffer_size_bytes
+                 << " is too small for compression; storing uncompressed";
+    return uncompressed_mode;
+  }
+  return LogBuffer::Mode::kCompressed;
+}
+
+std::string MainLoop::GetConfiguredBufferDir() {
+  return base::GetProperty(kBufferDirProperty, "");
+}
+
+size_t MainLoop::GetConfiguredReceiverThreads() {
+  return base::GetUintProperty<size_t>(kReceiverThreadsProperty, 0,
+                                       ParallelReceiver::kMaxThreads);
+}
 
 MainLoop::MainLoop(const std::string& socket_name, std::unique_ptr<Os> os,
-                   std::unique_ptr<CommandProcessor> command_processor)
-    : os_(std::move(os)), command_processor_(std::move(command_processor)) {
+                   std::unique_ptr<CommandProcessor> command_processor,
+                   size_t receive_batch_size, size_t n_receiver_threads)
+    : os_(std::move(os)),
+      command_processor_(std::move(command_processor)),
+      receive_batch_size_(receive_batch_size),
+      receive_bufs_(
+          new uint8_t[receive_batch_size * protocol::kMaxMessageSize]),
+      datagram_lens_(new size_t[receive_batch_size]),
+      datagram_fds_(new int[receive_batch_size]),
+      n_batches_received_(0),
+      n_datagrams_received_(0),
+      sock_fd_(Os::kInvalidFd),
+      epoll_fd_(),
+      ready_fds_(),
+      fd_handlers_(),
+      timers_(),
+      idle_tasks_(),
+      idle_work_pending_(true),
+      parallel_receiver_() {
+  CHECK(receive_batch_size > 0);
+  CHECK(receive_batch_size <= Os::kMaxDatagramBatchSize);
+
   Os::Errno err;
   std::tie(sock_fd_, err) = os_->GetControlSocket(socket_name);
   if (err) {
     PLOG(FATAL) << "Failed to get control socket";
   }
+
+  int epoll_fd;
+  std::tie(epoll_fd, err) = os_->CreateEpoll();
+  if (err) {
+    LOG(FATAL) << "Failed to create epoll instance: " << std::strerror(err);
+  }
+  epoll_fd_.reset(epoll_fd);
+
+  if (n_receiver_threads) {
+    // Each receiver waits for the socket to become readable, and then
+    // races the others to receive. The losers must not block.
+    err = os_->SetNonBlocking(sock_fd_);
+    if (err) {
+      LOG(FATAL) << "Failed to make control socket non-blocking: "
+                 << std::strerror(err);
+    }
+    parallel_receiver_ = std::make_unique<ParallelReceiver>(
+        os_.get(), sock_fd_, n_receiver_threads, receive_batch_size,
+        Timestamper::Mode::kDeriveFromBoottime);
+    AddFdHandler(parallel_receiver_->GetWakeupFd(), [this]() {
+      parallel_receiver_->ProcessStagedCommands(command_processor_.get());
+    });
+  } else {
+    AddFdHandler(sock_fd_, [this]() { ReceiveCommands(); });
+  }
+  AddIdleTask([this]() { return command_processor_->DoIdleWork(); });
+}
+
+double MainLoop::GetAverageBatchDepth() const {
+  uint64_t n_batches = n_batches_received_;
+  uint64_t n_datagrams = n_datagrams_received_;
+  if (parallel_receiver_) {
+    n_batches += parallel_receiver_->GetNumBatchesReceived();
+    n_datagrams += parallel_receiver_->GetNumDatagramsReceived();
+  }
+  if (!n_batches) {
+    return 0;
+  }
+  return static_cast<double>(n_datagrams) / n_batches;
+}
+
+void MainLoop::AddFdHandler(int fd, FdHandler handler) {
+  CHECK(fd_handlers_.find(fd) == fd_handlers_.end());
+  const Os::Errno err = os_->AddEpollFd(epoll_fd_.get(), fd);
+  if (err) {
+    LOG(FATAL) << "Failed to watch fd " << fd << ": " << std::strerror(err);
+  }
+  fd_handlers_.emplace(fd, std::move(handler));
+}
+
+void MainLoop::RemoveFdHandler(int fd) {
+  CHECK(fd_handlers_.find(fd) != fd_handlers_.end());
+  const Os::Errno err = os_->RemoveEpollFd(epoll_fd_.get(), fd);
+  if (err) {
+    LOG(FATAL) << "Failed to unwatch fd " << fd << ": " << std::strerror(err);
+  }
+  fd_handlers_.erase(fd);
+}
+
+void MainLoop::AddPeriodicTimer(uint32_t period_msec, TimerCallback callback) {
+  CHECK(period_msec > 0);
+  const int64_t period_nsec = period_msec * kNsecPerMsec;
+  timers_.push_back(
+      {period_nsec,
+       os_->GetTimestamp(CLOCK_MONOTONIC).ToNsec() + period_nsec,
+       std::move(callback)});
+}
+
+void MainLoop::AddIdleTask(IdleTask task) {
+  idle_tasks_.push_back(std::move(task));
+  idle_work_pending_ = true;
 }
 
 void MainLoop::RunOnce() {
-  std::array<uint8_t, protocol::kMaxMessageSize> input_buf;
-  size_t datagram_len;
+  size_t n_ready;
   Os::Errno err;
-  std::tie(datagram_len, err) =
-      os_->ReceiveDatagram(sock_fd_, input_buf.data(), input_buf.size());
+  std::tie(n_ready, err) =
+      os_->WaitForReadableFds(epoll_fd_.get(), ready_fds_.data(),
+                              ready_fds_.size(), GetWaitTimeoutMsec());
   if (err) {
     ProcessError(err);
     return;
   }
 
-  if (datagram_len > protocol::kMaxMessageSize) {
-    // TODO(b/32098735): Increment stats counter.
-    datagram_len = protocol::kMaxMessageSize;
+  CHECK(n_ready <= ready_fds_.size());
+  for (size_t i = 0; i < n_ready; ++i) {
+    const auto handler_it = fd_handlers_.find(ready_fds_[i]);
+    if (handler_it == fd_handlers_.end()) {
+      // The handler was removed by an earlier handler.
+      continue;
+    }
+    // Call a copy, as the handler may remove itself.
+    const FdHandler handler = handler_it->second;
+    handler();
+  }
+  if (n_ready) {
+    // Handling a file descriptor may have created new idle work.
+    idle_work_pending_ = true;
   }
 
-  command_processor_->ProcessCommand(input_buf.data(), datagram_len,
-                                     Os::kInvalidFd);
+  RunExpiredTimers();
+  if (!n_ready && idle_work_pending_) {
+    RunIdleTasks();
+  }
 }
 
 // Private methods below.
 
+int MainLoop::GetWaitTimeoutMsec() const {
+  if (idle_work_pending_ && !idle_tasks_.empty()) {
+    return 0;
+  }
+  if (timers_.empty()) {
+    return -1;
+  }
+
+  const int64_t now_nsec = os_->GetTimestamp(CLOCK_MONOTONIC).ToNsec();
+  int64_t min_deadline_nsec = timers_.front().deadline_nsec;
+  for (const auto& timer : timers_) {
+    min_deadline_nsec = std::min(min_deadline_nsec, timer.deadline_nsec);
+  }
+  if (min_deadline_nsec <= now_nsec) {
+    return 0;
+  }
+  // Round up, so that we don't wake before the deadline.
+  const int64_t timeout_msec =
+      (min_deadline_nsec - now_nsec + kNsecPerMsec - 1) / kNsecPerMsec;
+  return SAFELY_CLAMP(timeout_msec, int, 0,
+                      local_utils::GetMaxVal<int>());
+}
+
+void MainLoop::ReceiveCommands() {
+  size_t n_datagrams;
+  Os::Errno err;
+  if (receive_batch_size_ == 1) {
+    // No point in the extra bookkeeping of ReceiveDatagrams().
+    n_datagrams = 1;
+    datagram_fds_[0] = Os::kInvalidFd;
+    std::tie(datagram_lens_[0], err) = os_->ReceiveDatagram(
+        sock_fd_, receive_bufs_.get(), protocol::kMaxMessageSize);
+  } else {
+    std::tie(n_datagrams, err) = os_->ReceiveDatagrams(
+        sock_fd_, receive_bufs_.get(), protocol::kMaxMessageSize,
+        receive_batch_size_, datagram_lens_.get(), datagram_fds_.get());
+  }
+  if (err) {
+    ProcessError(err);
+    return;
+  }
+
+  CHECK(n_datagrams <= receive_batch_size_);
+  ++n_batches_received_;
+  n_datagrams_received_ += n_datagrams;
+  for (size_t i = 0; i < n_datagrams; ++i) {
+    if (datagram_lens_[i] > protocol::kMaxMessageSize) {
+      command_processor_->CountTruncatedDatagram();
+      datagram_lens_[i] = protocol::kMaxMessageSize;
+    }
+  }
+
+  command_processor_->ProcessCommands(
+      receive_bufs_.get(), protocol::kMaxMessageSize, datagram_lens_.get(),
+      datagram_fds_.get(), n_datagrams);
+}
+
 void MainLoop::ProcessError(Os::Errno err) {
-  if (err == EINTR || err == ENOMEM) {
-    // TODO(b/32098735): Increment stats counter.
+  if (err == ENOMEM) {
+    // The system is short on memory. Give some back, then retry later.
+    command_processor_->CountRetriedReceiveError(err);
+    command_processor_->ShrinkBuffers();
+    os_->Nanosleep(kTransientErrorSleepTimeNsec);
+    return;
+  }
+
+  if (err == EINTR) {
+    command_processor_->CountRetriedReceiveError(err);
     os_->Nanosleep(kTransientErrorSleepTimeNsec);
     return;
   }
@@ -83,5 +350,32 @@ void MainLoop::ProcessError(Os::Errno err) {
   PLOG(FATAL) << "Unexpected error";
 }
 
+void MainLoop::RunIdleTasks() {
+  bool more_work = false;
+  // Index, rather than iterate, as a task may add more tasks.
+  for (size_t i = 0; i < idle_tasks_.size(); ++i) {
+    const IdleTask task = idle_tasks_[i];
+    more_work |= task();
+  }
+  idle_work_pending_ = more_work;
+}
+
+void MainLoop::RunExpiredTimers() {
+  if (timers_.empty()) {
+    return;
+  }
+
+  const int64_t now_nsec = os_->GetTimestamp(CLOCK_MONOTONIC).ToNsec();
+  // Index, rather than iterate, as a callback may add more timers.
+  for (size_t i = 0; i < timers_.size(); ++i) {
+    if (timers_[i].deadline_nsec > now_nsec) {
+      continue;
+    }
+    timers_[i].deadline_nsec = now_nsec + timers_[i].period_nsec;
+    const TimerCallback callback = timers_[i].callback;
+    callback();
+  }
+}
+
 }  // namespace wifilogd
 }  // namespace android
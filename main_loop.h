@@ -17,36 +17,170 @@
 #ifndef MAIN_LOOP_H_
 #define MAIN_LOOP_H_
 
+#include <array>
+#include <cstdint>
+#include <functional>
+#include <map>
 #include <memory>
 #include <string>
+#include <vector>
 
 #include "android-base/macros.h"
+#include "android-base/unique_fd.h"
 
 #include "wifilogd/command_processor.h"
+#include "wifilogd/log_buffer.h"
 #include "wifilogd/os.h"
+#include "wifilogd/parallel_receiver.h"
 
 namespace android {
 namespace wifilogd {
 
-// The main event loop for wifilogd.
+// The main event loop for wifilogd. Each iteration waits (via epoll) for
+// any of the registered file descriptors to become readable, and calls the
+// handler for each readable descriptor. The control socket is always
+// registered. The loop also runs periodic timers, and runs idle tasks when
+// no descriptor is readable.
 class MainLoop {
  public:
+  // Called when a registered file descriptor becomes readable.
+  using FdHandler = std::function<void()>;
+  // Called when a timer expires.
+  using TimerCallback = std::function<void()>;
+  // Called when the loop is idle. Should do a small amount of work, and
+  // return true if more work remains.
+  using IdleTask = std::function<bool()>;
+
+  // Constructs a MainLoop with the buffer size configured for this device.
   explicit MainLoop(const std::string& socket_name);
+
+  // Constructs a MainLoop with |buffer_size_bytes| of log buffer space.
+  // (E.g., for a size given on the command line.) Messages are rate limited
+  // as they arrive if the system property persist.wifilogd.ingest_policy is
+  // true (see CommandProcessor::EnableIngestPolicy()). Repeated messages are
+  // coalesced unless persist.wifilogd.coalesce_repeats is false (see
+  // CommandProcessor::EnableRepeatCoalescing()). Commands are received on
+  // the number of threads given by GetConfiguredReceiverThreads().
+  MainLoop(const std::string& socket_name, size_t buffer_size_bytes);
+
+  // Constructs a MainLoop which receives up to |receive_batch_size| datagrams
+  // per iteration. |receive_batch_size| must be between 1 and
+  // Os::kMaxDatagramBatchSize. File descriptors passed with a datagram are
+  // received only if |receive_batch_size| is greater than 1.
+  //
+  // If |n_receiver_threads| is non-zero, commands are instead received by
+  // a ParallelReceiver with that many threads, which receive up to
+  // |receive_batch_size| datagrams at a time (with file descriptors), and
+  // timestamp them in Timestamper::Mode::kDeriveFromBoottime. The loop
+  // then watches the ParallelReceiver, rather than the control socket, and
+  // the control socket is made non-blocking.
   MainLoop(const std::string& socket_name, std::unique_ptr<Os> os,
-           std::unique_ptr<CommandProcessor> command_processor);
+           std::unique_ptr<CommandProcessor> command_processor,
+           size_t receive_batch_size = 1, size_t n_receiver_threads = 0);
+
+  // Returns the log buffer size configured by the system property
+  // persist.wifilogd.buffer_size_kb, clamped to the supported range. If the
+  // property is unset or invalid, returns the default size.
+  static size_t GetConfiguredBufferSizeBytes();
+
+  // Returns the log buffer mode configured by the system properties
+  // persist.wifilogd.compress_buffers and persist.wifilogd.align_buffers.
+  // Compression is used only if each log buffer, given |buffer_size_bytes|
+  // of buffer space, would be large enough for LogBuffer::Mode::kCompressed,
+  // and the log buffers do not persist (see GetConfiguredBufferDir()).
+  // Otherwise, messages are stored uncompressed, and aligned if so
+  // configured.
+  static LogBuffer::Mode GetConfiguredLogBufferMode(size_t buffer_size_bytes);
+
+  // Returns the directory configured by the system property
+  // persist.wifilogd.buffer_dir, in which the log buffers persist. (E.g., a
+  // directory on tmpfs, so that the logs survive a restart of wifilogd,
+  // but not a reboot.) Returns the empty string if the property is unset,
+  // in which case the log buffers are kept in memory.
+  static std::string GetConfiguredBufferDir();
+
+  // Returns the number of receiving threads configured by the system
+  // property persist.wifilogd.receiver_threads, clamped to
+  // ParallelReceiver::kMaxThreads. If the property is unset or invalid,
+  // returns 0, in which case the loop receives commands itself. (That
+  // suits devices with few cores.)
+  static size_t GetConfiguredReceiverThreads();
+
+  // Returns the average number of datagrams received per iteration of the
+  // loop (or, with receiver threads, per batch that a thread received).
+  // Iterations which failed to receive any datagrams are not counted.
+  double GetAverageBatchDepth() const;
+
+  // Calls |handler| whenever |fd| is readable. |fd| must not already have
+  // a handler. The caller retains ownership of |fd|.
+  void AddFdHandler(int fd, FdHandler handler);
 
-  // Runs one iteration of the loop.
+  // Stops watching |fd|, which must have a handler. May be called from
+  // within the handler itself.
+  void RemoveFdHandler(int fd);
+
+  // Calls |callback| every |period_msec| milliseconds (measured on
+  // CLOCK_MONOTONIC), starting |period_msec| from now. |period_msec| must
+  // be non-zero. A timer which expires while the loop is busy runs late,
+  // rather than running multiple times to catch up.
+  void AddPeriodicTimer(uint32_t period_msec, TimerCallback callback);
+
+  // Adds |task| to the tasks which are run when the loop is idle. Idle
+  // tasks run only when no file descriptor is readable, so that they do not
+  // add to the latency of handling incoming commands. Once every idle task
+  // has reported that it has no more work, idle tasks are not run again
+  // until a file descriptor has been handled.
+  void AddIdleTask(IdleTask task);
+
+  // Runs one iteration of the loop. Blocks until a file descriptor is
+  // readable, a timer expires, or (if idle work is pending) immediately.
   void RunOnce();
 
  private:
+  struct Timer {
+    int64_t period_nsec;
+    int64_t deadline_nsec;
+    TimerCallback callback;
+  };
+
+  // Returns the timeout for the next wait, in milliseconds, per the
+  // conventions of Os::WaitForReadableFds().
+  int GetWaitTimeoutMsec() const;
+
   void ProcessError(Os::Errno err);
 
+  // Receives and processes the commands waiting on the control socket.
+  void ReceiveCommands();
+
+  // Runs each idle task once.
+  void RunIdleTasks();
+
+  // Runs the callback of each timer which has expired.
+  void RunExpiredTimers();
+
   std::unique_ptr<Os> os_;
   std::unique_ptr<CommandProcessor> command_processor_;
+  const size_t receive_batch_size_;
+  // Storage for received datagrams. Allocated once, and reused on every
+  // iteration of the loop, to avoid per-iteration allocation.
+  const std::unique_ptr<uint8_t[]> receive_bufs_;
+  const std::unique_ptr<size_t[]> datagram_lens_;
+  const std::unique_ptr<int[]> datagram_fds_;
+  uint64_t n_batches_received_;
+  uint64_t n_datagrams_received_;
   // We use an int, rather than a unique_fd, because the file
   // descriptor's lifetime is managed by init. (init creates
   // the socket before forking our process.)
   int sock_fd_;
+  ::android::base::unique_fd epoll_fd_;
+  std::array<int, Os::kMaxReadyFds> ready_fds_;
+  std::map<int, FdHandler> fd_handlers_;
+  std::vector<Timer> timers_;
+  std::vector<IdleTask> idle_tasks_;
+  bool idle_work_pending_;
+  // Null unless commands are received on other threads. Declared last, so
+  // that the threads stop before anything else is destroyed.
+  std::unique_ptr<ParallelReceiver> parallel_receiver_;
 
   DISALLOW_COPY_AND_ASSIGN(MainLoop);
 };
@@ -50,6 +50,19 @@ class MemoryReader {
     return out;
   }
 
+  // Copies the fields of |LayoutT| (a RecordLayout) out of our referenced
+  // memory, with a single bounds check, aborting if LayoutT::kSize exceeds
+  // the number of bytes available. On success, updates the read position,
+  // and the number of bytes available.
+  template <typename LayoutT>
+  typename LayoutT::Fields CopyOutLayoutOrDie() {
+    CHECK(head_);
+    const auto out = LayoutT::ReadOrDie(head_, n_bytes_avail_);
+    head_ += LayoutT::kSize;
+    n_bytes_avail_ -= LayoutT::kSize;
+    return out;
+  }
+
   // Returns a pointer to the next bytes available for reading. Aborts if
   // the number of available bytes is less than |n_bytes|. On success, updates
   // the read position, and the number of bytes available.
@@ -14,49 +14,200 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
 #include <cinttypes>
 #include <cstring>
+#include <utility>
 
 #include "android-base/logging.h"
 
 #include "wifilogd/message_buffer.h"
+#include "wifilogd/profiler.h"
 
 namespace android {
 namespace wifilogd {
 
+using ::android::base::unique_fd;
 using local_utils::CopyFromBufferOrDie;
 
-MessageBuffer::MessageBuffer(size_t size)
-    : data_(new uint8_t[size]), capacity_(size), read_pos_(0), write_pos_(0) {
-  CHECK(size > GetHeaderSize());
+constexpr size_t MessageBuffer::kRecordAlignment;
+
+namespace {
+
+// Identifies a backing file. ("WLOG", in little-endian order.)
+constexpr uint32_t kPersistentMagic = 0x474f4c57;
+// Incremented whenever the layout of a backing file changes.
+constexpr uint32_t kPersistentVersion = 2;
+
+// Returns the length of the mapping for a buffer of |size| bytes. A
+// backing file needs an extra page, for its header.
+size_t GetMappingLen(size_t size, const unique_fd& backing_file) {
+  return backing_file.get() >= 0 ? getpagesize() + size : size;
 }
 
-bool MessageBuffer::Append(const uint8_t* message, uint16_t message_len) {
-  CHECK(message_len);
+uint8_t* MapStorage(size_t len, int backing_fd) {
+  void* storage;
+  if (backing_fd >= 0) {
+    // Sizing the file does not allocate its blocks, so (as with anonymous
+    // memory) pages are committed on first write.
+    if (ftruncate(backing_fd, len)) {
+      PLOG(FATAL) << "Failed to size buffer file to " << len << " bytes";
+    }
+    storage = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+                   backing_fd, 0);
+  } else {
+    // MAP_NORESERVE, because the buffer may well never fill. Pages are
+    // committed (zero-filled) on first write.
+    storage = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+  }
+  if (storage == MAP_FAILED) {
+    PLOG(FATAL) << "Failed to map " << len << " bytes of buffer storage";
+  }
+  return static_cast<uint8_t*>(storage);
+}
+
+size_t GetRecordAlignment(MessageBuffer::Framing framing) {
+  return framing == MessageBuffer::Framing::kAligned
+             ? MessageBuffer::kRecordAlignment
+             : 1;
+}
+
+}  // namespace
 
-  if (!CanFitNow(message_len)) {
+MessageBuffer::MessageBuffer(size_t size) : MessageBuffer(size, unique_fd()) {}
+
+MessageBuffer::MessageBuffer(size_t size, unique_fd backing_file)
+    : MessageBuffer(size, std::move(backing_file), Framing::kPacked) {}
+
+MessageBuffer::MessageBuffer(size_t size, unique_fd backing_file,
+                             Framing framing)
+    : backing_file_(std::move(backing_file)),
+      mapping_len_(GetMappingLen(size, backing_file_)),
+      mapping_(MapStorage(mapping_len_, backing_file_.get())),
+      persistent_header_(backing_file_.get() >= 0
+                             ? reinterpret_cast<PersistentHeader*>(mapping_)
+                             : nullptr),
+      data_(mapping_ + (mapping_len_ - size)),
+      record_alignment_(GetRecordAlignment(framing)),
+      capacity_(size / record_alignment_ * record_alignment_),
+      begin_pos_(0),
+      read_pos_(0),
+      write_pos_(0),
+      last_pos_(0),
+      reserved_pos_(0),
+      reserved_len_(0),
+      n_messages_(0),
+      n_evicted_(0),
+      n_recovered_(0),
+      eviction_handler_() {
+  CHECK(capacity_ > GetPayloadOffset());
+  if (persistent_header_) {
+    CHECK(sizeof(PersistentHeader) <= static_cast<size_t>(getpagesize()));
+    RecoverOrInitialize();
+  }
+}
+
+MessageBuffer::~MessageBuffer() { munmap(mapping_, mapping_len_); }
+
+void MessageBuffer::SetEvictionHandler(EvictionHandler handler) {
+  eviction_handler_ = std::move(handler);
+}
+
+bool MessageBuffer::Append(const uint8_t* message, uint16_t message_len) {
+  uint8_t* const reserved = Reserve(message_len);
+  if (!reserved) {
     return false;
   }
 
-  AppendHeader(message_len);
-  AppendRawBytes(message, message_len);
+  std::memcpy(reserved, message, message_len);
+  Commit(message_len);
   return true;
 }
 
+uint8_t* MessageBuffer::Reserve(uint16_t data_len) {
+  WIFILOGD_PROFILE_SCOPE(ProfiledStage::kBufferReserve);
+  CHECK(data_len);
+  CHECK(!reserved_len_);
+
+  if (!CanFitEver(data_len)) {
+    return nullptr;
+  }
+
+  const size_t record_len = GetRecordLen(data_len);
+  const uint64_t record_pos = GetNextRecordPos(record_len);
+  while (record_pos + record_len - begin_pos_ > capacity_) {
+    if (begin_pos_ == write_pos_) {
+      // The buffer is empty, so there's nothing to pad out. Start afresh
+      // at |record_pos|.
+      begin_pos_ = read_pos_ = write_pos_ = record_pos;
+      PersistPositions();
+      break;
+    }
+    EvictOldestMessage();
+  }
+
+  // Any padding is written in Commit(), since readers must not see padding
+  // that isn't followed by a message.
+  reserved_pos_ = record_pos;
+  reserved_len_ = data_len;
+  return data_ + GetOffset(record_pos) + GetPayloadOffset();
+}
+
+void MessageBuffer::Commit(uint16_t data_len) {
+  CHECK(reserved_len_);
+  CHECK(data_len);
+  CHECK(data_len <= reserved_len_);
+
+  if (write_pos_ != reserved_pos_) {
+    AppendPadding();
+  }
+  CHECK(write_pos_ == reserved_pos_);
+
+  AppendHeader(data_len);
+  AdvanceWritePos(AlignLen(data_len));
+  PersistPositions();
+  last_pos_ = reserved_pos_;
+  reserved_len_ = 0;
+  ++n_messages_;
+}
+
 bool MessageBuffer::CanFitEver(uint16_t length) const {
   // This unusual formulation is intended to avoid overflow.
-  return capacity_ - GetHeaderSize() >= length;
+  return capacity_ - GetPayloadOffset() >= AlignLen(length);
 }
 
 bool MessageBuffer::CanFitNow(uint16_t length) const {
-  // This unusual formulation is intended to avoid overflow/underflow.
-  return GetFreeSize() >= GetHeaderSize() &&
-         GetFreeSize() - GetHeaderSize() >= length;
+  if (!CanFitEver(length)) {
+    return false;
+  }
+
+  if (begin_pos_ == write_pos_) {
+    return true;
+  }
+
+  const size_t record_len = GetRecordLen(length);
+  return GetNextRecordPos(record_len) + record_len - begin_pos_ <= capacity_;
 }
 
 void MessageBuffer::Clear() {
+  if (eviction_handler_) {
+    while (n_messages_) {
+      EvictOldestMessage();
+    }
+  }
+  n_evicted_ += n_messages_;
+  n_messages_ = 0;
+  begin_pos_ = 0;
   read_pos_ = 0;
   write_pos_ = 0;
+  reserved_len_ = 0;
+  PersistPositions();
 }
 
 std::tuple<const uint8_t*, size_t> MessageBuffer::ConsumeNextMessage() {
@@ -64,18 +215,49 @@ std::tuple<const uint8_t*, size_t> MessageBuffer::ConsumeNextMessage() {
     return {nullptr, 0};
   }
 
-  const auto& header = CopyFromBufferOrDie<LengthHeader>(
-      data_.get() + read_pos_, GetReadableSize());
-  read_pos_ += sizeof(header);
-
-  const uint8_t* payload_start = data_.get() + read_pos_;
-  read_pos_ += header.payload_len;
+  read_pos_ = SkipPadding(read_pos_);
+  const auto& header = ReadHeader(read_pos_);
+  const uint8_t* payload_start =
+      data_ + GetOffset(read_pos_) + GetPayloadOffset();
+  read_pos_ += GetRecordLen(header.payload_len);
   CHECK(read_pos_ <= write_pos_);
 
   return {payload_start, header.payload_len};
 }
 
-void MessageBuffer::Rewind() { read_pos_ = 0; }
+size_t MessageBuffer::ConsumeNextMessages(
+    std::tuple<const uint8_t*, size_t>* messages, size_t max_messages) {
+  // Software prefetching was tried here, and measured as a net loss: the
+  // messages are read in storage order, which the hardware prefetchers
+  // already follow, and a buffer of typical size is cache-resident anyway.
+  size_t n_messages = 0;
+  while (n_messages < max_messages && read_pos_ != write_pos_) {
+    messages[n_messages++] = ConsumeNextMessage();
+  }
+  return n_messages;
+}
+
+std::tuple<uint8_t*, size_t> MessageBuffer::GetLastMessage() {
+  if (!n_messages_) {
+    return {nullptr, 0};
+  }
+
+  // Evictions remove the oldest messages, so the newest message remains
+  // for as long as any message does.
+  const auto& header = ReadHeader(last_pos_);
+  return {data_ + GetOffset(last_pos_) + GetPayloadOffset(),
+          header.payload_len};
+}
+
+void MessageBuffer::Shrink(size_t max_retained_bytes) {
+  CHECK(!reserved_len_);
+  while (GetUsedSize() > max_retained_bytes) {
+    EvictOldestMessage();
+  }
+  ReleaseFreePages();
+}
+
+void MessageBuffer::Rewind() { read_pos_ = begin_pos_; }
 
 // Private methods below.
 
@@ -83,12 +265,176 @@ void MessageBuffer::AppendHeader(uint16_t message_len) {
   LengthHeader header;
   header.payload_len = message_len;
   AppendRawBytes(&header, sizeof(header));
+  AdvanceWritePos(GetPayloadOffset() - sizeof(header));
+}
+
+void MessageBuffer::AppendPadding() {
+  const size_t tail_len = capacity_ - GetOffset(write_pos_);
+  if (tail_len >= GetHeaderSize()) {
+    // If the tail is too small to hold a header, readers will skip over it
+    // without any help from us.
+    LengthHeader header;
+    header.payload_len = 0;
+    std::memcpy(data_ + GetOffset(write_pos_), &header, sizeof(header));
+  }
+  write_pos_ += tail_len;
 }
 
 void MessageBuffer::AppendRawBytes(const void* data_start, size_t data_len) {
-  std::memcpy(data_.get() + write_pos_, data_start, data_len);
+  const size_t offset = GetOffset(write_pos_);
+  CHECK(data_len <= capacity_ - offset);
+  std::memcpy(data_ + offset, data_start, data_len);
+  write_pos_ += data_len;
+}
+
+void MessageBuffer::AdvanceWritePos(size_t data_len) {
+  CHECK(data_len <= capacity_ - GetOffset(write_pos_));
   write_pos_ += data_len;
-  CHECK(write_pos_ <= capacity_);
+}
+
+void MessageBuffer::EvictOldestMessage() {
+  CHECK(begin_pos_ != write_pos_);
+  begin_pos_ = SkipPadding(begin_pos_);
+  const uint16_t message_len = ReadHeader(begin_pos_).payload_len;
+  if (eviction_handler_) {
+    eviction_handler_(data_ + GetOffset(begin_pos_) + GetPayloadOffset(),
+                      message_len);
+  }
+  begin_pos_ += GetRecordLen(message_len);
+  CHECK(begin_pos_ <= write_pos_);
+  PersistPositions();
+  if (read_pos_ < begin_pos_) {
+    read_pos_ = begin_pos_;
+  }
+  --n_messages_;
+  ++n_evicted_;
+}
+
+uint64_t MessageBuffer::GetNextRecordPos(size_t record_len) const {
+  const size_t tail_len = capacity_ - GetOffset(write_pos_);
+  if (tail_len >= record_len) {
+    return write_pos_;
+  }
+  return write_pos_ + tail_len;
+}
+
+void MessageBuffer::ReleaseFreePages() {
+  const size_t page_size = getpagesize();
+  // The unused storage runs from |write_pos_| to |begin_pos_|, wrapping
+  // around the end of the storage if necessary. So it maps to at most two
+  // ranges of offsets.
+  const size_t free_len = GetFreeSize();
+  const size_t free_start = GetOffset(write_pos_);
+  const size_t first_len = std::min(free_len, capacity_ - free_start);
+  const std::array<std::tuple<size_t, size_t>, 2> free_ranges{
+      {std::make_tuple(free_start, free_start + first_len),
+       std::make_tuple(size_t{0}, free_len - first_len)}};
+  for (const auto& range : free_ranges) {
+    // Release only whole pages, so that we don't discard live data that
+    // shares a page with free space.
+    const size_t start =
+        (std::get<0>(range) + page_size - 1) / page_size * page_size;
+    const size_t end = std::get<1>(range) / page_size * page_size;
+    if (start >= end) {
+      continue;
+    }
+    // Dropping the pages of a shared mapping would leave the file's pages
+    // in memory. So, for a backing file, free the file's pages instead.
+    const bool failed =
+        backing_file_.get() >= 0
+            ? fallocate(backing_file_.get(),
+                        FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+                        (data_ - mapping_) + start, end - start)
+            : madvise(data_ + start, end - start, MADV_DONTNEED);
+    if (failed) {
+      PLOG(ERROR) << "Failed to release buffer pages";
+    }
+  }
+}
+
+void MessageBuffer::RecoverOrInitialize() {
+  PersistentHeader* const header = persistent_header_;
+  size_t n_messages;
+  uint64_t last_pos;
+  if (header->magic == kPersistentMagic &&
+      header->version == kPersistentVersion &&
+      header->capacity == capacity_ &&
+      header->record_alignment == record_alignment_ &&
+      ValidateMessages(header->begin_pos, header->write_pos, &n_messages,
+                       &last_pos)) {
+    begin_pos_ = read_pos_ = header->begin_pos;
+    write_pos_ = header->write_pos;
+    last_pos_ = last_pos;
+    n_messages_ = n_recovered_ = n_messages;
+    ++header->generation;
+    return;
+  }
+
+  // Clear the magic first, so that a crash while we initialize the header
+  // does not leave a header which looks valid.
+  header->magic = 0;
+  std::atomic_signal_fence(std::memory_order_release);
+  header->version = kPersistentVersion;
+  header->capacity = capacity_;
+  header->record_alignment = record_alignment_;
+  header->generation = 1;
+  header->begin_pos = 0;
+  header->write_pos = 0;
+  std::atomic_signal_fence(std::memory_order_release);
+  header->magic = kPersistentMagic;
+}
+
+bool MessageBuffer::ValidateMessages(uint64_t begin_pos, uint64_t write_pos,
+                                     size_t* n_messages,
+                                     uint64_t* last_pos) const {
+  if (begin_pos > write_pos || write_pos - begin_pos > capacity_ ||
+      begin_pos % record_alignment_ || write_pos % record_alignment_) {
+    return false;
+  }
+
+  // As in SkipPadding() and ReadHeader(), but without CHECKs, since the
+  // file may hold anything.
+  *n_messages = 0;
+  *last_pos = begin_pos;
+  uint64_t pos = begin_pos;
+  while (pos < write_pos) {
+    const size_t tail_len = capacity_ - GetOffset(pos);
+    if (tail_len < GetHeaderSize()) {
+      pos += tail_len;
+      continue;
+    }
+    LengthHeader header;
+    std::memcpy(&header, data_ + GetOffset(pos), sizeof(header));
+    if (!header.payload_len) {
+      pos += tail_len;
+      continue;
+    }
+    if (header.payload_len > tail_len - GetPayloadOffset()) {
+      return false;
+    }
+    *last_pos = pos;
+    pos += GetRecordLen(header.payload_len);
+    ++*n_messages;
+  }
+  return pos == write_pos;
+}
+
+MessageBuffer::LengthHeader MessageBuffer::ReadHeader(uint64_t pos) const {
+  const size_t offset = GetOffset(pos);
+  const auto& header = CopyFromBufferOrDie<LengthHeader>(data_ + offset,
+                                                         capacity_ - offset);
+  // Positions are aligned, so the padding after the message also fits.
+  CHECK(header.payload_len <= capacity_ - offset - GetPayloadOffset());
+  return header;
+}
+
+uint64_t MessageBuffer::SkipPadding(uint64_t pos) const {
+  const size_t tail_len = capacity_ - GetOffset(pos);
+  if (tail_len < GetHeaderSize() || !ReadHeader(pos).payload_len) {
+    pos += tail_len;
+  }
+  CHECK(pos < write_pos_);
+  return pos;
 }
 
 }  // namespace wifilogd
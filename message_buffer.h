@@ -17,21 +17,52 @@
 #ifndef MESSAGE_BUFFER_H_
 #define MESSAGE_BUFFER_H_
 
+#include <atomic>
 #include <cstdint>
-#include <memory>
+#include <functional>
 #include <tuple>
 
 #include "android-base/macros.h"
+#include "android-base/unique_fd.h"
 
 #include "wifilogd/local_utils.h"
 
 namespace android {
 namespace wifilogd {
 
-// A fixed-size buffer, which provides FIFO access to read and write
-// a sequence of messages.
+// A fixed-size ring buffer, which provides FIFO access to read and write
+// a sequence of messages. When the buffer is full, appending a message
+// evicts the oldest messages, to make room for the new one.
+//
+// Messages are stored contiguously, and never wrap around the end of the
+// underlying storage. When a message does not fit in the space remaining at
+// the end of the storage, that space is skipped, and the message is written
+// at the start of the storage instead.
+//
+// The storage is reserved as anonymous virtual memory, so physical pages are
+// only committed once messages are written into them. Shrink() returns
+// pages to the system.
+//
+// Alternatively, the storage can be a file (e.g., on tmpfs), so that the
+// messages survive a crash or restart of the process. The file starts with
+// a header page, which records the positions of the oldest message and of
+// the end of the newest message. Those positions are updated as messages
+// are evicted and committed, and always describe a valid sequence of
+// messages. A MessageBuffer constructed on the same file later recovers
+// those messages, in place.
+//
+// By default, messages are packed back to back, each behind a 2-byte header.
+// In Framing::kAligned, each message instead starts on a kRecordAlignment
+// boundary (as does its header), and the space used for alignment counts
+// against the buffer's capacity. That lets the reader load a message's
+// 64-bit fields with aligned accesses.
 class MessageBuffer {
  public:
+  enum class Framing { kPacked, kAligned };
+
+  // The alignment of each message's storage, in Framing::kAligned.
+  static constexpr size_t kRecordAlignment = 8;
+
   // A wrapper which guarantees that a MessageBuffer will be rewound,
   // when the program exits the wrapper's scope. The user must ensure that
   // |buffer| does not expire before the ScopedRewinder.
@@ -44,64 +75,250 @@ class MessageBuffer {
     MessageBuffer* const buffer_;
   };
 
+  // Called with each message, just before the message is evicted. (Lets
+  // the owner release anything that the message refers to.)
+  using EvictionHandler =
+      std::function<void(const uint8_t* message, size_t message_len)>;
+
   // Constructs the buffer. |size| must be greater than GetHeaderSize().
   explicit MessageBuffer(size_t size);
 
-  // Appends a single message to the buffer. |data_len| must be >=1. Returns
-  // true if the message was added to the buffer.
+  // Constructs a buffer whose storage is |backing_file|, as described
+  // above, or anonymous memory if |backing_file| is invalid. Any messages
+  // left in |backing_file| by a buffer of the same |size| are recovered.
+  // (Otherwise, the file is reinitialized.) |size| must be greater than
+  // GetHeaderSize().
+  MessageBuffer(size_t size, ::android::base::unique_fd backing_file);
+
+  // Constructs a buffer as above, whose messages are laid out as described
+  // for |framing|. In Framing::kAligned, any part of |size| that is not a
+  // multiple of kRecordAlignment goes unused, and messages are recovered
+  // only from a backing file that was written with the same |framing|.
+  MessageBuffer(size_t size, ::android::base::unique_fd backing_file,
+                Framing framing);
+  ~MessageBuffer();
+
+  // Sets the handler to be called when messages are evicted, whether to make
+  // room for new messages, by Shrink(), or by Clear().
+  void SetEvictionHandler(EvictionHandler handler);
+
+  // Appends a single message to the buffer. |data_len| must be >=1. If the
+  // buffer does not have enough free space for the message, evicts the oldest
+  // messages until the new message fits. Returns true if the message was
+  // added to the buffer. (That is, returns false only if the message could
+  // never fit, per CanFitEver().)
   bool Append(NONNULL const uint8_t* data, uint16_t data_len);
 
+  // Reserves space for a single message of up to |data_len| bytes, and
+  // returns a pointer to that space. |data_len| must be >=1. As with
+  // Append(), evicts the oldest messages if needed. The caller may write
+  // the message into the returned space, and should then call Commit().
+  // The message is not visible to readers until it is committed. At most
+  // one reservation may be outstanding. Returns nullptr if the message could
+  // never fit, per CanFitEver().
+  uint8_t* Reserve(uint16_t data_len);
+
+  // Commits the message in the outstanding reservation. |data_len| gives
+  // the actual length of the message, and must be between 1 and the length
+  // passed to Reserve().
+  void Commit(uint16_t data_len);
+
   // Returns true if the buffer is large enough to hold |length| bytes of user
   // data, when the buffer is empty.
   bool CanFitEver(uint16_t length) const;
 
   // Returns true if the buffer currently has enough free space to hold |length|
-  // bytes of user data.
+  // bytes of user data. (That is, returns true if Append() would not need to
+  // evict any messages.)
   bool CanFitNow(uint16_t length) const;
 
   // Clears the buffer. An immediately following read operation will return an
   // empty message. An immediately following write operation will write to the
   // head of the buffer. Clearing may be lazy (i.e., underlying storage is not
-  // necessarily zeroed).
+  // necessarily zeroed). Clearing also cancels any outstanding reservation.
   void Clear();
 
   // Returns the first unread message in the buffer. If there is no such
   // message, returns {nullptr, 0}. MessageBuffer retains ownership of the
-  // message's storage.
+  // message's storage. If the next unread message has been evicted, reading
+  // resumes from the oldest message remaining in the buffer.
   std::tuple<const uint8_t*, size_t> ConsumeNextMessage();
 
-  // Returns the size of MessageBuffer's per-message header.
+  // Consumes up to |max_messages| unread messages, as if by repeated calls
+  // to ConsumeNextMessage(), and stores them in |messages|. Returns the
+  // number of messages stored, which is less than |max_messages| only if
+  // the unread messages ran out.
+  size_t ConsumeNextMessages(
+      NONNULL std::tuple<const uint8_t*, size_t>* messages,
+      size_t max_messages);
+
+  // Returns the newest message in the buffer, or {nullptr, 0} if the buffer
+  // is empty. The caller may modify the message in place (e.g., to update a
+  // counter), but may not change its length. The pointer is valid until the
+  // next call to Append(), Reserve(), Clear() or Shrink().
+  std::tuple<uint8_t*, size_t> GetLastMessage();
+
+  // Returns the size of MessageBuffer's per-message header. (In
+  // Framing::kAligned, messages also carry padding; see GetRecordLen().)
   static constexpr size_t GetHeaderSize() { return sizeof(LengthHeader); }
 
+  // Returns the space occupied by a message of |data_len| bytes, including
+  // its header, and any padding used to align the message.
+  size_t GetRecordLen(size_t data_len) const {
+    return GetPayloadOffset() + AlignLen(data_len);
+  }
+
   // Returns the total available free space in the buffer. This may be
   // larger than the usable space, due to overheads.
-  size_t GetFreeSize() const { return capacity_ - write_pos_; }
+  size_t GetFreeSize() const { return capacity_ - GetUsedSize(); }
+
+  // Returns the space occupied by messages, including overheads.
+  size_t GetUsedSize() const { return write_pos_ - begin_pos_; }
+
+  // Returns the number of messages which were recovered from the backing
+  // file, when the buffer was constructed.
+  size_t GetNumRecovered() const { return n_recovered_; }
+
+  // Returns the number of times that the backing file has been opened by
+  // a MessageBuffer, including this one. (Zero if the buffer has no backing
+  // file.) Counts from one whenever the file is reinitialized.
+  uint64_t GetGeneration() const {
+    return persistent_header_ ? persistent_header_->generation : 0;
+  }
+
+  // Returns the number of messages which have been evicted (whether to
+  // make room for new messages, by Shrink(), or by Clear()), over the
+  // life of the buffer.
+  uint64_t GetNumEvicted() const { return n_evicted_; }
 
-  // Resets the read pointer to the start of the buffer. An immediately
-  // following read will return the first message in the buffer. An immediately
+  // Evicts the oldest messages, until no more than |max_retained_bytes|
+  // of the buffer (including overheads) are in use. Then releases the
+  // physical memory backing the unused part of the buffer. (The memory is
+  // committed again, as new messages are written.) There must not be an
+  // outstanding reservation.
+  void Shrink(size_t max_retained_bytes);
+
+  // Resets the read pointer to the oldest message in the buffer. An immediately
+  // following read will return the oldest message in the buffer. An immediately
   // following write, however, will be placed at the same position as if
   // Rewind() had not been called.
   void Rewind();
 
  private:
+  // A LengthHeader with a |payload_len| of zero marks the end of the
+  // messages in the current pass over the storage. (Such a header is never
+  // written for a real message, since Append() requires |data_len| >= 1.)
   struct LengthHeader {
     uint16_t payload_len;
   };
 
+  // The header page of a backing file.
+  struct PersistentHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t capacity;
+    uint64_t record_alignment;
+    uint64_t generation;
+    uint64_t begin_pos;
+    uint64_t write_pos;
+  };
+
+  // Publishes |begin_pos_| and |write_pos_| to the backing file, if any.
+  // Must be called whenever a message is evicted (before its storage is
+  // reused), and after a message has been written.
+  void PersistPositions() {
+    if (persistent_header_) {
+      // Keep the compiler from publishing a position before the message
+      // it covers has been written. (Against a crash of this process, the
+      // ordering of the stores is all that matters.)
+      std::atomic_signal_fence(std::memory_order_release);
+      persistent_header_->begin_pos = begin_pos_;
+      persistent_header_->write_pos = write_pos_;
+    }
+  }
+
+  // Recovers the messages described by |persistent_header_|, or
+  // reinitializes the backing file if they are not valid.
+  void RecoverOrInitialize();
+
+  // Returns true if the storage between |begin_pos| and |write_pos| holds
+  // a valid sequence of messages, and stores the number of those messages
+  // in |n_messages|, and the position of the newest of them in |last_pos|.
+  bool ValidateMessages(uint64_t begin_pos, uint64_t write_pos,
+                        NONNULL size_t* n_messages,
+                        NONNULL uint64_t* last_pos) const;
+
   // Prepares a header, and writes that header into the buffer.
   void AppendHeader(uint16_t message_len);
 
+  // Marks the rest of the current pass over the storage as unused, and moves
+  // the write position to the start of the storage.
+  void AppendPadding();
+
   // Writes arbitrary data into the buffer.
   void AppendRawBytes(NONNULL const void* data_start, size_t data_len);
 
-  // Returns the total number of bytes available for reading. This number
-  // includes headers.
-  size_t GetReadableSize() const { return write_pos_ - read_pos_; }
+  // Moves the write position past |data_len| bytes that have already been
+  // written into the buffer.
+  void AdvanceWritePos(size_t data_len);
+
+  // Removes the oldest message from the buffer. The buffer must not be empty.
+  void EvictOldestMessage();
+
+  // Returns the position at which a record of |record_len| bytes (including
+  // the header) would be written.
+  uint64_t GetNextRecordPos(size_t record_len) const;
+
+  // Returns |len|, rounded up to a multiple of |record_alignment_|.
+  size_t AlignLen(size_t len) const {
+    return (len + record_alignment_ - 1) / record_alignment_ *
+           record_alignment_;
+  }
+
+  // Returns the offset of a message from the start of its record.
+  size_t GetPayloadOffset() const { return AlignLen(GetHeaderSize()); }
+
+  // Returns the offset into |data_| for |pos|.
+  size_t GetOffset(uint64_t pos) const { return pos % capacity_; }
+
+  // Releases the physical memory for any pages which lie entirely within
+  // the unused part of the buffer.
+  void ReleaseFreePages();
+
+  // Returns the header of the record starting at |pos|.
+  LengthHeader ReadHeader(uint64_t pos) const;
+
+  // Returns the position of the first record at or after |pos|, skipping over
+  // any padding at the end of the storage. There must be a record at or after
+  // |pos|.
+  uint64_t SkipPadding(uint64_t pos) const;
 
-  const std::unique_ptr<uint8_t[]> data_;
-  const size_t capacity_;
-  size_t read_pos_;
-  size_t write_pos_;
+  const ::android::base::unique_fd backing_file_;  // May be invalid.
+  const size_t mapping_len_;
+  uint8_t* const mapping_;  // Owned; from mmap().
+  // Null if there is no backing file.
+  PersistentHeader* const persistent_header_;
+  uint8_t* const data_;  // Within |mapping_|.
+  // One, in Framing::kPacked. Every position is a multiple of this.
+  const size_t record_alignment_;
+  const size_t capacity_;  // A multiple of |record_alignment_|.
+  // Positions are byte counts, which increase monotonically over the life
+  // of the buffer (until Clear()). Hence, every position between
+  // |begin_pos_| and |write_pos_| maps to a unique offset in |data_|.
+  // We use 64-bit positions, so that positions do not overflow in practice,
+  // even on 32-bit platforms.
+  uint64_t begin_pos_;  // Start of the oldest message.
+  uint64_t read_pos_;
+  uint64_t write_pos_;
+  // Start of the record for the newest message. Valid if |n_messages_| is
+  // non-zero.
+  uint64_t last_pos_;
+  uint64_t reserved_pos_;  // Start of the record for the reserved message.
+  uint16_t reserved_len_;  // Zero if there is no outstanding reservation.
+  size_t n_messages_;      // Messages between |begin_pos_| and |write_pos_|.
+  uint64_t n_evicted_;
+  size_t n_recovered_;
+  EvictionHandler eviction_handler_;  // May be empty.
 
   // MessageBuffer is a value type, so it would be semantically reasonable to
   // support copy and assign. Performance-wise, though, we should avoid
@@ -14,7 +14,16 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
 #include <algorithm>
+#include <array>
 #include <cerrno>
 #include <cstdint>
 #include <cstring>
@@ -23,6 +32,7 @@
 
 #include "wifilogd/local_utils.h"
 #include "wifilogd/os.h"
+#include "wifilogd/profiler.h"
 
 namespace android {
 namespace wifilogd {
@@ -34,11 +44,91 @@ constexpr auto kMaxNanoSeconds = 1000 * 1000 * 1000 - 1;
 }
 
 constexpr int Os::kInvalidFd;
+constexpr size_t Os::kMaxDatagramBatchSize;
+constexpr size_t Os::kMaxReadyFds;
 
 Os::Os() : raw_os_(new RawOs()) {}
 Os::Os(std::unique_ptr<RawOs> raw_os) : raw_os_(std::move(raw_os)) {}
 Os::~Os() {}
 
+std::tuple<int, Os::Errno> Os::CreateEpoll() {
+  const int epoll_fd = raw_os_->EpollCreate1(EPOLL_CLOEXEC);
+  if (epoll_fd < 0) {
+    return {kInvalidFd, errno};
+  }
+  return {epoll_fd, 0};
+}
+
+Os::Errno Os::AddEpollFd(int epoll_fd, int fd) {
+  struct epoll_event event {};
+  event.events = EPOLLIN;
+  event.data.fd = fd;
+  if (raw_os_->EpollCtl(epoll_fd, EPOLL_CTL_ADD, fd, &event)) {
+    return errno;
+  }
+  return 0;
+}
+
+Os::Errno Os::RemoveEpollFd(int epoll_fd, int fd) {
+  // Kernels before 2.6.9 require a non-null |event|, even though it is
+  // ignored.
+  struct epoll_event event {};
+  if (raw_os_->EpollCtl(epoll_fd, EPOLL_CTL_DEL, fd, &event)) {
+    return errno;
+  }
+  return 0;
+}
+
+std::tuple<size_t, Os::Errno> Os::WaitForReadableFds(int epoll_fd,
+                                                     int* ready_fds,
+                                                     size_t max_fds,
+                                                     int timeout_msec) {
+  CHECK(max_fds > 0);
+  CHECK(max_fds <= kMaxReadyFds);
+
+  std::array<struct epoll_event, kMaxReadyFds> events;
+  const int res = raw_os_->EpollWait(
+      epoll_fd, events.data(), SAFELY_CLAMP(max_fds, int, 1, kMaxReadyFds),
+      timeout_msec);
+  if (res < 0) {
+    return {0, errno};
+  }
+
+  const size_t n_ready = SAFELY_CLAMP(res, size_t, 0, kMaxReadyFds);
+  CHECK(n_ready <= max_fds);  // Abort on buffer overflow.
+  for (size_t i = 0; i < n_ready; ++i) {
+    ready_fds[i] = events[i].data.fd;
+  }
+  return {n_ready, 0};
+}
+
+std::tuple<int, Os::Errno> Os::CreateEventFd() {
+  const int event_fd = raw_os_->Eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+  if (event_fd < 0) {
+    return {kInvalidFd, errno};
+  }
+  return {event_fd, 0};
+}
+
+Os::Errno Os::SignalEventFd(int event_fd) {
+  const uint64_t increment = 1;
+  if (raw_os_->Write(event_fd, &increment, sizeof(increment)) < 0) {
+    // EAGAIN means that the counter is saturated. The eventfd is readable
+    // regardless.
+    return errno == EAGAIN ? 0 : errno;
+  }
+  return 0;
+}
+
+Os::Errno Os::ClearEventFd(int event_fd) {
+  uint64_t count;
+  if (raw_os_->Read(event_fd, &count, sizeof(count)) < 0) {
+    // EAGAIN means that the eventfd was not signalled.
+    return errno == EAGAIN ? 0 : errno;
+  }
+  return 0;
+}
+
 std::tuple<int, Os::Errno> Os::GetControlSocket(
     const std::string& socket_name) {
   int sock_fd = raw_os_->GetControlSocket(socket_name.c_str());
@@ -70,6 +160,42 @@ Os::Timestamp Os::GetTimestamp(clockid_t clock_id) const {
   return now_timestamp;
 }
 
+std::tuple<void*, Os::Errno> Os::MapSharedMemory(int fd, size_t len) {
+  CHECK(len > 0);
+
+  const int seals = raw_os_->Fcntl(fd, F_GET_SEALS);
+  if (seals < 0) {
+    return {nullptr, errno};
+  }
+  if (!(seals & F_SEAL_SHRINK)) {
+    return {nullptr, EPERM};
+  }
+
+  struct stat fd_stat;
+  if (raw_os_->Fstat(fd, &fd_stat)) {
+    return {nullptr, errno};
+  }
+  if (fd_stat.st_size < 0 ||
+      static_cast<uintmax_t>(fd_stat.st_size) < static_cast<uintmax_t>(len)) {
+    return {nullptr, EPERM};
+  }
+
+  void* const addr = raw_os_->Mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                                   MAP_SHARED, fd, 0);
+  if (addr == MAP_FAILED) {
+    return {nullptr, errno};
+  }
+  return {addr, 0};
+}
+
+void Os::UnmapSharedMemory(void* addr, size_t len) {
+  if (raw_os_->Munmap(addr, len)) {
+    // munmap() fails only if the arguments are invalid. This indicates a
+    // logic error, rather than a runtime error.
+    LOG(FATAL) << "Unexpected error: " << std::strerror(errno);
+  }
+}
+
 void Os::Nanosleep(uint32_t sleep_time_nsec) {
   struct timespec sleep_timespec = {
       0,  // tv_sec
@@ -92,6 +218,7 @@ void Os::Nanosleep(uint32_t sleep_time_nsec) {
 
 std::tuple<size_t, Os::Errno> Os::ReceiveDatagram(int fd, void* buf,
                                                   size_t buflen) {
+  WIFILOGD_PROFILE_SCOPE(ProfiledStage::kReceiveDatagram);
   // recv() takes a size_t, but returns an ssize_t. That means that the largest
   // successful read that recv() can report is the maximal ssize_t. Passing a
   // larger |buflen| risks mistakenly reporting a truncated read.
@@ -109,6 +236,78 @@ std::tuple<size_t, Os::Errno> Os::ReceiveDatagram(int fd, void* buf,
   return {res, 0};
 }
 
+std::tuple<size_t, Os::Errno> Os::ReceiveDatagrams(int fd, uint8_t* bufs,
+                                                   size_t buflen, size_t n_bufs,
+                                                   size_t* datagram_lens,
+                                                   int* datagram_fds) {
+  WIFILOGD_PROFILE_SCOPE(ProfiledStage::kReceiveDatagram);
+  // recvmmsg() reports the size of each datagram as an unsigned int. Passing
+  // a larger |buflen| risks mistakenly reporting a truncated read.
+  CHECK(buflen <= GetMaxVal<decltype(mmsghdr::msg_len)>());
+  CHECK(n_bufs > 0);
+  CHECK(n_bufs <= kMaxDatagramBatchSize);
+
+  // Each control buffer has room for a single file descriptor. (The kernel
+  // discards any descriptors that don't fit.) The union ensures that the
+  // buffer is suitably aligned for a cmsghdr.
+  union ControlBuffer {
+    struct cmsghdr align;
+    uint8_t buf[CMSG_SPACE(sizeof(int))];
+  };
+  std::array<struct iovec, kMaxDatagramBatchSize> iovecs;
+  std::array<ControlBuffer, kMaxDatagramBatchSize> control_bufs;
+  std::array<struct mmsghdr, kMaxDatagramBatchSize> msgs{};
+  for (size_t i = 0; i < n_bufs; ++i) {
+    iovecs[i].iov_base = bufs + i * buflen;
+    iovecs[i].iov_len = buflen;
+    msgs[i].msg_hdr.msg_iov = &iovecs[i];
+    msgs[i].msg_hdr.msg_iovlen = 1;
+    msgs[i].msg_hdr.msg_control = control_bufs[i].buf;
+    msgs[i].msg_hdr.msg_controllen = sizeof(control_bufs[i].buf);
+  }
+
+  // MSG_WAITFORONE makes the call block only until the first datagram
+  // arrives. MSG_TRUNC has the same effect as in ReceiveDatagram().
+  // MSG_CMSG_CLOEXEC keeps received descriptors from leaking across exec().
+  const int res = raw_os_->RecvMmsg(
+      fd, msgs.data(), SAFELY_CLAMP(n_bufs, unsigned int, 1,
+                                    kMaxDatagramBatchSize),
+      MSG_TRUNC | MSG_WAITFORONE | MSG_CMSG_CLOEXEC, nullptr);
+  if (res < 0) {
+    return {0, errno};
+  }
+
+  const size_t n_received = SAFELY_CLAMP(res, size_t, 0, kMaxDatagramBatchSize);
+  CHECK(n_received <= n_bufs);  // Abort on buffer overflow.
+  for (size_t i = 0; i < n_received; ++i) {
+    datagram_lens[i] = msgs[i].msg_len;
+    datagram_fds[i] = kInvalidFd;
+    for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg;
+         cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS &&
+          cmsg->cmsg_len >= CMSG_LEN(sizeof(int))) {
+        std::memcpy(&datagram_fds[i], CMSG_DATA(cmsg), sizeof(int));
+        break;
+      }
+    }
+  }
+  return {n_received, 0};
+}
+
+Os::Errno Os::SetNonBlocking(int fd) {
+  const int flags = raw_os_->Fcntl(fd, F_GETFL);
+  if (flags < 0) {
+    return errno;
+  }
+  if (flags & O_NONBLOCK) {
+    return 0;
+  }
+  if (raw_os_->Fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+    return errno;
+  }
+  return 0;
+}
+
 std::tuple<size_t, Os::Errno> Os::Write(int fd, const void* buf,
                                         size_t buflen) {
   // write() takes a size_t, but returns an ssize_t. That means that the
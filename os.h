@@ -44,12 +44,19 @@ class Os {
   using Errno = int;
 
   struct Timestamp {
+    // Returns the timestamp as a count of nanoseconds.
+    int64_t ToNsec() const {
+      return static_cast<int64_t>(secs) * 1000 * 1000 * 1000 + nsecs;
+    }
+
     uint32_t secs;  // Sufficient through 2100.
     uint32_t nsecs;
   };
 
   static constexpr int kInvalidFd = -1;
   static constexpr auto kMaxNanos = 999'999'999;
+  static constexpr size_t kMaxDatagramBatchSize = 64;
+  static constexpr size_t kMaxReadyFds = 16;
 
   // Constructs an Os instance.
   Os();
@@ -60,6 +67,53 @@ class Os {
 
   virtual ~Os();
 
+  // Returns a new epoll instance, and the result of the operation (0 for
+  // success, |errno| otherwise). The caller owns the returned file
+  // descriptor, which is opened with O_CLOEXEC.
+  virtual std::tuple<int, Errno> CreateEpoll();
+
+  // Adds |fd| to the set of file descriptors watched by |epoll_fd|, waiting
+  // for |fd| to become readable. Returns 0 on success, and |errno|
+  // otherwise.
+  virtual Errno AddEpollFd(int epoll_fd, int fd);
+
+  // Removes |fd| from the set of file descriptors watched by |epoll_fd|.
+  // Returns 0 on success, and |errno| otherwise.
+  virtual Errno RemoveEpollFd(int epoll_fd, int fd);
+
+  // Waits up to |timeout_msec| for any of the file descriptors watched by
+  // |epoll_fd| to become readable, writing up to |max_fds| readable file
+  // descriptors to |ready_fds|. Returns the number of file descriptors
+  // written, and the result of the operation (0 for success, |errno|
+  // otherwise).
+  //
+  // Notes:
+  // - |max_fds| must be non-zero, and may not exceed kMaxReadyFds.
+  // - A |timeout_msec| of -1 waits indefinitely. A |timeout_msec| of 0
+  //   returns immediately.
+  // - A file descriptor which hits an error, or hangup, is reported as
+  //   readable. (So that the caller discovers the condition, when it reads.)
+  virtual std::tuple<size_t, Errno> WaitForReadableFds(int epoll_fd,
+                                                       NONNULL int* ready_fds,
+                                                       size_t max_fds,
+                                                       int timeout_msec);
+
+  // Returns a new eventfd, and the result of the operation (0 for success,
+  // |errno| otherwise). The eventfd lets one thread wake another, which
+  // waits (e.g. via epoll) for the eventfd to become readable. The caller
+  // owns the returned file descriptor, which is opened with O_CLOEXEC and
+  // O_NONBLOCK.
+  virtual std::tuple<int, Errno> CreateEventFd();
+
+  // Makes the eventfd |event_fd| readable, until ClearEventFd() is called.
+  // Returns 0 on success, and |errno| otherwise.
+  virtual Errno SignalEventFd(int event_fd);
+
+  // Makes the eventfd |event_fd| unreadable, until it is next signalled.
+  // Returns 0 on success (including if |event_fd| was not signalled), and
+  // |errno| otherwise.
+  virtual Errno ClearEventFd(int event_fd);
+
   // Returns the Android control socket with name |socket_name|. If no such
   // socket exists, or the init daemon has not provided this process with
   // access to said socket, returns {kInvalidFd, errno}.
@@ -69,6 +123,23 @@ class Os {
   // Returns the current time, as reported by the clock with |clock_id|.
   virtual Timestamp GetTimestamp(clockid_t clock_id) const;
 
+  // Maps the first |len| bytes of the shared memory in |fd|, for reading and
+  // writing. Returns the address of the mapping, and the result of the
+  // operation (0 for success, |errno| otherwise).
+  //
+  // Notes:
+  // - |len| must be non-zero.
+  // - The memory must be sealed with F_SEAL_SHRINK, and must be at least
+  //   |len| bytes long. (Otherwise, the owner of the memory could truncate
+  //   it while it is mapped, and our accesses would fault.) If the memory
+  //   does not satisfy these requirements, returns {nullptr, EPERM}.
+  // - The mapping remains valid after |fd| is closed. The caller should
+  //   release the mapping with UnmapSharedMemory().
+  virtual std::tuple<void*, Errno> MapSharedMemory(int fd, size_t len);
+
+  // Unmaps the |len| bytes at |addr|, which were mapped by MapSharedMemory().
+  virtual void UnmapSharedMemory(NONNULL void* addr, size_t len);
+
   // Suspends execution of this process, for |sleep_time_nsec|. The passed
   // value must not exceed kMaxNanos.
   virtual void Nanosleep(uint32_t sleep_time_nsec);
@@ -86,6 +157,37 @@ class Os {
   virtual std::tuple<size_t, Errno> ReceiveDatagram(int fd, NONNULL void* buf,
                                                     size_t buflen);
 
+  // Receives up to |n_bufs| datagrams from |fd|, using a single system call.
+  // The i-th datagram is written to the |buflen| bytes starting at
+  // |bufs + i * buflen|, and the size of the i-th datagram is written to
+  // |datagram_lens[i]|. If the i-th datagram carried a file descriptor (as
+  // SCM_RIGHTS ancillary data), the descriptor is written to
+  // |datagram_fds[i]|; otherwise, kInvalidFd is written. Returns the number
+  // of datagrams received, and the result of the operation (0 for success,
+  // |errno| otherwise).
+  //
+  // Notes:
+  // - |buflen| may not exceed the maximal value for unsigned int.
+  // - |n_bufs| must be non-zero, and may not exceed kMaxDatagramBatchSize.
+  // - The call blocks until at least one datagram is available. Once a
+  //   datagram is available, the call receives any other datagrams that
+  //   are already queued, without blocking.
+  // - As with ReceiveDatagram(), datagrams larger than |buflen| are truncated,
+  //   but the corresponding |datagram_lens| entry reflects the full length
+  //   of the datagram.
+  // - At most one file descriptor is received per datagram. Any others are
+  //   discarded by the kernel. The caller takes ownership of the received
+  //   descriptors, which are opened with O_CLOEXEC.
+  virtual std::tuple<size_t, Errno> ReceiveDatagrams(
+      int fd, NONNULL uint8_t* bufs, size_t buflen, size_t n_bufs,
+      NONNULL size_t* datagram_lens, NONNULL int* datagram_fds);
+
+  // Makes writes to (and reads from) |fd| non-blocking, by setting
+  // O_NONBLOCK. Returns the result of the operation (0 for success, |errno|
+  // otherwise). Note that the flag is shared with any other descriptor for
+  // the same open file (e.g., one held by the process that sent us |fd|).
+  virtual Errno SetNonBlocking(int fd);
+
   // Writes |buflen| bytes from |buf| to |fd|. Returns the number of bytes
   // written, and the result of the operation (0 for success, |errno|
   // otherwise).
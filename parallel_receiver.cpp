@@ -0,0 +1,335 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include <tuple>
+#include <utility>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/parallel_receiver.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+
+using ::android::base::unique_fd;
+using local_utils::CopyFromBufferOrDie;
+
+constexpr size_t ParallelReceiver::kMaxThreads;
+constexpr size_t ParallelReceiver::kStagingBufferSizeBytes;
+
+namespace {
+
+// TODO(b/32840641): Tune the sleep time.
+constexpr auto kTransientErrorSleepTimeNsec = 100 * 1000;  // 100 usec
+
+}  // namespace
+
+ParallelReceiver::ParallelReceiver(Os* os, int sock_fd, size_t n_threads,
+                                   size_t receive_batch_size,
+                                   Timestamper::Mode timestamp_mode)
+    : os_(os),
+      sock_fd_(sock_fd),
+      receive_batch_size_(receive_batch_size),
+      timestamp_mode_(timestamp_mode),
+      wakeup_fd_(),
+      stop_fd_(),
+      stopping_(false),
+      n_batches_received_(0),
+      n_datagrams_received_(0),
+      receivers_() {
+  CHECK(n_threads > 0);
+  CHECK(n_threads <= kMaxThreads);
+  CHECK(receive_batch_size > 0);
+  CHECK(receive_batch_size <= Os::kMaxDatagramBatchSize);
+  static_assert(kStagingBufferSizeBytes >=
+                    MessageBuffer::GetHeaderSize() +
+                        sizeof(StagedCommandHeader) + protocol::kMaxMessageSize,
+                "a staging buffer cannot hold a maximal command");
+
+  for (auto* fd : {&wakeup_fd_, &stop_fd_}) {
+    int event_fd;
+    Os::Errno err;
+    std::tie(event_fd, err) = os_->CreateEventFd();
+    if (err) {
+      LOG(FATAL) << "Failed to create eventfd: " << std::strerror(err);
+    }
+    fd->reset(event_fd);
+  }
+
+  for (size_t i = 0; i < n_threads; ++i) {
+    receivers_.push_back(std::make_unique<Receiver>());
+  }
+  // Start the threads only once every Receiver exists, as
+  // ProcessStagedCommands() may run as soon as a thread signals.
+  for (auto& receiver : receivers_) {
+    receiver->thread =
+        std::thread(&ParallelReceiver::Run, this, receiver.get());
+  }
+}
+
+ParallelReceiver::~ParallelReceiver() {
+  stopping_ = true;
+  const Os::Errno err = os_->SignalEventFd(stop_fd_.get());
+  if (err) {
+    LOG(FATAL) << "Failed to stop receivers: " << std::strerror(err);
+  }
+  for (auto& receiver : receivers_) {
+    {
+      // Hold the lock, so that a thread which is about to wait for space
+      // cannot miss the notification.
+      std::lock_guard<std::mutex> lock(receiver->mutex);
+    }
+    receiver->space_available.notify_one();
+    receiver->thread.join();
+    DiscardStagedCommands(receiver->filling.get());
+    DiscardStagedCommands(receiver->draining.get());
+  }
+}
+
+size_t ParallelReceiver::ProcessStagedCommands(
+    CommandProcessor* command_processor) {
+  // Clear the wakeup before taking the staged commands, so that commands
+  // staged after we take them signal us again.
+  const Os::Errno err = os_->ClearEventFd(wakeup_fd_.get());
+  if (err) {
+    LOG(FATAL) << "Failed to clear wakeup: " << std::strerror(err);
+  }
+
+  ReceiveCounts counts{};
+  for (auto& receiver : receivers_) {
+    {
+      std::lock_guard<std::mutex> lock(receiver->mutex);
+      std::swap(receiver->filling, receiver->draining);
+      counts.n_batches += receiver->counts.n_batches;
+      counts.n_datagrams += receiver->counts.n_datagrams;
+      counts.n_datagrams_truncated += receiver->counts.n_datagrams_truncated;
+      counts.n_enomem_errors += receiver->counts.n_enomem_errors;
+      counts.n_eintr_errors += receiver->counts.n_eintr_errors;
+      receiver->counts = ReceiveCounts();
+    }
+    receiver->space_available.notify_one();
+  }
+  n_batches_received_ += counts.n_batches;
+  n_datagrams_received_ += counts.n_datagrams;
+  for (uint64_t i = 0; i < counts.n_datagrams_truncated; ++i) {
+    command_processor->CountTruncatedDatagram();
+  }
+  for (uint64_t i = 0; i < counts.n_eintr_errors; ++i) {
+    command_processor->CountRetriedReceiveError(EINTR);
+  }
+  for (uint64_t i = 0; i < counts.n_enomem_errors; ++i) {
+    command_processor->CountRetriedReceiveError(ENOMEM);
+  }
+  if (counts.n_enomem_errors) {
+    // As in MainLoop::ProcessError(): give some memory back.
+    command_processor->ShrinkBuffers();
+  }
+
+  // A k-way merge, as in CommandProcessor. Each thread stages its commands
+  // in the order in which it timestamped them, so each buffer is sorted.
+  std::array<std::tuple<const uint8_t*, size_t>, kMaxThreads> heads;
+  std::array<StagedCommandHeader, kMaxThreads> head_headers;
+  const auto advance = [this, &heads, &head_headers](size_t i) {
+    heads[i] = receivers_[i]->draining->ConsumeNextMessage();
+    if (std::get<0>(heads[i])) {
+      head_headers[i] = CopyFromBufferOrDie<StagedCommandHeader>(
+          std::get<0>(heads[i]), std::get<1>(heads[i]));
+    }
+  };
+  for (size_t i = 0; i < receivers_.size(); ++i) {
+    advance(i);
+  }
+
+  size_t n_processed = 0;
+  while (true) {
+    size_t oldest = receivers_.size();
+    for (size_t i = 0; i < receivers_.size(); ++i) {
+      if (!std::get<0>(heads[i])) {
+        continue;
+      }
+      if (oldest == receivers_.size() ||
+          head_headers[i].tstamp_header.since_boot_with_sleep.ToNsec() <
+              head_headers[oldest]
+                  .tstamp_header.since_boot_with_sleep.ToNsec()) {
+        oldest = i;
+      }
+    }
+    if (oldest == receivers_.size()) {
+      break;
+    }
+
+    const uint8_t* const record = std::get<0>(heads[oldest]);
+    const size_t record_len = std::get<1>(heads[oldest]);
+    command_processor->ProcessTimestampedCommand(
+        head_headers[oldest].tstamp_header,
+        record + sizeof(StagedCommandHeader),
+        record_len - sizeof(StagedCommandHeader), head_headers[oldest].fd);
+    ++n_processed;
+    advance(oldest);
+  }
+
+  for (auto& receiver : receivers_) {
+    receiver->draining->Clear();
+  }
+  return n_processed;
+}
+
+// Private methods below.
+
+void ParallelReceiver::Run(Receiver* receiver) {
+  // Each thread has its own Timestamper (and epoll instance), so that
+  // receiving shares no state with the other threads.
+  Timestamper timestamper(os_, timestamp_mode_);
+
+  int epoll_fd;
+  Os::Errno err;
+  std::tie(epoll_fd, err) = os_->CreateEpoll();
+  if (err) {
+    LOG(FATAL) << "Failed to create epoll instance: " << std::strerror(err);
+  }
+  const unique_fd wrapped_epoll_fd(epoll_fd);
+  for (const int fd : {sock_fd_, stop_fd_.get()}) {
+    err = os_->AddEpollFd(epoll_fd, fd);
+    if (err) {
+      LOG(FATAL) << "Failed to watch fd " << fd << ": " << std::strerror(err);
+    }
+  }
+
+  const std::unique_ptr<uint8_t[]> bufs(
+      new uint8_t[receive_batch_size_ * protocol::kMaxMessageSize]);
+  const std::unique_ptr<size_t[]> datagram_lens(
+      new size_t[receive_batch_size_]);
+  const std::unique_ptr<int[]> datagram_fds(new int[receive_batch_size_]);
+  std::array<int, 2> ready_fds;
+  while (!stopping_) {
+    size_t n_ready;
+    std::tie(n_ready, err) = os_->WaitForReadableFds(
+        epoll_fd, ready_fds.data(), ready_fds.size(), -1);
+    if (err == EINTR) {
+      continue;
+    }
+    if (err) {
+      LOG(FATAL) << "Unexpected error: " << std::strerror(err);
+    }
+    if (stopping_) {
+      return;
+    }
+
+    size_t n_datagrams;
+    std::tie(n_datagrams, err) = os_->ReceiveDatagrams(
+        sock_fd_, bufs.get(), protocol::kMaxMessageSize, receive_batch_size_,
+        datagram_lens.get(), datagram_fds.get());
+    if (err == EAGAIN) {
+      // Another thread received the datagrams first.
+      continue;
+    }
+    if (err == ENOMEM || err == EINTR) {
+      CountRetriedReceiveError(receiver, err);
+      os_->Nanosleep(kTransientErrorSleepTimeNsec);
+      continue;
+    }
+    if (err) {
+      LOG(FATAL) << "Unexpected error: " << std::strerror(err);
+    }
+
+    if (!StageBatch(receiver, bufs.get(), datagram_lens.get(),
+                    datagram_fds.get(), n_datagrams,
+                    timestamper.GetTimestamps())) {
+      return;
+    }
+    const Os::Errno signal_err = os_->SignalEventFd(wakeup_fd_.get());
+    if (signal_err) {
+      LOG(FATAL) << "Failed to signal wakeup: " << std::strerror(signal_err);
+    }
+  }
+}
+
+bool ParallelReceiver::StageBatch(Receiver* receiver, const uint8_t* bufs,
+                                  const size_t* datagram_lens,
+                                  const int* datagram_fds, size_t n_datagrams,
+                                  const Timestamper::Timestamps& timestamps) {
+  CHECK(n_datagrams <= receive_batch_size_);
+  // Every datagram in a batch arrived by the time that the batch was
+  // received, so they share that time.
+  StagedCommandHeader header;
+  header.tstamp_header
+      .set_since_boot_awake_only(timestamps.since_boot_awake_only)
+      .set_since_boot_with_sleep(timestamps.since_boot_with_sleep)
+      .set_since_epoch(timestamps.since_epoch);
+
+  std::unique_lock<std::mutex> lock(receiver->mutex);
+  for (size_t i = 0; i < n_datagrams; ++i) {
+    const size_t datagram_len = datagram_lens[i];
+    const uint16_t command_len =
+        SAFELY_CLAMP(datagram_len, uint16_t, 0, protocol::kMaxMessageSize);
+    if (datagram_len > protocol::kMaxMessageSize) {
+      ++receiver->counts.n_datagrams_truncated;
+    }
+    const uint16_t record_len = sizeof(header) + command_len;
+    receiver->space_available.wait(lock, [this, receiver, record_len]() {
+      return stopping_ || receiver->filling->CanFitNow(record_len);
+    });
+    if (stopping_) {
+      for (; i < n_datagrams; ++i) {
+        unique_fd unstaged_fd(datagram_fds[i]);
+      }
+      return false;
+    }
+
+    header.fd = datagram_fds[i];
+    uint8_t* const record = receiver->filling->Reserve(record_len);
+    CHECK(record);  // CanFitNow() implies that the record can fit.
+    std::memcpy(record, &header, sizeof(header));
+    std::memcpy(record + sizeof(header), bufs + i * protocol::kMaxMessageSize,
+                command_len);
+    receiver->filling->Commit(record_len);
+  }
+  ++receiver->counts.n_batches;
+  receiver->counts.n_datagrams += n_datagrams;
+  return true;
+}
+
+void ParallelReceiver::CountRetriedReceiveError(Receiver* receiver,
+                                                Os::Errno err) {
+  std::lock_guard<std::mutex> lock(receiver->mutex);
+  if (err == ENOMEM) {
+    ++receiver->counts.n_enomem_errors;
+  } else if (err == EINTR) {
+    ++receiver->counts.n_eintr_errors;
+  }
+}
+
+void ParallelReceiver::DiscardStagedCommands(MessageBuffer* buffer) {
+  while (true) {
+    const uint8_t* record;
+    size_t record_len;
+    std::tie(record, record_len) = buffer->ConsumeNextMessage();
+    if (!record) {
+      break;
+    }
+    unique_fd staged_fd(
+        CopyFromBufferOrDie<StagedCommandHeader>(record, record_len).fd);
+  }
+  buffer->Clear();
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PARALLEL_RECEIVER_H_
+#define PARALLEL_RECEIVER_H_
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "android-base/macros.h"
+#include "android-base/unique_fd.h"
+
+#include "wifilogd/command_processor.h"
+#include "wifilogd/local_utils.h"
+#include "wifilogd/message_buffer.h"
+#include "wifilogd/os.h"
+#include "wifilogd/timestamp_header.h"
+#include "wifilogd/timestamper.h"
+
+namespace android {
+namespace wifilogd {
+
+// Receives commands from a socket on several threads, so that receiving
+// and timestamping the commands is not limited to a single core.
+//
+// Each thread receives batches of datagrams from the socket, timestamps
+// them, and stages them in a MessageBuffer of its own. The thread then
+// signals the eventfd returned by GetWakeupFd(). The owner of the
+// ParallelReceiver (e.g. the MainLoop) watches that fd, and calls
+// ProcessStagedCommands(), which hands the staged commands to a
+// CommandProcessor, on the owner's thread, merged in timestamp order.
+//
+// No lock is shared between the threads. Each thread's staging buffer has
+// a lock of its own, which the owner's thread takes only to swap the
+// staging buffer for an empty one. A thread whose staging buffer is full
+// waits for that swap, leaving further datagrams queued on the socket.
+//
+// Commands are ordered only within each call to ProcessStagedCommands().
+// A command staged after that call is processed by the next call, even if
+// it was timestamped before commands that the earlier call processed.
+//
+// The user must ensure that |os| outlives the ParallelReceiver. |os| is
+// used from every thread.
+class ParallelReceiver {
+ public:
+  // The maximal number of receiving threads.
+  static constexpr size_t kMaxThreads = 8;
+
+  // The size of each of a thread's two staging buffers. Each must be able
+  // to hold a maximal command, and should hold several batches.
+  static constexpr size_t kStagingBufferSizeBytes = 128 * 1024;
+
+  // Starts |n_threads| threads, which receive up to |receive_batch_size|
+  // datagrams at a time from |sock_fd|, and timestamp them as described for
+  // |timestamp_mode|. |n_threads| must be between 1 and kMaxThreads, and
+  // |receive_batch_size| must be between 1 and Os::kMaxDatagramBatchSize.
+  // The caller retains ownership of |sock_fd|, which must be non-blocking,
+  // so that a thread which loses the race for a datagram does not block.
+  ParallelReceiver(NONNULL Os* os, int sock_fd, size_t n_threads,
+                   size_t receive_batch_size,
+                   Timestamper::Mode timestamp_mode);
+
+  // Stops the threads. Closes the file descriptors of any commands which
+  // were staged, but not processed.
+  ~ParallelReceiver();
+
+  // Returns an fd which is readable when commands are waiting to be
+  // processed. The ParallelReceiver retains ownership of the fd.
+  int GetWakeupFd() const { return wakeup_fd_.get(); }
+
+  // Passes the commands staged so far to |command_processor|, in order of
+  // TimestampHeader::since_boot_with_sleep, via
+  // CommandProcessor::ProcessTimestampedCommand(). Also passes along the
+  // counts of truncated datagrams and retried receive errors, and shrinks
+  // the log buffers if a receive ran out of memory. Returns the number of
+  // commands processed.
+  size_t ProcessStagedCommands(NONNULL CommandProcessor* command_processor);
+
+  // Returns the number of batches, and of datagrams, received by the
+  // commands processed so far.
+  uint64_t GetNumBatchesReceived() const { return n_batches_received_; }
+  uint64_t GetNumDatagramsReceived() const { return n_datagrams_received_; }
+
+ private:
+  // Precedes each command in a staging buffer.
+  struct StagedCommandHeader {
+    TimestampHeader tstamp_header;
+    int fd;  // The fd received with the command, or Os::kInvalidFd.
+  };
+
+  // Counts of receive events, which the owner's thread passes on to the
+  // CommandProcessor.
+  struct ReceiveCounts {
+    uint64_t n_batches;
+    uint64_t n_datagrams;
+    uint64_t n_datagrams_truncated;
+    uint64_t n_enomem_errors;
+    uint64_t n_eintr_errors;
+  };
+
+  // The state of one receiving thread.
+  struct Receiver {
+    Receiver()
+        : mutex(),
+          space_available(),
+          filling(std::make_unique<MessageBuffer>(kStagingBufferSizeBytes)),
+          counts(),
+          draining(std::make_unique<MessageBuffer>(kStagingBufferSizeBytes)),
+          thread() {}
+
+    std::mutex mutex;
+    // Signalled when |filling| is swapped for an empty buffer, or when the
+    // ParallelReceiver is stopping.
+    std::condition_variable space_available;
+    std::unique_ptr<MessageBuffer> filling;  // Guarded by |mutex|.
+    ReceiveCounts counts;                    // Guarded by |mutex|.
+    // Used only by the owner's thread.
+    std::unique_ptr<MessageBuffer> draining;
+    std::thread thread;
+  };
+
+  // The body of |receiver|'s thread. Receives until |stopping_| is set.
+  void Run(NONNULL Receiver* receiver);
+
+  // Stages the |n_datagrams| datagrams in |bufs|, as received at
+  // |timestamps|, in |receiver|'s |filling| buffer, waiting for space as
+  // needed. Returns false if the ParallelReceiver stopped before every
+  // datagram was staged, in which case the fds of the unstaged datagrams
+  // are closed.
+  bool StageBatch(NONNULL Receiver* receiver, const uint8_t* bufs,
+                  const size_t* datagram_lens, const int* datagram_fds,
+                  size_t n_datagrams,
+                  const Timestamper::Timestamps& timestamps);
+
+  // Counts |err|, a receive error which will be retried, in |receiver|'s
+  // counts.
+  static void CountRetriedReceiveError(NONNULL Receiver* receiver,
+                                       Os::Errno err);
+
+  // Closes the fds of the commands in |buffer|, and then clears |buffer|.
+  static void DiscardStagedCommands(NONNULL MessageBuffer* buffer);
+
+  Os* const os_;  // non-owned
+  const int sock_fd_;
+  const size_t receive_batch_size_;
+  const Timestamper::Mode timestamp_mode_;
+  ::android::base::unique_fd wakeup_fd_;
+  // Readable once the ParallelReceiver is stopping.
+  ::android::base::unique_fd stop_fd_;
+  std::atomic<bool> stopping_;
+  uint64_t n_batches_received_;
+  uint64_t n_datagrams_received_;
+  std::vector<std::unique_ptr<Receiver>> receivers_;
+
+  DISALLOW_COPY_AND_ASSIGN(ParallelReceiver);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // PARALLEL_RECEIVER_H_
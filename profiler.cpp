@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+
+#include "android-base/logging.h"
+
+#if defined(WIFILOGD_ATRACE)
+#define ATRACE_TAG ATRACE_TAG_NETWORK
+#include "cutils/trace.h"
+#endif
+
+#include "wifilogd/profiler.h"
+
+namespace android {
+namespace wifilogd {
+
+namespace {
+
+constexpr int64_t kNsecPerSec = 1000 * 1000 * 1000;
+
+size_t GetStageIndex(ProfiledStage stage) {
+  const size_t index = local_utils::CastEnumToInteger(stage);
+  CHECK(index < kNumProfiledStages);
+  return index;
+}
+
+}  // namespace
+
+Profiler::Scope::Scope(Profiler* profiler, ProfiledStage stage)
+    : profiler_(profiler), stage_(stage), start_nsec_(GetTimeNsec()) {
+#if defined(WIFILOGD_ATRACE)
+  ATRACE_BEGIN(GetProfiledStageName(stage_));
+#endif
+}
+
+Profiler::Scope::~Scope() {
+#if defined(WIFILOGD_ATRACE)
+  ATRACE_END();
+#endif
+  const int64_t elapsed_nsec = GetTimeNsec() - start_nsec_;
+  profiler_->Record(stage_, elapsed_nsec > 0 ? elapsed_nsec : 0);
+}
+
+// Value-initializing |stage_counters_| zeroes every counter.
+Profiler::Profiler() : stage_counters_() {}
+
+Profiler* Profiler::GetInstance() {
+  // Never destroyed, so that the dump thread may use it during shutdown.
+  static Profiler* const instance = new Profiler();
+  return instance;
+}
+
+int64_t Profiler::GetTimeNsec() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  return static_cast<int64_t>(now.tv_sec) * kNsecPerSec + now.tv_nsec;
+}
+
+void Profiler::Record(ProfiledStage stage, uint64_t elapsed_nsec) {
+  StageCounters& counters = stage_counters_[GetStageIndex(stage)];
+  counters.n_calls.fetch_add(1, std::memory_order_relaxed);
+  counters.total_nsec.fetch_add(elapsed_nsec, std::memory_order_relaxed);
+  uint64_t max_nsec = counters.max_nsec.load(std::memory_order_relaxed);
+  while (elapsed_nsec > max_nsec &&
+         !counters.max_nsec.compare_exchange_weak(
+             max_nsec, elapsed_nsec, std::memory_order_relaxed)) {
+  }
+}
+
+StageProfile Profiler::GetStageProfile(ProfiledStage stage) const {
+  const StageCounters& counters = stage_counters_[GetStageIndex(stage)];
+  StageProfile profile;
+  profile.n_calls = counters.n_calls.load(std::memory_order_relaxed);
+  profile.total_nsec = counters.total_nsec.load(std::memory_order_relaxed);
+  profile.max_nsec = counters.max_nsec.load(std::memory_order_relaxed);
+  return profile;
+}
+
+}  // namespace wifilogd
+}  // namespace android
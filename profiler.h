@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef PROFILER_H_
+#define PROFILER_H_
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+
+namespace android {
+namespace wifilogd {
+
+// The stages of the ingest and dump paths which are timed when wifilogd is
+// built with -DWIFILOGD_PROFILING. (See WIFILOGD_PROFILE_SCOPE, below.)
+enum class ProfiledStage : uint8_t {
+  kReceiveDatagram,
+  kGetTimestamps,
+  kCopyCommandToLog,
+  kBufferReserve,
+  kDumpFormat,
+  kDumpWrite,
+};
+
+constexpr size_t kNumProfiledStages = 6;
+
+// Returns a short name for |stage|, for use in dumps and trace events.
+inline const char* GetProfiledStageName(ProfiledStage stage) {
+  switch (stage) {
+    case ProfiledStage::kReceiveDatagram:
+      return "receive_datagram";
+    case ProfiledStage::kGetTimestamps:
+      return "get_timestamps";
+    case ProfiledStage::kCopyCommandToLog:
+      return "copy_command_to_log";
+    case ProfiledStage::kBufferReserve:
+      return "buffer_reserve";
+    case ProfiledStage::kDumpFormat:
+      return "dump_format";
+    case ProfiledStage::kDumpWrite:
+      return "dump_write";
+  }
+  return "unknown";
+}
+
+// The longest name returned by GetProfiledStageName().
+constexpr size_t kMaxProfiledStageNameLen = sizeof("copy_command_to_log") - 1;
+
+// The time spent in a ProfiledStage.
+struct StageProfile {
+  uint64_t n_calls;
+  uint64_t total_nsec;
+  uint64_t max_nsec;
+};
+
+// Accumulates the time spent in each ProfiledStage. The stages run on both
+// the main thread and the dump thread, so the counters are atomic. (Within
+// a stage, the counters are updated independently. So a reader may see,
+// e.g., |n_calls| updated before |total_nsec|.)
+//
+// Time is measured with CLOCK_MONOTONIC_RAW, directly rather than via Os,
+// so that profiling does not perturb the interactions that the unit tests
+// expect.
+class Profiler {
+ public:
+  // Times the enclosing scope, and records the time with a Profiler.
+  class Scope {
+   public:
+    Scope(NONNULL Profiler* profiler, ProfiledStage stage);
+    ~Scope();
+
+   private:
+    Profiler* const profiler_;  // non-owned
+    const ProfiledStage stage_;
+    const int64_t start_nsec_;
+
+    DISALLOW_COPY_AND_ASSIGN(Scope);
+  };
+
+  Profiler();
+
+  // Returns the Profiler used by WIFILOGD_PROFILE_SCOPE.
+  static Profiler* GetInstance();
+
+  // Returns the current CLOCK_MONOTONIC_RAW time.
+  static int64_t GetTimeNsec();
+
+  // Records a call to |stage| which took |elapsed_nsec|. May be called from
+  // any thread.
+  void Record(ProfiledStage stage, uint64_t elapsed_nsec);
+
+  // Returns the time spent in |stage| so far. May be called from any
+  // thread.
+  StageProfile GetStageProfile(ProfiledStage stage) const;
+
+ private:
+  struct StageCounters {
+    std::atomic<uint64_t> n_calls;
+    std::atomic<uint64_t> total_nsec;
+    std::atomic<uint64_t> max_nsec;
+  };
+
+  std::array<StageCounters, kNumProfiledStages> stage_counters_;
+
+  DISALLOW_COPY_AND_ASSIGN(Profiler);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+// Times the rest of the enclosing scope as |stage|, if profiling is enabled.
+// Otherwise, expands to nothing, so that the instrumentation costs nothing
+// in regular builds. At most one WIFILOGD_PROFILE_SCOPE may appear in a
+// scope.
+#if defined(WIFILOGD_PROFILING)
+#define WIFILOGD_PROFILE_SCOPE(stage)                 \
+  ::android::wifilogd::Profiler::Scope profile_scope{ \
+      ::android::wifilogd::Profiler::GetInstance(), (stage)}
+#else
+#define WIFILOGD_PROFILE_SCOPE(stage) \
+  do {                                \
+  } while (0)
+#endif
+
+#endif  // PROFILER_H_
@@ -17,6 +17,7 @@
 #ifndef PROTOCOL_H_
 #define PROTOCOL_H_
 
+#include <atomic>
 #include <cstdint>
 
 #include "cutils/sockets.h"
@@ -39,7 +40,18 @@ constexpr size_t kMaxMessageSize = 4096;
 
 enum class Opcode : uint16_t {
   kWriteAsciiMessage,
+  kWriteStructuredMessage,
   kDumpBuffers = 0x20,
+  kDumpBuffersBinary,
+  kDumpStats,
+  kDumpBuffersSince,
+  kDumpBuffersQuery,
+  kSubscribe,
+  kRegisterSharedRing = 0x40,
+  kDrainSharedRings,
+  // Never sent by clients. Used only for records in the log buffers (and
+  // hence in binary dumps). See RepeatedMessage.
+  kRepeatedMessage = 0x60,
 };
 
 enum class MessageSeverity : uint8_t {
@@ -61,7 +73,19 @@ struct Command {
     return *this;
   }
 
-  uint64_t src_boottime_nsec;  // For latency measurement.
+  Command& set_src_boottime_nsec(uint64_t new_src_boottime_nsec) {
+    src_boottime_nsec = new_src_boottime_nsec;
+    return *this;
+  }
+
+  Command& set_sequence_num(uint16_t new_sequence_num) {
+    sequence_num = new_sequence_num;
+    return *this;
+  }
+
+  // For latency measurement. The CLOCK_BOOTTIME at which the client sent
+  // the command, or zero if the client does not measure latency.
+  uint64_t src_boottime_nsec;
   // For drop detection. Sequence numbers are meaningful only within
   // the context of a single tag. (This is to minimize synchronization
   // requirements for multi-threaded clients.)
@@ -96,6 +120,302 @@ struct AsciiMessage {  // Old-style log messages.
   // uint8_t data[data_len];
 };
 
+// A compact alternative to AsciiMessage, for messages formatted from a
+// fixed set of format strings (see structured_formats.h). The client sends
+// the ID of the format string, and its arguments in binary, rather than
+// formatting the message itself. wifilogd stores the message as sent, and
+// expands it only when the message is dumped.
+//
+// |tag_len| and |severity| are at the same offsets as in AsciiMessage, so
+// that wifilogd can route and sequence-check both types of message alike.
+struct StructuredMessage {
+  StructuredMessage& set_format_id(uint16_t new_format_id) {
+    format_id = new_format_id;
+    return *this;
+  }
+
+  StructuredMessage& set_tag_len(uint8_t new_tag_len) {
+    tag_len = new_tag_len;
+    return *this;
+  }
+
+  StructuredMessage& set_severity(MessageSeverity new_severity) {
+    severity = new_severity;
+    return *this;
+  }
+
+  uint16_t format_id;
+  uint8_t tag_len;
+  MessageSeverity severity;
+  // Payload follows.
+  // uint8_t tag[tag_len];
+  // Arguments, up to the end of the command. Each argument is a
+  // StructuredArgType, followed by the argument's value. Integers are in
+  // host byte order. kBytes values are a uint8_t length, followed by that
+  // many bytes.
+};
+
+enum class StructuredArgType : uint8_t {
+  kInt32,
+  kUint32,
+  kInt64,
+  kUint64,
+  kMacAddress,
+  kBytes,  // E.g., an SSID.
+};
+
+constexpr size_t kMacAddressLen = 6;
+// Arguments past this many are not formatted.
+constexpr size_t kMaxStructuredArgs = 16;
+
+// Stands in for repeats of the message logged just before it (in the same
+// log buffer), so that a writer which logs the same message in a loop does
+// not fill the log buffer with copies. The record's TimestampHeader gives
+// the time of the latest repeat.
+struct RepeatedMessage {
+  RepeatedMessage& set_n_repeats(uint32_t new_n_repeats) {
+    n_repeats = new_n_repeats;
+    return *this;
+  }
+
+  RepeatedMessage& set_tag_len(uint8_t new_tag_len) {
+    tag_len = new_tag_len;
+    return *this;
+  }
+
+  uint32_t n_repeats;
+  uint8_t tag_len;
+  uint8_t reserved[3];  // Must be zero.
+  // Payload follows.
+  // uint8_t tag[tag_len];  // The tag of the repeated message.
+};
+
+// The number of log buffers that a DumpCursor tracks. (wifilogd keeps a log
+// buffer for each MessageSeverity.)
+constexpr size_t kNumDumpCursorBuffers = 5;
+
+// The payload of kDumpBuffersSince, which asks for only those records which
+// were logged after the ones already read. A client that polls the log
+// starts with a zeroed cursor, and then sends, with each request, the
+// cursor from the previous response.
+//
+// The response is a text dump, without the Stats. It starts with a line
+// for each log buffer, of the form
+//   # cursor buffer=<i> next=<next_record> missed=<n_missed>
+// where |next_record| is the value of |next_record[i]| for the next
+// request, and |n_missed| counts records which were evicted from the log
+// buffer before they could be read. The lines for the records follow, as
+// in the response to kDumpBuffers.
+//
+// Records are numbered from zero, in the order they were logged, within
+// each log buffer, and for the life of the wifilogd process. A cursor from
+// an earlier process, whose position is past the newest record, reads the
+// log buffer from its oldest record. Since a RepeatedMessage record is
+// updated in place, each kDumpBuffersSince ends any run of repeats, so that
+// a record that has been read does not change afterwards.
+struct DumpCursor {
+  DumpCursor& set_next_record(size_t log_buffer, uint64_t new_next_record) {
+    next_record[log_buffer] = new_next_record;
+    return *this;
+  }
+
+  // For each log buffer, the number of the first record to dump.
+  uint64_t next_record[kNumDumpCursorBuffers];
+};
+
+// The payload of kDumpBuffersQuery, which asks for only those records which
+// match every one of its bounds. The response is as for kDumpBuffers, but
+// with only the matching records.
+//
+// The time bounds are on the TimestampHeader of each record (see
+// timestamp_header.h), in nanoseconds, and are inclusive. A maximum of zero
+// means that there is no upper bound. (So a zeroed DumpQuery matches every
+// record of kError severity.)
+struct DumpQuery {
+  DumpQuery& set_min_boottime_nsec(uint64_t new_min_boottime_nsec) {
+    min_boottime_nsec = new_min_boottime_nsec;
+    return *this;
+  }
+
+  DumpQuery& set_max_boottime_nsec(uint64_t new_max_boottime_nsec) {
+    max_boottime_nsec = new_max_boottime_nsec;
+    return *this;
+  }
+
+  DumpQuery& set_min_realtime_nsec(uint64_t new_min_realtime_nsec) {
+    min_realtime_nsec = new_min_realtime_nsec;
+    return *this;
+  }
+
+  DumpQuery& set_max_realtime_nsec(uint64_t new_max_realtime_nsec) {
+    max_realtime_nsec = new_max_realtime_nsec;
+    return *this;
+  }
+
+  DumpQuery& set_min_severity(MessageSeverity new_min_severity) {
+    min_severity = new_min_severity;
+    return *this;
+  }
+
+  DumpQuery& set_tag_len(uint8_t new_tag_len) {
+    tag_len = new_tag_len;
+    return *this;
+  }
+
+  // Bounds on TimestampHeader::since_boot_with_sleep.
+  uint64_t min_boottime_nsec;
+  uint64_t max_boottime_nsec;
+  // Bounds on TimestampHeader::since_epoch.
+  uint64_t min_realtime_nsec;
+  uint64_t max_realtime_nsec;
+  // Records less severe than |min_severity| do not match.
+  MessageSeverity min_severity;
+  // If non-zero, only records with this tag match.
+  uint8_t tag_len;
+  uint8_t reserved[6];  // Must be zero.
+  // Payload follows.
+  // uint8_t tag[tag_len];
+};
+
+// kSubscribe, which has no payload, asks for records to be streamed to the
+// fd sent with the command (as SCM_RIGHTS ancillary data), as they are
+// logged. Only records logged after the subscription are streamed. Each
+// record is written as a line of text, as in the response to kDumpBuffers.
+// (A RepeatedMessage record is written again each time that it counts
+// another repeat.)
+//
+// wifilogd makes the fd non-blocking, and queues what the subscriber has
+// yet to read. A subscriber that falls too far behind is detached, by
+// closing the fd, so that a slow subscriber cannot stall logging.
+
+// The response to kDumpBuffersBinary starts with a BinaryDumpPreamble.
+// The preamble is followed by the Stats at the time of the dump, and then
+// by zero or more records, oldest first. Each record consists of
+// - a uint16_t giving the length of the rest of the record,
+// - a TimestampHeader (see timestamp_header.h), and
+// - the Command that was logged, including its payload.
+//
+// All fields are in the byte order of the device that produced the dump.
+// (A reader can detect a byte-order mismatch from |magic|.) Any change to
+// the format of the records requires a new |version|.
+constexpr uint32_t kBinaryDumpMagic = 0x474f4c57;  // "WLOG", little-endian.
+constexpr uint16_t kBinaryDumpVersion = 2;
+// Version 1 dumps are identical to version 2 dumps, except that they have
+// no Stats.
+constexpr uint16_t kBinaryDumpVersionWithoutStats = 1;
+
+struct BinaryDumpPreamble {
+  BinaryDumpPreamble& set_magic(uint32_t new_magic) {
+    magic = new_magic;
+    return *this;
+  }
+
+  BinaryDumpPreamble& set_version(uint16_t new_version) {
+    version = new_version;
+    return *this;
+  }
+
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;  // Must be zero.
+};
+
+// Counts of events which cost us log messages (or which suggest that the
+// buffers are mis-sized). The counts start at zero when wifilogd starts.
+// The response to kDumpStats is a line of text summarizing the Stats,
+// followed by a line for each opcode whose latency has been measured. (See
+// Command::src_boottime_nsec.) When wifilogd is built with profiling (see
+// profiler.h), a line for each profiled stage follows. Text dumps start
+// with the same lines, and binary dumps include the Stats themselves.
+struct Stats {
+  uint64_t n_messages_logged;
+  // Messages evicted from the log buffers, to make room for newer
+  // messages, or in response to memory pressure.
+  uint64_t n_messages_evicted;
+  // Messages which never reached us, as inferred from gaps in the
+  // Command::sequence_num values for each tag. This includes messages which
+  // were dropped because the socket's receive queue was full.
+  uint64_t n_messages_missing;
+  // Datagrams longer than kMaxMessageSize, which were truncated.
+  uint64_t n_datagrams_truncated;
+  // Commands which were malformed, had an unknown opcode, or could not be
+  // carried out.
+  uint64_t n_commands_rejected;
+  // Records in shared rings which were dropped as malformed.
+  uint64_t n_ring_records_dropped;
+  // Receive attempts which failed with ENOMEM, or EINTR, and were retried.
+  uint64_t n_receive_enomem_errors;
+  uint64_t n_receive_eintr_errors;
+};
+
+// A client that logs at a high rate may, instead of sending each message
+// as its own datagram, publish messages into a ring in shared memory.
+// The client creates a memfd with F_SEAL_SHRINK applied, lays out a
+// SharedRingHeader at the start of the mapping, and sends the fd (as
+// SCM_RIGHTS ancillary data) with a kRegisterSharedRing command. The
+// payload of that command is a SharedRingRegistration.
+//
+// The ring has a single producer (the client) and a single consumer
+// (wifilogd). Records are a uint16_t length, followed by that many bytes
+// of Command (as would otherwise have been sent as a datagram). A record
+// never wraps around the end of the data area. When a record would not
+// fit before the end, the producer writes a zero length (if there is room
+// for one), and continues at the start of the data area.
+//
+// |write_pos| and |read_pos| count bytes, mod 2^32, and are reduced mod
+// |data_len| to find an offset. The producer publishes records by storing
+// |write_pos| with release semantics; the consumer frees space by storing
+// |read_pos| with release semantics.
+//
+// The consumer sets |reader_waiting| before it stops polling the ring. A
+// producer that finds |reader_waiting| set, after publishing a record,
+// clears it, and sends a kDrainSharedRings command over the socket. The
+// control socket remains the channel for all other commands.
+constexpr uint32_t kSharedRingMagic = 0x474e5257;  // "WRNG", little-endian.
+constexpr uint16_t kSharedRingVersion = 1;
+constexpr size_t kSharedRingCacheLineSize = 64;
+// |data_len| must be large enough for a maximal record, and small enough
+// that a misbehaving client can't tie up much of wifilogd's address space.
+constexpr size_t kMinSharedRingDataLen = 8192;
+constexpr size_t kMaxSharedRingDataLen = 4 * 1024 * 1024;
+static_assert(kMinSharedRingDataLen >= sizeof(uint16_t) + kMaxMessageSize,
+              "a shared ring must be able to hold a maximal message");
+
+struct SharedRingRegistration {
+  SharedRingRegistration& set_mapping_len(uint32_t new_mapping_len) {
+    mapping_len = new_mapping_len;
+    return *this;
+  }
+
+  // The header plus data, in bytes. Must be between
+  // sizeof(SharedRingHeader) + kMinSharedRingDataLen and
+  // sizeof(SharedRingHeader) + kMaxSharedRingDataLen.
+  uint32_t mapping_len;
+  uint32_t reserved;  // Must be zero.
+};
+
+struct SharedRingHeader {
+  // Written by the producer, before registration.
+  uint32_t magic;
+  uint16_t version;
+  uint16_t reserved;  // Must be zero.
+  uint32_t data_len;  // Must be a power of two.
+
+  // Written by the producer, after registration. Kept on its own cache
+  // line, to avoid false sharing with the consumer's fields.
+  alignas(kSharedRingCacheLineSize) std::atomic<uint32_t> write_pos;
+
+  // Written by the consumer (and, for |reader_waiting|, cleared by the
+  // producer).
+  alignas(kSharedRingCacheLineSize) std::atomic<uint32_t> read_pos;
+  std::atomic<uint32_t> reader_waiting;
+
+  // |data_len| bytes of data follow, starting at offset
+  // sizeof(SharedRingHeader), which is a multiple of the cache line size.
+};
+static_assert(std::atomic<uint32_t>::is_always_lock_free,
+              "SharedRingHeader requires lock-free atomics");
+
 }  // namespace protocol
 }  // namespace wifilogd
 }  // namespace android
@@ -14,6 +14,11 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -35,18 +40,55 @@ int RawOs::ClockGettime(clockid_t clock_id, struct timespec* ts) const {
   return clock_gettime(clock_id, ts);
 }
 
+int RawOs::EpollCreate1(int flags) { return epoll_create1(flags); }
+
+int RawOs::EpollCtl(int epfd, int op, int fd, struct epoll_event* event) {
+  return epoll_ctl(epfd, op, fd, event);
+}
+
+int RawOs::EpollWait(int epfd, struct epoll_event* events, int maxevents,
+                     int timeout) {
+  return epoll_wait(epfd, events, maxevents, timeout);
+}
+
+int RawOs::Eventfd(unsigned int initval, int flags) {
+  return eventfd(initval, flags);
+}
+
+int RawOs::Fcntl(int fd, int cmd) { return fcntl(fd, cmd); }
+
+int RawOs::Fcntl(int fd, int cmd, int arg) { return fcntl(fd, cmd, arg); }
+
+int RawOs::Fstat(int fd, struct stat* statbuf) { return fstat(fd, statbuf); }
+
 int RawOs::GetControlSocket(const char* socket_name) {
   return android_get_control_socket(socket_name);
 }
 
+void* RawOs::Mmap(void* addr, size_t length, int prot, int flags, int fd,
+                  off_t offset) {
+  return mmap(addr, length, prot, flags, fd, offset);
+}
+
+int RawOs::Munmap(void* addr, size_t length) { return munmap(addr, length); }
+
 int RawOs::Nanosleep(const struct timespec* req, struct timespec* rem) {
   return nanosleep(req, rem);
 }
 
+ssize_t RawOs::Read(int fd, void* buf, size_t buflen) {
+  return read(fd, buf, buflen);
+}
+
 ssize_t RawOs::Recv(int sockfd, void* buf, size_t buflen, int flags) {
   return recv(sockfd, buf, buflen, flags);
 }
 
+int RawOs::RecvMmsg(int sockfd, struct mmsghdr* msgvec, unsigned int vlen,
+                    int flags, struct timespec* timeout) {
+  return recvmmsg(sockfd, msgvec, vlen, flags, timeout);
+}
+
 ssize_t RawOs::Write(int fd, const void* buf, size_t buflen) {
   return write(fd, buf, buflen);
 }
@@ -17,7 +17,9 @@
 #ifndef RAW_OS_H_
 #define RAW_OS_H_
 
+#include <sys/epoll.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 
@@ -38,16 +40,52 @@ class RawOs {
   virtual int ClockGettime(clockid_t clock_id,
                            NONNULL struct timespec* tspec) const;
 
+  // See epoll_create1().
+  virtual int EpollCreate1(int flags);
+
+  // See epoll_ctl().
+  virtual int EpollCtl(int epfd, int op, int fd, struct epoll_event* event);
+
+  // See epoll_wait().
+  virtual int EpollWait(int epfd, NONNULL struct epoll_event* events,
+                        int maxevents, int timeout);
+
+  // See eventfd().
+  virtual int Eventfd(unsigned int initval, int flags);
+
+  // See fcntl(). (For commands which take no argument.)
+  virtual int Fcntl(int fd, int cmd);
+
+  // See fcntl(). (For commands which take an int argument.)
+  virtual int Fcntl(int fd, int cmd, int arg);
+
+  // See fstat().
+  virtual int Fstat(int fd, NONNULL struct stat* statbuf);
+
   // See android_get_control_socket().
   virtual int GetControlSocket(const char* socket_name);
 
+  // See mmap().
+  virtual void* Mmap(void* addr, size_t length, int prot, int flags, int fd,
+                     off_t offset);
+
+  // See munmap().
+  virtual int Munmap(void* addr, size_t length);
+
   // See nanosleep().
   virtual int Nanosleep(NONNULL const struct timespec* req,
                         struct timespec* rem);
 
+  // See read().
+  virtual ssize_t Read(int fd, void* buf, size_t buflen);
+
   // See recv().
   virtual ssize_t Recv(int sockfd, void* buf, size_t buflen, int flags);
 
+  // See recvmmsg().
+  virtual int RecvMmsg(int sockfd, NONNULL struct mmsghdr* msgvec,
+                       unsigned int vlen, int flags, struct timespec* timeout);
+
   // See write().
   virtual ssize_t Write(int fd, const void* buf, size_t buflen);
 
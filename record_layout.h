@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef RECORD_LAYOUT_H_
+#define RECORD_LAYOUT_H_
+
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/timestamp_header.h"
+
+namespace android {
+namespace wifilogd {
+
+namespace internal {
+
+// Returns the offset of the |index|-th of |FieldTs|, when the fields are
+// packed back to back. |index| may be sizeof...(FieldTs), in which case the
+// result is the size of all of the fields.
+template <typename... FieldTs>
+constexpr size_t GetPackedOffset(size_t index) {
+  const size_t sizes[] = {0, sizeof(FieldTs)...};
+  size_t offset = 0;
+  for (size_t i = 1; i <= index; ++i) {
+    offset += sizes[i];
+  }
+  return offset;
+}
+
+}  // namespace internal
+
+// Describes a record which begins with the headers |FieldTs|, packed back to
+// back. (That is how CommandProcessor writes its records, and how clients
+// write their commands.) The offset of each header, and the size of the
+// whole layout, are known at compile time. So reading or writing all of the
+// headers costs a single bounds check, rather than one check per header.
+//
+// As with local_utils::CopyFromBufferOrDie(), the headers are copied in and
+// out with memcpy(), so the buffer need not be aligned.
+//
+// Usage could be as follows:
+//     TimestampHeader tstamp_header;
+//     protocol::Command command_header;
+//     std::tie(tstamp_header, command_header) =
+//         RecordHeaderLayout::ReadOrDie(record, record_len);
+template <typename... FieldTs>
+class RecordLayout {
+ public:
+  static_assert(sizeof...(FieldTs) > 0, "a layout must have a field");
+
+  using Fields = std::tuple<FieldTs...>;
+  template <size_t I>
+  using Field = typename std::tuple_element<I, Fields>::type;
+
+  static constexpr size_t kNumFields = sizeof...(FieldTs);
+  // The number of bytes occupied by all of the fields.
+  static constexpr size_t kSize =
+      internal::GetPackedOffset<FieldTs...>(sizeof...(FieldTs));
+
+  // Returns the offset of the |I|-th field, from the start of the record.
+  template <size_t I>
+  static constexpr size_t GetOffset() {
+    static_assert(I < kNumFields, "field index out of range");
+    return internal::GetPackedOffset<FieldTs...>(I);
+  }
+
+  // Copies every field out of |buf|, aborting if |buf_len| is less than
+  // kSize.
+  static Fields ReadOrDie(NONNULL const void* buf, size_t buf_len) {
+    CHECK(buf_len >= kSize);
+    return ReadFields(static_cast<const uint8_t*>(buf),
+                      std::index_sequence_for<FieldTs...>());
+  }
+
+  // Copies the |I|-th field out of |buf|, aborting if |buf_len| is too
+  // short to hold that field. (The fields after the |I|-th need not be
+  // present.)
+  template <size_t I>
+  static Field<I> ReadFieldOrDie(NONNULL const void* buf, size_t buf_len) {
+    CHECK(buf_len >= GetOffset<I>() + sizeof(Field<I>));
+    return CopyFieldOut<I>(static_cast<const uint8_t*>(buf));
+  }
+
+  // Writes |fields| to |buf|, aborting if |buf_len| is less than kSize.
+  // Returns a pointer just past the last field written.
+  static RETURNS_NONNULL uint8_t* WriteOrDie(NONNULL void* buf,
+                                             size_t buf_len,
+                                             const FieldTs&... fields) {
+    CHECK(buf_len >= kSize);
+    auto* const out = static_cast<uint8_t*>(buf);
+    WriteFields(out, std::index_sequence_for<FieldTs...>(), fields...);
+    return out + kSize;
+  }
+
+  // Overwrites the |I|-th field in |buf| with |field|, aborting if
+  // |buf_len| is too short to hold that field.
+  template <size_t I>
+  static void WriteFieldOrDie(NONNULL void* buf, size_t buf_len,
+                              const Field<I>& field) {
+    CHECK(buf_len >= GetOffset<I>() + sizeof(field));
+    std::memcpy(static_cast<uint8_t*>(buf) + GetOffset<I>(), &field,
+                sizeof(field));
+  }
+
+ private:
+  template <size_t I>
+  static Field<I> CopyFieldOut(const uint8_t* buf) {
+    static_assert(std::is_trivially_copyable<Field<I>>::value,
+                  "RecordLayout can only copy trivially copyable types");
+    Field<I> out;
+    std::memcpy(&out, buf + GetOffset<I>(), sizeof(out));
+    return out;
+  }
+
+  template <size_t... Is>
+  static Fields ReadFields(const uint8_t* buf, std::index_sequence<Is...>) {
+    return Fields(CopyFieldOut<Is>(buf)...);
+  }
+
+  template <size_t... Is>
+  static void WriteFields(uint8_t* buf, std::index_sequence<Is...>,
+                          const FieldTs&... fields) {
+    // Expands to one memcpy() per field, in order.
+    const int expander[] = {
+        (std::memcpy(buf + GetOffset<Is>(), &fields, sizeof(fields)), 0)...};
+    (void)expander;
+  }
+};
+
+template <typename... FieldTs>
+constexpr size_t RecordLayout<FieldTs...>::kNumFields;
+template <typename... FieldTs>
+constexpr size_t RecordLayout<FieldTs...>::kSize;
+
+// The headers at the start of every record in a log buffer (and, hence, of
+// every record in a binary dump). See CommandProcessor::log_buffers_.
+using RecordHeaderLayout = RecordLayout<TimestampHeader, protocol::Command>;
+
+// The headers of a record for a kWriteAsciiMessage or
+// kWriteStructuredMessage command. (StructuredMessage shares the layout of
+// AsciiMessage's tag_len and severity.)
+using AsciiRecordHeaderLayout =
+    RecordLayout<TimestampHeader, protocol::Command, protocol::AsciiMessage>;
+
+// The headers of a record for a kRepeatedMessage.
+using RepeatedRecordHeaderLayout =
+    RecordLayout<TimestampHeader, protocol::Command,
+                 protocol::RepeatedMessage>;
+
+// The headers of a kWriteAsciiMessage or kWriteStructuredMessage command, as
+// received from a client.
+using TaggedCommandLayout =
+    RecordLayout<protocol::Command, protocol::AsciiMessage>;
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // RECORD_LAYOUT_H_
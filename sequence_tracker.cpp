@@ -0,0 +1,66 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "wifilogd/sequence_tracker.h"
+
+namespace android {
+namespace wifilogd {
+
+constexpr size_t SequenceTracker::kMaxTrackedTags;
+
+namespace {
+
+// Gaps of this size or more are treated as a sequence number moving
+// backwards. (As with TCP sequence numbers, comparisons are modulo 2^16.)
+constexpr uint16_t kMinBackwardsDistance = 0x8000;
+
+// Returns the 64-bit FNV-1a hash of |len| bytes at |data|.
+uint64_t HashTag(const uint8_t* data, size_t len) {
+  constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+  constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+  uint64_t hash = kFnvOffsetBasis;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ data[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+}  // namespace
+
+SequenceTracker::SequenceTracker() : next_sequence_nums_() {
+  next_sequence_nums_.reserve(kMaxTrackedTags);
+}
+
+uint16_t SequenceTracker::Track(const uint8_t* tag, size_t tag_len,
+                                uint16_t sequence_num) {
+  const uint64_t tag_hash = HashTag(tag, tag_len);
+  const uint16_t next_sequence_num = sequence_num + 1;
+  const auto it = next_sequence_nums_.find(tag_hash);
+  if (it == next_sequence_nums_.end()) {
+    if (next_sequence_nums_.size() == kMaxTrackedTags) {
+      next_sequence_nums_.clear();
+    }
+    next_sequence_nums_.emplace(tag_hash, next_sequence_num);
+    return 0;
+  }
+
+  const uint16_t gap = sequence_num - it->second;
+  it->second = next_sequence_num;
+  return gap < kMinBackwardsDistance ? gap : 0;
+}
+
+}  // namespace wifilogd
+}  // namespace android
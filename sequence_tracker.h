@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SEQUENCE_TRACKER_H_
+#define SEQUENCE_TRACKER_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+
+namespace android {
+namespace wifilogd {
+
+// Detects messages lost between a writer and wifilogd, from gaps in the
+// protocol::Command::sequence_num values. Sequence numbers are meaningful
+// only within a single tag, so each tag is tracked separately.
+//
+// Tags are identified by a 64-bit hash, so that tracking a message does not
+// require copying its tag. (A collision between two tags would make gaps
+// appear where there are none. With the handful of tags in use on a device,
+// that is vanishingly unlikely.)
+class SequenceTracker {
+ public:
+  // The maximal number of tags which are tracked at once. When a new tag
+  // would exceed this limit, tracking restarts for all tags.
+  static constexpr size_t kMaxTrackedTags = 128;
+
+  SequenceTracker();
+
+  // Records the receipt of a message with |sequence_num|, for the tag of
+  // |tag_len| bytes at |tag|. Returns the number of messages for that tag
+  // that were skipped since the previous message with that tag.
+  //
+  // A sequence number which is at or behind the expected one (as when a
+  // writer restarts, or does not set sequence numbers at all) restarts
+  // tracking for the tag, and is not counted as a gap.
+  uint16_t Track(NONNULL const uint8_t* tag, size_t tag_len,
+                 uint16_t sequence_num);
+
+ private:
+  // Maps the hash of each tag to the sequence number expected next.
+  std::unordered_map<uint64_t, uint16_t> next_sequence_nums_;
+
+  DISALLOW_COPY_AND_ASSIGN(SequenceTracker);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // SEQUENCE_TRACKER_H_
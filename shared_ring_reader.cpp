@@ -0,0 +1,145 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <tuple>
+
+#include "wifilogd/shared_ring_reader.h"
+
+namespace android {
+namespace wifilogd {
+
+using protocol::SharedRingHeader;
+
+std::unique_ptr<SharedRingReader> SharedRingReader::Create(void* mapping,
+                                                           size_t mapping_len) {
+  if (reinterpret_cast<uintptr_t>(mapping) %
+          protocol::kSharedRingCacheLineSize ||
+      mapping_len < sizeof(SharedRingHeader)) {
+    return nullptr;
+  }
+
+  auto* const header = static_cast<SharedRingHeader*>(mapping);
+  const uint32_t data_len = header->data_len;
+  if (header->magic != protocol::kSharedRingMagic ||
+      header->version != protocol::kSharedRingVersion ||
+      data_len < protocol::kMinSharedRingDataLen ||
+      data_len > protocol::kMaxSharedRingDataLen ||
+      (data_len & (data_len - 1)) ||
+      mapping_len - sizeof(SharedRingHeader) < data_len) {
+    return nullptr;
+  }
+
+  std::unique_ptr<SharedRingReader> reader(
+      new SharedRingReader(header, data_len));
+  if (reader->IsCorrupt()) {
+    return nullptr;
+  }
+  return reader;
+}
+
+std::tuple<const uint8_t*, size_t> SharedRingReader::ConsumeNextRecord() {
+  uint16_t record_len;
+  while (!corrupt_) {
+    if (read_pos_ == write_pos_) {
+      // Everything we know of has been consumed. Release the space, and
+      // look for more records. (As in ArmWakeup(), the release pairs with
+      // the writer's acquire. And the acquire here pairs with the writer's
+      // store of |write_pos|, so that the records are visible before we
+      // read them.)
+      header_->read_pos.store(read_pos_, std::memory_order_release);
+      SetWritePos(header_->write_pos.load(std::memory_order_acquire));
+      if (read_pos_ == write_pos_) {
+        break;
+      }
+      continue;
+    }
+
+    const uint32_t offset = read_pos_ & (data_len_ - 1);
+    const uint32_t len_to_end = data_len_ - offset;
+    const uint32_t unread_len = write_pos_ - read_pos_;
+    if (len_to_end >= sizeof(record_len) && unread_len >= sizeof(record_len)) {
+      std::memcpy(&record_len, data_ + offset, sizeof(record_len));
+    } else {
+      record_len = 0;  // Too little space for a length. Skip to the start.
+    }
+
+    if (!record_len) {
+      if (unread_len < len_to_end) {
+        corrupt_ = true;
+        break;
+      }
+      read_pos_ += len_to_end;
+      continue;
+    }
+
+    const uint32_t total_len = sizeof(record_len) + record_len;
+    if (total_len > len_to_end || total_len > unread_len) {
+      corrupt_ = true;
+      break;
+    }
+    read_pos_ += total_len;
+    return {data_ + offset + sizeof(record_len), record_len};
+  }
+  return {nullptr, 0};
+}
+
+bool SharedRingReader::ArmWakeup() {
+  if (corrupt_) {
+    return true;
+  }
+
+  // The release pairs with the writer's acquire, so that our reads of the
+  // consumed records complete before the writer can overwrite them.
+  header_->read_pos.store(read_pos_, std::memory_order_release);
+
+  // Setting |reader_waiting| and then re-checking |write_pos| must not be
+  // reordered, or we could miss a record that the writer is just
+  // publishing. (The writer publishes |write_pos|, and then checks
+  // |reader_waiting|.)
+  header_->reader_waiting.store(1, std::memory_order_seq_cst);
+  SetWritePos(header_->write_pos.load(std::memory_order_seq_cst));
+  return corrupt_ || read_pos_ == write_pos_;
+}
+
+// Private methods below.
+
+SharedRingReader::SharedRingReader(SharedRingHeader* header,
+                                   uint32_t data_len)
+    : header_(header),
+      data_(reinterpret_cast<const uint8_t*>(header) +
+            sizeof(SharedRingHeader)),
+      data_len_(data_len),
+      read_pos_(header->read_pos.load(std::memory_order_relaxed)),
+      write_pos_(read_pos_),
+      corrupt_(false) {
+  SetWritePos(header_->write_pos.load(std::memory_order_acquire));
+}
+
+void SharedRingReader::SetWritePos(uint32_t write_pos) {
+  // The writer may never get more than a ring's worth ahead of us. (Note
+  // that the subtraction is modulo 2^32, as with the positions themselves.)
+  if (write_pos - read_pos_ > data_len_) {
+    corrupt_ = true;
+    return;
+  }
+  write_pos_ = write_pos;
+}
+
+}  // namespace wifilogd
+}  // namespace android
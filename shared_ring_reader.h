@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHARED_RING_READER_H_
+#define SHARED_RING_READER_H_
+
+#include <cstdint>
+#include <memory>
+#include <tuple>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+
+// The consumer side of a shared-memory ring, as described for
+// protocol::SharedRingHeader.
+//
+// The ring is shared with an untrusted client. So the reader keeps its own
+// copy of the ring's geometry and read position, and validates every length
+// that it reads from the ring. Note, however, that the client can modify a
+// record even while that record is being read. Callers which need a stable
+// view of a record must copy the record first.
+//
+// The user must ensure that the mapping outlives the SharedRingReader.
+class SharedRingReader {
+ public:
+  // Returns a reader for the ring in the |mapping_len| bytes at |mapping|.
+  // Returns nullptr if the mapping does not hold a valid ring, with a
+  // supported protocol::kSharedRingVersion.
+  static std::unique_ptr<SharedRingReader> Create(NONNULL void* mapping,
+                                                  size_t mapping_len);
+
+  // Returns a pointer to the next record in the ring, along with the length
+  // of that record. The record remains valid until the next call to
+  // ConsumeNextRecord() or ArmWakeup(). Returns {nullptr, 0} if the ring is
+  // empty, or corrupt. The space held by consumed records is released to
+  // the writer whenever the reader catches up with the writer.
+  std::tuple<const uint8_t*, size_t> ConsumeNextRecord();
+
+  // Releases the space held by consumed records, and asks the writer to
+  // send a wakeup when the next record is published. Returns true if the
+  // ring is empty, or corrupt. Returns false if the writer published more
+  // records since the last call to ConsumeNextRecord(). (In which case, the
+  // caller should consume those records, and then try again.)
+  bool ArmWakeup();
+
+  // Returns true if the writer has violated the ring protocol. Once the
+  // ring is corrupt, no further records are returned.
+  bool IsCorrupt() const { return corrupt_; }
+
+  // Returns the size of the ring's data area.
+  size_t GetDataLen() const { return data_len_; }
+
+ private:
+  SharedRingReader(NONNULL protocol::SharedRingHeader* header,
+                   uint32_t data_len);
+
+  // Updates |write_pos_| from |header_|. Validates the new value, and marks
+  // the ring corrupt if the value is invalid.
+  void SetWritePos(uint32_t write_pos);
+
+  protocol::SharedRingHeader* const header_;
+  const uint8_t* const data_;
+  const uint32_t data_len_;
+  uint32_t read_pos_;
+  uint32_t write_pos_;  // As last read from |header_|.
+  bool corrupt_;
+
+  DISALLOW_COPY_AND_ASSIGN(SharedRingReader);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // SHARED_RING_READER_H_
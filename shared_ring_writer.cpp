@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/shared_ring_writer.h"
+
+namespace android {
+namespace wifilogd {
+
+using protocol::SharedRingHeader;
+
+namespace {
+
+// Constructs an empty SharedRingHeader at |mapping|.
+SharedRingHeader* ConstructHeader(void* mapping) {
+  CHECK(reinterpret_cast<uintptr_t>(mapping) %
+            protocol::kSharedRingCacheLineSize ==
+        0);
+  return new (mapping) SharedRingHeader();
+}
+
+// Returns the largest power of two which fits in the data area of a
+// |mapping_len|-byte mapping, up to protocol::kMaxSharedRingDataLen.
+uint32_t GetDataLenForMapping(size_t mapping_len) {
+  CHECK(mapping_len >= SharedRingWriter::GetMinMappingLen());
+  const size_t max_len = std::min(mapping_len - sizeof(SharedRingHeader),
+                                  protocol::kMaxSharedRingDataLen);
+  size_t data_len = protocol::kMinSharedRingDataLen;
+  while (data_len <= max_len / 2) {
+    data_len *= 2;
+  }
+  return data_len;
+}
+
+}  // namespace
+
+SharedRingWriter::SharedRingWriter(void* mapping, size_t mapping_len)
+    : header_(ConstructHeader(mapping)),
+      data_(static_cast<uint8_t*>(mapping) + sizeof(SharedRingHeader)),
+      data_len_(GetDataLenForMapping(mapping_len)),
+      write_pos_(0) {
+  header_->magic = protocol::kSharedRingMagic;
+  header_->version = protocol::kSharedRingVersion;
+  header_->data_len = data_len_;
+}
+
+SharedRingWriter::WriteResult SharedRingWriter::Write(const void* data,
+                                                      uint16_t data_len) {
+  CHECK(data_len >= 1);
+  if (data_len > protocol::kMaxMessageSize) {
+    return WriteResult::kRecordTooLarge;
+  }
+
+  // Records never wrap. If this record doesn't fit before the end of the
+  // data area, the space up to the end is skipped.
+  const uint32_t record_len = sizeof(data_len) + data_len;
+  uint32_t offset = write_pos_ & (data_len_ - 1);
+  const uint32_t len_to_end = data_len_ - offset;
+  const uint32_t skip_len = len_to_end < record_len ? len_to_end : 0;
+
+  // The acquire pairs with the reader's release, so that we don't overwrite
+  // a record that is still being read.
+  const uint32_t used_len =
+      write_pos_ - header_->read_pos.load(std::memory_order_acquire);
+  if (used_len > data_len_ || data_len_ - used_len < skip_len + record_len) {
+    return WriteResult::kRingFull;
+  }
+
+  if (skip_len) {
+    if (skip_len >= sizeof(data_len)) {
+      const uint16_t skip_marker = 0;
+      std::memcpy(data_ + offset, &skip_marker, sizeof(skip_marker));
+    }
+    write_pos_ += skip_len;
+    offset = 0;
+  }
+  std::memcpy(data_ + offset, &data_len, sizeof(data_len));
+  std::memcpy(data_ + offset + sizeof(data_len), data, data_len);
+  write_pos_ += record_len;
+
+  // Publishing |write_pos| and then checking |reader_waiting| must not be
+  // reordered, or we could miss a reader that is just going to sleep. (The
+  // reader sets |reader_waiting|, and then re-checks |write_pos|.) Hence
+  // the sequentially-consistent operations.
+  header_->write_pos.store(write_pos_, std::memory_order_seq_cst);
+  if (header_->reader_waiting.load(std::memory_order_seq_cst) &&
+      header_->reader_waiting.exchange(0, std::memory_order_seq_cst)) {
+    return WriteResult::kOkWakeupNeeded;
+  }
+  return WriteResult::kOk;
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,78 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SHARED_RING_WRITER_H_
+#define SHARED_RING_WRITER_H_
+
+#include <cstdint>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+
+// The producer side of a shared-memory ring, as described for
+// protocol::SharedRingHeader. Publishes records without locks, or system
+// calls. (The caller sends the kDrainSharedRings doorbell, when Write()
+// asks for it.)
+//
+// The user must ensure that the mapping outlives the SharedRingWriter. At
+// most one SharedRingWriter may write to a given ring.
+class SharedRingWriter {
+ public:
+  enum class WriteResult {
+    kOk,              // The record was published.
+    kOkWakeupNeeded,  // As above, and the reader must be woken.
+    kRingFull,        // The record was dropped, for lack of space.
+    kRecordTooLarge,  // The record exceeds protocol::kMaxMessageSize.
+  };
+
+  // Lays out an empty ring in the |mapping_len| bytes at |mapping|. The
+  // data area is sized to the largest power of two that fits in the mapping,
+  // up to protocol::kMaxSharedRingDataLen. |mapping| must be aligned to
+  // protocol::kSharedRingCacheLineSize, and |mapping_len| must be at least
+  // GetMinMappingLen().
+  SharedRingWriter(NONNULL void* mapping, size_t mapping_len);
+
+  // Returns the smallest mapping which can hold a ring.
+  static constexpr size_t GetMinMappingLen() {
+    return sizeof(protocol::SharedRingHeader) +
+           protocol::kMinSharedRingDataLen;
+  }
+
+  // Publishes the |data_len| bytes at |data| as a single record. |data_len|
+  // must be >= 1.
+  WriteResult Write(NONNULL const void* data, uint16_t data_len);
+
+  // Returns the size of the ring's data area.
+  size_t GetDataLen() const { return data_len_; }
+
+ private:
+  protocol::SharedRingHeader* const header_;
+  uint8_t* const data_;
+  const uint32_t data_len_;
+  uint32_t write_pos_;  // Our copy of |header_->write_pos|.
+
+  DISALLOW_COPY_AND_ASSIGN(SharedRingWriter);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // SHARED_RING_WRITER_H_
@@ -0,0 +1,91 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STRUCTURED_FORMATS_H_
+#define STRUCTURED_FORMATS_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "wifilogd/local_utils.h"
+
+namespace android {
+namespace wifilogd {
+namespace structured_formats {
+
+// The format strings for protocol::StructuredMessage. Each "{}" in a format
+// string is replaced by the next argument of the message. (The types of the
+// arguments are carried in the message, so they are not repeated here.)
+//
+// Dumps are formatted with the catalog of the reader, which may be older or
+// newer than that of the writer. So IDs must never be reused, or their
+// format strings changed in a way that changes the meaning of their
+// arguments. Add new formats at the end.
+enum class FormatId : uint16_t {
+  kConnected,
+  kDisconnected,
+  kScanStarted,
+  kScanResults,
+  kRssiPoll,
+  kRoamStarted,
+};
+
+// The maximal length of a format string, excluding the terminating NUL.
+constexpr size_t kMaxFormatStringLen = 128;
+
+namespace internal {
+
+constexpr std::array<const char*, 6> kFormatStrings{{
+    "connected ssid={} bssid={} freq_mhz={}",
+    "disconnected bssid={} reason={} locally_generated={}",
+    "scan started n_freqs={}",
+    "scan results n_results={}",
+    "rssi poll bssid={} rssi_dbm={} tx_kbps={} rx_kbps={}",
+    "roam started from={} to={} rssi_dbm={}",
+}};
+
+constexpr size_t GetLength(const char* str) {
+  return *str ? 1 + GetLength(str + 1) : 0;
+}
+
+constexpr bool AllFitMaxLength(size_t i) {
+  return i == kFormatStrings.size() ||
+         (GetLength(kFormatStrings[i]) <= kMaxFormatStringLen &&
+          AllFitMaxLength(i + 1));
+}
+
+static_assert(kFormatStrings.size() ==
+                  local_utils::CastEnumToInteger(FormatId::kRoamStarted) + 1,
+              "every FormatId must have a format string");
+static_assert(AllFitMaxLength(0),
+              "a format string is longer than kMaxFormatStringLen");
+
+}  // namespace internal
+
+// Returns the NUL-terminated format string for |format_id|, or nullptr if
+// |format_id| is unknown (e.g., because it was added after this version).
+inline const char* GetFormatString(uint16_t format_id) {
+  return format_id < internal::kFormatStrings.size()
+             ? internal::kFormatStrings[format_id]
+             : nullptr;
+}
+
+}  // namespace structured_formats
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // STRUCTURED_FORMATS_H_
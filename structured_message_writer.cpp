@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstring>
+
+#include "wifilogd/structured_message_writer.h"
+
+namespace android {
+namespace wifilogd {
+
+using protocol::StructuredArgType;
+
+namespace {
+
+constexpr size_t kHeadersLen =
+    sizeof(protocol::Command) + sizeof(protocol::StructuredMessage);
+
+}  // namespace
+
+StructuredMessageWriter::StructuredMessageWriter(
+    structured_formats::FormatId format_id, const char* tag, size_t tag_len,
+    protocol::MessageSeverity severity)
+    : command_(protocol::Command().set_opcode(
+          protocol::Opcode::kWriteStructuredMessage)),
+      buf_(),
+      len_(kHeadersLen),
+      n_args_(0) {
+  tag_len = std::min<size_t>(
+      tag_len,
+      local_utils::GetMaxVal<decltype(protocol::StructuredMessage::tag_len)>());
+  const auto structured_message_header =
+      protocol::StructuredMessage()
+          .set_format_id(local_utils::CastEnumToInteger(format_id))
+          .set_tag_len(tag_len)
+          .set_severity(severity);
+  std::memcpy(buf_.data() + sizeof(protocol::Command),
+              &structured_message_header, sizeof(structured_message_header));
+  std::memcpy(buf_.data() + len_, tag, tag_len);
+  len_ += tag_len;
+  WriteCommandHeader();
+}
+
+StructuredMessageWriter& StructuredMessageWriter::set_sequence_num(
+    uint16_t sequence_num) {
+  command_.set_sequence_num(sequence_num);
+  WriteCommandHeader();
+  return *this;
+}
+
+StructuredMessageWriter& StructuredMessageWriter::set_src_boottime_nsec(
+    uint64_t src_boottime_nsec) {
+  command_.set_src_boottime_nsec(src_boottime_nsec);
+  WriteCommandHeader();
+  return *this;
+}
+
+StructuredMessageWriter& StructuredMessageWriter::AddInt32(int32_t value) {
+  return AddArg(StructuredArgType::kInt32, &value, sizeof(value), false);
+}
+
+StructuredMessageWriter& StructuredMessageWriter::AddUint32(uint32_t value) {
+  return AddArg(StructuredArgType::kUint32, &value, sizeof(value), false);
+}
+
+StructuredMessageWriter& StructuredMessageWriter::AddInt64(int64_t value) {
+  return AddArg(StructuredArgType::kInt64, &value, sizeof(value), false);
+}
+
+StructuredMessageWriter& StructuredMessageWriter::AddUint64(uint64_t value) {
+  return AddArg(StructuredArgType::kUint64, &value, sizeof(value), false);
+}
+
+StructuredMessageWriter& StructuredMessageWriter::AddMacAddress(
+    const uint8_t* mac_address) {
+  return AddArg(StructuredArgType::kMacAddress, mac_address,
+                protocol::kMacAddressLen, false);
+}
+
+StructuredMessageWriter& StructuredMessageWriter::AddBytes(const void* data,
+                                                           uint8_t len) {
+  return AddArg(StructuredArgType::kBytes, data, len, true);
+}
+
+// Private methods below.
+
+StructuredMessageWriter& StructuredMessageWriter::AddArg(
+    StructuredArgType type, const void* value, size_t value_len,
+    bool prefix_len) {
+  const size_t arg_len = sizeof(type) + (prefix_len ? 1 : 0) + value_len;
+  if (n_args_ == protocol::kMaxStructuredArgs ||
+      arg_len > buf_.size() - len_) {
+    return *this;
+  }
+
+  uint8_t* out = buf_.data() + len_;
+  std::memcpy(out, &type, sizeof(type));
+  out += sizeof(type);
+  if (prefix_len) {
+    *out++ = static_cast<uint8_t>(value_len);
+  }
+  std::memcpy(out, value, value_len);
+  len_ += arg_len;
+  ++n_args_;
+  WriteCommandHeader();
+  return *this;
+}
+
+void StructuredMessageWriter::WriteCommandHeader() {
+  command_.set_payload_len(len_ - sizeof(protocol::Command));
+  std::memcpy(buf_.data(), &command_, sizeof(command_));
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef STRUCTURED_MESSAGE_WRITER_H_
+#define STRUCTURED_MESSAGE_WRITER_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/structured_formats.h"
+
+namespace android {
+namespace wifilogd {
+
+// Builds a kWriteStructuredMessage command, for a client to send to
+// wifilogd. As compared to formatting an AsciiMessage, this avoids parsing
+// a format string on the client, and produces a much smaller message.
+//
+// Usage could be as follows:
+//     StructuredMessageWriter writer(FormatId::kRssiPoll, kTag,
+//                                    sizeof(kTag) - 1,
+//                                    MessageSeverity::kInformational);
+//     writer.AddMacAddress(bssid).AddInt32(rssi_dbm).AddUint32(tx_kbps)
+//         .AddUint32(rx_kbps);
+//     send(sock_fd, writer.data(), writer.size(), MSG_DONTWAIT);
+//
+// The tag is truncated, if necessary. An argument which would not fit
+// within protocol::kMaxMessageSize, or which exceeds
+// protocol::kMaxStructuredArgs, is dropped. (A dump of the message shows
+// a dropped argument as a "{}" in the formatted text.)
+class StructuredMessageWriter {
+ public:
+  StructuredMessageWriter(structured_formats::FormatId format_id,
+                          NONNULL const char* tag, size_t tag_len,
+                          protocol::MessageSeverity severity);
+
+  // Set the corresponding fields of the Command header.
+  StructuredMessageWriter& set_sequence_num(uint16_t sequence_num);
+  StructuredMessageWriter& set_src_boottime_nsec(uint64_t src_boottime_nsec);
+
+  // Append an argument. Each returns a reference to the writer, to support
+  // chaining.
+  StructuredMessageWriter& AddInt32(int32_t value);
+  StructuredMessageWriter& AddUint32(uint32_t value);
+  StructuredMessageWriter& AddInt64(int64_t value);
+  StructuredMessageWriter& AddUint64(uint64_t value);
+  // |mac_address| must point at protocol::kMacAddressLen bytes.
+  StructuredMessageWriter& AddMacAddress(NONNULL const uint8_t* mac_address);
+  StructuredMessageWriter& AddBytes(NONNULL const void* data, uint8_t len);
+
+  // Returns the command built so far. The command remains valid until the
+  // writer is modified, or destroyed.
+  RETURNS_NONNULL const uint8_t* data() const { return buf_.data(); }
+  size_t size() const { return len_; }
+
+  // Returns the number of arguments appended (not counting those dropped).
+  size_t GetNumArgs() const { return n_args_; }
+
+ private:
+  // Appends an argument of |type|, with the |value_len| bytes at |value| as
+  // its value. If |prefix_len| is true, the value is preceded by its length,
+  // as a uint8_t.
+  StructuredMessageWriter& AddArg(protocol::StructuredArgType type,
+                                  NONNULL const void* value, size_t value_len,
+                                  bool prefix_len);
+
+  // Writes |command_| to the head of |buf_|.
+  void WriteCommandHeader();
+
+  protocol::Command command_;
+  std::array<uint8_t, protocol::kMaxMessageSize> buf_;
+  size_t len_;
+  size_t n_args_;
+
+  DISALLOW_COPY_AND_ASSIGN(StructuredMessageWriter);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // STRUCTURED_MESSAGE_WRITER_H_
@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/tag_table.h"
+
+namespace android {
+namespace wifilogd {
+
+constexpr size_t TagTable::kMaxTags;
+constexpr uint16_t TagTable::kNoTagId;
+
+namespace {
+
+// Returns the 64-bit FNV-1a hash of |len| bytes at |data|.
+uint64_t HashTag(const uint8_t* data, size_t len) {
+  constexpr uint64_t kFnvOffsetBasis = 0xcbf29ce484222325ULL;
+  constexpr uint64_t kFnvPrime = 0x100000001b3ULL;
+  uint64_t hash = kFnvOffsetBasis;
+  for (size_t i = 0; i < len; ++i) {
+    hash = (hash ^ data[i]) * kFnvPrime;
+  }
+  return hash;
+}
+
+}  // namespace
+
+TagTable::TagTable() : entries_(), index_(), free_ids_() {
+  index_.reserve(kMaxTags);
+  free_ids_.reserve(kMaxTags);
+  // Hand out low IDs first, which makes the table easier to debug.
+  for (size_t i = kMaxTags; i > 0; --i) {
+    free_ids_.push_back(i - 1);
+  }
+}
+
+uint16_t TagTable::Acquire(const uint8_t* tag, size_t tag_len) {
+  if (!tag_len) {
+    return kNoTagId;
+  }
+
+  const uint64_t tag_hash = HashTag(tag, tag_len);
+  const auto it = index_.find(tag_hash);
+  if (it != index_.end()) {
+    Entry& entry = entries_[it->second];
+    if (entry.tag.size() != tag_len ||
+        std::memcmp(entry.tag.data(), tag, tag_len) != 0) {
+      return kNoTagId;
+    }
+    ++entry.n_refs;
+    return it->second;
+  }
+
+  if (free_ids_.empty()) {
+    return kNoTagId;
+  }
+  const uint16_t tag_id = free_ids_.back();
+  free_ids_.pop_back();
+  Entry& entry = entries_[tag_id];
+  entry.tag.assign(reinterpret_cast<const char*>(tag), tag_len);
+  entry.tag_hash = tag_hash;
+  entry.n_refs = 1;
+  index_.emplace(tag_hash, tag_id);
+  return tag_id;
+}
+
+void TagTable::Release(uint16_t tag_id) {
+  CHECK(tag_id < kMaxTags);
+  Entry& entry = entries_[tag_id];
+  CHECK(entry.n_refs);
+  if (--entry.n_refs) {
+    return;
+  }
+  index_.erase(entry.tag_hash);
+  free_ids_.push_back(tag_id);
+}
+
+std::tuple<const uint8_t*, size_t> TagTable::GetTag(uint16_t tag_id) const {
+  CHECK(tag_id < kMaxTags);
+  const Entry& entry = entries_[tag_id];
+  CHECK(entry.n_refs);
+  return std::tuple<const uint8_t*, size_t>{
+      reinterpret_cast<const uint8_t*>(entry.tag.data()), entry.tag.size()};
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TAG_TABLE_H_
+#define TAG_TABLE_H_
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <tuple>
+#include <unordered_map>
+#include <vector>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+
+namespace android {
+namespace wifilogd {
+
+// Interns message tags, so that a logged message can refer to its tag by
+// a small ID, rather than storing the tag's bytes. (On a device, a few dozen
+// tags account for nearly every message.)
+//
+// Each ID is reference-counted, with one reference per logged message that
+// uses the ID. An ID is freed, for reuse by another tag, when its last
+// reference is released. So, as long as every evicted message releases its
+// reference, an ID never changes meaning while a message that uses it
+// remains in the log.
+class TagTable {
+ public:
+  // The maximal number of tags which may be interned at once. When the
+  // table is full, new tags are not interned.
+  static constexpr size_t kMaxTags = 256;
+  // Returned by Acquire() when a tag is not interned.
+  static constexpr uint16_t kNoTagId = kMaxTags;
+
+  TagTable();
+
+  // Returns the ID for the tag of |tag_len| bytes at |tag|, interning the
+  // tag if necessary, and takes a reference on that ID. Returns kNoTagId,
+  // without interning, if |tag_len| is zero, or the table is full.
+  uint16_t Acquire(NONNULL const uint8_t* tag, size_t tag_len);
+
+  // Releases a reference taken by Acquire(). |tag_id| must be referenced.
+  void Release(uint16_t tag_id);
+
+  // Returns the tag for |tag_id|, which must be referenced. The tag's
+  // storage remains valid until the last reference on |tag_id| is released.
+  std::tuple<const uint8_t*, size_t> GetTag(uint16_t tag_id) const;
+
+  // Returns the number of tags currently interned.
+  size_t GetNumTags() const { return index_.size(); }
+
+ private:
+  struct Entry {
+    std::string tag;
+    uint64_t tag_hash;
+    size_t n_refs;  // Zero if the entry is free.
+  };
+
+  std::array<Entry, kMaxTags> entries_;
+  // Maps the hash of each interned tag to its ID. A tag whose hash collides
+  // with that of a different interned tag is not interned.
+  std::unordered_map<uint64_t, uint16_t> index_;
+  std::vector<uint16_t> free_ids_;
+
+  DISALLOW_COPY_AND_ASSIGN(TagTable);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // TAG_TABLE_H_
@@ -0,0 +1,118 @@
+/*
+ * Copyright (C) 2016, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "android-base/stringprintf.h"
+#include "gtest/gtest.h"
+
+#include "wifilogd/ascii_sanitizer.h"
+#include "wifilogd/local_utils.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using ascii_sanitizer::CopySanitized;
+using ascii_sanitizer::CopySanitizedScalar;
+using local_utils::GetMaxVal;
+
+constexpr char kReplacement = '?';
+
+std::string Sanitize(const std::vector<uint8_t>& input) {
+  std::string out(input.size(), '\0');
+  char* const end =
+      CopySanitized(input.data(), input.size(), kReplacement, &out.front());
+  EXPECT_EQ(&out.front() + out.size(), end);
+  return out;
+}
+
+std::string SanitizeScalar(const std::vector<uint8_t>& input) {
+  std::string out(input.size(), '\0');
+  char* const end = CopySanitizedScalar(input.data(), input.size(),
+                                        kReplacement, &out.front());
+  EXPECT_EQ(&out.front() + out.size(), end);
+  return out;
+}
+
+}  // namespace
+
+TEST(AsciiSanitizerTest, CopySanitizedHandlesEmptyInput) {
+  char out = 'x';
+  EXPECT_EQ(&out, CopySanitized(nullptr, 0, kReplacement, &out));
+  EXPECT_EQ('x', out);
+}
+
+TEST(AsciiSanitizerTest, CopySanitizedPreservesPrintableCharacters) {
+  const std::string printable("\t\n !\"#$%&'()*+,-./0123456789:;<=>?@"
+                              "ABCDEFGHIJKLMNOPQRSTUVWXYZ[\\]^_`"
+                              "abcdefghijklmnopqrstuvwxyz{|}~");
+  EXPECT_EQ(printable,
+            Sanitize(std::vector<uint8_t>(printable.begin(), printable.end())));
+}
+
+TEST(AsciiSanitizerTest, CopySanitizedReplacesUnprintableCharacters) {
+  const std::vector<uint8_t> input{0x00, 0x08, 0x0b, 0x1f, 0x7f, 0x80, 0xff};
+  EXPECT_EQ(std::string(input.size(), kReplacement), Sanitize(input));
+}
+
+TEST(AsciiSanitizerTest, CopySanitizedMatchesScalarForEveryByteValue) {
+  // Place each byte value at every position within a vector block (and in
+  // the scalar tail), to verify that every lane is handled identically.
+  for (size_t len = 1; len <= 48; ++len) {
+    for (size_t pos = 0; pos < len; ++pos) {
+      for (unsigned int c = 0; c <= GetMaxVal<uint8_t>(); ++c) {
+        std::vector<uint8_t> input(len, 'a');
+        input[pos] = static_cast<uint8_t>(c);
+        ASSERT_EQ(SanitizeScalar(input), Sanitize(input))
+            << base::StringPrintf("Failed with len=%zu, pos=%zu, c=0x%02x",
+                                  len, pos, c);
+      }
+    }
+  }
+}
+
+TEST(AsciiSanitizerTest, CopySanitizedMatchesScalarForMaximalMessage) {
+  std::vector<uint8_t> input(protocol::kMaxMessageSize);
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = static_cast<uint8_t>(i * 37);
+  }
+  EXPECT_EQ(SanitizeScalar(input), Sanitize(input));
+}
+
+TEST(AsciiSanitizerTest, CopySanitizedHandlesUnalignedInputAndOutput) {
+  std::array<uint8_t, 64> input;
+  for (size_t i = 0; i < input.size(); ++i) {
+    input[i] = static_cast<uint8_t>(i % 2 ? 'a' : 0x01);
+  }
+  for (size_t offset = 0; offset < 16; ++offset) {
+    const size_t len = input.size() - offset;
+    std::string expected(len, '\0');
+    std::string actual(len + offset, '\0');
+    CopySanitizedScalar(input.data() + offset, len, kReplacement,
+                        &expected.front());
+    CopySanitized(input.data() + offset, len, kReplacement,
+                  &actual.front() + offset);
+    EXPECT_EQ(expected, actual.substr(offset)) << "offset=" << offset;
+  }
+}
+
+}  // namespace wifilogd
+}  // namespace android
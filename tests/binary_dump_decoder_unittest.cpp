@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2016, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/byte_buffer.h"
+#include "wifilogd/log_formatter.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/timestamp_header.h"
+
+#include "wifilogd/binary_dump_decoder.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using binary_dump_decoder::DecodeBinaryDump;
+
+constexpr size_t kBufferSizeBytes = 4 * log_formatter::kMaxRecordLen;
+using DumpBuffer = ByteBuffer<kBufferSizeBytes>;
+
+constexpr char kFormattedTimestamps[] = "1.000000 2.000000 3.000000";
+
+class BinaryDumpDecoderTest : public ::testing::Test {
+ public:
+  // Most tests examine the decoding of records. So, for brevity, the
+  // fixture's dump omits the stats.
+  BinaryDumpDecoderTest() {
+    const auto preamble =
+        protocol::BinaryDumpPreamble()
+            .set_magic(protocol::kBinaryDumpMagic)
+            .set_version(protocol::kBinaryDumpVersionWithoutStats);
+    dump_.AppendOrDie(&preamble, sizeof(preamble));
+  }
+
+ protected:
+  // Appends a record holding an AsciiMessage with |tag| and |message|.
+  void AppendAsciiMessageRecord(const std::string& tag,
+                                const std::string& message) {
+    const auto tstamp_header = TimestampHeader()
+                                   .set_since_boot_awake_only({1, 0})
+                                   .set_since_boot_with_sleep({2, 0})
+                                   .set_since_epoch({3, 0});
+    const auto ascii_message_header = protocol::AsciiMessage()
+                                          .set_tag_len(tag.size())
+                                          .set_data_len(message.size());
+    const uint16_t payload_len =
+        sizeof(ascii_message_header) + tag.size() + message.size();
+    const auto command = protocol::Command()
+                             .set_opcode(protocol::Opcode::kWriteAsciiMessage)
+                             .set_payload_len(payload_len);
+    const uint16_t record_len =
+        sizeof(tstamp_header) + sizeof(command) + payload_len;
+    dump_.AppendOrDie(&record_len, sizeof(record_len))
+        .AppendOrDie(&tstamp_header, sizeof(tstamp_header))
+        .AppendOrDie(&command, sizeof(command))
+        .AppendOrDie(&ascii_message_header, sizeof(ascii_message_header))
+        .AppendOrDie(tag.data(), tag.size())
+        .AppendOrDie(message.data(), message.size());
+  }
+
+  bool Decode(std::string* out) {
+    return DecodeBinaryDump(dump_.data(), dump_.size(), out);
+  }
+
+  DumpBuffer dump_;
+};
+
+}  // namespace
+
+TEST_F(BinaryDumpDecoderTest, DecodesEmptyDump) {
+  std::string out;
+  EXPECT_TRUE(Decode(&out));
+  EXPECT_EQ("", out);
+}
+
+TEST_F(BinaryDumpDecoderTest, DecodesRecordsInOrder) {
+  AppendAsciiMessageRecord("tag1", "message1");
+  AppendAsciiMessageRecord("tag2", "message2");
+  std::string out;
+  EXPECT_TRUE(Decode(&out));
+  EXPECT_EQ(std::string(kFormattedTimestamps) + " tag1 message1\n" +
+                kFormattedTimestamps + " tag2 message2\n",
+            out);
+}
+
+TEST_F(BinaryDumpDecoderTest, AppendsToExistingOutput) {
+  AppendAsciiMessageRecord("tag", "message");
+  std::string out("existing\n");
+  EXPECT_TRUE(Decode(&out));
+  EXPECT_EQ(std::string("existing\n") + kFormattedTimestamps +
+                " tag message\n",
+            out);
+}
+
+TEST_F(BinaryDumpDecoderTest, SanitizesMessages) {
+  AppendAsciiMessageRecord("tag", "\x01message\xff");
+  std::string out;
+  EXPECT_TRUE(Decode(&out));
+  EXPECT_EQ(std::string(kFormattedTimestamps) + " tag ?message?\n", out);
+}
+
+TEST_F(BinaryDumpDecoderTest, RejectsTruncatedPreamble) {
+  std::string out;
+  EXPECT_FALSE(DecodeBinaryDump(dump_.data(), dump_.size() - 1, &out));
+  EXPECT_EQ("", out);
+}
+
+TEST_F(BinaryDumpDecoderTest, RejectsWrongMagic) {
+  const auto preamble = protocol::BinaryDumpPreamble()
+                            .set_magic(protocol::kBinaryDumpMagic + 1)
+                            .set_version(protocol::kBinaryDumpVersion);
+  const auto dump = DumpBuffer().AppendOrDie(&preamble, sizeof(preamble));
+  std::string out;
+  EXPECT_FALSE(DecodeBinaryDump(dump.data(), dump.size(), &out));
+  EXPECT_EQ("", out);
+}
+
+TEST_F(BinaryDumpDecoderTest, RejectsUnsupportedVersion) {
+  const auto preamble = protocol::BinaryDumpPreamble()
+                            .set_magic(protocol::kBinaryDumpMagic)
+                            .set_version(protocol::kBinaryDumpVersion + 1);
+  const auto dump = DumpBuffer().AppendOrDie(&preamble, sizeof(preamble));
+  std::string out;
+  EXPECT_FALSE(DecodeBinaryDump(dump.data(), dump.size(), &out));
+  EXPECT_EQ("", out);
+}
+
+TEST_F(BinaryDumpDecoderTest, DecodesStats) {
+  const auto preamble = protocol::BinaryDumpPreamble()
+                            .set_magic(protocol::kBinaryDumpMagic)
+                            .set_version(protocol::kBinaryDumpVersion);
+  protocol::Stats stats{};
+  stats.n_messages_logged = 1;
+  stats.n_messages_evicted = 2;
+  const auto dump = DumpBuffer()
+                        .AppendOrDie(&preamble, sizeof(preamble))
+                        .AppendOrDie(&stats, sizeof(stats));
+  std::string out;
+  EXPECT_TRUE(DecodeBinaryDump(dump.data(), dump.size(), &out));
+  EXPECT_EQ(
+      "# stats logged=1 evicted=2 missing=0 truncated=0 rejected=0 "
+      "ring_dropped=0 enomem=0 eintr=0\n",
+      out);
+}
+
+TEST_F(BinaryDumpDecoderTest, RejectsTruncatedStats) {
+  const auto preamble = protocol::BinaryDumpPreamble()
+                            .set_magic(protocol::kBinaryDumpMagic)
+                            .set_version(protocol::kBinaryDumpVersion);
+  const protocol::Stats stats{};
+  const auto dump = DumpBuffer()
+                        .AppendOrDie(&preamble, sizeof(preamble))
+                        .AppendOrDie(&stats, sizeof(stats) - 1);
+  std::string out;
+  EXPECT_FALSE(DecodeBinaryDump(dump.data(), dump.size(), &out));
+  EXPECT_EQ("", out);
+}
+
+TEST_F(BinaryDumpDecoderTest, ReportsTruncatedRecordLength) {
+  AppendAsciiMessageRecord("tag", "message");
+  const uint8_t partial_record_len = 0;
+  dump_.AppendOrDie(&partial_record_len, sizeof(partial_record_len));
+  std::string out;
+  EXPECT_FALSE(Decode(&out));
+  EXPECT_EQ(std::string(kFormattedTimestamps) +
+                " tag message\n[truncated-record]\n",
+            out);
+}
+
+TEST_F(BinaryDumpDecoderTest, ReportsTruncatedRecord) {
+  AppendAsciiMessageRecord("tag", "message");
+  std::string out;
+  EXPECT_FALSE(DecodeBinaryDump(dump_.data(), dump_.size() - 1, &out));
+  EXPECT_EQ("[truncated-record]\n", out);
+}
+
+TEST_F(BinaryDumpDecoderTest, SkipsOversizedRecord) {
+  const uint16_t record_len = log_formatter::kMaxRecordLen + 1;
+  const std::string record(record_len, 'x');
+  dump_.AppendOrDie(&record_len, sizeof(record_len))
+      .AppendOrDie(record.data(), record.size());
+  AppendAsciiMessageRecord("tag", "message");
+  std::string out;
+  EXPECT_FALSE(Decode(&out));
+  EXPECT_EQ(std::string("[oversized-record]\n") + kFormattedTimestamps +
+                " tag message\n",
+            out);
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2016, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <tuple>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "wifilogd/tests/mock_os.h"
+
+#include "wifilogd/buffered_writer.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using ::testing::_;
+using ::testing::Invoke;
+using ::testing::Return;
+using ::testing::StrictMock;
+
+constexpr int kFakeFd = 100;
+
+class BufferedWriterTest : public ::testing::Test {
+ public:
+  BufferedWriterTest() : writer_(&os_, kFakeFd) {}
+
+ protected:
+  // Returns an action which accepts up to |max_write_len| bytes per write,
+  // and accumulates the written bytes in |written_to_os_|.
+  auto AcceptUpTo(size_t max_write_len) {
+    auto& accumulator = written_to_os_;
+    return Invoke([&accumulator, max_write_len](int /* fd */, const void* buf,
+                                                size_t buflen) {
+      const size_t n_written = std::min(buflen, max_write_len);
+      accumulator.append(static_cast<const char*>(buf), n_written);
+      return std::tuple<size_t, Os::Errno>{n_written, 0};
+    });
+  }
+
+  std::string written_to_os_;
+  StrictMock<MockOs> os_;
+  BufferedWriter writer_;
+};
+
+}  // namespace
+
+TEST_F(BufferedWriterTest, AppendDoesNotWriteWhileBufferHasSpace) {
+  EXPECT_CALL(os_, Write(_, _, _)).Times(0);
+  EXPECT_TRUE(writer_.Append("hello", 5));
+  EXPECT_EQ(0U, writer_.GetBytesWritten());
+}
+
+TEST_F(BufferedWriterTest, FlushOnEmptyBufferDoesNotWrite) {
+  EXPECT_CALL(os_, Write(_, _, _)).Times(0);
+  EXPECT_TRUE(writer_.Flush());
+}
+
+TEST_F(BufferedWriterTest, FlushCoalescesAppendsIntoOneWrite) {
+  EXPECT_TRUE(writer_.Append("hello ", 6));
+  EXPECT_TRUE(writer_.Append("world", 5));
+  EXPECT_CALL(os_, Write(kFakeFd, _, 11)).WillOnce(AcceptUpTo(11));
+  EXPECT_TRUE(writer_.Flush());
+  EXPECT_EQ("hello world", written_to_os_);
+  EXPECT_EQ(11U, writer_.GetBytesWritten());
+}
+
+TEST_F(BufferedWriterTest, AppendWritesWhenBufferWouldOverflow) {
+  const std::string data(BufferedWriter::kBufferSizeBytes - 1, 'x');
+  EXPECT_TRUE(writer_.Append(data.data(), data.size()));
+
+  EXPECT_CALL(os_, Write(_, _, data.size())).WillOnce(AcceptUpTo(data.size()));
+  EXPECT_TRUE(writer_.Append("yz", 2));
+  EXPECT_EQ(data, written_to_os_);
+
+  EXPECT_CALL(os_, Write(_, _, 2)).WillOnce(AcceptUpTo(2));
+  EXPECT_TRUE(writer_.Flush());
+  EXPECT_EQ(data + "yz", written_to_os_);
+}
+
+TEST_F(BufferedWriterTest, AppendLargerThanBufferPreservesOrder) {
+  const std::string data(BufferedWriter::kBufferSizeBytes * 2, 'y');
+  EXPECT_TRUE(writer_.Append("x", 1));
+  EXPECT_CALL(os_, Write(_, _, _)).WillRepeatedly(AcceptUpTo(data.size()));
+  EXPECT_TRUE(writer_.Append(data.data(), data.size()));
+  EXPECT_EQ("x" + data, written_to_os_);
+}
+
+TEST_F(BufferedWriterTest, CommitAppendsReservedBytes) {
+  uint8_t* reserved = writer_.Reserve(100);
+  ASSERT_NE(nullptr, reserved);
+  std::memcpy(reserved, "hello", 5);
+  writer_.Commit(5);
+  EXPECT_TRUE(writer_.Append(" world", 6));
+
+  EXPECT_CALL(os_, Write(_, _, 11)).WillOnce(AcceptUpTo(11));
+  EXPECT_TRUE(writer_.Flush());
+  EXPECT_EQ("hello world", written_to_os_);
+}
+
+TEST_F(BufferedWriterTest, ReserveWritesWhenBufferWouldOverflow) {
+  EXPECT_TRUE(writer_.Append("hello", 5));
+  EXPECT_CALL(os_, Write(_, _, 5)).WillOnce(AcceptUpTo(5));
+  EXPECT_NE(nullptr, writer_.Reserve(BufferedWriter::kBufferSizeBytes));
+  EXPECT_EQ("hello", written_to_os_);
+}
+
+TEST_F(BufferedWriterTest, ReserveFailsAfterError) {
+  EXPECT_TRUE(writer_.Append("hello", 5));
+  EXPECT_CALL(os_, Write(_, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EBADF}));
+  EXPECT_EQ(nullptr, writer_.Reserve(BufferedWriter::kBufferSizeBytes));
+}
+
+TEST_F(BufferedWriterTest, FlushRetriesShortWrites) {
+  EXPECT_TRUE(writer_.Append("hello world", 11));
+  EXPECT_CALL(os_, Write(_, _, _)).WillRepeatedly(AcceptUpTo(3));
+  EXPECT_TRUE(writer_.Flush());
+  EXPECT_EQ("hello world", written_to_os_);
+  EXPECT_EQ(11U, writer_.GetBytesWritten());
+}
+
+TEST_F(BufferedWriterTest, FlushRetriesAfterEintr) {
+  EXPECT_TRUE(writer_.Append("hello", 5));
+  EXPECT_CALL(os_, Write(_, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EINTR}))
+      .WillOnce(AcceptUpTo(5));
+  EXPECT_TRUE(writer_.Flush());
+  EXPECT_EQ("hello", written_to_os_);
+}
+
+TEST_F(BufferedWriterTest, FlushGivesUpWithoutProgress) {
+  EXPECT_TRUE(writer_.Append("hello", 5));
+  EXPECT_CALL(os_, Write(_, _, _))
+      .Times(BufferedWriter::kMaxAttemptsWithoutProgress)
+      .WillRepeatedly(Return(std::tuple<size_t, Os::Errno>{0, EINTR}));
+  EXPECT_FALSE(writer_.Flush());
+}
+
+TEST_F(BufferedWriterTest, FlushFailsOnError) {
+  EXPECT_TRUE(writer_.Append("hello", 5));
+  EXPECT_CALL(os_, Write(_, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EBADF}));
+  EXPECT_FALSE(writer_.Flush());
+}
+
+TEST_F(BufferedWriterTest, AppendAndFlushFailAfterError) {
+  EXPECT_TRUE(writer_.Append("hello", 5));
+  EXPECT_CALL(os_, Write(_, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EBADF}));
+  ASSERT_FALSE(writer_.Flush());
+
+  EXPECT_CALL(os_, Write(_, _, _)).Times(0);
+  EXPECT_FALSE(writer_.Append("world", 5));
+  EXPECT_FALSE(writer_.Flush());
+}
+
+// Per
+// github.com/google/googletest/blob/master/googletest/docs/AdvancedGuide.md#death-tests,
+// death tests should be specially named.
+using BufferedWriterDeathTest = BufferedWriterTest;
+
+TEST_F(BufferedWriterDeathTest, ReserveLargerThanBufferCausesDeath) {
+  EXPECT_DEATH(writer_.Reserve(BufferedWriter::kBufferSizeBytes + 1),
+               "Check failed");
+}
+
+TEST_F(BufferedWriterDeathTest, CommitLargerThanReservationCausesDeath) {
+  ASSERT_NE(nullptr, writer_.Reserve(5));
+  EXPECT_DEATH(writer_.Commit(6), "Check failed");
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -15,23 +15,39 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
 
 #include <algorithm>
+#include <array>
 #include <cstring>
+#include <future>
 #include <memory>
 #include <string>
 #include <tuple>
 #include <type_traits>
 #include <utility>
+#include <vector>
 
+#include "android-base/file.h"
 #include "android-base/unique_fd.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
+#include "wifilogd/binary_dump_decoder.h"
 #include "wifilogd/byte_buffer.h"
+#include "wifilogd/ingest_policy.h"
+#include "wifilogd/latency_histogram.h"
 #include "wifilogd/local_utils.h"
+#include "wifilogd/log_buffer.h"
+#include "wifilogd/message_buffer.h"
 #include "wifilogd/protocol.h"
+#include "wifilogd/shared_ring_writer.h"
+#include "wifilogd/structured_formats.h"
+#include "wifilogd/structured_message_writer.h"
+#include "wifilogd/tag_table.h"
+#include "wifilogd/time_index.h"
+#include "wifilogd/timestamp_header.h"
 #include "wifilogd/tests/mock_os.h"
 
 #include "wifilogd/command_processor.h"
@@ -47,6 +63,7 @@ using ::testing::AtLeast;
 using ::testing::EndsWith;
 using ::testing::HasSubstr;
 using ::testing::Invoke;
+using ::testing::Not;
 using ::testing::Return;
 using ::testing::StartsWith;
 using ::testing::StrictMock;
@@ -59,6 +76,12 @@ using CommandBuffer = ByteBuffer<protocol::kMaxMessageSize * 2>;
 
 constexpr size_t kBufferSizeBytes = protocol::kMaxMessageSize * 16;
 constexpr char kLogRecordSeparator = '\n';
+// The size of the log buffer which holds kError messages.
+constexpr size_t kErrorBufferSizeBytes =
+    kBufferSizeBytes *
+    CommandProcessor::kLogBufferShares[static_cast<size_t>(
+        protocol::MessageSeverity::kError)] /
+    CommandProcessor::kLogBufferShareDenominator;
 constexpr size_t kMaxAsciiMessagePayloadLen = protocol::kMaxMessageSize -
                                               sizeof(protocol::Command) -
                                               sizeof(protocol::AsciiMessage);
@@ -66,6 +89,16 @@ constexpr size_t kMaxAsciiMessagePayloadLen = protocol::kMaxMessageSize -
 class CommandProcessorTest : public ::testing::Test {
  public:
   CommandProcessorTest() {
+    ResetCommandProcessor(kBufferSizeBytes, LogBuffer::Mode::kUncompressed);
+  }
+
+ protected:
+  // Replaces |command_processor_| with one that has |buffer_size_bytes| of
+  // log buffers, in |log_buffer_mode|, persisted to |persistent_dir| (if
+  // non-empty).
+  void ResetCommandProcessor(
+      size_t buffer_size_bytes, LogBuffer::Mode log_buffer_mode,
+      const std::string& persistent_dir = std::string()) {
     os_ = new StrictMock<MockOs>();
     auto& accumulator = written_to_os_;
     ON_CALL(*os_, Write(_, _, _))
@@ -74,16 +107,17 @@ class CommandProcessorTest : public ::testing::Test {
               accumulator.append(static_cast<const char*>(write_buf), buflen);
               return std::tuple<size_t, Os::Errno>(buflen, 0);
             }));
-    command_processor_ = std::unique_ptr<CommandProcessor>(
-        new CommandProcessor(kBufferSizeBytes, std::unique_ptr<Os>(os_)));
+    command_processor_ = std::unique_ptr<CommandProcessor>(new CommandProcessor(
+        buffer_size_bytes, std::unique_ptr<Os>(os_),
+        Timestamper::Mode::kReadAllClocks, log_buffer_mode, persistent_dir));
   }
 
- protected:
   CommandBuffer BuildAsciiMessageCommandWithAdjustments(
       const std::string& tag, const std::string& message,
       ssize_t command_payload_len_adjustment,
       ssize_t ascii_message_tag_len_adjustment,
-      ssize_t ascii_message_data_len_adjustment) {
+      ssize_t ascii_message_data_len_adjustment,
+      protocol::MessageSeverity severity) {
     const size_t adjusted_tag_len =
         tag.length() + ascii_message_tag_len_adjustment;
     const size_t adjusted_data_len =
@@ -96,7 +130,7 @@ class CommandProcessorTest : public ::testing::Test {
             .set_data_len(SAFELY_CLAMP(
                 adjusted_data_len, uint16_t, 0,
                 GetMaxVal<decltype(protocol::AsciiMessage::data_len)>()))
-            .set_severity(protocol::MessageSeverity::kError);
+            .set_severity(severity);
     EXPECT_EQ(adjusted_tag_len, ascii_message_header.tag_len);
     EXPECT_EQ(adjusted_data_len, ascii_message_header.data_len);
 
@@ -119,7 +153,8 @@ class CommandProcessorTest : public ::testing::Test {
 
   CommandBuffer BuildAsciiMessageCommand(const std::string& tag,
                                          const std::string& message) {
-    return BuildAsciiMessageCommandWithAdjustments(tag, message, 0, 0, 0);
+    return BuildAsciiMessageCommandWithAdjustments(
+        tag, message, 0, 0, 0, protocol::MessageSeverity::kError);
   }
 
   bool SendAsciiMessageWithAdjustments(
@@ -129,7 +164,8 @@ class CommandProcessorTest : public ::testing::Test {
       ssize_t ascii_message_data_len_adjustment) {
     const CommandBuffer& command_buffer(BuildAsciiMessageCommandWithAdjustments(
         tag, message, command_payload_len_adjustment,
-        ascii_message_tag_len_adjustment, ascii_message_data_len_adjustment));
+        ascii_message_tag_len_adjustment, ascii_message_data_len_adjustment,
+        protocol::MessageSeverity::kError));
     EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC));
     EXPECT_CALL(*os_, GetTimestamp(CLOCK_BOOTTIME));
     EXPECT_CALL(*os_, GetTimestamp(CLOCK_REALTIME));
@@ -142,22 +178,266 @@ class CommandProcessorTest : public ::testing::Test {
     return SendAsciiMessageWithAdjustments(tag, message, 0, 0, 0, 0);
   }
 
+  // Sends a message with |severity|, which will be logged with a
+  // since_boot_with_sleep timestamp of |boottime|.
+  bool SendAsciiMessageWithSeverityAt(const std::string& tag,
+                                      const std::string& message,
+                                      protocol::MessageSeverity severity,
+                                      Os::Timestamp boottime) {
+    const CommandBuffer& command_buffer(BuildAsciiMessageCommandWithAdjustments(
+        tag, message, 0, 0, 0, severity));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_BOOTTIME)).WillOnce(Return(boottime));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_REALTIME));
+    return command_processor_->ProcessCommand(
+        command_buffer.data(), command_buffer.size(), Os::kInvalidFd);
+  }
+
+  // Sends an AsciiMessage command, which will be logged with a
+  // since_boot_with_sleep timestamp of |boottime|. The command's
+  // |src_boottime_nsec| and |sequence_num| are taken from |command_fields|.
+  bool SendAsciiMessageWithCommandFields(
+      const std::string& tag, const std::string& message,
+      const protocol::Command& command_fields, Os::Timestamp boottime) {
+    const CommandBuffer& original(BuildAsciiMessageCommand(tag, message));
+    protocol::Command command;
+    std::memcpy(&command, original.data(), sizeof(command));
+    command.set_src_boottime_nsec(command_fields.src_boottime_nsec)
+        .set_sequence_num(command_fields.sequence_num);
+    const auto command_buffer =
+        CommandBuffer()
+            .AppendOrDie(&command, sizeof(command))
+            .AppendOrDie(original.data() + sizeof(command),
+                         original.size() - sizeof(command));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_BOOTTIME)).WillOnce(Return(boottime));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_REALTIME));
+    return command_processor_->ProcessCommand(
+        command_buffer.data(), command_buffer.size(), Os::kInvalidFd);
+  }
+
+  bool SendAsciiMessageWithSequenceNum(const std::string& tag,
+                                       const std::string& message,
+                                       uint16_t sequence_num) {
+    return SendAsciiMessageWithCommandFields(
+        tag, message, protocol::Command().set_sequence_num(sequence_num),
+        Os::Timestamp{0, 0});
+  }
+
+  // Sends an AsciiMessage command, which was sent at |src_boottime_nsec|,
+  // and is logged at |boottime|.
+  bool SendAsciiMessageWithLatency(uint64_t src_boottime_nsec,
+                                   Os::Timestamp boottime) {
+    return SendAsciiMessageWithCommandFields(
+        "tag", "message",
+        protocol::Command().set_src_boottime_nsec(src_boottime_nsec),
+        boottime);
+  }
+
+  bool SendStructuredMessage(const StructuredMessageWriter& writer) {
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_BOOTTIME));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_REALTIME));
+    return command_processor_->ProcessCommand(writer.data(), writer.size(),
+                                              Os::kInvalidFd);
+  }
+
   bool SendDumpBuffers() {
+    return SendDumpCommand(protocol::Opcode::kDumpBuffers);
+  }
+
+  bool SendDumpBuffersBinary() {
+    return SendDumpCommand(protocol::Opcode::kDumpBuffersBinary);
+  }
+
+  bool SendDumpCommand(protocol::Opcode opcode) {
+    const auto command =
+        protocol::Command().set_opcode(opcode).set_payload_len(0);
+    const auto buf = CommandBuffer().AppendOrDie(&command, sizeof(command));
+    constexpr int kFakeFd = 100;
+    // Dumping reads the clock, to measure the dump's throughput.
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+    const size_t dump_start = written_to_os_.size();
+    const bool started =
+        command_processor_->ProcessCommand(buf.data(), buf.size(), kFakeFd);
+    // The dump is written on another thread. Wait for it, so that tests can
+    // examine the output.
+    command_processor_->WaitForDumps();
+    if (opcode == protocol::Opcode::kDumpBuffers) {
+      ExtractStatsLine(dump_start);
+    }
+    return started;
+  }
+
+  bool SendDumpBuffersSince(const protocol::DumpCursor& since) {
+    const auto command = protocol::Command()
+                             .set_opcode(protocol::Opcode::kDumpBuffersSince)
+                             .set_payload_len(sizeof(since));
+    const auto buf = CommandBuffer()
+                         .AppendOrDie(&command, sizeof(command))
+                         .AppendOrDie(&since, sizeof(since));
+    constexpr int kFakeFd = 100;
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+    const bool started =
+        command_processor_->ProcessCommand(buf.data(), buf.size(), kFakeFd);
+    command_processor_->WaitForDumps();
+    return started;
+  }
+
+  bool SendDumpBuffersQuery(protocol::DumpQuery query,
+                            const std::string& tag) {
+    query.set_tag_len(tag.size());
+    const auto command = protocol::Command()
+                             .set_opcode(protocol::Opcode::kDumpBuffersQuery)
+                             .set_payload_len(sizeof(query) + tag.size());
+    const auto buf = CommandBuffer()
+                         .AppendOrDie(&command, sizeof(command))
+                         .AppendOrDie(&query, sizeof(query))
+                         .AppendOrDie(tag.data(), tag.size());
+    constexpr int kFakeFd = 100;
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+    const size_t dump_start = written_to_os_.size();
+    const bool started =
+        command_processor_->ProcessCommand(buf.data(), buf.size(), kFakeFd);
+    command_processor_->WaitForDumps();
+    ExtractStatsLine(dump_start);
+    return started;
+  }
+
+  // Sends a kError message, which will be logged with a since_epoch
+  // timestamp of |realtime|.
+  bool SendAsciiMessageWithRealtime(const std::string& tag,
+                                    const std::string& message,
+                                    Os::Timestamp realtime) {
+    const CommandBuffer& command_buffer(BuildAsciiMessageCommand(tag, message));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_BOOTTIME));
+    EXPECT_CALL(*os_, GetTimestamp(CLOCK_REALTIME)).WillOnce(Return(realtime));
+    return command_processor_->ProcessCommand(
+        command_buffer.data(), command_buffer.size(), Os::kInvalidFd);
+  }
+
+  // Sends a kSubscribe command, with |subscriber_fd|. The fd is closed
+  // when the subscriber is detached (or the command fails), so tests
+  // should use fds which are not open.
+  bool SendSubscribe(int subscriber_fd) {
     const auto command = protocol::Command()
-                             .set_opcode(protocol::Opcode::kDumpBuffers)
+                             .set_opcode(protocol::Opcode::kSubscribe)
                              .set_payload_len(0);
     const auto buf = CommandBuffer().AppendOrDie(&command, sizeof(command));
-    constexpr int kFakeFd = 100;
-    return command_processor_->ProcessCommand(buf.data(), buf.size(), kFakeFd);
+    return command_processor_->ProcessCommand(buf.data(), buf.size(),
+                                              subscriber_fd);
+  }
+
+  // Moves the stats line, which starts a text dump written at |dump_start|
+  // in |written_to_os_|, to |dumped_stats_line_|. This leaves only the
+  // records in |written_to_os_|.
+  void ExtractStatsLine(size_t dump_start) {
+    const std::string kStatsPrefix{"# stats "};
+    if (written_to_os_.compare(dump_start, kStatsPrefix.size(),
+                               kStatsPrefix) != 0) {
+      return;
+    }
+    const size_t line_len =
+        written_to_os_.find(kLogRecordSeparator, dump_start) - dump_start + 1;
+    dumped_stats_line_ = written_to_os_.substr(dump_start, line_len);
+    written_to_os_.erase(dump_start, line_len);
   }
 
   std::string written_to_os_;  // Must out-live |os_|
+  std::string dumped_stats_line_;
   std::unique_ptr<CommandProcessor> command_processor_;
   // We use a raw pointer to access the mock, since ownership passes
   // to |command_processor_|.
   StrictMock<MockOs>* os_;
 };
 
+constexpr size_t kRingMappingLen = SharedRingWriter::GetMinMappingLen();
+
+// Stands in for the memory that a client would share with us.
+struct RingMapping {
+  alignas(protocol::kSharedRingCacheLineSize)
+      std::array<uint8_t, kRingMappingLen> bytes;
+};
+
+class CommandProcessorSharedRingTest : public CommandProcessorTest {
+ public:
+  CommandProcessorSharedRingTest()
+      : ring_mapping_(new RingMapping()),
+        ring_writer_(ring_mapping_->bytes.data(), kRingMappingLen) {
+    EXPECT_CALL(*os_, GetTimestamp(_)).Times(AnyNumber());
+    EXPECT_CALL(*os_, UnmapSharedMemory(_, _)).Times(AnyNumber());
+  }
+
+ protected:
+  protocol::SharedRingHeader* GetRingHeader() {
+    return reinterpret_cast<protocol::SharedRingHeader*>(
+        ring_mapping_->bytes.data());
+  }
+
+  // Sends a kRegisterSharedRing command, for a mapping of |mapping_len|
+  // bytes, with |fd|.
+  bool SendRegisterSharedRing(size_t mapping_len, int fd) {
+    const auto registration =
+        protocol::SharedRingRegistration().set_mapping_len(mapping_len);
+    const auto command =
+        protocol::Command()
+            .set_opcode(protocol::Opcode::kRegisterSharedRing)
+            .set_payload_len(sizeof(registration));
+    const auto buf = CommandBuffer()
+                         .AppendOrDie(&command, sizeof(command))
+                         .AppendOrDie(&registration, sizeof(registration));
+    return command_processor_->ProcessCommand(buf.data(), buf.size(), fd);
+  }
+
+  // Returns a file descriptor to pass with a registration. The descriptor
+  // is one end of a pipe, so that the CommandProcessor has something real
+  // to close.
+  int MakeRingFd() {
+    int pipe_fds[2];
+    EXPECT_EQ(0, pipe(pipe_fds));
+    unused_pipe_fds_.emplace_back(pipe_fds[0]);
+    return pipe_fds[1];
+  }
+
+  // Registers the ring in |mapping|.
+  bool RegisterSharedRing(NONNULL void* mapping) {
+    const int ring_fd = MakeRingFd();
+    EXPECT_CALL(*os_, MapSharedMemory(ring_fd, kRingMappingLen))
+        .WillOnce(Return(std::tuple<void*, Os::Errno>{mapping, 0}));
+    return SendRegisterSharedRing(kRingMappingLen, ring_fd);
+  }
+
+  bool RegisterSharedRing() {
+    return RegisterSharedRing(ring_mapping_->bytes.data());
+  }
+
+  bool SendDrainSharedRings() {
+    const auto command =
+        protocol::Command().set_opcode(protocol::Opcode::kDrainSharedRings);
+    const auto buf = CommandBuffer().AppendOrDie(&command, sizeof(command));
+    return command_processor_->ProcessCommand(buf.data(), buf.size(),
+                                              Os::kInvalidFd);
+  }
+
+  SharedRingWriter::WriteResult WriteToRing(const CommandBuffer& command) {
+    return ring_writer_.Write(command.data(), command.size());
+  }
+
+  // Returns the number of records in a text dump of the log.
+  size_t CountDumpedRecords() {
+    written_to_os_.clear();
+    EXPECT_CALL(*os_, Write(_, _, _)).Times(AnyNumber());
+    EXPECT_TRUE(SendDumpBuffers());
+    return std::count(written_to_os_.begin(), written_to_os_.end(),
+                      kLogRecordSeparator);
+  }
+
+  const std::unique_ptr<RingMapping> ring_mapping_;
+  SharedRingWriter ring_writer_;
+  std::vector<unique_fd> unused_pipe_fds_;
+};
+
 }  // namespace
 
 // A valid ASCII message should, of course, be processed successfully.
@@ -241,6 +521,135 @@ TEST_F(CommandProcessorTest, ProcessCommandSucceedsEvenAfterFillingBuffer) {
   }
 }
 
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersRetainsRecentMessagesAfterFillingBuffer) {
+  const std::string tag{"tag"};
+  const std::string message(kMaxAsciiMessagePayloadLen - tag.size(), '.');
+  constexpr size_t kMaxMessagesInBuffer =
+      kErrorBufferSizeBytes / protocol::kMaxMessageSize;
+  for (size_t i = 0; i < kMaxMessagesInBuffer * 2; ++i) {
+    ASSERT_TRUE(SendAsciiMessage(tag, message));
+  }
+  ASSERT_TRUE(SendAsciiMessage("tag", "last"));
+
+  // Per-message overheads, and unused space at the end of the buffer, mean
+  // that we can't quite fit |kMaxMessagesInBuffer|. But we should come close.
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_LE(kMaxMessagesInBuffer - 2,
+            static_cast<size_t>(std::count(written_to_os_.begin(),
+                                           written_to_os_.end(),
+                                           kLogRecordSeparator)));
+  EXPECT_THAT(written_to_os_, EndsWith("tag last\n"));
+}
+
+TEST_F(CommandProcessorTest, ShrinkBuffersRetainsNewestMessages) {
+  const std::string tag{"tag"};
+  const std::string message(kMaxAsciiMessagePayloadLen - tag.size(), '.');
+  for (size_t i = 0; i < kErrorBufferSizeBytes / protocol::kMaxMessageSize;
+       ++i) {
+    ASSERT_TRUE(SendAsciiMessage(tag, message));
+  }
+  ASSERT_TRUE(SendAsciiMessage("tag", "last"));
+  command_processor_->ShrinkBuffers();
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_GE(2, std::count(written_to_os_.begin(), written_to_os_.end(),
+                          kLogRecordSeparator));
+  EXPECT_THAT(written_to_os_, EndsWith("tag last\n"));
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandSucceedsAfterShrinkBuffers) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  command_processor_->ShrinkBuffers();
+  EXPECT_TRUE(SendAsciiMessage("tag", "message"));
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersRetainsErrorsDespiteFloodOfTraceMessages) {
+  using protocol::MessageSeverity;
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "error",
+                                             MessageSeverity::kError, {0, 0}));
+  const std::string message(kMaxAsciiMessagePayloadLen - 3, '.');
+  for (size_t i = 0; i < kBufferSizeBytes / protocol::kMaxMessageSize; ++i) {
+    ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+        "tag", message, MessageSeverity::kTrace, {1, 0}));
+  }
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_, HasSubstr("tag error\n"));
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersMergesSeveritiesInTimestampOrder) {
+  using protocol::MessageSeverity;
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "first",
+                                             MessageSeverity::kError, {1, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "second",
+                                             MessageSeverity::kTrace, {2, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+      "tag", "third", MessageSeverity::kInformational, {2, 1000}));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "fourth",
+                                             MessageSeverity::kError, {3, 0}));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  const size_t first_pos = written_to_os_.find("tag first\n");
+  const size_t second_pos = written_to_os_.find("tag second\n");
+  const size_t third_pos = written_to_os_.find("tag third\n");
+  const size_t fourth_pos = written_to_os_.find("tag fourth\n");
+  ASSERT_NE(std::string::npos, fourth_pos);
+  EXPECT_LT(first_pos, second_pos);
+  EXPECT_LT(second_pos, third_pos);
+  EXPECT_LT(third_pos, fourth_pos);
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersMergesManyMessagesInTimestampOrder) {
+  for (LogBuffer::Mode mode :
+       {LogBuffer::Mode::kUncompressed, LogBuffer::Mode::kCompressed,
+        LogBuffer::Mode::kAligned}) {
+    ResetCommandProcessor(2 * kBufferSizeBytes, mode);
+    // Enough messages that each log buffer is read in several batches, with
+    // runs of differing lengths in each severity.
+    constexpr uint32_t kNumMessages = 200;
+    for (uint32_t i = 0; i < kNumMessages; ++i) {
+      ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+          "tag", std::to_string(i),
+          i % 3 ? protocol::MessageSeverity::kInformational
+                : protocol::MessageSeverity::kError,
+          {i, 0}));
+    }
+    ASSERT_EQ(0U, command_processor_->GetStats().n_messages_evicted);
+
+    EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+    written_to_os_.clear();
+    EXPECT_TRUE(SendDumpBuffers());
+    size_t last_pos = 0;
+    for (uint32_t i = 0; i < kNumMessages; ++i) {
+      const size_t pos =
+          written_to_os_.find(" tag " + std::to_string(i) + "\n");
+      ASSERT_NE(std::string::npos, pos);
+      EXPECT_LE(last_pos, pos);
+      last_pos = pos;
+    }
+  }
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersIncludesMessagesWithInvalidSeverity) {
+  const auto invalid_severity = static_cast<protocol::MessageSeverity>(
+      GetMaxVal<std::underlying_type<protocol::MessageSeverity>::type>());
+  ASSERT_TRUE(
+      SendAsciiMessageWithSeverityAt("tag", "message", invalid_severity, {}));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_, EndsWith("tag message\n"));
+}
+
 TEST_F(CommandProcessorTest,
        ProcessCommandDumpBuffersOutputIncludesCorrectlyFormattedTimestamps) {
   const CommandBuffer& command_buf(BuildAsciiMessageCommand("tag", "message"));
@@ -258,9 +667,138 @@ TEST_F(CommandProcessorTest,
   EXPECT_THAT(written_to_os_, StartsWith("0.000000 1.000001 123456.123456"));
 }
 
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersOutputIncludesMaximalTimestamps) {
+  const CommandBuffer& command_buf(BuildAsciiMessageCommand("tag", "message"));
+  constexpr Os::Timestamp kMaxTimestamp{GetMaxVal<uint32_t>(), 999999999};
+  EXPECT_CALL(*os_, GetTimestamp(_)).WillRepeatedly(Return(kMaxTimestamp));
+  EXPECT_TRUE(command_processor_->ProcessCommand(
+      command_buf.data(), command_buf.size(), Os::kInvalidFd));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(
+      "4294967295.999999 4294967295.999999 4294967295.999999 tag message\n",
+      written_to_os_);
+}
+
 TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersSucceedsOnEmptyLog) {
-  EXPECT_CALL(*os_, Write(_, _, _)).Times(0);
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(1);
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(
+      "# stats logged=0 evicted=0 missing=0 truncated=0 rejected=0 "
+      "ring_dropped=0 enomem=0 eintr=0\n",
+      dumped_stats_line_);
+  EXPECT_EQ("", written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersStartsWithStats) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
   EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(dumped_stats_line_, StartsWith("# stats logged=1 "));
+  EXPECT_THAT(written_to_os_, EndsWith("tag message\n"));
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpStatsWritesOnlyStats) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(1);
+  EXPECT_TRUE(SendDumpCommand(protocol::Opcode::kDumpStats));
+  EXPECT_EQ(
+      "# stats logged=2 evicted=0 missing=0 truncated=0 rejected=0 "
+      "ring_dropped=0 enomem=0 eintr=0\n",
+      written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, GetStatsCountsLoggedMessages) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_EQ(2U, command_processor_->GetStats().n_messages_logged);
+}
+
+TEST_F(CommandProcessorTest, GetStatsCountsMessagesMissingFromSequence) {
+  ASSERT_TRUE(SendAsciiMessageWithSequenceNum("tag", "message", 1));
+  ASSERT_TRUE(SendAsciiMessageWithSequenceNum("tag", "message", 4));
+  EXPECT_EQ(2U, command_processor_->GetStats().n_messages_missing);
+}
+
+TEST_F(CommandProcessorTest,
+       GetStatsCountsStructuredMessagesMissingFromSequence) {
+  StructuredMessageWriter writer(structured_formats::FormatId::kScanStarted,
+                                 "tag", 3,
+                                 protocol::MessageSeverity::kInformational);
+  ASSERT_TRUE(SendStructuredMessage(writer.set_sequence_num(1)));
+  ASSERT_TRUE(SendStructuredMessage(writer.set_sequence_num(4)));
+  EXPECT_EQ(2U, command_processor_->GetStats().n_messages_missing);
+}
+
+TEST_F(CommandProcessorTest, GetStatsTracksSequenceNumsPerTag) {
+  ASSERT_TRUE(SendAsciiMessageWithSequenceNum("first", "message", 1));
+  ASSERT_TRUE(SendAsciiMessageWithSequenceNum("second", "message", 7));
+  ASSERT_TRUE(SendAsciiMessageWithSequenceNum("first", "message", 2));
+  ASSERT_TRUE(SendAsciiMessageWithSequenceNum("second", "message", 8));
+  EXPECT_EQ(0U, command_processor_->GetStats().n_messages_missing);
+}
+
+TEST_F(CommandProcessorTest, GetLatenciesMeasuresFromSourceBoottime) {
+  ASSERT_TRUE(SendAsciiMessageWithLatency(1000 * 1000, Os::Timestamp{1, 0}));
+  const OpcodeLatencies& latencies = command_processor_->GetLatencies();
+  ASSERT_EQ(1U, latencies.count(protocol::Opcode::kWriteAsciiMessage));
+  const LatencyHistogram& histogram =
+      latencies.at(protocol::Opcode::kWriteAsciiMessage);
+  EXPECT_EQ(1U, histogram.GetNumSamples());
+  EXPECT_EQ(999U * 1000 * 1000, histogram.GetMaxNsec());
+}
+
+TEST_F(CommandProcessorTest, GetLatenciesIgnoresCommandsWithoutSourceTime) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_TRUE(command_processor_->GetLatencies().empty());
+}
+
+TEST_F(CommandProcessorTest, GetLatenciesIgnoresSourceTimeInFuture) {
+  ASSERT_TRUE(SendAsciiMessageWithLatency(2ULL * 1000 * 1000 * 1000,
+                                          Os::Timestamp{1, 0}));
+  EXPECT_TRUE(command_processor_->GetLatencies().empty());
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpStatsIncludesLatencies) {
+  ASSERT_TRUE(SendAsciiMessageWithLatency(1000, Os::Timestamp{0, 11000}));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(1);
+  EXPECT_TRUE(SendDumpCommand(protocol::Opcode::kDumpStats));
+  EXPECT_THAT(written_to_os_,
+              EndsWith("\n# latency opcode=0 samples=1 p50_usec=10 "
+                       "p90_usec=10 p99_usec=10 max_usec=10\n"));
+}
+
+TEST_F(CommandProcessorTest, GetStatsCountsRejectedCommands) {
+  const CommandBuffer& runt(BuildAsciiMessageCommand("tag", "message"));
+  EXPECT_FALSE(command_processor_->ProcessCommand(
+      runt.data(), sizeof(protocol::Command) - 1, Os::kInvalidFd));
+
+  const auto unknown_command =
+      protocol::Command().set_opcode(static_cast<protocol::Opcode>(0xff));
+  const auto unknown =
+      CommandBuffer().AppendOrDie(&unknown_command, sizeof(unknown_command));
+  EXPECT_FALSE(command_processor_->ProcessCommand(
+      unknown.data(), unknown.size(), Os::kInvalidFd));
+
+  EXPECT_EQ(2U, command_processor_->GetStats().n_commands_rejected);
+}
+
+TEST_F(CommandProcessorTest, GetStatsCountsEvictedMessages) {
+  const std::string tag{"tag"};
+  const std::string message(kMaxAsciiMessagePayloadLen - tag.size(), '.');
+  const size_t n_messages =
+      2 * (kErrorBufferSizeBytes / protocol::kMaxMessageSize);
+  for (size_t i = 0; i < n_messages; ++i) {
+    ASSERT_TRUE(SendAsciiMessage(tag, message));
+  }
+
+  const protocol::Stats stats = command_processor_->GetStats();
+  EXPECT_EQ(n_messages, stats.n_messages_logged);
+  EXPECT_GE(stats.n_messages_evicted, n_messages / 2);
+  EXPECT_LT(stats.n_messages_evicted, n_messages);
 }
 
 TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersIncludesAllMessages) {
@@ -284,6 +822,41 @@ TEST_F(CommandProcessorTest,
   EXPECT_THAT(written_to_os_, EndsWith("tag message\n"));
 }
 
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersExpandsStructuredMessage) {
+  StructuredMessageWriter writer(structured_formats::FormatId::kScanResults,
+                                 "tag", 3,
+                                 protocol::MessageSeverity::kInformational);
+  writer.AddUint32(12);
+  ASSERT_TRUE(SendStructuredMessage(writer));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  ASSERT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_, EndsWith("tag scan results n_results=12\n"));
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersMergesAsciiAndStructuredMessages) {
+  StructuredMessageWriter writer(structured_formats::FormatId::kScanStarted,
+                                 "tag", 3, protocol::MessageSeverity::kError);
+  writer.AddUint32(3);
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+      "tag", "first", protocol::MessageSeverity::kInformational,
+      Os::Timestamp{1, 0}));
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC));
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_BOOTTIME))
+      .WillOnce(Return(Os::Timestamp{2, 0}));
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_REALTIME));
+  ASSERT_TRUE(command_processor_->ProcessCommand(writer.data(), writer.size(),
+                                                 Os::kInvalidFd));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  ASSERT_TRUE(SendDumpBuffers());
+  const size_t first_pos = written_to_os_.find("tag first\n");
+  const size_t second_pos = written_to_os_.find("tag scan started n_freqs=3\n");
+  ASSERT_NE(std::string::npos, first_pos);
+  ASSERT_NE(std::string::npos, second_pos);
+  EXPECT_LT(first_pos, second_pos);
+}
+
 TEST_F(CommandProcessorTest,
        ProcessCommandDumpBuffersAsciiMessageHandlesEmptyTag) {
   ASSERT_TRUE(SendAsciiMessage("", "message"));
@@ -391,10 +964,50 @@ TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersStopsAfterFirstError) {
 
   EXPECT_CALL(*os_, Write(_, _, _))
       .WillOnce(Return(std::tuple<size_t, Os::Errno>{-1, EBADF}));
-  ASSERT_FALSE(SendDumpBuffers());
+  // The dump is started successfully, and fails later, on the dump thread.
+  // The StrictMock verifies that the dump makes no further writes.
+  ASSERT_TRUE(SendDumpBuffers());
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersCoalescesWrites) {
+  constexpr int kNumMessages = 5;
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  }
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(1);
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(kNumMessages,
+            std::count(written_to_os_.begin(), written_to_os_.end(),
+                       kLogRecordSeparator));
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersRetriesPastEintr) {
+  constexpr int kNumMessages = 5;
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  }
+
+  std::string written_to_os;
+  bool interrupted = false;
+  EXPECT_CALL(*os_, Write(_, _, _))
+      .WillRepeatedly(Invoke([&written_to_os, &interrupted](
+          int /*fd*/, const void* write_buf, size_t buflen) {
+        interrupted = !interrupted;
+        if (interrupted) {
+          return std::tuple<size_t, Os::Errno>{0, EINTR};
+        }
+        written_to_os.append(static_cast<const char*>(write_buf), buflen);
+        return std::tuple<size_t, Os::Errno>{buflen, 0};
+      }));
+  EXPECT_TRUE(SendDumpBuffers());
+  // One more line, for the stats.
+  EXPECT_EQ(kNumMessages + 1,
+            std::count(written_to_os.begin(), written_to_os.end(),
+                       kLogRecordSeparator));
 }
 
-TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersContinuesPastEintr) {
+TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersRetriesShortWrites) {
   constexpr int kNumMessages = 5;
   for (size_t i = 0; i < kNumMessages; ++i) {
     ASSERT_TRUE(SendAsciiMessage("tag", "message"));
@@ -404,39 +1017,1167 @@ TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersContinuesPastEintr) {
   EXPECT_CALL(*os_, Write(_, _, _))
       .WillRepeatedly(Invoke(
           [&written_to_os](int /*fd*/, const void* write_buf, size_t buflen) {
-            written_to_os.append(static_cast<const char*>(write_buf), buflen);
-            return std::tuple<size_t, Os::Errno>{buflen / 2, EINTR};
+            const size_t n_written = (buflen + 1) / 2;
+            written_to_os.append(static_cast<const char*>(write_buf),
+                                 n_written);
+            return std::tuple<size_t, Os::Errno>{n_written, 0};
           }));
   EXPECT_TRUE(SendDumpBuffers());
-  EXPECT_EQ(kNumMessages, std::count(written_to_os.begin(), written_to_os.end(),
-                                     kLogRecordSeparator));
+  // One more line, for the stats.
+  EXPECT_EQ(kNumMessages + 1,
+            std::count(written_to_os.begin(), written_to_os.end(),
+                       kLogRecordSeparator));
+  EXPECT_THAT(written_to_os, EndsWith("tag message\n"));
 }
 
-TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersIsIdempotent) {
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersBinaryWritesOnlyPreambleAndStatsForEmptyLog) {
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(1);
+  EXPECT_TRUE(SendDumpBuffersBinary());
+  ASSERT_EQ(sizeof(protocol::BinaryDumpPreamble) + sizeof(protocol::Stats),
+            written_to_os_.size());
+
+  protocol::BinaryDumpPreamble preamble;
+  std::memcpy(&preamble, written_to_os_.data(), sizeof(preamble));
+  EXPECT_EQ(protocol::kBinaryDumpMagic, preamble.magic);
+  EXPECT_EQ(protocol::kBinaryDumpVersion, preamble.version);
+  EXPECT_EQ(0U, preamble.reserved);
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersBinaryDecodesIdenticallyToTextDump) {
   ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("\x01tag", "message\xff"));
+  ASSERT_TRUE(SendAsciiMessageWithAdjustments("tag", "message", 0, 0, 1, 0));
+  ASSERT_TRUE(SendAsciiMessage("tag", ""));
 
   EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
-  ASSERT_TRUE(SendDumpBuffers());
-  ASSERT_GT(written_to_os_.size(), 0U);
+  EXPECT_TRUE(SendDumpBuffers());
+  const std::string text_dump = written_to_os_;
   written_to_os_.clear();
-  ASSERT_EQ(0U, written_to_os_.size());
 
   EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
-  EXPECT_TRUE(SendDumpBuffers());
-  EXPECT_GT(written_to_os_.size(), 0U);
+  EXPECT_TRUE(SendDumpBuffersBinary());
+  std::string decoded;
+  EXPECT_TRUE(binary_dump_decoder::DecodeBinaryDump(
+      reinterpret_cast<const uint8_t*>(written_to_os_.data()),
+      written_to_os_.size(), &decoded));
+  EXPECT_EQ(dumped_stats_line_ + text_dump, decoded);
 }
 
 TEST_F(CommandProcessorTest,
-       ProcessCommandDumpBuffersIsIdempotentEvenWithWriteFailure) {
+       ProcessCommandDumpBuffersBinaryRestoresInternedTags) {
+  const CommandBuffer& command = BuildAsciiMessageCommand("tag", "message");
   ASSERT_TRUE(SendAsciiMessage("tag", "message"));
-  EXPECT_CALL(*os_, Write(_, _, _))
-      .WillOnce(Return(std::tuple<size_t, Os::Errno>{-1, EBADF}));
-  ASSERT_FALSE(SendDumpBuffers());
-  ASSERT_EQ(0U, written_to_os_.size());
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersBinary());
+
+  constexpr size_t kRecordStart = sizeof(protocol::BinaryDumpPreamble) +
+                                  sizeof(protocol::Stats) + sizeof(uint16_t) +
+                                  sizeof(TimestampHeader);
+  ASSERT_EQ(kRecordStart + command.size(), written_to_os_.size());
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(command.data()),
+                        command.size()),
+            written_to_os_.substr(kRecordStart));
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandInterningTagsRetainsMoreMessages) {
+  // Without interning, each record would hold the full tag.
+  const std::string tag(200, 't');
+  const std::string message("message");
+  const size_t uninterned_record_len =
+      MessageBuffer::GetHeaderSize() + sizeof(TimestampHeader) +
+      BuildAsciiMessageCommand(tag, message).size();
+  const size_t n_messages = 4 * kErrorBufferSizeBytes / uninterned_record_len;
+  for (size_t i = 0; i < n_messages; ++i) {
+    ASSERT_TRUE(SendAsciiMessage(tag, message));
+  }
 
   EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
   EXPECT_TRUE(SendDumpBuffers());
-  EXPECT_GT(written_to_os_.size(), 0U);
+  EXPECT_LT(static_cast<ssize_t>(2 * kErrorBufferSizeBytes /
+                                 uninterned_record_len),
+            std::count(written_to_os_.begin(), written_to_os_.end(),
+                       kLogRecordSeparator));
+  EXPECT_THAT(written_to_os_, EndsWith(tag + " " + message + "\n"));
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersRestoresTagsAfterTagIdsAreReused) {
+  // Log more distinct tags than can be interned at once. Tags are released
+  // as their messages are evicted, so IDs are reused.
+  const size_t n_messages = 4 * TagTable::kMaxTags;
+  for (size_t i = 0; i < n_messages; ++i) {
+    const std::string tag = "tag" + std::to_string(i);
+    ASSERT_TRUE(SendAsciiMessage(tag, tag + std::string(100, '.')));
+  }
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  size_t n_dumped = 0;
+  size_t line_start = 0;
+  while (line_start < written_to_os_.size()) {
+    const size_t line_end = written_to_os_.find('\n', line_start);
+    const std::string line =
+        written_to_os_.substr(line_start, line_end - line_start);
+    line_start = line_end + 1;
+    // Each line is "<timestamps> <tag> <tag>....".
+    const size_t message_start = line.rfind(' ') + 1;
+    const size_t tag_start = line.rfind(' ', message_start - 2) + 1;
+    const std::string tag =
+        line.substr(tag_start, message_start - 1 - tag_start);
+    EXPECT_EQ(tag + std::string(100, '.'), line.substr(message_start));
+    ++n_dumped;
+  }
+  EXPECT_LT(0U, n_dumped);
+  EXPECT_THAT(written_to_os_,
+              EndsWith("tag" + std::to_string(n_messages - 1) +
+                       std::string(100, '.') + "\n"));
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandCompressedLogBuffersRetainMoreMessages) {
+  constexpr size_t kCompressedBufferSizeBytes = 2 * kBufferSizeBytes;
+  ResetCommandProcessor(kCompressedBufferSizeBytes,
+                        LogBuffer::Mode::kCompressed);
+  const std::string tag("wpa_supplicant");
+  const std::string message_prefix("wlan0: CTRL-EVENT-SIGNAL-CHANGE seq=");
+  const size_t uncompressed_record_len =
+      MessageBuffer::GetHeaderSize() + sizeof(TimestampHeader) +
+      BuildAsciiMessageCommand(tag, message_prefix + "100000").size() -
+      tag.size();
+  const size_t n_retained_uncompressed =
+      kCompressedBufferSizeBytes *
+      CommandProcessor::kLogBufferShares[static_cast<size_t>(
+          protocol::MessageSeverity::kError)] /
+      CommandProcessor::kLogBufferShareDenominator / uncompressed_record_len;
+  const size_t n_messages = 8 * n_retained_uncompressed;
+  // Offset the sequence numbers, so that every message has the same length.
+  constexpr size_t kFirstSeq = 100000;
+  for (size_t i = 0; i < n_messages; ++i) {
+    ASSERT_TRUE(
+        SendAsciiMessage(tag, message_prefix + std::to_string(kFirstSeq + i)));
+  }
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_LT(static_cast<ssize_t>(2 * n_retained_uncompressed),
+            std::count(written_to_os_.begin(), written_to_os_.end(),
+                       kLogRecordSeparator));
+  EXPECT_THAT(written_to_os_,
+              EndsWith(tag + " " + message_prefix +
+                       std::to_string(kFirstSeq + n_messages - 1) + "\n"));
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandCompressedLogBuffersReleaseEvictedTags) {
+  ResetCommandProcessor(2 * kBufferSizeBytes, LogBuffer::Mode::kCompressed);
+  // As above, but the messages are evicted a block at a time.
+  const size_t n_messages = 8 * TagTable::kMaxTags;
+  for (size_t i = 0; i < n_messages; ++i) {
+    const std::string tag = "tag" + std::to_string(i);
+    ASSERT_TRUE(SendAsciiMessage(tag, tag + std::string(100, '.')));
+  }
+  ASSERT_LT(0U, command_processor_->GetStats().n_messages_evicted);
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_,
+              EndsWith("tag" + std::to_string(n_messages - 1) + " tag" +
+                       std::to_string(n_messages - 1) +
+                       std::string(100, '.') + "\n"));
+}
+
+TEST_F(CommandProcessorTest,
+       PersistentAlignedLogBuffersRecoverMessagesAfterRestart) {
+  TemporaryDir persistent_dir;
+  ResetCommandProcessor(kBufferSizeBytes, LogBuffer::Mode::kAligned,
+                        persistent_dir.path);
+  ASSERT_TRUE(SendAsciiMessage("tag", "before restart"));
+
+  ResetCommandProcessor(kBufferSizeBytes, LogBuffer::Mode::kAligned,
+                        persistent_dir.path);
+  ASSERT_TRUE(SendAsciiMessage("tag", "after restart"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_, HasSubstr("tag before restart\n"));
+  EXPECT_THAT(written_to_os_, EndsWith("tag after restart\n"));
+}
+
+TEST_F(CommandProcessorTest, PersistentLogBuffersRecoverMessagesAfterRestart) {
+  TemporaryDir persistent_dir;
+  ResetCommandProcessor(kBufferSizeBytes, LogBuffer::Mode::kUncompressed,
+                        persistent_dir.path);
+  ASSERT_TRUE(SendAsciiMessage("tag", "before restart"));
+
+  // Replacing the CommandProcessor discards everything in memory, as a
+  // crash would.
+  ResetCommandProcessor(kBufferSizeBytes, LogBuffer::Mode::kUncompressed,
+                        persistent_dir.path);
+  ASSERT_TRUE(SendAsciiMessage("tag", "after restart"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_, HasSubstr("tag before restart\n"));
+  EXPECT_THAT(written_to_os_, EndsWith("tag after restart\n"));
+}
+
+TEST_F(CommandProcessorTest, PersistentLogBuffersDiscardMalformedMessages) {
+  TemporaryDir persistent_dir;
+  {
+    // Write a message that is too short to be a record, where the kError
+    // log buffer will find it.
+    const std::string path = std::string(persistent_dir.path) + "/log_buffer_" +
+                             std::to_string(static_cast<size_t>(
+                                 protocol::MessageSeverity::kError));
+    MessageBuffer buffer(kErrorBufferSizeBytes,
+                         unique_fd(open(path.c_str(), O_RDWR | O_CREAT, 0600)));
+    const uint8_t message = 0;
+    ASSERT_TRUE(buffer.Append(&message, sizeof(message)));
+  }
+
+  ResetCommandProcessor(kBufferSizeBytes, LogBuffer::Mode::kUncompressed,
+                        persistent_dir.path);
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(1, std::count(written_to_os_.begin(), written_to_os_.end(),
+                          kLogRecordSeparator));
+}
+
+TEST_F(CommandProcessorTest, PersistentLogBuffersDoNotInternTags) {
+  TemporaryDir persistent_dir;
+  ResetCommandProcessor(kBufferSizeBytes, LogBuffer::Mode::kUncompressed,
+                        persistent_dir.path);
+  const CommandBuffer& command = BuildAsciiMessageCommand("tag", "message");
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+
+  ResetCommandProcessor(kBufferSizeBytes, LogBuffer::Mode::kUncompressed,
+                        persistent_dir.path);
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersBinary());
+  constexpr size_t kRecordStart = sizeof(protocol::BinaryDumpPreamble) +
+                                  sizeof(protocol::Stats) + sizeof(uint16_t) +
+                                  sizeof(TimestampHeader);
+  ASSERT_EQ(kRecordStart + command.size(), written_to_os_.size());
+  EXPECT_EQ(std::string(reinterpret_cast<const char*>(command.data()),
+                        command.size()),
+            written_to_os_.substr(kRecordStart));
+}
+
+TEST_F(CommandProcessorTest, IngestPolicyIsDisabledByDefault) {
+  for (int64_t i = 0; i <= IngestPolicy::kTagBurstMessages; ++i) {
+    ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  }
+  EXPECT_EQ(static_cast<uint64_t>(IngestPolicy::kTagBurstMessages + 1),
+            command_processor_->GetStats().n_messages_logged);
+  EXPECT_EQ(0U, command_processor_->GetNumMessagesSuppressed());
+}
+
+TEST_F(CommandProcessorTest, IngestPolicySuppressesFloodAndSummarizesIt) {
+  constexpr uint32_t kStartSecs = 100;
+  constexpr uint32_t kSummaryIntervalSecs =
+      IngestPolicy::kSummaryIntervalNsec / (1000 * 1000 * 1000);
+  command_processor_->EnableIngestPolicy();
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC_COARSE))
+      .WillRepeatedly(Return(Os::Timestamp{kStartSecs, 0}));
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_BOOTTIME)).Times(AnyNumber());
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_REALTIME)).Times(AnyNumber());
+
+  const CommandBuffer& spam = BuildAsciiMessageCommand("spammer", "spam");
+  for (int64_t i = 0; i < IngestPolicy::kTagBurstMessages + 3; ++i) {
+    ASSERT_TRUE(command_processor_->ProcessCommand(spam.data(), spam.size(),
+                                                   Os::kInvalidFd));
+  }
+  EXPECT_EQ(3U, command_processor_->GetNumMessagesSuppressed());
+
+  // The first suppression is summarized at once. The others are summarized
+  // by the first message after the summary interval.
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC_COARSE))
+      .WillRepeatedly(
+          Return(Os::Timestamp{kStartSecs + kSummaryIntervalSecs, 0}));
+  const CommandBuffer& quiet = BuildAsciiMessageCommand("quiet", "message");
+  ASSERT_TRUE(command_processor_->ProcessCommand(quiet.data(), quiet.size(),
+                                                 Os::kInvalidFd));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("wifilogd 1 messages suppressed from tag spammer\n"));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("wifilogd 2 messages suppressed from tag spammer\n"));
+  EXPECT_THAT(written_to_os_, HasSubstr("quiet message\n"));
+  size_t n_spam_records = 0;
+  for (size_t pos = written_to_os_.find("spammer spam\n");
+       pos != std::string::npos;
+       pos = written_to_os_.find("spammer spam\n", pos + 1)) {
+    ++n_spam_records;
+  }
+  EXPECT_EQ(static_cast<size_t>(IngestPolicy::kTagBurstMessages),
+            n_spam_records);
+}
+
+TEST_F(CommandProcessorTest, RepeatCoalescingIsDisabledByDefault) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(2, std::count(written_to_os_.begin(), written_to_os_.end(),
+                          kLogRecordSeparator));
+}
+
+TEST_F(CommandProcessorTest, RepeatCoalescingCountsRepeats) {
+  command_processor_->EnableRepeatCoalescing();
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_EQ(3U, command_processor_->GetStats().n_messages_logged);
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(2, std::count(written_to_os_.begin(), written_to_os_.end(),
+                          kLogRecordSeparator));
+  EXPECT_THAT(written_to_os_, HasSubstr(" tag message\n"));
+  EXPECT_THAT(written_to_os_,
+              EndsWith(" tag last message repeated 2 times\n"));
+}
+
+TEST_F(CommandProcessorTest, RepeatCoalescingDistinguishesMessages) {
+  command_processor_->EnableRepeatCoalescing();
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message2"));
+  ASSERT_TRUE(SendAsciiMessage("tag2", "message2"));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+      "tag2", "message2", protocol::MessageSeverity::kWarning, {0, 0}));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(4, std::count(written_to_os_.begin(), written_to_os_.end(),
+                          kLogRecordSeparator));
+}
+
+TEST_F(CommandProcessorTest, RepeatCoalescingRestartsAfterOtherMessage) {
+  command_processor_->EnableRepeatCoalescing();
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "other"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(5, std::count(written_to_os_.begin(), written_to_os_.end(),
+                          kLogRecordSeparator));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr(" tag last message repeated 1 times\n"));
+  EXPECT_THAT(written_to_os_,
+              EndsWith(" tag last message repeated 2 times\n"));
+}
+
+TEST_F(CommandProcessorTest, RepeatCoalescingHandlesEmptyTag) {
+  command_processor_->EnableRepeatCoalescing();
+  ASSERT_TRUE(SendAsciiMessage("", "message"));
+  ASSERT_TRUE(SendAsciiMessage("", "message"));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_,
+              EndsWith(" [empty] last message repeated 1 times\n"));
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandRejectsRepeatedMessageOpcode) {
+  const auto repeated_message_header =
+      protocol::RepeatedMessage().set_n_repeats(1);
+  const auto command =
+      protocol::Command()
+          .set_opcode(protocol::Opcode::kRepeatedMessage)
+          .set_payload_len(sizeof(repeated_message_header));
+  const auto buf = CommandBuffer()
+                       .AppendOrDie(&command, sizeof(command))
+                       .AppendOrDie(&repeated_message_header,
+                                    sizeof(repeated_message_header));
+  EXPECT_FALSE(
+      command_processor_->ProcessCommand(buf.data(), buf.size(),
+                                         Os::kInvalidFd));
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersSinceReturnsOnlyNewRecords) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "first"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "second"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersSince(protocol::DumpCursor()));
+  EXPECT_EQ(
+      "# cursor buffer=0 next=2 missed=0\n"
+      "# cursor buffer=1 next=0 missed=0\n"
+      "# cursor buffer=2 next=0 missed=0\n"
+      "# cursor buffer=3 next=0 missed=0\n"
+      "# cursor buffer=4 next=0 missed=0\n"
+      "0.000000 0.000000 0.000000 tag first\n"
+      "0.000000 0.000000 0.000000 tag second\n",
+      written_to_os_);
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "third"));
+  written_to_os_.clear();
+  EXPECT_TRUE(
+      SendDumpBuffersSince(protocol::DumpCursor().set_next_record(0, 2)));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("# cursor buffer=0 next=3 missed=0\n"));
+  EXPECT_THAT(written_to_os_, Not(HasSubstr("first")));
+  EXPECT_THAT(written_to_os_, Not(HasSubstr("second")));
+  EXPECT_THAT(written_to_os_, EndsWith(" tag third\n"));
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersSinceReturnsNoRecordsWhenUpToDate) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(
+      SendDumpBuffersSince(protocol::DumpCursor().set_next_record(0, 1)));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("# cursor buffer=0 next=1 missed=0\n"));
+  EXPECT_EQ(static_cast<ssize_t>(protocol::kNumDumpCursorBuffers),
+            std::count(written_to_os_.begin(), written_to_os_.end(),
+                       kLogRecordSeparator));
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersSinceTracksEachLogBuffer) {
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+      "tag", "warning", protocol::MessageSeverity::kWarning, {1, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+      "tag", "error", protocol::MessageSeverity::kError, {2, 0}));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(
+      SendDumpBuffersSince(protocol::DumpCursor().set_next_record(1, 1)));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("# cursor buffer=0 next=1 missed=0\n"
+                        "# cursor buffer=1 next=1 missed=0\n"));
+  EXPECT_THAT(written_to_os_, Not(HasSubstr("warning")));
+  EXPECT_THAT(written_to_os_, EndsWith(" tag error\n"));
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersSinceReportsEvictedRecords) {
+  const std::string tag{"tag"};
+  const std::string message(kMaxAsciiMessagePayloadLen - tag.size(), '.');
+  constexpr size_t kNumMessages =
+      2 * kErrorBufferSizeBytes / protocol::kMaxMessageSize;
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(SendAsciiMessage(tag, message));
+  }
+  const uint64_t n_evicted = command_processor_->GetStats().n_messages_evicted;
+  ASSERT_LT(1U, n_evicted);
+
+  // A reader which had read only the first record missed the rest of the
+  // evicted records.
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(
+      SendDumpBuffersSince(protocol::DumpCursor().set_next_record(0, 1)));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("# cursor buffer=0 next=" +
+                        std::to_string(kNumMessages) + " missed=" +
+                        std::to_string(n_evicted - 1) + "\n"));
+  EXPECT_EQ(kNumMessages - n_evicted,
+            static_cast<size_t>(std::count(written_to_os_.begin(),
+                                           written_to_os_.end(),
+                                           kLogRecordSeparator)) -
+                protocol::kNumDumpCursorBuffers);
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersSinceRereadsWhenCursorIsPastNewest) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(
+      SendDumpBuffersSince(protocol::DumpCursor().set_next_record(0, 5)));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("# cursor buffer=0 next=1 missed=0\n"));
+  EXPECT_THAT(written_to_os_, EndsWith(" tag message\n"));
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersSinceWorksWithCompressedBuffers) {
+  ResetCommandProcessor(2 * kBufferSizeBytes, LogBuffer::Mode::kCompressed);
+  // Enough messages to seal a block in the kError buffer.
+  constexpr size_t kNumMessages = 2 * LogBuffer::kBlockSizeBytes / 100;
+  const std::string message(100, '.');
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(SendAsciiMessage("tag", message));
+  }
+  ASSERT_TRUE(SendAsciiMessage("tag", "last"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersSince(
+      protocol::DumpCursor().set_next_record(0, kNumMessages)));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("# cursor buffer=0 next=" +
+                        std::to_string(kNumMessages + 1) + " missed=0\n"));
+  EXPECT_THAT(written_to_os_, Not(HasSubstr(message)));
+  EXPECT_THAT(written_to_os_, EndsWith(" tag last\n"));
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersSinceEndsRunOfRepeats) {
+  command_processor_->EnableRepeatCoalescing();
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersSince(protocol::DumpCursor()));
+  EXPECT_THAT(written_to_os_,
+              EndsWith(" tag last message repeated 1 times\n"));
+
+  // The record that was read is not updated. The repeat is logged anew.
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  written_to_os_.clear();
+  EXPECT_TRUE(
+      SendDumpBuffersSince(protocol::DumpCursor().set_next_record(0, 2)));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr("# cursor buffer=0 next=3 missed=0\n"));
+  EXPECT_THAT(written_to_os_, EndsWith(" tag message\n"));
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandRejectsShortDumpBuffersSince) {
+  const auto command = protocol::Command()
+                           .set_opcode(protocol::Opcode::kDumpBuffersSince)
+                           .set_payload_len(0);
+  const auto buf = CommandBuffer().AppendOrDie(&command, sizeof(command));
+  EXPECT_FALSE(command_processor_->ProcessCommand(buf.data(), buf.size(),
+                                                  Os::kInvalidFd));
+  EXPECT_EQ(1U, command_processor_->GetStats().n_commands_rejected);
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersQueryFiltersByBoottime) {
+  using protocol::MessageSeverity;
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "first",
+                                             MessageSeverity::kError, {1, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "second",
+                                             MessageSeverity::kError, {2, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "third",
+                                             MessageSeverity::kError, {3, 0}));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersQuery(protocol::DumpQuery()
+                                       .set_min_boottime_nsec(2000000000)
+                                       .set_max_boottime_nsec(2000000000),
+                                   ""));
+  EXPECT_EQ("0.000000 2.000000 0.000000 tag second\n", written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersQueryFiltersByRealtime) {
+  ASSERT_TRUE(SendAsciiMessageWithRealtime("tag", "first", {10, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithRealtime("tag", "second", {20, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithRealtime("tag", "third", {30, 0}));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersQuery(protocol::DumpQuery()
+                                       .set_min_realtime_nsec(15000000000)
+                                       .set_max_realtime_nsec(25000000000),
+                                   ""));
+  EXPECT_EQ("0.000000 0.000000 20.000000 tag second\n", written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersQueryFiltersBySeverity) {
+  using protocol::MessageSeverity;
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "error",
+                                             MessageSeverity::kError, {1, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+      "tag", "warning", MessageSeverity::kWarning, {2, 0}));
+  ASSERT_TRUE(SendAsciiMessageWithSeverityAt("tag", "trace",
+                                             MessageSeverity::kTrace, {3, 0}));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersQuery(
+      protocol::DumpQuery().set_min_severity(MessageSeverity::kWarning), ""));
+  EXPECT_EQ(
+      "0.000000 1.000000 0.000000 tag error\n"
+      "0.000000 2.000000 0.000000 tag warning\n",
+      written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersQueryFiltersByTag) {
+  command_processor_->EnableRepeatCoalescing();
+  ASSERT_TRUE(SendAsciiMessage("wanted", "message"));
+  ASSERT_TRUE(SendAsciiMessage("wanted", "message"));
+  ASSERT_TRUE(SendAsciiMessage("other", "message"));
+  ASSERT_TRUE(SendAsciiMessage("want", "message"));
+  ASSERT_TRUE(SendAsciiMessage("wanted2", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersQuery(protocol::DumpQuery(), "wanted"));
+  EXPECT_EQ(
+      "0.000000 0.000000 0.000000 wanted message\n"
+      "0.000000 0.000000 0.000000 wanted last message repeated 1 times\n",
+      written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersQueryFiltersByUninternedTag) {
+  // Log more distinct tags than can be interned at once.
+  for (size_t i = 0; i <= TagTable::kMaxTags; ++i) {
+    ASSERT_TRUE(SendAsciiMessage("tag" + std::to_string(i), "message"));
+  }
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersQuery(
+      protocol::DumpQuery(), "tag" + std::to_string(TagTable::kMaxTags)));
+  EXPECT_EQ("0.000000 0.000000 0.000000 tag" +
+                std::to_string(TagTable::kMaxTags) + " message\n",
+            written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersQueryHandlesTruncatedTag) {
+  ASSERT_TRUE(SendAsciiMessageWithAdjustments("tag", "", 0, 0, 1, 0));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersQuery(protocol::DumpQuery(), "tag"));
+  EXPECT_EQ("", written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersQuerySeeksAcrossIndexEntries) {
+  for (LogBuffer::Mode mode :
+       {LogBuffer::Mode::kUncompressed, LogBuffer::Mode::kCompressed,
+        LogBuffer::Mode::kAligned}) {
+    ResetCommandProcessor(2 * kBufferSizeBytes, mode);
+    constexpr uint32_t kNumMessages = 10 * TimeIndex::kRecordsPerEntry;
+    for (uint32_t i = 0; i < kNumMessages; ++i) {
+      ASSERT_TRUE(SendAsciiMessageWithSeverityAt(
+          "tag", std::to_string(i), protocol::MessageSeverity::kError,
+          {i, 0}));
+    }
+    ASSERT_EQ(0U, command_processor_->GetStats().n_messages_evicted);
+    // Start within an interval, so that the query must read some records
+    // which are too old.
+    constexpr uint32_t kFirstWanted = 5 * TimeIndex::kRecordsPerEntry + 3;
+    EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+    written_to_os_.clear();
+    EXPECT_TRUE(SendDumpBuffersQuery(
+        protocol::DumpQuery()
+            .set_min_boottime_nsec(uint64_t{kFirstWanted} * 1000000000)
+            .set_max_boottime_nsec(uint64_t{kFirstWanted + 1} * 1000000000),
+        ""));
+    EXPECT_EQ(2, std::count(written_to_os_.begin(), written_to_os_.end(),
+                            kLogRecordSeparator));
+    EXPECT_THAT(written_to_os_,
+                HasSubstr(" tag " + std::to_string(kFirstWanted) + "\n"));
+    EXPECT_THAT(written_to_os_,
+                EndsWith(" tag " + std::to_string(kFirstWanted + 1) + "\n"));
+  }
+}
+
+TEST_F(CommandProcessorTest, DumpBuffersQueryIncludesStats) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersQuery(protocol::DumpQuery(), ""));
+  EXPECT_THAT(dumped_stats_line_, HasSubstr(" logged=1 "));
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandRejectsMalformedDumpBuffersQuery) {
+  const auto query_with_bad_severity = protocol::DumpQuery().set_min_severity(
+      static_cast<protocol::MessageSeverity>(CommandProcessor::kNumLogBuffers));
+  const auto query_with_long_tag = protocol::DumpQuery().set_tag_len(1);
+  for (const auto& query : {query_with_bad_severity, query_with_long_tag}) {
+    const auto command = protocol::Command()
+                             .set_opcode(protocol::Opcode::kDumpBuffersQuery)
+                             .set_payload_len(sizeof(query));
+    const auto buf = CommandBuffer()
+                         .AppendOrDie(&command, sizeof(command))
+                         .AppendOrDie(&query, sizeof(query));
+    EXPECT_FALSE(command_processor_->ProcessCommand(buf.data(), buf.size(),
+                                                    Os::kInvalidFd));
+    EXPECT_FALSE(command_processor_->ProcessCommand(
+        buf.data(), buf.size() - 1, Os::kInvalidFd));
+  }
+  EXPECT_EQ(4U, command_processor_->GetStats().n_commands_rejected);
+}
+
+TEST_F(CommandProcessorTest, ProcessTimestampedCommandLogsGivenTimestamp) {
+  const CommandBuffer& command_buffer(
+      BuildAsciiMessageCommand("tag", "message"));
+  const auto tstamp_header = TimestampHeader()
+                                 .set_since_boot_awake_only({1, 0})
+                                 .set_since_boot_with_sleep({2, 0})
+                                 .set_since_epoch({3, 0});
+  // The clocks are not read. (|os_| is a StrictMock.)
+  ASSERT_TRUE(command_processor_->ProcessTimestampedCommand(
+      tstamp_header, command_buffer.data(), command_buffer.size(),
+      Os::kInvalidFd));
+  EXPECT_EQ(1U, command_processor_->GetStats().n_messages_logged);
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ("1.000000 2.000000 3.000000 tag message\n", written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, SubscriberReceivesNewMessages) {
+  constexpr int kSubscriberFd = 1000;
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(0));
+  ASSERT_TRUE(SendSubscribe(kSubscriberFd));
+  EXPECT_EQ(1U, command_processor_->GetNumSubscribers());
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _)).Times(AtLeast(1));
+  EXPECT_FALSE(command_processor_->DoIdleWork());
+  EXPECT_THAT(written_to_os_, EndsWith(" tag message\n"));
+  EXPECT_EQ(1, std::count(written_to_os_.begin(), written_to_os_.end(),
+                          kLogRecordSeparator));
+}
+
+TEST_F(CommandProcessorTest, SubscriberDoesNotReceiveEarlierMessages) {
+  constexpr int kSubscriberFd = 1000;
+  ASSERT_TRUE(SendAsciiMessage("tag", "before"));
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(0));
+  ASSERT_TRUE(SendSubscribe(kSubscriberFd));
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "after"));
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _)).Times(AtLeast(1));
+  command_processor_->DoIdleWork();
+  EXPECT_THAT(written_to_os_, Not(HasSubstr("before")));
+  EXPECT_THAT(written_to_os_, HasSubstr(" tag after\n"));
+}
+
+TEST_F(CommandProcessorTest, EverySubscriberReceivesEachMessage) {
+  constexpr int kFirstSubscriberFd = 1000;
+  constexpr int kSecondSubscriberFd = 1001;
+  EXPECT_CALL(*os_, SetNonBlocking(_)).Times(2).WillRepeatedly(Return(0));
+  ASSERT_TRUE(SendSubscribe(kFirstSubscriberFd));
+  ASSERT_TRUE(SendSubscribe(kSecondSubscriberFd));
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(kFirstSubscriberFd, _, _)).Times(AtLeast(1));
+  EXPECT_CALL(*os_, Write(kSecondSubscriberFd, _, _)).Times(AtLeast(1));
+  command_processor_->DoIdleWork();
+  EXPECT_EQ(2, std::count(written_to_os_.begin(), written_to_os_.end(),
+                          kLogRecordSeparator));
+}
+
+TEST_F(CommandProcessorTest, SubscriberReceivesInternedTag) {
+  constexpr int kSubscriberFd = 1000;
+  ASSERT_TRUE(SendAsciiMessage("tag", "interns the tag"));
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(0));
+  ASSERT_TRUE(SendSubscribe(kSubscriberFd));
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _)).Times(AtLeast(1));
+  command_processor_->DoIdleWork();
+  EXPECT_THAT(written_to_os_, EndsWith(" tag message\n"));
+}
+
+TEST_F(CommandProcessorTest, SubscriberReceivesEachRepeatCount) {
+  constexpr int kSubscriberFd = 1000;
+  command_processor_->EnableRepeatCoalescing();
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(0));
+  ASSERT_TRUE(SendSubscribe(kSubscriberFd));
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _)).Times(AtLeast(1));
+  command_processor_->DoIdleWork();
+  EXPECT_THAT(written_to_os_, HasSubstr(" tag message\n"));
+  EXPECT_THAT(written_to_os_,
+              HasSubstr(" tag last message repeated 1 times\n"));
+  EXPECT_THAT(written_to_os_,
+              EndsWith(" tag last message repeated 2 times\n"));
+}
+
+TEST_F(CommandProcessorTest, SubscriberKeepsOutputWhileBlocked) {
+  constexpr int kSubscriberFd = 1000;
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(0));
+  ASSERT_TRUE(SendSubscribe(kSubscriberFd));
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EAGAIN}));
+  // Blocked output does not keep the main loop busy.
+  EXPECT_FALSE(command_processor_->DoIdleWork());
+  EXPECT_EQ(1U, command_processor_->GetNumSubscribers());
+  EXPECT_TRUE(written_to_os_.empty());
+
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _)).Times(AtLeast(1));
+  command_processor_->DoIdleWork();
+  EXPECT_THAT(written_to_os_, EndsWith(" tag message\n"));
+}
+
+TEST_F(CommandProcessorTest, SubscriberResumesAfterShortWrite) {
+  constexpr int kSubscriberFd = 1000;
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(0));
+  ASSERT_TRUE(SendSubscribe(kSubscriberFd));
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  auto& accumulator = written_to_os_;
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _))
+      .WillOnce(Invoke([&accumulator](int /*fd*/, const void* write_buf,
+                                      size_t /*buflen*/) {
+        accumulator.append(static_cast<const char*>(write_buf), 1);
+        return std::tuple<size_t, Os::Errno>(1, 0);
+      }))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EAGAIN}));
+  command_processor_->DoIdleWork();
+  EXPECT_EQ(1U, written_to_os_.size());
+
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _)).Times(AtLeast(1));
+  command_processor_->DoIdleWork();
+  EXPECT_THAT(written_to_os_, EndsWith(" tag message\n"));
+}
+
+TEST_F(CommandProcessorTest, SlowSubscriberIsDetached) {
+  constexpr int kSubscriberFd = 1000;
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(0));
+  ASSERT_TRUE(SendSubscribe(kSubscriberFd));
+
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _))
+      .WillRepeatedly(Return(std::tuple<size_t, Os::Errno>{0, EAGAIN}));
+  const std::string message(kMaxAsciiMessagePayloadLen, '.');
+  const size_t n_messages =
+      CommandProcessor::kMaxSubscriberQueueBytes / message.size() + 1;
+  for (size_t i = 0; i < n_messages; ++i) {
+    ASSERT_TRUE(SendAsciiMessage("", message));
+    command_processor_->DoIdleWork();
+  }
+  EXPECT_EQ(0U, command_processor_->GetNumSubscribers());
+  // Logging continues without subscribers.
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_FALSE(command_processor_->DoIdleWork());
+}
+
+TEST_F(CommandProcessorTest, SubscriberIsDetachedOnWriteError) {
+  constexpr int kSubscriberFd = 1000;
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(0));
+  ASSERT_TRUE(SendSubscribe(kSubscriberFd));
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(kSubscriberFd, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EPIPE}));
+  command_processor_->DoIdleWork();
+  EXPECT_EQ(0U, command_processor_->GetNumSubscribers());
+}
+
+TEST_F(CommandProcessorTest, SubscribeDetachesOldestSubscriberWhenFull) {
+  EXPECT_CALL(*os_, SetNonBlocking(_)).WillRepeatedly(Return(0));
+  for (size_t i = 0; i <= CommandProcessor::kMaxSubscribers; ++i) {
+    ASSERT_TRUE(SendSubscribe(1000 + i));
+  }
+  EXPECT_EQ(CommandProcessor::kMaxSubscribers,
+            command_processor_->GetNumSubscribers());
+
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(1000, _, _)).Times(0);
+  EXPECT_CALL(*os_, Write(Not(1000), _, _)).Times(AtLeast(1));
+  command_processor_->DoIdleWork();
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandRejectsSubscribeWithoutFd) {
+  EXPECT_FALSE(SendSubscribe(Os::kInvalidFd));
+  EXPECT_EQ(0U, command_processor_->GetNumSubscribers());
+  EXPECT_EQ(1U, command_processor_->GetStats().n_commands_rejected);
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandRejectsSubscriberWhichCannotBeMadeNonBlocking) {
+  constexpr int kSubscriberFd = 1000;
+  EXPECT_CALL(*os_, SetNonBlocking(kSubscriberFd)).WillOnce(Return(EBADF));
+  EXPECT_FALSE(SendSubscribe(kSubscriberFd));
+  EXPECT_EQ(0U, command_processor_->GetNumSubscribers());
+  EXPECT_EQ(1U, command_processor_->GetStats().n_commands_rejected);
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersBinaryStopsAfterError) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+
+  EXPECT_CALL(*os_, Write(_, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, ERANGE}));
+  // As with text dumps, the failure occurs after the dump has started.
+  EXPECT_TRUE(SendDumpBuffersBinary());
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersWritesSnapshotTakenWhenDumpStarted) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "before dump"));
+
+  // Hold the dump in its first write, while we log more messages. Logging
+  // enough maximal messages wraps the log buffer, evicting the message that
+  // was logged before the dump started.
+  std::promise<void> write_started;
+  std::promise<void> release_write;
+  auto release = release_write.get_future().share();
+  auto& accumulator = written_to_os_;
+  EXPECT_CALL(*os_, Write(_, _, _))
+      .WillOnce(Invoke([&write_started, release, &accumulator](
+          int /*fd*/, const void* write_buf, size_t buflen) {
+        write_started.set_value();
+        release.wait();
+        accumulator.append(static_cast<const char*>(write_buf), buflen);
+        return std::tuple<size_t, Os::Errno>{buflen, 0};
+      }));
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+  const auto command = protocol::Command()
+                           .set_opcode(protocol::Opcode::kDumpBuffers)
+                           .set_payload_len(0);
+  const auto buf = CommandBuffer().AppendOrDie(&command, sizeof(command));
+  constexpr int kFakeFd = 100;
+  ASSERT_TRUE(
+      command_processor_->ProcessCommand(buf.data(), buf.size(), kFakeFd));
+  write_started.get_future().wait();
+
+  const std::string tag{"after"};
+  const std::string message(kMaxAsciiMessagePayloadLen - tag.size(), '.');
+  for (size_t i = 0; i <= kErrorBufferSizeBytes / protocol::kMaxMessageSize;
+       ++i) {
+    ASSERT_TRUE(SendAsciiMessage(tag, message));
+  }
+  // The dump reads the clock again, once it has written its output.
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+  release_write.set_value();
+  command_processor_->WaitForDumps();
+  EXPECT_THAT(written_to_os_, EndsWith("tag before dump\n"));
+  EXPECT_THAT(written_to_os_, Not(HasSubstr("after")));
+
+  // A new dump sees the new messages, and not the evicted one.
+  written_to_os_.clear();
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_THAT(written_to_os_, HasSubstr("after"));
+  EXPECT_THAT(written_to_os_, Not(HasSubstr("before dump")));
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersFailsIfTooManyDumpsPend) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+
+  std::promise<void> release_writes;
+  auto release = release_writes.get_future().share();
+  EXPECT_CALL(*os_, Write(_, _, _))
+      .Times(DumpWorker::kMaxPendingDumps)
+      .WillRepeatedly(Invoke(
+          [release](int /*fd*/, const void* /*write_buf*/, size_t buflen) {
+            release.wait();
+            return std::tuple<size_t, Os::Errno>{buflen, 0};
+          }));
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+  const auto command = protocol::Command()
+                           .set_opcode(protocol::Opcode::kDumpBuffers)
+                           .set_payload_len(0);
+  const auto buf = CommandBuffer().AppendOrDie(&command, sizeof(command));
+  constexpr int kFakeFd = 100;
+  for (size_t i = 0; i < DumpWorker::kMaxPendingDumps; ++i) {
+    EXPECT_TRUE(
+        command_processor_->ProcessCommand(buf.data(), buf.size(), kFakeFd));
+  }
+  EXPECT_FALSE(
+      command_processor_->ProcessCommand(buf.data(), buf.size(), kFakeFd));
+  release_writes.set_value();
+  command_processor_->WaitForDumps();
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersBinaryIsIdempotent) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersBinary());
+  const std::string first_dump = written_to_os_;
+  written_to_os_.clear();
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffersBinary());
+  EXPECT_EQ(first_dump, written_to_os_);
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandDumpBuffersIsIdempotent) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  ASSERT_TRUE(SendDumpBuffers());
+  ASSERT_GT(written_to_os_.size(), 0U);
+  written_to_os_.clear();
+  ASSERT_EQ(0U, written_to_os_.size());
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_GT(written_to_os_.size(), 0U);
+}
+
+TEST_F(CommandProcessorTest,
+       ProcessCommandDumpBuffersIsIdempotentEvenWithWriteFailure) {
+  ASSERT_TRUE(SendAsciiMessage("tag", "message"));
+  EXPECT_CALL(*os_, Write(_, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{-1, EBADF}));
+  // The dump is started successfully, and fails later, on the dump thread.
+  // The StrictMock verifies that the dump makes no further writes.
+  ASSERT_TRUE(SendDumpBuffers());
+  ASSERT_EQ(0U, written_to_os_.size());
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_GT(written_to_os_.size(), 0U);
+}
+
+TEST_F(CommandProcessorTest, ProcessCommandsLogsEveryCommandInBatch) {
+  const CommandBuffer& command_buf(BuildAsciiMessageCommand("tag", "message"));
+  constexpr size_t kNumCommands = 3;
+  constexpr size_t kBufStride = protocol::kMaxMessageSize;
+  std::vector<uint8_t> input_bufs(kBufStride * kNumCommands);
+  std::vector<size_t> command_lens(kNumCommands, command_buf.size());
+  const std::vector<int> command_fds(kNumCommands, Os::kInvalidFd);
+  for (size_t i = 0; i < kNumCommands; ++i) {
+    std::copy(command_buf.data(), command_buf.data() + command_buf.size(),
+              input_bufs.data() + i * kBufStride);
+  }
+  // Make the middle command a runt, which should be rejected.
+  command_lens[1] = sizeof(protocol::Command) - 1;
+
+  EXPECT_CALL(*os_, GetTimestamp(_)).Times(AnyNumber());
+  EXPECT_EQ(kNumCommands - 1,
+            command_processor_->ProcessCommands(
+                input_bufs.data(), kBufStride, command_lens.data(),
+                command_fds.data(), kNumCommands));
+
+  EXPECT_CALL(*os_, Write(_, _, _)).Times(AtLeast(1));
+  EXPECT_TRUE(SendDumpBuffers());
+  EXPECT_EQ(static_cast<ssize_t>(kNumCommands - 1),
+            std::count(written_to_os_.begin(), written_to_os_.end(),
+                       kLogRecordSeparator));
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       RegisterSharedRingLogsRecordsWrittenBeforeRegistration) {
+  ASSERT_EQ(SharedRingWriter::WriteResult::kOk,
+            WriteToRing(BuildAsciiMessageCommand("tag", "early message")));
+  EXPECT_TRUE(RegisterSharedRing());
+  EXPECT_EQ(1U, CountDumpedRecords());
+  EXPECT_THAT(written_to_os_, HasSubstr("early message"));
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       RegisterSharedRingArmsWakeupForFirstRecord) {
+  ASSERT_TRUE(RegisterSharedRing());
+  EXPECT_EQ(SharedRingWriter::WriteResult::kOkWakeupNeeded,
+            WriteToRing(BuildAsciiMessageCommand("tag", "message")));
+  EXPECT_EQ(SharedRingWriter::WriteResult::kOk,
+            WriteToRing(BuildAsciiMessageCommand("tag", "message")));
+}
+
+TEST_F(CommandProcessorSharedRingTest, DrainSharedRingsLogsEveryRecord) {
+  ASSERT_TRUE(RegisterSharedRing());
+  WriteToRing(BuildAsciiMessageCommand("tag", "first message"));
+  WriteToRing(BuildAsciiMessageCommand("tag", "second message"));
+  EXPECT_TRUE(SendDrainSharedRings());
+  EXPECT_EQ(2U, CountDumpedRecords());
+  EXPECT_THAT(written_to_os_, HasSubstr("first message"));
+  EXPECT_THAT(written_to_os_, HasSubstr("second message"));
+}
+
+TEST_F(CommandProcessorSharedRingTest, DrainSharedRingsLogsStructuredMessages) {
+  ASSERT_TRUE(RegisterSharedRing());
+  StructuredMessageWriter writer(structured_formats::FormatId::kScanResults,
+                                 "tag", 3,
+                                 protocol::MessageSeverity::kInformational);
+  writer.AddUint32(5);
+  ring_writer_.Write(writer.data(), writer.size());
+  EXPECT_TRUE(SendDrainSharedRings());
+  EXPECT_EQ(1U, CountDumpedRecords());
+  EXPECT_THAT(written_to_os_, HasSubstr("scan results n_results=5"));
+  EXPECT_EQ(0U, command_processor_->GetStats().n_ring_records_dropped);
+}
+
+TEST_F(CommandProcessorSharedRingTest, DrainSharedRingsReleasesRingSpace) {
+  ASSERT_TRUE(RegisterSharedRing());
+  const CommandBuffer& command = BuildAsciiMessageCommand("tag", "message");
+  for (size_t i = 0; i < 4 * kRingMappingLen / command.size(); ++i) {
+    ASSERT_NE(SharedRingWriter::WriteResult::kRingFull, WriteToRing(command));
+    ASSERT_TRUE(SendDrainSharedRings());
+  }
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       DrainSharedRingsDropsRecordsWithUnsupportedOpcodes) {
+  ASSERT_TRUE(RegisterSharedRing());
+  const auto dump_command =
+      protocol::Command().set_opcode(protocol::Opcode::kDumpBuffers);
+  WriteToRing(CommandBuffer().AppendOrDie(&dump_command, sizeof(dump_command)));
+  WriteToRing(BuildAsciiMessageCommand("tag", "message"));
+  EXPECT_TRUE(SendDrainSharedRings());
+  EXPECT_EQ(1U, CountDumpedRecords());
+  EXPECT_EQ(1U, command_processor_->GetStats().n_ring_records_dropped);
+}
+
+TEST_F(CommandProcessorSharedRingTest, DrainSharedRingsDropsRuntRecords) {
+  ASSERT_TRUE(RegisterSharedRing());
+  const CommandBuffer& command = BuildAsciiMessageCommand("tag", "message");
+  ring_writer_.Write(command.data(), sizeof(protocol::Command) - 1);
+  WriteToRing(command);
+  EXPECT_TRUE(SendDrainSharedRings());
+  EXPECT_EQ(1U, CountDumpedRecords());
+  EXPECT_EQ(1U, command_processor_->GetStats().n_ring_records_dropped);
+}
+
+TEST_F(CommandProcessorSharedRingTest, DrainSharedRingsSucceedsWithNoRings) {
+  EXPECT_TRUE(SendDrainSharedRings());
+}
+
+TEST_F(CommandProcessorSharedRingTest, DoIdleWorkReportsNoWorkWhenDrained) {
+  ASSERT_TRUE(RegisterSharedRing());
+  WriteToRing(BuildAsciiMessageCommand("tag", "message"));
+  EXPECT_TRUE(SendDrainSharedRings());
+  EXPECT_FALSE(command_processor_->DoIdleWork());
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       DrainSharedRingsUnregistersCorruptRing) {
+  ASSERT_TRUE(RegisterSharedRing());
+  GetRingHeader()->write_pos.store(kRingMappingLen * 2);
+  EXPECT_CALL(*os_, UnmapSharedMemory(ring_mapping_->bytes.data(),
+                                      kRingMappingLen));
+  EXPECT_TRUE(SendDrainSharedRings());
+  EXPECT_TRUE(SendDrainSharedRings());  // Should not unmap again.
+}
+
+TEST_F(CommandProcessorSharedRingTest, RegisterSharedRingFailsWithoutFd) {
+  EXPECT_FALSE(SendRegisterSharedRing(kRingMappingLen, Os::kInvalidFd));
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       RegisterSharedRingFailsWithoutRegistration) {
+  const auto command =
+      protocol::Command().set_opcode(protocol::Opcode::kRegisterSharedRing);
+  const auto buf = CommandBuffer().AppendOrDie(&command, sizeof(command));
+  EXPECT_FALSE(
+      command_processor_->ProcessCommand(buf.data(), buf.size(), MakeRingFd()));
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       RegisterSharedRingFailsForUndersizedMapping) {
+  EXPECT_FALSE(SendRegisterSharedRing(kRingMappingLen - 1, MakeRingFd()));
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       RegisterSharedRingFailsForOversizedMapping) {
+  EXPECT_FALSE(SendRegisterSharedRing(
+      sizeof(protocol::SharedRingHeader) + protocol::kMaxSharedRingDataLen + 1,
+      MakeRingFd()));
+}
+
+TEST_F(CommandProcessorSharedRingTest, RegisterSharedRingFailsIfMapFails) {
+  EXPECT_CALL(*os_, MapSharedMemory(_, _))
+      .WillOnce(Return(std::tuple<void*, Os::Errno>{nullptr, EPERM}));
+  EXPECT_FALSE(SendRegisterSharedRing(kRingMappingLen, MakeRingFd()));
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       RegisterSharedRingRejectsAndUnmapsInvalidRing) {
+  ++GetRingHeader()->magic;
+  EXPECT_CALL(*os_, UnmapSharedMemory(ring_mapping_->bytes.data(),
+                                      kRingMappingLen));
+  EXPECT_FALSE(RegisterSharedRing());
+}
+
+TEST_F(CommandProcessorSharedRingTest,
+       RegisterSharedRingUnregistersOldestRingWhenFull) {
+  std::vector<std::unique_ptr<RingMapping>> mappings;
+  for (size_t i = 0; i < CommandProcessor::kMaxSharedRings; ++i) {
+    mappings.emplace_back(new RingMapping());
+    const SharedRingWriter writer(mappings.back()->bytes.data(),
+                                  kRingMappingLen);
+    ASSERT_TRUE(RegisterSharedRing(mappings.back()->bytes.data()));
+  }
+
+  EXPECT_CALL(*os_, UnmapSharedMemory(mappings.front()->bytes.data(),
+                                      kRingMappingLen));
+  EXPECT_TRUE(RegisterSharedRing());
+}
+
+TEST_F(CommandProcessorSharedRingTest, DestructorUnmapsRegisteredRings) {
+  ASSERT_TRUE(RegisterSharedRing());
+  EXPECT_CALL(*os_, UnmapSharedMemory(ring_mapping_->bytes.data(),
+                                      kRingMappingLen));
+  command_processor_.reset();
 }
 
 // Strictly speaking, this is not a unit test. But there's no easy way to get
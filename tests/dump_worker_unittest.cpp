@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <unistd.h>
+
+#include <cstring>
+#include <future>
+#include <memory>
+#include <string>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "android-base/unique_fd.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "wifilogd/byte_buffer.h"
+#include "wifilogd/log_formatter.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/tests/mock_os.h"
+#include "wifilogd/timestamp_header.h"
+
+#include "wifilogd/dump_worker.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using ::android::base::unique_fd;
+using ::testing::_;
+using ::testing::AnyNumber;
+using ::testing::EndsWith;
+using ::testing::Invoke;
+using ::testing::StrictMock;
+
+using RecordBuffer = ByteBuffer<log_formatter::kMaxRecordLen>;
+
+constexpr int kFakeFd = 100;
+constexpr char kEmptyStatsLine[] =
+    "# stats logged=0 evicted=0 missing=0 truncated=0 rejected=0 "
+    "ring_dropped=0 enomem=0 eintr=0\n";
+
+// Returns a logged record (a TimestampHeader, followed by an AsciiMessage
+// command), for |tag| and |message|.
+RecordBuffer MakeRecord(const std::string& tag, const std::string& message) {
+  const auto ascii_message_header =
+      protocol::AsciiMessage()
+          .set_tag_len(tag.length())
+          .set_data_len(message.length())
+          .set_severity(protocol::MessageSeverity::kError);
+  const auto command =
+      protocol::Command()
+          .set_opcode(protocol::Opcode::kWriteAsciiMessage)
+          .set_payload_len(sizeof(ascii_message_header) + tag.length() +
+                           message.length());
+  const auto tstamp_header = TimestampHeader();
+  return RecordBuffer()
+      .AppendOrDie(&tstamp_header, sizeof(tstamp_header))
+      .AppendOrDie(&command, sizeof(command))
+      .AppendOrDie(&ascii_message_header, sizeof(ascii_message_header))
+      .AppendOrDie(tag.data(), tag.length())
+      .AppendOrDie(message.data(), message.length());
+}
+
+// Appends |record| to |snapshot|, framed as DumpWorker expects.
+void AppendToSnapshot(const RecordBuffer& record,
+                      std::vector<uint8_t>* snapshot) {
+  const uint16_t record_len = record.size();
+  const auto* const record_len_bytes =
+      reinterpret_cast<const uint8_t*>(&record_len);
+  snapshot->insert(snapshot->end(), record_len_bytes,
+                   record_len_bytes + sizeof(record_len));
+  snapshot->insert(snapshot->end(), record.data(),
+                   record.data() + record.size());
+}
+
+class DumpWorkerTest : public ::testing::Test {
+ public:
+  DumpWorkerTest() : written_to_os_(), os_(), dump_worker_(&os_) {
+    EXPECT_CALL(os_, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+  }
+
+ protected:
+  // Returns an action which accumulates the written bytes in
+  // |written_to_os_|.
+  auto AcceptWrites() {
+    auto& accumulator = written_to_os_;
+    return Invoke([&accumulator](int /* fd */, const void* buf,
+                                 size_t buflen) {
+      accumulator.append(static_cast<const char*>(buf), buflen);
+      return std::tuple<size_t, Os::Errno>{buflen, 0};
+    });
+  }
+
+  // Returns an action which blocks until |release| is ready, and then
+  // accepts the write.
+  static auto BlockUntil(std::shared_future<void> release) {
+    return Invoke([release](int /* fd */, const void* /* buf */,
+                            size_t buflen) {
+      release.wait();
+      return std::tuple<size_t, Os::Errno>{buflen, 0};
+    });
+  }
+
+  void EnqueueDump(std::vector<uint8_t> snapshot,
+                   DumpWorker::Format format) {
+    ASSERT_TRUE(dump_worker_.CanEnqueue());
+    dump_worker_.Enqueue(std::move(snapshot), protocol::Stats(),
+                         OpcodeLatencies(), unique_fd(kFakeFd), format);
+  }
+
+  std::string written_to_os_;  // Must out-live |os_|
+  StrictMock<MockOs> os_;      // Must out-live |dump_worker_|
+  DumpWorker dump_worker_;
+};
+
+}  // namespace
+
+TEST_F(DumpWorkerTest, WaitUntilIdleReturnsWithNoDumps) {
+  dump_worker_.WaitUntilIdle();
+}
+
+TEST_F(DumpWorkerTest, TextDumpOfEmptySnapshotWritesOnlyStats) {
+  EXPECT_CALL(os_, Write(kFakeFd, _, _)).WillOnce(AcceptWrites());
+  EnqueueDump({}, DumpWorker::Format::kText);
+  dump_worker_.WaitUntilIdle();
+  EXPECT_EQ(kEmptyStatsLine, written_to_os_);
+}
+
+TEST_F(DumpWorkerTest, TextDumpStartsWithStats) {
+  protocol::Stats stats{};
+  stats.n_messages_logged = 2;
+  stats.n_messages_evicted = 1;
+  stats.n_receive_eintr_errors = 3;
+  std::vector<uint8_t> snapshot;
+  AppendToSnapshot(MakeRecord("tag", "message"), &snapshot);
+
+  EXPECT_CALL(os_, Write(kFakeFd, _, _)).WillOnce(AcceptWrites());
+  dump_worker_.Enqueue(std::move(snapshot), stats, OpcodeLatencies(),
+                       unique_fd(kFakeFd), DumpWorker::Format::kText);
+  dump_worker_.WaitUntilIdle();
+  EXPECT_EQ(
+      "# stats logged=2 evicted=1 missing=0 truncated=0 rejected=0 "
+      "ring_dropped=0 enomem=0 eintr=3\n"
+      "0.000000 0.000000 0.000000 tag message\n",
+      written_to_os_);
+}
+
+TEST_F(DumpWorkerTest, StatsDumpWritesOnlyStats) {
+  std::vector<uint8_t> snapshot;
+  AppendToSnapshot(MakeRecord("tag", "message"), &snapshot);
+
+  EXPECT_CALL(os_, Write(kFakeFd, _, _)).WillOnce(AcceptWrites());
+  EnqueueDump(std::move(snapshot), DumpWorker::Format::kStats);
+  dump_worker_.WaitUntilIdle();
+  EXPECT_EQ(kEmptyStatsLine, written_to_os_);
+}
+
+TEST_F(DumpWorkerTest, StatsDumpIncludesLatencies) {
+  OpcodeLatencies latencies;
+  latencies[protocol::Opcode::kWriteAsciiMessage].Record(5000);
+
+  EXPECT_CALL(os_, Write(kFakeFd, _, _)).WillOnce(AcceptWrites());
+  dump_worker_.Enqueue({}, protocol::Stats(), latencies, unique_fd(kFakeFd),
+                       DumpWorker::Format::kStats);
+  dump_worker_.WaitUntilIdle();
+  EXPECT_EQ(std::string(kEmptyStatsLine) +
+                "# latency opcode=0 samples=1 p50_usec=5 p90_usec=5 "
+                "p99_usec=5 max_usec=5\n",
+            written_to_os_);
+}
+
+TEST_F(DumpWorkerTest, TextDumpFormatsEveryRecord) {
+  std::vector<uint8_t> snapshot;
+  AppendToSnapshot(MakeRecord("tag", "first"), &snapshot);
+  AppendToSnapshot(MakeRecord("tag", "second"), &snapshot);
+
+  EXPECT_CALL(os_, Write(kFakeFd, _, _)).WillOnce(AcceptWrites());
+  EnqueueDump(std::move(snapshot), DumpWorker::Format::kText);
+  dump_worker_.WaitUntilIdle();
+  EXPECT_EQ(std::string(kEmptyStatsLine) +
+                "0.000000 0.000000 0.000000 tag first\n"
+                "0.000000 0.000000 0.000000 tag second\n",
+            written_to_os_);
+}
+
+TEST_F(DumpWorkerTest, TextSinceDumpStartsWithCursor) {
+  DumpWorker::Cursor cursor{};
+  cursor[0] = {3, 0};
+  cursor[2] = {12, 5};
+  std::vector<uint8_t> snapshot;
+  AppendToSnapshot(MakeRecord("tag", "message"), &snapshot);
+
+  EXPECT_CALL(os_, Write(kFakeFd, _, _)).WillOnce(AcceptWrites());
+  ASSERT_TRUE(dump_worker_.CanEnqueue());
+  dump_worker_.EnqueueSince(std::move(snapshot), cursor, unique_fd(kFakeFd));
+  dump_worker_.WaitUntilIdle();
+  EXPECT_EQ(
+      "# cursor buffer=0 next=3 missed=0\n"
+      "# cursor buffer=1 next=0 missed=0\n"
+      "# cursor buffer=2 next=12 missed=5\n"
+      "# cursor buffer=3 next=0 missed=0\n"
+      "# cursor buffer=4 next=0 missed=0\n"
+      "0.000000 0.000000 0.000000 tag message\n",
+      written_to_os_);
+}
+
+TEST_F(DumpWorkerTest, BinaryDumpWritesPreambleStatsAndSnapshot) {
+  protocol::Stats stats{};
+  stats.n_messages_missing = 5;
+  std::vector<uint8_t> snapshot;
+  AppendToSnapshot(MakeRecord("tag", "message"), &snapshot);
+
+  EXPECT_CALL(os_, Write(kFakeFd, _, _)).WillOnce(AcceptWrites());
+  dump_worker_.Enqueue(snapshot, stats, OpcodeLatencies(),
+                       unique_fd(kFakeFd), DumpWorker::Format::kBinary);
+  dump_worker_.WaitUntilIdle();
+
+  constexpr size_t kStatsOffset = sizeof(protocol::BinaryDumpPreamble);
+  constexpr size_t kSnapshotOffset = kStatsOffset + sizeof(protocol::Stats);
+  ASSERT_EQ(kSnapshotOffset + snapshot.size(), written_to_os_.size());
+  protocol::BinaryDumpPreamble preamble;
+  std::memcpy(&preamble, written_to_os_.data(), sizeof(preamble));
+  EXPECT_EQ(protocol::kBinaryDumpMagic, preamble.magic);
+  EXPECT_EQ(protocol::kBinaryDumpVersion, preamble.version);
+  protocol::Stats written_stats;
+  std::memcpy(&written_stats, written_to_os_.data() + kStatsOffset,
+              sizeof(written_stats));
+  EXPECT_EQ(5U, written_stats.n_messages_missing);
+  EXPECT_EQ(0, std::memcmp(snapshot.data(),
+                           written_to_os_.data() + kSnapshotOffset,
+                           snapshot.size()));
+}
+
+TEST_F(DumpWorkerTest, DumpsRunInOrder) {
+  std::vector<uint8_t> first_snapshot;
+  AppendToSnapshot(MakeRecord("tag", "first"), &first_snapshot);
+  std::vector<uint8_t> second_snapshot;
+  AppendToSnapshot(MakeRecord("tag", "second"), &second_snapshot);
+
+  EXPECT_CALL(os_, Write(_, _, _)).Times(2).WillRepeatedly(AcceptWrites());
+  EnqueueDump(std::move(first_snapshot), DumpWorker::Format::kText);
+  EnqueueDump(std::move(second_snapshot), DumpWorker::Format::kText);
+  dump_worker_.WaitUntilIdle();
+  EXPECT_THAT(written_to_os_,
+              EndsWith(std::string("tag first\n") + kEmptyStatsLine +
+                       "0.000000 0.000000 0.000000 tag second\n"));
+}
+
+TEST_F(DumpWorkerTest, DumpStopsAfterWriteError) {
+  std::vector<uint8_t> snapshot;
+  AppendToSnapshot(MakeRecord("tag", "message"), &snapshot);
+
+  EXPECT_CALL(os_, Write(_, _, _))
+      .WillOnce(Invoke([](int /* fd */, const void* /* buf */,
+                          size_t /* buflen */) {
+        return std::tuple<size_t, Os::Errno>{0, EBADF};
+      }));
+  EnqueueDump(std::move(snapshot), DumpWorker::Format::kText);
+  dump_worker_.WaitUntilIdle();
+}
+
+TEST_F(DumpWorkerTest, CanEnqueueIsFalseWhenTooManyDumpsArePending) {
+  std::vector<uint8_t> snapshot;
+  AppendToSnapshot(MakeRecord("tag", "message"), &snapshot);
+
+  std::promise<void> release;
+  EXPECT_CALL(os_, Write(_, _, _))
+      .Times(DumpWorker::kMaxPendingDumps)
+      .WillRepeatedly(BlockUntil(release.get_future().share()));
+  for (size_t i = 0; i < DumpWorker::kMaxPendingDumps; ++i) {
+    EnqueueDump(snapshot, DumpWorker::Format::kText);
+  }
+  EXPECT_FALSE(dump_worker_.CanEnqueue());
+
+  release.set_value();
+  dump_worker_.WaitUntilIdle();
+  EXPECT_TRUE(dump_worker_.CanEnqueue());
+}
+
+TEST_F(DumpWorkerTest, DumpClosesFd) {
+  int pipe_fds[2];
+  ASSERT_EQ(0, pipe(pipe_fds));
+  unique_fd read_end(pipe_fds[0]);
+  EXPECT_CALL(os_, Write(pipe_fds[1], _, _)).WillOnce(AcceptWrites());
+  dump_worker_.Enqueue({}, protocol::Stats(), OpcodeLatencies(),
+                       unique_fd(pipe_fds[1]), DumpWorker::Format::kText);
+  dump_worker_.WaitUntilIdle();
+
+  // With the write end closed, a read reports EOF.
+  char buf;
+  EXPECT_EQ(0, read(read_end.get(), &buf, sizeof(buf)));
+}
+
+TEST(DumpWorkerLifetimeTest, DestructorFinishesPendingDumps) {
+  std::vector<uint8_t> snapshot;
+  AppendToSnapshot(MakeRecord("tag", "message"), &snapshot);
+
+  StrictMock<MockOs> os;
+  EXPECT_CALL(os, GetTimestamp(CLOCK_MONOTONIC)).Times(AnyNumber());
+  EXPECT_CALL(os, Write(_, _, _))
+      .Times(2)
+      .WillRepeatedly(Invoke([](int /* fd */, const void* /* buf */,
+                                size_t buflen) {
+        return std::tuple<size_t, Os::Errno>{buflen, 0};
+      }));
+  {
+    DumpWorker dump_worker(&os);
+    dump_worker.Enqueue(snapshot, protocol::Stats(), OpcodeLatencies(),
+                        unique_fd(kFakeFd), DumpWorker::Format::kText);
+    dump_worker.Enqueue(snapshot, protocol::Stats(), OpcodeLatencies(),
+                        unique_fd(kFakeFd), DumpWorker::Format::kBinary);
+  }
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,247 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/ingest_policy.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using protocol::MessageSeverity;
+
+constexpr int64_t kNsecPerSec = 1000 * 1000 * 1000;
+constexpr int64_t kStartNsec = 1000 * kNsecPerSec;
+constexpr int64_t kTagRefillNsec =
+    kNsecPerSec / IngestPolicy::kTagMessagesPerSec;
+
+class IngestPolicyTest : public ::testing::Test {
+ public:
+  IngestPolicyTest() : policy_() {}
+
+ protected:
+  bool Admit(const std::string& tag, MessageSeverity severity,
+             int64_t now_nsec) {
+    return policy_.Admit(reinterpret_cast<const uint8_t*>(tag.data()),
+                         tag.size(), severity, now_nsec);
+  }
+
+  // Sends |n_messages| messages from |tag|, at |now_nsec|. Returns the
+  // number of messages admitted.
+  size_t AdmitMany(const std::string& tag, MessageSeverity severity,
+                   size_t n_messages, int64_t now_nsec) {
+    size_t n_admitted = 0;
+    for (size_t i = 0; i < n_messages; ++i) {
+      n_admitted += Admit(tag, severity, now_nsec);
+    }
+    return n_admitted;
+  }
+
+  // Floods the policy for |n_windows| load windows, starting at |now_nsec|.
+  // Returns the time at which the last window ends.
+  int64_t Flood(size_t n_windows, int64_t now_nsec) {
+    for (size_t i = 0; i < n_windows; ++i) {
+      AdmitMany("flood", MessageSeverity::kError,
+                IngestPolicy::kHighLoadMessagesPerWindow + 1, now_nsec);
+      now_nsec += IngestPolicy::kLoadWindowNsec;
+    }
+    return now_nsec;
+  }
+
+  IngestPolicy policy_;
+};
+
+}  // namespace
+
+TEST_F(IngestPolicyTest, TagMayBurst) {
+  EXPECT_EQ(static_cast<size_t>(IngestPolicy::kTagBurstMessages),
+            AdmitMany("tag", MessageSeverity::kInformational,
+                      IngestPolicy::kTagBurstMessages, kStartNsec));
+  EXPECT_FALSE(Admit("tag", MessageSeverity::kInformational, kStartNsec));
+}
+
+TEST_F(IngestPolicyTest, TagBucketRefillsOverTime) {
+  AdmitMany("tag", MessageSeverity::kInformational,
+            IngestPolicy::kTagBurstMessages, kStartNsec);
+  ASSERT_FALSE(Admit("tag", MessageSeverity::kInformational, kStartNsec));
+  EXPECT_FALSE(Admit("tag", MessageSeverity::kInformational,
+                     kStartNsec + kTagRefillNsec - 1));
+  EXPECT_TRUE(Admit("tag", MessageSeverity::kInformational,
+                    kStartNsec + kTagRefillNsec));
+  EXPECT_FALSE(Admit("tag", MessageSeverity::kInformational,
+                     kStartNsec + kTagRefillNsec));
+}
+
+TEST_F(IngestPolicyTest, TagBucketRefillIsCappedAtBurst) {
+  AdmitMany("tag", MessageSeverity::kInformational,
+            IngestPolicy::kTagBurstMessages, kStartNsec);
+  const int64_t later_nsec = kStartNsec + 100 * kNsecPerSec;
+  EXPECT_EQ(static_cast<size_t>(IngestPolicy::kTagBurstMessages),
+            AdmitMany("tag", MessageSeverity::kInformational,
+                      IngestPolicy::kTagBurstMessages + 1, later_nsec));
+}
+
+TEST_F(IngestPolicyTest, TagsAreLimitedSeparately) {
+  AdmitMany("tag1", MessageSeverity::kInformational,
+            IngestPolicy::kTagBurstMessages, kStartNsec);
+  ASSERT_FALSE(Admit("tag1", MessageSeverity::kInformational, kStartNsec));
+  EXPECT_TRUE(Admit("tag2", MessageSeverity::kInformational, kStartNsec));
+}
+
+TEST_F(IngestPolicyTest, SeverityBucketLimitsAllTags) {
+  const auto kDumpIndex = static_cast<size_t>(MessageSeverity::kDump);
+  const size_t kSeverityBurst =
+      IngestPolicy::kSeverityMessagesPerSec[kDumpIndex];
+  ASSERT_EQ(0U, kSeverityBurst % IngestPolicy::kTagBurstMessages);
+  size_t n_admitted = 0;
+  for (size_t i = 0; i < kSeverityBurst / IngestPolicy::kTagBurstMessages;
+       ++i) {
+    n_admitted += AdmitMany("tag" + std::to_string(i), MessageSeverity::kDump,
+                            IngestPolicy::kTagBurstMessages, kStartNsec);
+  }
+  EXPECT_EQ(kSeverityBurst, n_admitted);
+  EXPECT_FALSE(Admit("another tag", MessageSeverity::kDump, kStartNsec));
+  EXPECT_TRUE(Admit("another tag", MessageSeverity::kTrace, kStartNsec));
+}
+
+TEST_F(IngestPolicyTest, SuppressedMessageDoesNotUseSeverityTokens) {
+  const auto kDumpIndex = static_cast<size_t>(MessageSeverity::kDump);
+  const size_t kSeverityBurst =
+      IngestPolicy::kSeverityMessagesPerSec[kDumpIndex];
+  // Exhaust the bucket for "spam", then keep sending from it.
+  AdmitMany("spam", MessageSeverity::kDump, kSeverityBurst, kStartNsec);
+  EXPECT_TRUE(Admit("tag", MessageSeverity::kDump, kStartNsec));
+}
+
+TEST_F(IngestPolicyTest, AllSeveritiesAreAdmittedInitially) {
+  EXPECT_EQ(MessageSeverity::kDump, policy_.GetMinSeverity());
+}
+
+TEST_F(IngestPolicyTest, HighLoadSuppressesLeastSevereMessages) {
+  const int64_t now_nsec = Flood(1, kStartNsec);
+  EXPECT_FALSE(Admit("tag", MessageSeverity::kDump, now_nsec));
+  EXPECT_EQ(MessageSeverity::kTrace, policy_.GetMinSeverity());
+  EXPECT_TRUE(Admit("tag", MessageSeverity::kTrace, now_nsec));
+}
+
+TEST_F(IngestPolicyTest, HighLoadNeverSuppressesWarnings) {
+  const int64_t now_nsec = Flood(10, kStartNsec);
+  EXPECT_FALSE(Admit("tag", MessageSeverity::kInformational, now_nsec));
+  EXPECT_EQ(MessageSeverity::kWarning, policy_.GetMinSeverity());
+  EXPECT_TRUE(Admit("tag", MessageSeverity::kWarning, now_nsec));
+  EXPECT_TRUE(Admit("tag", MessageSeverity::kError, now_nsec));
+}
+
+TEST_F(IngestPolicyTest, LowLoadReadmitsSeverities) {
+  int64_t now_nsec = Flood(2, kStartNsec);
+  ASSERT_FALSE(Admit("tag", MessageSeverity::kTrace, now_nsec));
+  ASSERT_EQ(MessageSeverity::kInformational, policy_.GetMinSeverity());
+
+  // The window which began with the message above is quiet.
+  now_nsec += IngestPolicy::kLoadWindowNsec;
+  EXPECT_TRUE(Admit("tag", MessageSeverity::kTrace, now_nsec));
+  EXPECT_FALSE(Admit("tag", MessageSeverity::kDump, now_nsec));
+  now_nsec += IngestPolicy::kLoadWindowNsec;
+  EXPECT_TRUE(Admit("tag", MessageSeverity::kDump, now_nsec));
+}
+
+TEST_F(IngestPolicyTest, UnknownSeverityIsTreatedAsInformational) {
+  const auto kUnknownSeverity = static_cast<MessageSeverity>(
+      static_cast<size_t>(MessageSeverity::kDump) + 1);
+  int64_t now_nsec = Flood(2, kStartNsec);
+  EXPECT_TRUE(Admit("tag", kUnknownSeverity, now_nsec));
+  ASSERT_EQ(MessageSeverity::kInformational, policy_.GetMinSeverity());
+  now_nsec = Flood(1, now_nsec);
+  EXPECT_FALSE(Admit("tag", kUnknownSeverity, now_nsec));
+  ASSERT_EQ(MessageSeverity::kWarning, policy_.GetMinSeverity());
+}
+
+TEST_F(IngestPolicyTest, NoSummaryIsDueInitially) {
+  EXPECT_FALSE(policy_.IsSummaryDue(kStartNsec));
+  EXPECT_TRUE(policy_.TakeSummaries(kStartNsec).empty());
+}
+
+TEST_F(IngestPolicyTest, SuppressedMessagesAreSummarizedByTag) {
+  AdmitMany("tag2", MessageSeverity::kInformational,
+            IngestPolicy::kTagBurstMessages + 2, kStartNsec);
+  AdmitMany("tag1", MessageSeverity::kInformational,
+            IngestPolicy::kTagBurstMessages + 3, kStartNsec);
+  AdmitMany("tag3", MessageSeverity::kInformational, 1, kStartNsec);
+  ASSERT_TRUE(policy_.IsSummaryDue(kStartNsec));
+
+  const std::vector<IngestPolicy::Suppression> summaries =
+      policy_.TakeSummaries(kStartNsec);
+  ASSERT_EQ(2U, summaries.size());
+  EXPECT_EQ("tag1", summaries[0].tag);
+  EXPECT_EQ(3U, summaries[0].n_suppressed);
+  EXPECT_EQ("tag2", summaries[1].tag);
+  EXPECT_EQ(2U, summaries[1].n_suppressed);
+  EXPECT_FALSE(policy_.IsSummaryDue(kStartNsec));
+}
+
+TEST_F(IngestPolicyTest, SummariesAreRateLimited) {
+  AdmitMany("tag", MessageSeverity::kInformational,
+            IngestPolicy::kTagBurstMessages + 1, kStartNsec);
+  ASSERT_TRUE(policy_.IsSummaryDue(kStartNsec));
+  policy_.TakeSummaries(kStartNsec);
+
+  ASSERT_FALSE(Admit("tag", MessageSeverity::kInformational, kStartNsec));
+  EXPECT_FALSE(policy_.IsSummaryDue(kStartNsec +
+                                    IngestPolicy::kSummaryIntervalNsec - 1));
+  EXPECT_TRUE(
+      policy_.IsSummaryDue(kStartNsec + IngestPolicy::kSummaryIntervalNsec));
+}
+
+TEST_F(IngestPolicyTest, SummaryIsNotDueWithoutSuppressions) {
+  AdmitMany("tag", MessageSeverity::kInformational,
+            IngestPolicy::kTagBurstMessages + 1, kStartNsec);
+  policy_.TakeSummaries(kStartNsec);
+  EXPECT_FALSE(policy_.IsSummaryDue(kStartNsec + 100 * kNsecPerSec));
+}
+
+TEST_F(IngestPolicyTest, ExcessTagsShareABucket) {
+  for (size_t i = 0; i < IngestPolicy::kMaxTrackedTags; ++i) {
+    ASSERT_TRUE(Admit("tag" + std::to_string(i),
+                      MessageSeverity::kInformational, kStartNsec));
+  }
+  EXPECT_EQ(static_cast<size_t>(IngestPolicy::kTagBurstMessages),
+            AdmitMany("excess1", MessageSeverity::kInformational,
+                      IngestPolicy::kTagBurstMessages, kStartNsec));
+  EXPECT_FALSE(Admit("excess2", MessageSeverity::kInformational, kStartNsec));
+
+  const std::vector<IngestPolicy::Suppression> summaries =
+      policy_.TakeSummaries(kStartNsec);
+  ASSERT_EQ(1U, summaries.size());
+  EXPECT_EQ(IngestPolicy::kOtherTagsName, summaries[0].tag);
+  EXPECT_EQ(1U, summaries[0].n_suppressed);
+}
+
+TEST_F(IngestPolicyTest, NumSuppressedIsNotResetBySummaries) {
+  AdmitMany("tag", MessageSeverity::kInformational,
+            IngestPolicy::kTagBurstMessages + 2, kStartNsec);
+  policy_.TakeSummaries(kStartNsec);
+  AdmitMany("tag", MessageSeverity::kInformational, 1, kStartNsec);
+  EXPECT_EQ(3U, policy_.GetNumSuppressed());
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,131 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/latency_histogram.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+constexpr uint64_t kNsecPerUsec = 1000;
+
+class LatencyHistogramTest : public ::testing::Test {
+ public:
+  LatencyHistogramTest() : histogram_() {}
+
+ protected:
+  LatencyHistogram histogram_;
+};
+
+}  // namespace
+
+TEST_F(LatencyHistogramTest, EmptyHistogramReportsZeroes) {
+  EXPECT_EQ(0U, histogram_.GetNumSamples());
+  EXPECT_EQ(0U, histogram_.GetMaxNsec());
+  EXPECT_EQ(0U, histogram_.GetPercentileNsec(50));
+  EXPECT_EQ(0U, histogram_.GetPercentileNsec(100));
+}
+
+TEST_F(LatencyHistogramTest, SubMicrosecondLatencyGoesInFirstBucket) {
+  histogram_.Record(0);
+  histogram_.Record(kNsecPerUsec - 1);
+  EXPECT_EQ(2U, histogram_.GetBucketCount(0));
+  EXPECT_EQ(0U, histogram_.GetBucketCount(1));
+}
+
+TEST_F(LatencyHistogramTest, BucketsDoubleInWidth) {
+  histogram_.Record(1 * kNsecPerUsec);
+  histogram_.Record(2 * kNsecPerUsec);
+  histogram_.Record(3 * kNsecPerUsec);
+  histogram_.Record(4 * kNsecPerUsec);
+  histogram_.Record(8 * kNsecPerUsec - 1);
+  EXPECT_EQ(1U, histogram_.GetBucketCount(1));
+  EXPECT_EQ(2U, histogram_.GetBucketCount(2));
+  EXPECT_EQ(2U, histogram_.GetBucketCount(3));
+}
+
+TEST_F(LatencyHistogramTest, BucketLimitsMatchBucketContents) {
+  for (size_t i = 0; i < LatencyHistogram::kNumBuckets - 1; ++i) {
+    const uint64_t limit_nsec = LatencyHistogram::GetBucketLimitNsec(i);
+    LatencyHistogram histogram;
+    histogram.Record(limit_nsec - 1);
+    histogram.Record(limit_nsec);
+    EXPECT_EQ(1U, histogram.GetBucketCount(i)) << "bucket " << i;
+    EXPECT_EQ(1U, histogram.GetBucketCount(i + 1)) << "bucket " << i;
+  }
+}
+
+TEST_F(LatencyHistogramTest, LastBucketCountsHugeLatencies) {
+  histogram_.Record(UINT64_MAX);
+  EXPECT_EQ(1U,
+            histogram_.GetBucketCount(LatencyHistogram::kNumBuckets - 1));
+  EXPECT_EQ(UINT64_MAX, histogram_.GetMaxNsec());
+  EXPECT_EQ(UINT64_MAX, histogram_.GetPercentileNsec(50));
+}
+
+TEST_F(LatencyHistogramTest, MaxTracksLargestSample) {
+  histogram_.Record(5);
+  histogram_.Record(500);
+  histogram_.Record(50);
+  EXPECT_EQ(3U, histogram_.GetNumSamples());
+  EXPECT_EQ(500U, histogram_.GetMaxNsec());
+}
+
+TEST_F(LatencyHistogramTest, PercentileReportsBucketLimit) {
+  for (int i = 0; i < 90; ++i) {
+    histogram_.Record(10 * kNsecPerUsec);  // Bucket 4: [8, 16) usec.
+  }
+  for (int i = 0; i < 10; ++i) {
+    histogram_.Record(1000 * kNsecPerUsec);  // Bucket 10: [512, 1024) usec.
+  }
+  EXPECT_EQ(16 * kNsecPerUsec, histogram_.GetPercentileNsec(50));
+  EXPECT_EQ(16 * kNsecPerUsec, histogram_.GetPercentileNsec(90));
+  EXPECT_EQ(1000 * kNsecPerUsec, histogram_.GetPercentileNsec(91));
+  EXPECT_EQ(1000 * kNsecPerUsec, histogram_.GetPercentileNsec(99));
+}
+
+TEST_F(LatencyHistogramTest, PercentileIsClampedToMax) {
+  histogram_.Record(9 * kNsecPerUsec);
+  EXPECT_EQ(9 * kNsecPerUsec, histogram_.GetPercentileNsec(50));
+}
+
+TEST_F(LatencyHistogramTest, ZerothPercentileIsSmallestBucket) {
+  histogram_.Record(1 * kNsecPerUsec);
+  histogram_.Record(100 * kNsecPerUsec);
+  EXPECT_EQ(2 * kNsecPerUsec, histogram_.GetPercentileNsec(0));
+}
+
+// Per
+// github.com/google/googletest/blob/master/googletest/docs/AdvancedGuide.md#death-tests,
+// death tests should be specially named.
+using LatencyHistogramDeathTest = LatencyHistogramTest;
+
+TEST_F(LatencyHistogramDeathTest, PercentileAboveHundredCausesDeath) {
+  EXPECT_DEATH(histogram_.GetPercentileNsec(101), "Check failed");
+}
+
+TEST_F(LatencyHistogramDeathTest, LimitOfLastBucketCausesDeath) {
+  EXPECT_DEATH(LatencyHistogram::GetBucketLimitNsec(
+                   LatencyHistogram::kNumBuckets - 1),
+               "Check failed");
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,135 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/protocol.h"
+#include "wifilogd/tools/load_generator.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+constexpr char kTag[] = "loadgen0.0";
+constexpr size_t kHeadersLen =
+    sizeof(protocol::Command) + sizeof(protocol::AsciiMessage);
+
+class LoadGeneratorTest : public ::testing::Test {
+ public:
+  LoadGeneratorTest() : buf_() {}
+
+ protected:
+  protocol::Command GetCommand() const {
+    protocol::Command command;
+    std::memcpy(&command, buf_.data(), sizeof(command));
+    return command;
+  }
+
+  protocol::AsciiMessage GetAsciiMessage() const {
+    protocol::AsciiMessage ascii_message;
+    std::memcpy(&ascii_message, buf_.data() + sizeof(protocol::Command),
+                sizeof(ascii_message));
+    return ascii_message;
+  }
+
+  std::array<uint8_t, protocol::kMaxMessageSize> buf_;
+};
+
+}  // namespace
+
+TEST_F(LoadGeneratorTest, BuildMessageFillsInCommandHeader) {
+  const size_t len =
+      LoadGenerator::BuildMessage(kTag, 42, 1234, 10, buf_.data());
+  const protocol::Command command = GetCommand();
+  EXPECT_EQ(protocol::Opcode::kWriteAsciiMessage, command.opcode);
+  EXPECT_EQ(42U, command.sequence_num);
+  EXPECT_EQ(1234U, command.src_boottime_nsec);
+  EXPECT_EQ(len, sizeof(protocol::Command) + command.payload_len);
+}
+
+TEST_F(LoadGeneratorTest, BuildMessageIncludesTagAndText) {
+  const size_t len =
+      LoadGenerator::BuildMessage(kTag, 0, 0, 10, buf_.data());
+  const protocol::AsciiMessage ascii_message = GetAsciiMessage();
+  EXPECT_EQ(std::strlen(kTag), ascii_message.tag_len);
+  EXPECT_EQ(10U, ascii_message.data_len);
+  EXPECT_EQ(kHeadersLen + std::strlen(kTag) + 10, len);
+  EXPECT_EQ(kTag, std::string(reinterpret_cast<const char*>(
+                                  buf_.data() + kHeadersLen),
+                              std::strlen(kTag)));
+}
+
+TEST_F(LoadGeneratorTest, BuildMessageTextVariesWithSequenceNum) {
+  LoadGenerator::BuildMessage(kTag, 0, 0, 10, buf_.data());
+  const std::string first_text(
+      reinterpret_cast<const char*>(buf_.data() + kHeadersLen +
+                                    std::strlen(kTag)),
+      10);
+  LoadGenerator::BuildMessage(kTag, 1, 0, 10, buf_.data());
+  const std::string second_text(
+      reinterpret_cast<const char*>(buf_.data() + kHeadersLen +
+                                    std::strlen(kTag)),
+      10);
+  EXPECT_NE(first_text, second_text);
+}
+
+TEST_F(LoadGeneratorTest, BuildMessageTruncatesToMaxMessageSize) {
+  const size_t len = LoadGenerator::BuildMessage(
+      kTag, 0, 0, protocol::kMaxMessageSize, buf_.data());
+  EXPECT_EQ(protocol::kMaxMessageSize, len);
+  EXPECT_EQ(protocol::kMaxMessageSize - kHeadersLen - std::strlen(kTag),
+            GetAsciiMessage().data_len);
+}
+
+TEST(LoadGeneratorParseTest, ParseStatsResponseReadsStatsAndLatencies) {
+  const std::string response =
+      "# stats logged=1 evicted=2 missing=3 truncated=4 rejected=5"
+      " ring_dropped=6 enomem=7 eintr=8\n"
+      "# latency opcode=2 samples=1 p50_usec=1 p90_usec=1 p99_usec=1"
+      " max_usec=1\n";
+  protocol::Stats stats{};
+  std::string latency_summary;
+  ASSERT_TRUE(
+      LoadGenerator::ParseStatsResponse(response, &stats, &latency_summary));
+  EXPECT_EQ(1U, stats.n_messages_logged);
+  EXPECT_EQ(2U, stats.n_messages_evicted);
+  EXPECT_EQ(3U, stats.n_messages_missing);
+  EXPECT_EQ(4U, stats.n_datagrams_truncated);
+  EXPECT_EQ(5U, stats.n_commands_rejected);
+  EXPECT_EQ(6U, stats.n_ring_records_dropped);
+  EXPECT_EQ(7U, stats.n_receive_enomem_errors);
+  EXPECT_EQ(8U, stats.n_receive_eintr_errors);
+  EXPECT_EQ(
+      "# latency opcode=2 samples=1 p50_usec=1 p90_usec=1 p99_usec=1"
+      " max_usec=1\n",
+      latency_summary);
+}
+
+TEST(LoadGeneratorParseTest, ParseStatsResponseFailsWithoutStatsLine) {
+  protocol::Stats stats{};
+  std::string latency_summary;
+  EXPECT_FALSE(LoadGenerator::ParseStatsResponse("", &stats, &latency_summary));
+  EXPECT_FALSE(LoadGenerator::ParseStatsResponse("# stats logged=1\n", &stats,
+                                                 &latency_summary));
+}
+
+}  // namespace wifilogd
+}  // namespace android
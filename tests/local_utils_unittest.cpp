@@ -16,6 +16,7 @@
 
 #include <cstdint>
 #include <limits>
+#include <string>
 
 #include "android-base/stringprintf.h"
 #include "gtest/gtest.h"
@@ -27,6 +28,9 @@ namespace wifilogd {
 
 using local_utils::CastEnumToInteger;
 using local_utils::CopyFromBufferOrDie;
+using local_utils::FormatDecimal;
+using local_utils::FormatDecimal64;
+using local_utils::FormatZeroPaddedDecimal;
 using local_utils::GetMaxVal;
 using local_utils::IsAsciiPrintable;
 
@@ -57,6 +61,46 @@ TEST(LocalUtilsTest, CopyFromBufferOrDieCopiesData) {
   EXPECT_EQ(original.b, duplicate.b);
 }
 
+TEST(LocalUtilsTest, FormatDecimalWorksForMinimalAndMaximalValues) {
+  char buf[local_utils::kMaxFormattedDecimalLen];
+  EXPECT_EQ("0", std::string(buf, FormatDecimal(0, buf)));
+  EXPECT_EQ("4294967295",
+            std::string(buf, FormatDecimal(GetMaxVal<uint32_t>(), buf)));
+}
+
+TEST(LocalUtilsTest, FormatDecimalOmitsLeadingZeros) {
+  char buf[local_utils::kMaxFormattedDecimalLen];
+  EXPECT_EQ("7", std::string(buf, FormatDecimal(7, buf)));
+  EXPECT_EQ("10", std::string(buf, FormatDecimal(10, buf)));
+  EXPECT_EQ("1000000", std::string(buf, FormatDecimal(1000000, buf)));
+}
+
+TEST(LocalUtilsTest, FormatDecimal64WorksForMinimalAndMaximalValues) {
+  char buf[local_utils::kMaxFormattedDecimal64Len];
+  EXPECT_EQ("0", std::string(buf, FormatDecimal64(0, buf)));
+  EXPECT_EQ("18446744073709551615",
+            std::string(buf, FormatDecimal64(GetMaxVal<uint64_t>(), buf)));
+}
+
+TEST(LocalUtilsTest, FormatDecimal64OmitsLeadingZeros) {
+  char buf[local_utils::kMaxFormattedDecimal64Len];
+  EXPECT_EQ("7", std::string(buf, FormatDecimal64(7, buf)));
+  EXPECT_EQ("4294967296", std::string(buf, FormatDecimal64(1ULL << 32, buf)));
+}
+
+TEST(LocalUtilsTest, FormatZeroPaddedDecimalPadsToWidth) {
+  char buf[6];
+  EXPECT_EQ("000000", std::string(buf, FormatZeroPaddedDecimal(0, 6, buf)));
+  EXPECT_EQ("000042", std::string(buf, FormatZeroPaddedDecimal(42, 6, buf)));
+  EXPECT_EQ("999999",
+            std::string(buf, FormatZeroPaddedDecimal(999999, 6, buf)));
+}
+
+TEST(LocalUtilsTest, FormatZeroPaddedDecimalKeepsLowOrderDigitsOnOverflow) {
+  char buf[3];
+  EXPECT_EQ("345", std::string(buf, FormatZeroPaddedDecimal(12345, 3, buf)));
+}
+
 TEST(LocalUtilsTest, GetMaxValFromTypeIsCorrectForUnsignedTypes) {
   EXPECT_EQ(std::numeric_limits<uint8_t>::max(), GetMaxVal<uint8_t>());
   EXPECT_EQ(std::numeric_limits<uint16_t>::max(), GetMaxVal<uint16_t>());
@@ -0,0 +1,457 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/log_buffer.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+constexpr size_t kBufferSizeBytes = 64 * 1024;
+constexpr size_t kHeaderSizeBytes = MessageBuffer::GetHeaderSize();
+
+class LogBufferTest : public ::testing::Test {
+ public:
+  LogBufferTest()
+      : buffer_{kBufferSizeBytes, LogBuffer::Mode::kCompressed},
+        n_appended_(0) {}
+
+ protected:
+  // Appends |message| to |buffer|.
+  static void AppendMessage(const std::string& message, LogBuffer* buffer) {
+    uint8_t* const reserved = buffer->Reserve(message.size());
+    ASSERT_NE(nullptr, reserved);
+    std::memcpy(reserved, message.data(), message.size());
+    buffer->Commit(message.size());
+  }
+
+  // Returns a message resembling a line of Wi-Fi logs, which differs from
+  // the messages before and after it.
+  std::string MakeLogLikeMessage() {
+    char message[128];
+    std::snprintf(message, sizeof(message),
+                  "wlan0: CTRL-EVENT-SIGNAL-CHANGE above=1 signal=-%zu "
+                  "noise=9999 txrate=%zu seq=%zu",
+                  40 + n_appended_ % 50, 6500 + n_appended_ % 7 * 100,
+                  n_appended_);
+    ++n_appended_;
+    return message;
+  }
+
+  // Appends log-like messages to |buffer_| until |n_messages| have been
+  // appended over the life of the test. Returns the appended messages.
+  std::vector<std::string> AppendLogLikeMessages(size_t n_messages) {
+    std::vector<std::string> messages;
+    while (n_appended_ < n_messages) {
+      messages.push_back(MakeLogLikeMessage());
+      AppendMessage(messages.back(), &buffer_);
+    }
+    return messages;
+  }
+
+  // Returns the remaining messages in |buffer|.
+  static std::vector<std::string> ConsumeAllMessages(LogBuffer* buffer) {
+    std::vector<std::string> messages;
+    while (true) {
+      const uint8_t* start;
+      size_t len;
+      std::tie(start, len) = buffer->ConsumeNextMessage();
+      if (!start) {
+        return messages;
+      }
+      messages.emplace_back(reinterpret_cast<const char*>(start), len);
+    }
+  }
+
+  // Returns the remaining messages in |buffer|, read with
+  // ConsumeNextMessages(), in batches of up to |batch_size| messages. Each
+  // batch is copied out before the next is read.
+  static std::vector<std::string> ConsumeAllMessagesInBatches(
+      LogBuffer* buffer, size_t batch_size) {
+    std::vector<std::string> messages;
+    std::vector<std::tuple<const uint8_t*, size_t>> batch(batch_size);
+    while (true) {
+      const size_t n_messages =
+          buffer->ConsumeNextMessages(batch.data(), batch.size());
+      EXPECT_LE(n_messages, batch_size);
+      if (!n_messages) {
+        return messages;
+      }
+      for (size_t i = 0; i < n_messages; ++i) {
+        messages.emplace_back(
+            reinterpret_cast<const char*>(std::get<0>(batch[i])),
+            std::get<1>(batch[i]));
+      }
+    }
+  }
+
+  LogBuffer buffer_;
+  size_t n_appended_;
+};
+
+}  // namespace
+
+TEST_F(LogBufferTest, UncompressedBufferReturnsMessagesInOrder) {
+  LogBuffer buffer(kBufferSizeBytes, LogBuffer::Mode::kUncompressed);
+  const std::vector<std::string> messages{"first", "second", "third"};
+  for (const auto& message : messages) {
+    AppendMessage(message, &buffer);
+  }
+  EXPECT_EQ(messages, ConsumeAllMessages(&buffer));
+  EXPECT_EQ(buffer.GetUsedSize(), buffer.GetUncompressedSize());
+}
+
+TEST_F(LogBufferTest, AlignedBufferReturnsMessagesInOrder) {
+  LogBuffer buffer(kBufferSizeBytes, LogBuffer::Mode::kAligned);
+  const std::vector<std::string> messages{"first", "second", "third"};
+  for (const auto& message : messages) {
+    AppendMessage(message, &buffer);
+  }
+  EXPECT_EQ(messages, ConsumeAllMessages(&buffer));
+  EXPECT_EQ(buffer.GetUsedSize(), buffer.GetUncompressedSize());
+}
+
+TEST_F(LogBufferTest, AlignedBufferAlignsMessages) {
+  LogBuffer buffer(kBufferSizeBytes, LogBuffer::Mode::kAligned);
+  for (const std::string message : {"a", "bcd", "efghijklm"}) {
+    AppendMessage(message, &buffer);
+  }
+  while (true) {
+    const uint8_t* const message = std::get<0>(buffer.ConsumeNextMessage());
+    if (!message) {
+      break;
+    }
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(message) %
+                      MessageBuffer::kRecordAlignment);
+  }
+}
+
+TEST_F(LogBufferTest, ConsumeNextMessagesReturnsEveryMessageInEachMode) {
+  // Enough messages to seal several blocks, but not to evict any.
+  const auto& messages = AppendLogLikeMessages(500);
+  LogBuffer uncompressed_buffer(kBufferSizeBytes,
+                                LogBuffer::Mode::kUncompressed);
+  LogBuffer aligned_buffer(kBufferSizeBytes, LogBuffer::Mode::kAligned);
+  for (const auto& message : messages) {
+    AppendMessage(message, &uncompressed_buffer);
+    AppendMessage(message, &aligned_buffer);
+  }
+  ASSERT_EQ(0U, buffer_.GetNumEvicted());
+  ASSERT_EQ(0U, uncompressed_buffer.GetNumEvicted());
+  ASSERT_EQ(0U, aligned_buffer.GetNumEvicted());
+
+  for (LogBuffer* buffer : {&buffer_, &uncompressed_buffer, &aligned_buffer}) {
+    for (size_t batch_size : {1U, 16U, 1000U}) {
+      EXPECT_EQ(messages, ConsumeAllMessagesInBatches(buffer, batch_size));
+      buffer->Rewind();
+    }
+  }
+}
+
+TEST_F(LogBufferTest, ConsumeNextMessagesStopsAtEndOfSealedBlock) {
+  const auto& messages = AppendLogLikeMessages(500);
+  std::vector<std::tuple<const uint8_t*, size_t>> batch(messages.size());
+  const size_t n_messages =
+      buffer_.ConsumeNextMessages(batch.data(), batch.size());
+  // The first block is full, so holds more than one message, but not all
+  // of them.
+  EXPECT_LT(1U, n_messages);
+  EXPECT_GT(messages.size(), n_messages);
+  for (size_t i = 0; i < n_messages; ++i) {
+    EXPECT_EQ(messages[i],
+              std::string(reinterpret_cast<const char*>(std::get<0>(batch[i])),
+                          std::get<1>(batch[i])));
+  }
+}
+
+TEST_F(LogBufferTest, ConsumeNextMessagesReturnsZeroOnFreshBuffer) {
+  std::tuple<const uint8_t*, size_t> message;
+  EXPECT_EQ(0U, buffer_.ConsumeNextMessages(&message, 1));
+}
+
+TEST_F(LogBufferTest, ConsumeNextMessageReturnsNullOnFreshBuffer) {
+  EXPECT_EQ(std::make_tuple(nullptr, 0), buffer_.ConsumeNextMessage());
+}
+
+TEST_F(LogBufferTest, ConsumeNextMessageReturnsMessagesFromActiveBlock) {
+  const auto& messages = AppendLogLikeMessages(3);
+  EXPECT_EQ(messages, ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, ConsumeNextMessageReturnsMessagesFromSealedBlocks) {
+  // Enough messages to seal several blocks, but not to evict any.
+  const auto& messages = AppendLogLikeMessages(500);
+  ASSERT_EQ(0U, buffer_.GetNumEvicted());
+  ASSERT_LT(buffer_.GetUsedSize(), buffer_.GetUncompressedSize());
+  EXPECT_EQ(messages, ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, ConsumeNextMessageReturnsIncompressibleMessages) {
+  std::mt19937 rng(1);
+  std::vector<std::string> messages;
+  for (size_t i = 0; i < 20; ++i) {
+    std::string message(1000, '\0');
+    for (auto& c : message) {
+      c = static_cast<char>(rng());
+    }
+    messages.push_back(message);
+    AppendMessage(message, &buffer_);
+  }
+  EXPECT_EQ(messages, ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, ConsumeNextMessageSkipsEvictedMessages) {
+  AppendLogLikeMessages(10000);
+  ASSERT_GT(buffer_.GetNumEvicted(), 0U);
+  const auto& messages = ConsumeAllMessages(&buffer_);
+  ASSERT_FALSE(messages.empty());
+  EXPECT_EQ(10000 - buffer_.GetNumEvicted(), messages.size());
+  EXPECT_NE(std::string::npos, messages.back().find("seq=9999"));
+}
+
+TEST_F(LogBufferTest, AppendDuringReadOfActiveBlockDoesNotRepeatMessages) {
+  const auto& first_messages = AppendLogLikeMessages(2);
+  ASSERT_EQ(first_messages[0].size(),
+            std::get<1>(buffer_.ConsumeNextMessage()));
+
+  // Seal the block that we are reading.
+  const auto& later_messages = AppendLogLikeMessages(200);
+  std::vector<std::string> expected{first_messages[1]};
+  expected.insert(expected.end(), later_messages.begin(),
+                  later_messages.end());
+  EXPECT_EQ(expected, ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, AppendDuringReadOfSealedBlockDoesNotRepeatMessages) {
+  const auto& first_messages = AppendLogLikeMessages(200);
+  ASSERT_EQ(first_messages[0].size(),
+            std::get<1>(buffer_.ConsumeNextMessage()));
+
+  // Seal a block, which reuses the block that holds the message we read.
+  const auto& later_messages = AppendLogLikeMessages(400);
+  ASSERT_EQ(0U, buffer_.GetNumEvicted());
+  std::vector<std::string> expected(first_messages.begin() + 1,
+                                    first_messages.end());
+  expected.insert(expected.end(), later_messages.begin(),
+                  later_messages.end());
+  EXPECT_EQ(expected, ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, RewindReturnsToOldestMessage) {
+  const auto& messages = AppendLogLikeMessages(500);
+  ASSERT_EQ(messages, ConsumeAllMessages(&buffer_));
+  buffer_.Rewind();
+  EXPECT_EQ(messages, ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, CompressedBufferHoldsMoreMessagesThanUncompressed) {
+  LogBuffer uncompressed(kBufferSizeBytes, LogBuffer::Mode::kUncompressed);
+  constexpr size_t kNumMessages = 20000;
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    const std::string message = MakeLogLikeMessage();
+    AppendMessage(message, &buffer_);
+    AppendMessage(message, &uncompressed);
+  }
+  const size_t n_retained_uncompressed =
+      kNumMessages - uncompressed.GetNumEvicted();
+  const size_t n_retained_compressed = kNumMessages - buffer_.GetNumEvicted();
+  EXPECT_GT(n_retained_compressed, 3 * n_retained_uncompressed);
+}
+
+TEST_F(LogBufferTest, EvictionHandlerSeesEveryMessageEvictedByAppend) {
+  std::vector<std::string> evicted;
+  buffer_.SetEvictionHandler([&evicted](const uint8_t* message, size_t len) {
+    evicted.emplace_back(reinterpret_cast<const char*>(message), len);
+  });
+  const auto& messages = AppendLogLikeMessages(10000);
+  ASSERT_GT(buffer_.GetNumEvicted(), 0U);
+  ASSERT_EQ(buffer_.GetNumEvicted(), evicted.size());
+  EXPECT_TRUE(std::equal(evicted.begin(), evicted.end(), messages.begin()));
+}
+
+TEST_F(LogBufferTest, ShrinkToZeroEmptiesBuffer) {
+  size_t n_evicted = 0;
+  buffer_.SetEvictionHandler(
+      [&n_evicted](const uint8_t*, size_t) { ++n_evicted; });
+  AppendLogLikeMessages(500);
+  buffer_.Shrink(0);
+  EXPECT_EQ(0U, buffer_.GetUsedSize());
+  EXPECT_EQ(0U, buffer_.GetUncompressedSize());
+  EXPECT_EQ(500U, buffer_.GetNumEvicted());
+  EXPECT_EQ(500U, n_evicted);
+  EXPECT_EQ(std::make_tuple(nullptr, 0), buffer_.ConsumeNextMessage());
+}
+
+TEST_F(LogBufferTest, ShrinkEvictsOldestMessages) {
+  const auto& messages = AppendLogLikeMessages(500);
+  buffer_.Shrink(buffer_.GetUsedSize() / 2);
+  const auto& retained = ConsumeAllMessages(&buffer_);
+  ASSERT_FALSE(retained.empty());
+  ASSERT_EQ(500 - buffer_.GetNumEvicted(), retained.size());
+  EXPECT_TRUE(std::equal(retained.begin(), retained.end(),
+                         messages.begin() + buffer_.GetNumEvicted()));
+}
+
+TEST_F(LogBufferTest, ShrinkCanEvictPartOfActiveBlock) {
+  const auto& messages = AppendLogLikeMessages(3);
+  buffer_.Shrink(buffer_.GetUsedSize() - 1);
+  EXPECT_EQ(1U, buffer_.GetNumEvicted());
+  EXPECT_EQ(std::vector<std::string>(messages.begin() + 1, messages.end()),
+            ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, GetLastMessageReturnsNullOnFreshBuffer) {
+  EXPECT_EQ(nullptr, std::get<0>(buffer_.GetLastMessage()));
+}
+
+TEST_F(LogBufferTest, GetLastMessageReturnsNewestMessage) {
+  LogBuffer uncompressed_buffer(kBufferSizeBytes,
+                                LogBuffer::Mode::kUncompressed);
+  // Enough messages to seal several blocks.
+  std::string last_message;
+  for (size_t i = 0; i < 500; ++i) {
+    last_message = MakeLogLikeMessage();
+    AppendMessage(last_message, &buffer_);
+    AppendMessage(last_message, &uncompressed_buffer);
+  }
+  for (LogBuffer* buffer : {&buffer_, &uncompressed_buffer}) {
+    uint8_t* start;
+    size_t len;
+    std::tie(start, len) = buffer->GetLastMessage();
+    ASSERT_NE(nullptr, start);
+    EXPECT_EQ(last_message, std::string(reinterpret_cast<char*>(start), len));
+  }
+}
+
+TEST_F(LogBufferTest, GetLastMessageCanBeModifiedInPlace) {
+  AppendMessage("first", &buffer_);
+  AppendMessage("second", &buffer_);
+  uint8_t* const start = std::get<0>(buffer_.GetLastMessage());
+  ASSERT_NE(nullptr, start);
+  start[0] = 'S';
+  EXPECT_EQ((std::vector<std::string>{"first", "Second"}),
+            ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, GetLastMessageFollowsShrinkOfActiveBlock) {
+  const auto& messages = AppendLogLikeMessages(3);
+  buffer_.Shrink(buffer_.GetUsedSize() - 1);
+  uint8_t* start;
+  size_t len;
+  std::tie(start, len) = buffer_.GetLastMessage();
+  ASSERT_NE(nullptr, start);
+  EXPECT_EQ(messages.back(), std::string(reinterpret_cast<char*>(start), len));
+
+  buffer_.Shrink(0);
+  EXPECT_EQ(nullptr, std::get<0>(buffer_.GetLastMessage()));
+}
+
+TEST_F(LogBufferTest, GetNumAppendedCountsEvictedMessages) {
+  LogBuffer uncompressed_buffer(kBufferSizeBytes,
+                                LogBuffer::Mode::kUncompressed);
+  EXPECT_EQ(0U, buffer_.GetNumAppended());
+  for (size_t i = 0; i < 10000; ++i) {
+    const std::string& message = MakeLogLikeMessage();
+    AppendMessage(message, &buffer_);
+    AppendMessage(message, &uncompressed_buffer);
+  }
+  for (LogBuffer* buffer : {&buffer_, &uncompressed_buffer}) {
+    ASSERT_GT(buffer->GetNumEvicted(), 0U);
+    EXPECT_EQ(10000U, buffer->GetNumAppended());
+    EXPECT_EQ(10000 - buffer->GetNumEvicted(),
+              ConsumeAllMessages(buffer).size());
+  }
+}
+
+TEST_F(LogBufferTest, SkipMessagesSkipsToTheGivenMessage) {
+  LogBuffer uncompressed_buffer(kBufferSizeBytes,
+                                LogBuffer::Mode::kUncompressed);
+  // Enough messages to seal several blocks, but not to evict any.
+  constexpr size_t kNumMessages = 300;
+  std::vector<std::string> messages;
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    messages.push_back(MakeLogLikeMessage());
+    AppendMessage(messages.back(), &buffer_);
+    AppendMessage(messages.back(), &uncompressed_buffer);
+  }
+  ASSERT_EQ(0U, buffer_.GetNumEvicted());
+  ASSERT_EQ(0U, uncompressed_buffer.GetNumEvicted());
+
+  for (LogBuffer* buffer : {&buffer_, &uncompressed_buffer}) {
+    for (size_t n_to_skip : {0U, 1U, 57U, 200U, 299U, 300U}) {
+      EXPECT_EQ(n_to_skip, buffer->SkipMessages(n_to_skip));
+      EXPECT_EQ(std::vector<std::string>(messages.begin() + n_to_skip,
+                                         messages.end()),
+                ConsumeAllMessages(buffer));
+      buffer->Rewind();
+    }
+  }
+}
+
+TEST_F(LogBufferTest, SkipMessagesStopsAtNewestMessage) {
+  const auto& messages = AppendLogLikeMessages(150);
+  EXPECT_EQ(messages.size(), buffer_.SkipMessages(messages.size() + 1));
+  EXPECT_EQ(nullptr, std::get<0>(buffer_.ConsumeNextMessage()));
+}
+
+TEST_F(LogBufferTest, SkipMessagesContinuesPartialRead) {
+  const auto& messages = AppendLogLikeMessages(150);
+  buffer_.ConsumeNextMessage();
+  EXPECT_EQ(100U, buffer_.SkipMessages(100));
+  EXPECT_EQ(std::vector<std::string>(messages.begin() + 101, messages.end()),
+            ConsumeAllMessages(&buffer_));
+}
+
+TEST_F(LogBufferTest, GetUncompressedSizeCountsHeaders) {
+  AppendMessage("hello", &buffer_);
+  EXPECT_EQ(kHeaderSizeBytes + 5, buffer_.GetUncompressedSize());
+  EXPECT_EQ(kHeaderSizeBytes + 5, buffer_.GetUsedSize());
+}
+
+TEST_F(LogBufferTest, CanFitEverIsLimitedByBlockSize) {
+  EXPECT_TRUE(
+      buffer_.CanFitEver(LogBuffer::kBlockSizeBytes - kHeaderSizeBytes));
+  EXPECT_FALSE(
+      buffer_.CanFitEver(LogBuffer::kBlockSizeBytes - kHeaderSizeBytes + 1));
+}
+
+// Per
+// github.com/google/googletest/blob/master/googletest/docs/AdvancedGuide.md#death-tests,
+// death tests should be specially named.
+using LogBufferDeathTest = LogBufferTest;
+
+TEST_F(LogBufferDeathTest, ConstructingTooSmallCompressedBufferCausesDeath) {
+  EXPECT_DEATH(LogBuffer(LogBuffer::GetMinCompressedSize() - 1,
+                         LogBuffer::Mode::kCompressed),
+               "Check failed");
+}
+
+TEST_F(LogBufferDeathTest, ReserveZeroBytesCausesDeath) {
+  EXPECT_DEATH(buffer_.Reserve(0), "Check failed");
+}
+
+}  // namespace wifilogd
+}  // namespace android
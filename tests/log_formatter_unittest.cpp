@@ -0,0 +1,456 @@
+/*
+ * Copyright (C) 2016, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstddef>
+#include <cstring>
+#include <limits>
+#include <string>
+#include <type_traits>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/byte_buffer.h"
+#include "wifilogd/latency_histogram.h"
+#include "wifilogd/local_utils.h"
+#include "wifilogd/profiler.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/structured_formats.h"
+#include "wifilogd/structured_message_writer.h"
+#include "wifilogd/timestamp_header.h"
+
+#include "wifilogd/log_formatter.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using local_utils::GetMaxVal;
+
+constexpr size_t kBufferSizeBytes = log_formatter::kMaxRecordLen;
+using RecordBuffer = ByteBuffer<kBufferSizeBytes>;
+
+const auto kTimestampHeader =
+    TimestampHeader()
+        .set_since_boot_awake_only(Os::Timestamp{0, 999})
+        .set_since_boot_with_sleep(Os::Timestamp{1, 1000})
+        .set_since_epoch(Os::Timestamp{123456, 123456000});
+constexpr char kFormattedTimestamps[] = "0.000000 1.000001 123456.123456";
+
+std::string FormatRecord(const RecordBuffer& record) {
+  std::string out(log_formatter::kMaxFormattedRecordLen, '\0');
+  const char* const end = log_formatter::FormatRecord(
+      MemoryReader(record.data(), record.size()), &out.front());
+  out.resize(end - out.data());
+  return out;
+}
+
+using protocol::StructuredArgType;
+using structured_formats::FormatId;
+
+constexpr char kTag[] = "tag";
+constexpr uint8_t kMacAddress[protocol::kMacAddressLen] = {0x00, 0x11, 0x22,
+                                                          0xaa, 0xbb, 0xcc};
+
+// Formats the StructuredMessage which follows the Command in |writer|.
+std::string FormatStructuredMessage(const StructuredMessageWriter& writer) {
+  std::string out(log_formatter::kMaxFormattedStructuredMessageLen, '\0');
+  const char* const end = log_formatter::FormatStructuredMessage(
+      MemoryReader(writer.data() + sizeof(protocol::Command),
+                   writer.size() - sizeof(protocol::Command)),
+      &out.front());
+  out.resize(end - out.data());
+  return out;
+}
+
+// As above, but for a StructuredMessage with |format_id| and |tag|,
+// followed by |args|.
+std::string FormatStructuredMessage(uint16_t format_id,
+                                    const std::string& args) {
+  const auto structured_message_header =
+      protocol::StructuredMessage()
+          .set_format_id(format_id)
+          .set_tag_len(sizeof(kTag) - 1);
+  const auto message =
+      RecordBuffer()
+          .AppendOrDie(&structured_message_header,
+                       sizeof(structured_message_header))
+          .AppendOrDie(kTag, sizeof(kTag) - 1)
+          .AppendOrDie(args.data(), args.size());
+  std::string out(log_formatter::kMaxFormattedStructuredMessageLen, '\0');
+  const char* const end = log_formatter::FormatStructuredMessage(
+      MemoryReader(message.data(), message.size()), &out.front());
+  out.resize(end - out.data());
+  return out;
+}
+
+// Returns |type|, followed by the bytes of |value|, as a string.
+template <typename T>
+std::string MakeArg(StructuredArgType type, T value) {
+  std::string arg(1, static_cast<char>(type));
+  arg.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  return arg;
+}
+
+}  // namespace
+
+// The TimestampHeader is part of the binary dump format. So, like the
+// protocol tests, this test aims to provide friction against changes
+// that break byte-stream compatibility.
+TEST(LogFormatterTest, TimestampHeaderLayoutIsUnchanged) {
+  ASSERT_TRUE(std::is_standard_layout<TimestampHeader>::value);
+  EXPECT_EQ(0U, offsetof(TimestampHeader, since_boot_awake_only));
+  EXPECT_EQ(8U, offsetof(TimestampHeader, since_boot_with_sleep));
+  EXPECT_EQ(16U, offsetof(TimestampHeader, since_epoch));
+  EXPECT_EQ(24U, sizeof(TimestampHeader));
+}
+
+TEST(LogFormatterTest, FormatTimestampsWorksForMaximalTimestamps) {
+  constexpr Os::Timestamp kMaxTimestamp{GetMaxVal<uint32_t>(), 999999999};
+  const auto tstamp_header = TimestampHeader()
+                                 .set_since_boot_awake_only(kMaxTimestamp)
+                                 .set_since_boot_with_sleep(kMaxTimestamp)
+                                 .set_since_epoch(kMaxTimestamp);
+  std::string out(log_formatter::kMaxFormattedTimestampsLen, '\0');
+  EXPECT_EQ(&out.front() + out.size(),
+            log_formatter::FormatTimestamps(tstamp_header, &out.front()));
+  EXPECT_EQ("4294967295.999999 4294967295.999999 4294967295.999999", out);
+}
+
+TEST(LogFormatterTest, FormatRecordWorksForAsciiMessage) {
+  const std::string tag("tag");
+  const std::string message("message");
+  const auto ascii_message_header = protocol::AsciiMessage()
+                                        .set_tag_len(tag.size())
+                                        .set_data_len(message.size());
+  const auto command =
+      protocol::Command()
+          .set_opcode(protocol::Opcode::kWriteAsciiMessage)
+          .set_payload_len(sizeof(ascii_message_header) + tag.size() +
+                           message.size());
+  const auto record =
+      RecordBuffer()
+          .AppendOrDie(&kTimestampHeader, sizeof(kTimestampHeader))
+          .AppendOrDie(&command, sizeof(command))
+          .AppendOrDie(&ascii_message_header, sizeof(ascii_message_header))
+          .AppendOrDie(tag.data(), tag.size())
+          .AppendOrDie(message.data(), message.size());
+  EXPECT_EQ(std::string(kFormattedTimestamps) + " tag message\n",
+            FormatRecord(record));
+}
+
+TEST(LogFormatterTest, FormatRecordHandlesRecordTooShortForTimestamps) {
+  const auto record = RecordBuffer().AppendOrDie(&kTimestampHeader,
+                                                 sizeof(kTimestampHeader) - 1);
+  EXPECT_EQ("[truncated-record]\n", FormatRecord(record));
+}
+
+TEST(LogFormatterTest, FormatRecordHandlesRecordTooShortForCommand) {
+  const auto command = protocol::Command();
+  const auto record =
+      RecordBuffer()
+          .AppendOrDie(&kTimestampHeader, sizeof(kTimestampHeader))
+          .AppendOrDie(&command, sizeof(command) - 1);
+  EXPECT_EQ(std::string(kFormattedTimestamps) + " [truncated-record]\n",
+            FormatRecord(record));
+}
+
+TEST(LogFormatterTest, FormatRecordHandlesUnsupportedOpcode) {
+  const auto command =
+      protocol::Command().set_opcode(protocol::Opcode::kDumpBuffers);
+  const auto record =
+      RecordBuffer()
+          .AppendOrDie(&kTimestampHeader, sizeof(kTimestampHeader))
+          .AppendOrDie(&command, sizeof(command));
+  EXPECT_EQ(std::string(kFormattedTimestamps) + " [unsupported-opcode]\n",
+            FormatRecord(record));
+}
+
+TEST(LogFormatterTest, FormatRecordWorksForStructuredMessage) {
+  const std::string ssid("home");
+  StructuredMessageWriter writer(FormatId::kConnected, kTag, sizeof(kTag) - 1,
+                                 protocol::MessageSeverity::kInformational);
+  writer.AddBytes(ssid.data(), ssid.size())
+      .AddMacAddress(kMacAddress)
+      .AddUint32(2412);
+  const auto record =
+      RecordBuffer()
+          .AppendOrDie(&kTimestampHeader, sizeof(kTimestampHeader))
+          .AppendOrDie(writer.data(), writer.size());
+  EXPECT_EQ(std::string(kFormattedTimestamps) +
+                " tag connected ssid=home bssid=00:11:22:aa:bb:cc"
+                " freq_mhz=2412\n",
+            FormatRecord(record));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageFormatsEveryArgType) {
+  const std::string ssid("home");
+  StructuredMessageWriter writer(FormatId::kScanStarted, kTag,
+                                 sizeof(kTag) - 1,
+                                 protocol::MessageSeverity::kInformational);
+  writer.AddInt32(std::numeric_limits<int32_t>::min())
+      .AddInt32(-5)
+      .AddUint32(GetMaxVal<uint32_t>())
+      .AddInt64(std::numeric_limits<int64_t>::min())
+      .AddUint64(GetMaxVal<uint64_t>())
+      .AddMacAddress(kMacAddress)
+      .AddBytes(ssid.data(), ssid.size());
+  EXPECT_EQ(
+      "tag scan started n_freqs=-2147483648 -5 4294967295"
+      " -9223372036854775808 18446744073709551615 00:11:22:aa:bb:cc home",
+      FormatStructuredMessage(writer));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageLeavesPlaceholderForMissingArg) {
+  StructuredMessageWriter writer(FormatId::kDisconnected, kTag,
+                                 sizeof(kTag) - 1,
+                                 protocol::MessageSeverity::kInformational);
+  writer.AddMacAddress(kMacAddress);
+  EXPECT_EQ("tag disconnected bssid=00:11:22:aa:bb:cc reason={}"
+            " locally_generated={}",
+            FormatStructuredMessage(writer));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageSanitizesBytes) {
+  const std::string ssid("a\x01" "b");
+  StructuredMessageWriter writer(FormatId::kConnected, kTag, sizeof(kTag) - 1,
+                                 protocol::MessageSeverity::kInformational);
+  writer.AddBytes(ssid.data(), ssid.size());
+  EXPECT_EQ("tag connected ssid=a?b bssid={} freq_mhz={}",
+            FormatStructuredMessage(writer));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageHandlesUnknownFormat) {
+  EXPECT_EQ("tag [unknown-format=65535] 1 2",
+            FormatStructuredMessage(
+                GetMaxVal<uint16_t>(),
+                MakeArg(StructuredArgType::kUint32, uint32_t{1}) +
+                    MakeArg(StructuredArgType::kUint32, uint32_t{2})));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageHandlesTruncatedArg) {
+  const std::string arg = MakeArg(StructuredArgType::kUint32, uint32_t{1});
+  EXPECT_EQ("tag scan started n_freqs={}[malformed-arg]",
+            FormatStructuredMessage(
+                local_utils::CastEnumToInteger(FormatId::kScanStarted),
+                arg.substr(0, arg.size() - 1)));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageHandlesTruncatedBytes) {
+  std::string arg(1, static_cast<char>(StructuredArgType::kBytes));
+  arg += '\x05';
+  arg += "abcd";
+  EXPECT_EQ("tag scan started n_freqs={}[malformed-arg]",
+            FormatStructuredMessage(
+                local_utils::CastEnumToInteger(FormatId::kScanStarted), arg));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageHandlesUnknownArgType) {
+  EXPECT_EQ("tag scan started n_freqs=1 [malformed-arg]",
+            FormatStructuredMessage(
+                local_utils::CastEnumToInteger(FormatId::kScanStarted),
+                MakeArg(StructuredArgType::kUint32, uint32_t{1}) +
+                    MakeArg(static_cast<StructuredArgType>(0xff),
+                            uint32_t{2})));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageHandlesTooManyArgs) {
+  std::string args;
+  std::string expected("tag scan started n_freqs=0");
+  for (uint32_t i = 0; i < protocol::kMaxStructuredArgs + 1; ++i) {
+    args += MakeArg(StructuredArgType::kUint32, i);
+    if (i && i < protocol::kMaxStructuredArgs) {
+      expected += " " + std::to_string(i);
+    }
+  }
+  expected += "[too-many-args]";
+  EXPECT_EQ(expected,
+            FormatStructuredMessage(
+                local_utils::CastEnumToInteger(FormatId::kScanStarted), args));
+}
+
+TEST(LogFormatterTest, FormatStructuredMessageHandlesShortHeader) {
+  const auto structured_message_header = protocol::StructuredMessage();
+  std::string out(log_formatter::kMaxFormattedStructuredMessageLen, '\0');
+  const char* const end = log_formatter::FormatStructuredMessage(
+      MemoryReader(&structured_message_header,
+                   sizeof(structured_message_header) - 1),
+      &out.front());
+  out.resize(end - out.data());
+  EXPECT_EQ("[truncated-header]", out);
+}
+
+TEST(LogFormatterTest, FormatRecordWorksForRepeatedMessage) {
+  const auto repeated_message_header =
+      protocol::RepeatedMessage().set_n_repeats(42).set_tag_len(
+          sizeof(kTag) - 1);
+  const auto command =
+      protocol::Command()
+          .set_opcode(protocol::Opcode::kRepeatedMessage)
+          .set_payload_len(sizeof(repeated_message_header) + sizeof(kTag) -
+                           1);
+  const auto record =
+      RecordBuffer()
+          .AppendOrDie(&kTimestampHeader, sizeof(kTimestampHeader))
+          .AppendOrDie(&command, sizeof(command))
+          .AppendOrDie(&repeated_message_header,
+                       sizeof(repeated_message_header))
+          .AppendOrDie(kTag, sizeof(kTag) - 1);
+  EXPECT_EQ(std::string(kFormattedTimestamps) +
+                " tag last message repeated 42 times\n",
+            FormatRecord(record));
+}
+
+TEST(LogFormatterTest, FormatRepeatedMessageHandlesMaximalRepeats) {
+  const auto repeated_message_header =
+      protocol::RepeatedMessage()
+          .set_n_repeats(GetMaxVal<uint32_t>())
+          .set_tag_len(sizeof(kTag) - 1);
+  const auto message = RecordBuffer()
+                           .AppendOrDie(&repeated_message_header,
+                                        sizeof(repeated_message_header))
+                           .AppendOrDie(kTag, sizeof(kTag) - 1);
+  std::string out(log_formatter::kMaxFormattedAsciiMessageLen, '\0');
+  const char* const end = log_formatter::FormatRepeatedMessage(
+      MemoryReader(message.data(), message.size()), &out.front());
+  out.resize(end - out.data());
+  EXPECT_EQ("tag last message repeated 4294967295 times", out);
+}
+
+TEST(LogFormatterTest, FormatRepeatedMessageHandlesTruncatedTag) {
+  const auto repeated_message_header =
+      protocol::RepeatedMessage().set_n_repeats(2).set_tag_len(
+          sizeof(kTag));
+  const auto message = RecordBuffer()
+                           .AppendOrDie(&repeated_message_header,
+                                        sizeof(repeated_message_header))
+                           .AppendOrDie(kTag, sizeof(kTag) - 1);
+  std::string out(log_formatter::kMaxFormattedAsciiMessageLen, '\0');
+  const char* const end = log_formatter::FormatRepeatedMessage(
+      MemoryReader(message.data(), message.size()), &out.front());
+  out.resize(end - out.data());
+  EXPECT_EQ("tag[buffer-overrun] last message repeated 2 times", out);
+}
+
+TEST(LogFormatterTest, FormatRepeatedMessageHandlesShortHeader) {
+  const auto repeated_message_header = protocol::RepeatedMessage();
+  std::string out(log_formatter::kMaxFormattedAsciiMessageLen, '\0');
+  const char* const end = log_formatter::FormatRepeatedMessage(
+      MemoryReader(&repeated_message_header,
+                   sizeof(repeated_message_header) - 1),
+      &out.front());
+  out.resize(end - out.data());
+  EXPECT_EQ("[truncated-header]", out);
+}
+
+TEST(LogFormatterTest, FormatStatsFormatsEveryCounter) {
+  protocol::Stats stats{};
+  stats.n_messages_logged = 1;
+  stats.n_messages_evicted = 2;
+  stats.n_messages_missing = 3;
+  stats.n_datagrams_truncated = 4;
+  stats.n_commands_rejected = 5;
+  stats.n_ring_records_dropped = 6;
+  stats.n_receive_enomem_errors = 7;
+  stats.n_receive_eintr_errors = 8;
+  std::string out(log_formatter::kMaxFormattedStatsLen, '\0');
+  out.resize(log_formatter::FormatStats(stats, &out.front()) - out.data());
+  EXPECT_EQ(
+      "# stats logged=1 evicted=2 missing=3 truncated=4 rejected=5 "
+      "ring_dropped=6 enomem=7 eintr=8\n",
+      out);
+}
+
+TEST(LogFormatterTest, FormatStatsHandlesMaximalCounters) {
+  protocol::Stats stats;
+  std::memset(&stats, 0xff, sizeof(stats));
+  std::string out(log_formatter::kMaxFormattedStatsLen, '\0');
+  const char* const end = log_formatter::FormatStats(stats, &out.front());
+  EXPECT_LE(end - out.data(),
+            static_cast<ptrdiff_t>(log_formatter::kMaxFormattedStatsLen));
+  EXPECT_EQ('\n', end[-1]);
+}
+
+TEST(LogFormatterTest, FormatCursorFormatsPosition) {
+  std::string out(log_formatter::kMaxFormattedCursorLen, '\0');
+  out.resize(log_formatter::FormatCursor(3, 12, 4, &out.front()) -
+             out.data());
+  EXPECT_EQ("# cursor buffer=3 next=12 missed=4\n", out);
+}
+
+TEST(LogFormatterTest, FormatCursorHandlesMaximalPosition) {
+  std::string out(log_formatter::kMaxFormattedCursorLen, '\0');
+  const char* const end = log_formatter::FormatCursor(
+      GetMaxVal<size_t>(), GetMaxVal<uint64_t>(), GetMaxVal<uint64_t>(),
+      &out.front());
+  EXPECT_LE(end - out.data(),
+            static_cast<ptrdiff_t>(log_formatter::kMaxFormattedCursorLen));
+  EXPECT_EQ('\n', end[-1]);
+}
+
+TEST(LogFormatterTest, FormatLatencyFormatsSummary) {
+  LatencyHistogram histogram;
+  histogram.Record(3000);
+  histogram.Record(500000);
+  std::string out(log_formatter::kMaxFormattedLatencyLen, '\0');
+  out.resize(log_formatter::FormatLatency(protocol::Opcode::kDumpBuffers,
+                                          histogram, &out.front()) -
+             out.data());
+  EXPECT_EQ(
+      "# latency opcode=32 samples=2 p50_usec=4 p90_usec=500 p99_usec=500 "
+      "max_usec=500\n",
+      out);
+}
+
+TEST(LogFormatterTest, FormatLatencyHandlesMaximalLatencies) {
+  LatencyHistogram histogram;
+  histogram.Record(GetMaxVal<uint64_t>());
+  std::string out(log_formatter::kMaxFormattedLatencyLen, '\0');
+  const char* const end = log_formatter::FormatLatency(
+      static_cast<protocol::Opcode>(GetMaxVal<uint16_t>()), histogram,
+      &out.front());
+  EXPECT_LE(end - out.data(),
+            static_cast<ptrdiff_t>(log_formatter::kMaxFormattedLatencyLen));
+  EXPECT_EQ('\n', end[-1]);
+}
+
+TEST(LogFormatterTest, FormatStageProfileFormatsProfile) {
+  StageProfile profile;
+  profile.n_calls = 3;
+  profile.total_nsec = 4500;
+  profile.max_nsec = 2000;
+  std::string out(log_formatter::kMaxFormattedStageProfileLen, '\0');
+  out.resize(log_formatter::FormatStageProfile(
+                 ProfiledStage::kCopyCommandToLog, profile, &out.front()) -
+             out.data());
+  EXPECT_EQ(
+      "# profile stage=copy_command_to_log calls=3 total_nsec=4500 "
+      "max_nsec=2000\n",
+      out);
+}
+
+TEST(LogFormatterTest, FormatStageProfileHandlesMaximalProfile) {
+  StageProfile profile;
+  std::memset(&profile, 0xff, sizeof(profile));
+  std::string out(log_formatter::kMaxFormattedStageProfileLen, '\0');
+  const char* const end = log_formatter::FormatStageProfile(
+      ProfiledStage::kCopyCommandToLog, profile, &out.front());
+  EXPECT_LE(end - out.data(), static_cast<ptrdiff_t>(
+                                  log_formatter::kMaxFormattedStageProfileLen));
+  EXPECT_EQ('\n', end[-1]);
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -14,11 +14,16 @@
  * limitations under the License.
  */
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <cerrno>
 #include <memory>
 #include <tuple>
 #include <utility>
+#include <vector>
 
+#include "android-base/unique_fd.h"
 #include "gmock/gmock.h"
 #include "gtest/gtest.h"
 
@@ -32,28 +37,83 @@ namespace android {
 namespace wifilogd {
 namespace {
 
+using ::android::base::unique_fd;
 using ::testing::_;
 using ::testing::AnyNumber;
 using ::testing::Ge;
+using ::testing::InSequence;
+using ::testing::Invoke;
+using ::testing::NotNull;
 using ::testing::Return;
 using ::testing::StrictMock;
 
 constexpr int kControlSocketFd = 100;
+constexpr int kOtherFd = kControlSocketFd + 1;
 constexpr char kFakeSocketName[] = "fake-socket";
+constexpr size_t kReceiveBatchSize = 4;
+
+// Returns an action which reports that the file descriptors in |fds|
+// are readable.
+auto ReportReadableFds(std::vector<int> fds) {
+  return Invoke([fds](int /* epoll_fd */, int* ready_fds, size_t max_fds,
+                      int /* timeout_msec */) {
+    EXPECT_LE(fds.size(), max_fds);
+    std::copy(fds.begin(), fds.end(), ready_fds);
+    return std::tuple<size_t, Os::Errno>{fds.size(), 0};
+  });
+}
 
 class MainLoopTest : public ::testing::Test {
  public:
-  MainLoopTest()
+  MainLoopTest() : MainLoopTest(1) {}
+
+ protected:
+  explicit MainLoopTest(size_t receive_batch_size)
       : os_(new StrictMock<MockOs>()),
         command_processor_(new StrictMock<MockCommandProcessor>()) {
+    // The MainLoop closes its epoll fd. So we give it a real fd: one end of
+    // a pipe.
+    int pipe_fds[2];
+    EXPECT_EQ(0, pipe(pipe_fds));
+    unused_fd_.reset(pipe_fds[0]);
+    epoll_fd_ = pipe_fds[1];
+
     EXPECT_CALL(*os_, GetControlSocket(kFakeSocketName))
         .WillOnce(Return(std::tuple<size_t, Os::Errno>{kControlSocketFd, 0}));
+    EXPECT_CALL(*os_, CreateEpoll())
+        .WillOnce(Return(std::tuple<int, Os::Errno>{epoll_fd_, 0}));
+    EXPECT_CALL(*os_, AddEpollFd(epoll_fd_, kControlSocketFd))
+        .WillOnce(Return(0));
+    // Unless a test says otherwise, the control socket is always readable.
+    EXPECT_CALL(*os_, WaitForReadableFds(epoll_fd_, NotNull(), _, _))
+        .Times(AnyNumber())
+        .WillRepeatedly(ReportReadableFds({kControlSocketFd}));
     main_loop_ = std::make_unique<MainLoop>(
         kFakeSocketName, std::unique_ptr<Os>{os_},
-        std::unique_ptr<CommandProcessor>{command_processor_});
+        std::unique_ptr<CommandProcessor>{command_processor_},
+        receive_batch_size);
   }
 
  protected:
+  static Os::Timestamp MakeTimestampMsec(uint32_t msec) {
+    return {msec / 1000, (msec % 1000) * 1000 * 1000};
+  }
+
+  // Runs an iteration of the loop in which nothing is readable, so that
+  // the MainLoop's idle task (CommandProcessor::DoIdleWork()) runs, and
+  // reports that it has no more work.
+  void RunIdleIteration() {
+    EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, _))
+        .WillOnce(ReportReadableFds({}))
+        .RetiresOnSaturation();
+    EXPECT_CALL(*command_processor_, DoIdleWork())
+        .WillOnce(Return(false))
+        .RetiresOnSaturation();
+    main_loop_->RunOnce();
+  }
+
+  unique_fd unused_fd_;
+  int epoll_fd_;
   std::unique_ptr<MainLoop> main_loop_;
   // We use raw pointers to access the mocks, since ownership passes
   // to |main_loop_|.
@@ -61,6 +121,34 @@ class MainLoopTest : public ::testing::Test {
   StrictMock<MockCommandProcessor>* command_processor_;
 };
 
+class BatchedMainLoopTest : public MainLoopTest {
+ public:
+  BatchedMainLoopTest() : MainLoopTest(kReceiveBatchSize) {}
+
+ protected:
+  // Returns an action which reports that datagrams with lengths given by
+  // |lens|, and file descriptors given by |fds|, were received.
+  static auto ReceiveDatagramsOfLengthsWithFds(std::vector<size_t> lens,
+                                               std::vector<int> fds) {
+    return Invoke([lens, fds](int /* fd */, uint8_t* /* bufs */,
+                              size_t /* buflen */, size_t n_bufs,
+                              size_t* datagram_lens, int* datagram_fds) {
+      EXPECT_LE(lens.size(), n_bufs);
+      EXPECT_EQ(lens.size(), fds.size());
+      std::copy(lens.begin(), lens.end(), datagram_lens);
+      std::copy(fds.begin(), fds.end(), datagram_fds);
+      return std::tuple<size_t, Os::Errno>{lens.size(), 0};
+    });
+  }
+
+  // Returns an action which reports that datagrams with lengths given by
+  // |lens| were received, with no file descriptors.
+  static auto ReceiveDatagramsOfLengths(std::vector<size_t> lens) {
+    return ReceiveDatagramsOfLengthsWithFds(
+        lens, std::vector<int>(lens.size(), Os::kInvalidFd));
+  }
+};
+
 }  // namespace
 
 TEST_F(MainLoopTest, RunOnceReadsFromCorrectSocket) {
@@ -109,6 +197,14 @@ TEST_F(MainLoopTest, RunOnceLimitsMaxSizeReportedToCommandProcessor) {
   main_loop_->RunOnce();
 }
 
+TEST_F(MainLoopTest, RunOncePassesInvalidFdToCommandProcessor) {
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, _))
+      .WillOnce(
+          Return(std::tuple<size_t, Os::Errno>{sizeof(protocol::Command), 0}));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, Os::kInvalidFd));
+  main_loop_->RunOnce();
+}
+
 TEST_F(MainLoopTest, RunOnceSleepsAndDoesNotPassDataToCommandProcessorOnError) {
   EXPECT_CALL(*os_, ReceiveDatagram(_, _, protocol::kMaxMessageSize))
       .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EINTR}));
@@ -117,6 +213,308 @@ TEST_F(MainLoopTest, RunOnceSleepsAndDoesNotPassDataToCommandProcessorOnError) {
   main_loop_->RunOnce();
 }
 
+TEST_F(MainLoopTest, RunOnceShrinksBuffersOnEnomem) {
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, protocol::kMaxMessageSize))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, ENOMEM}));
+  EXPECT_CALL(*command_processor_, ShrinkBuffers());
+  EXPECT_CALL(*os_, Nanosleep(_));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _)).Times(0);
+  main_loop_->RunOnce();
+}
+
+TEST_F(MainLoopTest, RunOnceCountsTruncatedDatagram) {
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, _))
+      .WillOnce(Return(
+          std::tuple<size_t, Os::Errno>{protocol::kMaxMessageSize + 1, 0}));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _));
+  main_loop_->RunOnce();
+  EXPECT_EQ(1U, command_processor_->GetStats().n_datagrams_truncated);
+}
+
+TEST_F(MainLoopTest, RunOnceCountsRetriedEintr) {
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EINTR}));
+  EXPECT_CALL(*os_, Nanosleep(_));
+  main_loop_->RunOnce();
+  const protocol::Stats stats = command_processor_->GetStats();
+  EXPECT_EQ(1U, stats.n_receive_eintr_errors);
+  EXPECT_EQ(0U, stats.n_receive_enomem_errors);
+}
+
+TEST_F(MainLoopTest, RunOnceCountsRetriedEnomem) {
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, ENOMEM}));
+  EXPECT_CALL(*command_processor_, ShrinkBuffers());
+  EXPECT_CALL(*os_, Nanosleep(_));
+  main_loop_->RunOnce();
+  const protocol::Stats stats = command_processor_->GetStats();
+  EXPECT_EQ(1U, stats.n_receive_enomem_errors);
+  EXPECT_EQ(0U, stats.n_receive_eintr_errors);
+}
+
+TEST_F(MainLoopTest, RunOnceWaitsOnEpollFd) {
+  EXPECT_CALL(*os_, WaitForReadableFds(epoll_fd_, NotNull(), Os::kMaxReadyFds,
+                                       _))
+      .WillOnce(ReportReadableFds({kControlSocketFd}));
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, _));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _));
+  main_loop_->RunOnce();
+}
+
+TEST_F(MainLoopTest, RunOnceDoesNotReceiveIfControlSocketIsNotReadable) {
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, _))
+      .WillOnce(ReportReadableFds({}));
+  EXPECT_CALL(*command_processor_, DoIdleWork()).WillOnce(Return(false));
+  main_loop_->RunOnce();
+}
+
+TEST_F(MainLoopTest, RunOnceCallsHandlerForReadableFd) {
+  size_t n_calls = 0;
+  EXPECT_CALL(*os_, AddEpollFd(epoll_fd_, kOtherFd)).WillOnce(Return(0));
+  main_loop_->AddFdHandler(kOtherFd, [&n_calls]() { ++n_calls; });
+
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, _))
+      .WillOnce(ReportReadableFds({kOtherFd}));
+  main_loop_->RunOnce();
+  EXPECT_EQ(1U, n_calls);
+}
+
+TEST_F(MainLoopTest, RunOnceCallsHandlerForEveryReadableFd) {
+  size_t n_calls = 0;
+  EXPECT_CALL(*os_, AddEpollFd(epoll_fd_, kOtherFd)).WillOnce(Return(0));
+  main_loop_->AddFdHandler(kOtherFd, [&n_calls]() { ++n_calls; });
+
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, _))
+      .WillOnce(ReportReadableFds({kControlSocketFd, kOtherFd}));
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, _));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _));
+  main_loop_->RunOnce();
+  EXPECT_EQ(1U, n_calls);
+}
+
+TEST_F(MainLoopTest, RunOnceDoesNotCallRemovedHandler) {
+  size_t n_calls = 0;
+  EXPECT_CALL(*os_, AddEpollFd(epoll_fd_, kOtherFd)).WillOnce(Return(0));
+  EXPECT_CALL(*os_, RemoveEpollFd(epoll_fd_, kOtherFd)).WillOnce(Return(0));
+  main_loop_->AddFdHandler(kOtherFd, [&n_calls]() { ++n_calls; });
+  main_loop_->RemoveFdHandler(kOtherFd);
+
+  // A readiness notification may already have been queued.
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, _))
+      .WillOnce(ReportReadableFds({kOtherFd}));
+  main_loop_->RunOnce();
+  EXPECT_EQ(0U, n_calls);
+}
+
+TEST_F(MainLoopTest, HandlerMayRemoveItself) {
+  size_t n_calls = 0;
+  EXPECT_CALL(*os_, AddEpollFd(epoll_fd_, kOtherFd)).WillOnce(Return(0));
+  EXPECT_CALL(*os_, RemoveEpollFd(epoll_fd_, kOtherFd)).WillOnce(Return(0));
+  main_loop_->AddFdHandler(kOtherFd, [this, &n_calls]() {
+    ++n_calls;
+    main_loop_->RemoveFdHandler(kOtherFd);
+  });
+
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, _))
+      .WillOnce(ReportReadableFds({kOtherFd}));
+  main_loop_->RunOnce();
+  EXPECT_EQ(1U, n_calls);
+}
+
+TEST_F(MainLoopTest, RunOnceRunsIdleTasksOnlyIfNoFdIsReadable) {
+  size_t n_calls = 0;
+  main_loop_->AddIdleTask([&n_calls]() {
+    ++n_calls;
+    return true;
+  });
+
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, _));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _));
+  main_loop_->RunOnce();
+  EXPECT_EQ(0U, n_calls);
+
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, _))
+      .WillOnce(ReportReadableFds({}));
+  EXPECT_CALL(*command_processor_, DoIdleWork()).WillOnce(Return(false));
+  main_loop_->RunOnce();
+  EXPECT_EQ(1U, n_calls);
+}
+
+TEST_F(MainLoopTest, RunOncePollsWhileIdleWorkIsPending) {
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, 0))
+      .WillOnce(ReportReadableFds({}))
+      .WillOnce(ReportReadableFds({}));
+  EXPECT_CALL(*command_processor_, DoIdleWork())
+      .WillOnce(Return(true))
+      .WillOnce(Return(false));
+  main_loop_->RunOnce();
+  main_loop_->RunOnce();
+}
+
+TEST_F(MainLoopTest, RunOnceBlocksOnceIdleWorkIsDone) {
+  RunIdleIteration();
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, -1))
+      .WillOnce(ReportReadableFds({}));
+  main_loop_->RunOnce();  // Should not call DoIdleWork().
+}
+
+TEST_F(MainLoopTest, RunOnceResumesIdleWorkAfterHandlingFd) {
+  RunIdleIteration();
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, -1))
+      .WillOnce(ReportReadableFds({kControlSocketFd}));
+  EXPECT_CALL(*os_, ReceiveDatagram(_, _, _));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _));
+  main_loop_->RunOnce();
+
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, 0))
+      .WillOnce(ReportReadableFds({}));
+  EXPECT_CALL(*command_processor_, DoIdleWork()).WillOnce(Return(false));
+  main_loop_->RunOnce();
+}
+
+TEST_F(MainLoopTest, RunOnceWaitsUntilNextTimerDeadline) {
+  RunIdleIteration();
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(Return(MakeTimestampMsec(1000)))   // AddPeriodicTimer()
+      .WillOnce(Return(MakeTimestampMsec(1004)))   // Timeout computation
+      .WillOnce(Return(MakeTimestampMsec(1004)));  // Timer check
+  size_t n_calls = 0;
+  main_loop_->AddPeriodicTimer(10, [&n_calls]() { ++n_calls; });
+
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, 6))
+      .WillOnce(ReportReadableFds({}));
+  main_loop_->RunOnce();
+  EXPECT_EQ(0U, n_calls);
+}
+
+TEST_F(MainLoopTest, RunOnceRoundsTimerTimeoutUp) {
+  RunIdleIteration();
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(Return(Os::Timestamp{1, 0}))
+      .WillOnce(Return(Os::Timestamp{1, 1}))
+      .WillOnce(Return(Os::Timestamp{1, 1}));
+  main_loop_->AddPeriodicTimer(10, []() {});
+
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, 10))
+      .WillOnce(ReportReadableFds({}));
+  main_loop_->RunOnce();
+}
+
+TEST_F(MainLoopTest, RunOnceRunsExpiredTimerPeriodically) {
+  RunIdleIteration();
+  InSequence seq;
+  size_t n_calls = 0;
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(Return(MakeTimestampMsec(1000)));
+  main_loop_->AddPeriodicTimer(10, [&n_calls]() { ++n_calls; });
+
+  // The first deadline has passed.
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(Return(MakeTimestampMsec(1010)));
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, 0))
+      .WillOnce(ReportReadableFds({}));
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(Return(MakeTimestampMsec(1011)));
+  main_loop_->RunOnce();
+  EXPECT_EQ(1U, n_calls);
+
+  // The next deadline is a period after the timer ran.
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(Return(MakeTimestampMsec(1011)));
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, 10))
+      .WillOnce(ReportReadableFds({}));
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(Return(MakeTimestampMsec(1021)));
+  main_loop_->RunOnce();
+  EXPECT_EQ(2U, n_calls);
+}
+
+TEST_F(MainLoopTest, RunOnceRunsLateTimerOnlyOnce) {
+  RunIdleIteration();
+  size_t n_calls = 0;
+  EXPECT_CALL(*os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(Return(MakeTimestampMsec(1000)))
+      .WillRepeatedly(Return(MakeTimestampMsec(2000)));
+  main_loop_->AddPeriodicTimer(10, [&n_calls]() { ++n_calls; });
+
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, 0))
+      .WillOnce(ReportReadableFds({}));
+  main_loop_->RunOnce();
+  EXPECT_EQ(1U, n_calls);
+}
+
+TEST_F(MainLoopTest, RunOnceSleepsAndDoesNotCallHandlersOnWaitError) {
+  EXPECT_CALL(*os_, WaitForReadableFds(_, _, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EINTR}));
+  EXPECT_CALL(*os_, Nanosleep(_));
+  main_loop_->RunOnce();
+}
+
+TEST_F(MainLoopTest, GetAverageBatchDepthIsZeroBeforeFirstReceive) {
+  EXPECT_DOUBLE_EQ(0, main_loop_->GetAverageBatchDepth());
+}
+
+TEST_F(BatchedMainLoopTest, RunOnceReceivesBatchFromCorrectSocket) {
+  EXPECT_CALL(*os_, ReceiveDatagrams(kControlSocketFd, _, _, _, _, _));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _)).Times(AnyNumber());
+  main_loop_->RunOnce();
+}
+
+TEST_F(BatchedMainLoopTest, RunOnceReceivesWithSufficientlyLargeBuffers) {
+  EXPECT_CALL(*os_, ReceiveDatagrams(_, _, Ge(protocol::kMaxMessageSize),
+                                     kReceiveBatchSize, _, _));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _)).Times(AnyNumber());
+  main_loop_->RunOnce();
+}
+
+TEST_F(BatchedMainLoopTest, RunOncePassesEveryDatagramToCommandProcessor) {
+  EXPECT_CALL(*os_, ReceiveDatagrams(_, _, _, _, _, _))
+      .WillOnce(ReceiveDatagramsOfLengths({10, 20, 30}));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, 10, Os::kInvalidFd));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, 20, Os::kInvalidFd));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, 30, Os::kInvalidFd));
+  main_loop_->RunOnce();
+}
+
+TEST_F(BatchedMainLoopTest, RunOncePassesReceivedFdsToCommandProcessor) {
+  constexpr int kReceivedFd = kControlSocketFd + 1;
+  EXPECT_CALL(*os_, ReceiveDatagrams(_, _, _, _, _, _))
+      .WillOnce(ReceiveDatagramsOfLengthsWithFds(
+          {10, 20}, {kReceivedFd, Os::kInvalidFd}));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, 10, kReceivedFd));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, 20, Os::kInvalidFd));
+  main_loop_->RunOnce();
+}
+
+TEST_F(BatchedMainLoopTest, RunOnceLimitsMaxSizeReportedToCommandProcessor) {
+  EXPECT_CALL(*os_, ReceiveDatagrams(_, _, _, _, _, _))
+      .WillOnce(ReceiveDatagramsOfLengths({protocol::kMaxMessageSize + 1, 1}));
+  EXPECT_CALL(*command_processor_,
+              ProcessCommand(_, protocol::kMaxMessageSize, _));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, 1, _));
+  main_loop_->RunOnce();
+}
+
+TEST_F(BatchedMainLoopTest,
+       RunOnceSleepsAndDoesNotPassDataToCommandProcessorOnError) {
+  EXPECT_CALL(*os_, ReceiveDatagrams(_, _, _, _, _, _))
+      .WillOnce(Return(std::tuple<size_t, Os::Errno>{0, EINTR}));
+  EXPECT_CALL(*os_, Nanosleep(_));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _)).Times(0);
+  main_loop_->RunOnce();
+  EXPECT_DOUBLE_EQ(0, main_loop_->GetAverageBatchDepth());
+}
+
+TEST_F(BatchedMainLoopTest, GetAverageBatchDepthReflectsReceivedBatches) {
+  EXPECT_CALL(*os_, ReceiveDatagrams(_, _, _, _, _, _))
+      .WillOnce(ReceiveDatagramsOfLengths({10}))
+      .WillOnce(ReceiveDatagramsOfLengths({10, 10, 10, 10}));
+  EXPECT_CALL(*command_processor_, ProcessCommand(_, _, _)).Times(AnyNumber());
+  main_loop_->RunOnce();
+  main_loop_->RunOnce();
+  EXPECT_DOUBLE_EQ(2.5, main_loop_->GetAverageBatchDepth());
+}
+
 // Per
 // github.com/google/googletest/blob/master/googletest/docs/AdvancedGuide.md#death-tests,
 // death tests should be specially named.
@@ -132,6 +530,45 @@ TEST_F(MainLoopDeathTest, CtorFailureToFetchControlSocketCausesDeath) {
       "Failed to get control socket");
 }
 
+TEST_F(MainLoopDeathTest, CtorFailureToCreateEpollCausesDeath) {
+  auto os = std::make_unique<StrictMock<MockOs>>();
+  auto command_processor = std::make_unique<StrictMock<MockCommandProcessor>>();
+  ON_CALL(*os, GetControlSocket(kFakeSocketName))
+      .WillByDefault(
+          Return(std::tuple<size_t, Os::Errno>{kControlSocketFd, 0}));
+  ON_CALL(*os, CreateEpoll())
+      .WillByDefault(Return(std::tuple<int, Os::Errno>{-1, EMFILE}));
+  EXPECT_DEATH(
+      MainLoop(kFakeSocketName, std::move(os), std::move(command_processor)),
+      "Failed to create epoll instance");
+}
+
+TEST_F(MainLoopDeathTest, AddFdHandlerForWatchedFdCausesDeath) {
+  EXPECT_DEATH(main_loop_->AddFdHandler(kControlSocketFd, []() {}),
+               "Check failed");
+}
+
+TEST_F(MainLoopDeathTest, RemoveFdHandlerForUnwatchedFdCausesDeath) {
+  EXPECT_DEATH(main_loop_->RemoveFdHandler(kOtherFd), "Check failed");
+}
+
+TEST_F(MainLoopDeathTest, CtorWithZeroBatchSizeCausesDeath) {
+  auto os = std::make_unique<StrictMock<MockOs>>();
+  auto command_processor = std::make_unique<StrictMock<MockCommandProcessor>>();
+  EXPECT_DEATH(MainLoop(kFakeSocketName, std::move(os),
+                        std::move(command_processor), 0),
+               "Check failed");
+}
+
+TEST_F(MainLoopDeathTest, CtorWithOverlyLargeBatchSizeCausesDeath) {
+  auto os = std::make_unique<StrictMock<MockOs>>();
+  auto command_processor = std::make_unique<StrictMock<MockCommandProcessor>>();
+  EXPECT_DEATH(MainLoop(kFakeSocketName, std::move(os),
+                        std::move(command_processor),
+                        Os::kMaxDatagramBatchSize + 1),
+               "Check failed");
+}
+
 TEST_F(MainLoopDeathTest, RunOnceTerminatesOnUnexpectedError) {
   ON_CALL(*os_, ReceiveDatagram(_, _, protocol::kMaxMessageSize))
       .WillByDefault(Return(std::tuple<size_t, Os::Errno>{0, EFAULT}));
@@ -15,12 +15,14 @@
  */
 
 #include <array>
+#include <tuple>
 
 #include "gtest/gtest.h"
 
 #include "wifilogd/byte_buffer.h"
 #include "wifilogd/local_utils.h"
 #include "wifilogd/memory_reader.h"
+#include "wifilogd/record_layout.h"
 
 namespace android {
 namespace wifilogd {
@@ -106,6 +108,29 @@ TEST(MemoryReaderTest, CopyOutOrDieWorksForMultipleObjects) {
   EXPECT_EQ(second_message.b, copy_of_second_message.b);
 }
 
+TEST(MemoryReaderTest, CopyOutLayoutOrDieCopiesEveryField) {
+  using Layout = RecordLayout<uint8_t, uint32_t>;
+  constexpr uint8_t first_field = 1;
+  constexpr uint32_t second_field = GetMaxVal<uint32_t>();
+  const auto& buf = ByteBuffer<Layout::kSize + 1>()
+                        .AppendOrDie(&first_field, sizeof(first_field))
+                        .AppendOrDie(&second_field, sizeof(second_field))
+                        .AppendOrDie(&first_field, sizeof(first_field));
+
+  MemoryReader memory_reader(buf.data(), buf.size());
+  const auto& fields = memory_reader.CopyOutLayoutOrDie<Layout>();
+  EXPECT_EQ(first_field, std::get<0>(fields));
+  EXPECT_EQ(second_field, std::get<1>(fields));
+  EXPECT_EQ(1U, memory_reader.size());
+}
+
+TEST(MemoryReaderDeathTest, CopyOutLayoutOrDieAbortsOnShortBuffer) {
+  using Layout = RecordLayout<uint8_t, uint32_t>;
+  constexpr std::array<uint8_t, Layout::kSize - 1> buffer{};
+  MemoryReader memory_reader(buffer.data(), buffer.size());
+  EXPECT_DEATH(memory_reader.CopyOutLayoutOrDie<Layout>(), "Check failed");
+}
+
 TEST(MemoryReaderTest, GetBytesOrDieSucceedsOnSmallRead) {
   constexpr std::array<uint8_t, 1024> buffer{};
   MemoryReader memory_reader(buffer.data(), buffer.size());
@@ -14,10 +14,16 @@
  * limitations under the License.
  */
 
+#include <unistd.h>
+
+#include <algorithm>
 #include <array>
+#include <cstring>
 #include <tuple>
 #include <vector>
 
+#include "android-base/file.h"
+#include "android-base/unique_fd.h"
 #include "gtest/gtest.h"
 
 #include "wifilogd/message_buffer.h"
@@ -26,6 +32,8 @@ namespace android {
 namespace wifilogd {
 namespace {
 
+using ::android::base::unique_fd;
+
 constexpr size_t kBufferSizeBytes = 1024;
 constexpr size_t kHeaderSizeBytes = MessageBuffer::GetHeaderSize();
 constexpr std::array<uint8_t, 1> kSmallestMessage{};
@@ -51,6 +59,12 @@ class MessageBufferTest : public ::testing::Test {
     return n_written;
   }
 
+  // Appends a message of |len| bytes, with every byte set to |fill|.
+  bool AppendFilledMessage(uint8_t fill, uint16_t len) {
+    const std::vector<uint8_t> message(len, fill);
+    return buffer_.Append(message.data(), len);
+  }
+
   std::vector<uint8_t> GetNextMessageAsByteVector() {
     const uint8_t* start;
     size_t len;
@@ -89,6 +103,112 @@ TEST_F(MessageBufferTest, AppendUnalignedMessagesDoesNotCrash) {
   }
 }
 
+TEST_F(MessageBufferTest, AppendToFullBufferSucceeds) {
+  FillBufferWithMultipleMessages();
+  EXPECT_TRUE(buffer_.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+}
+
+TEST_F(MessageBufferTest, AppendMaximalToPartiallyFullBufferSucceeds) {
+  ASSERT_TRUE(buffer_.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+  EXPECT_TRUE(buffer_.Append(kLargestMessage.data(), kLargestMessage.size()));
+  EXPECT_EQ(kLargestMessage.size(), std::get<1>(buffer_.ConsumeNextMessage()));
+}
+
+TEST_F(MessageBufferTest, AppendToFullBufferEvictsOnlyOldestMessage) {
+  const size_t n_written = FillBufferWithMultipleMessages();
+  const std::vector<uint8_t> message(kHeaderSizeBytes, 'x');
+  ASSERT_TRUE(buffer_.Append(message.data(), message.size()));
+
+  size_t n_read = 0;
+  while (std::get<0>(buffer_.ConsumeNextMessage())) {
+    ++n_read;
+  }
+  EXPECT_EQ(n_written, n_read);
+
+  buffer_.Rewind();
+  for (size_t i = 0; i < n_written - 1; ++i) {
+    buffer_.ConsumeNextMessage();
+  }
+  EXPECT_EQ(message, GetNextMessageAsByteVector());
+}
+
+TEST_F(MessageBufferTest, AppendWrapsAroundEndOfStorage) {
+  // Three messages of this size fit in the buffer, with some space left over.
+  // So the fourth message must wrap to the start of the storage.
+  constexpr uint16_t kMessageLen = kBufferSizeBytes / 3 - kHeaderSizeBytes - 1;
+  for (uint8_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(AppendFilledMessage(i, kMessageLen));
+  }
+
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 1), GetNextMessageAsByteVector());
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 2), GetNextMessageAsByteVector());
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 3), GetNextMessageAsByteVector());
+  constexpr std::tuple<const uint8_t*, size_t> expected{nullptr, 0};
+  EXPECT_EQ(expected, buffer_.ConsumeNextMessage());
+}
+
+TEST_F(MessageBufferTest, AppendWrapsAroundEndOfStorageRepeatedly) {
+  // Odd-length messages ensure that the unused space at the end of the
+  // storage varies from one pass to the next, including tails that are too
+  // small to hold a header.
+  constexpr uint16_t kMessageLen = 97;
+  constexpr size_t kMessagesPerPass =
+      kBufferSizeBytes / (kHeaderSizeBytes + kMessageLen);
+  constexpr size_t kNumMessages = kMessagesPerPass * 10;
+  for (size_t i = 0; i < kNumMessages; ++i) {
+    ASSERT_TRUE(AppendFilledMessage(static_cast<uint8_t>(i), kMessageLen));
+  }
+
+  // At least kMessagesPerPass - 1 messages survive, in order, ending with the
+  // most recent message.
+  std::vector<std::vector<uint8_t>> messages;
+  while (true) {
+    const auto& message = GetNextMessageAsByteVector();
+    if (message.empty()) {
+      break;
+    }
+    messages.push_back(message);
+  }
+  ASSERT_GE(messages.size(), kMessagesPerPass - 1);
+  ASSERT_LE(messages.size(), kMessagesPerPass);
+  for (size_t i = 0; i < messages.size(); ++i) {
+    const size_t message_num = kNumMessages - messages.size() + i;
+    EXPECT_EQ(
+        std::vector<uint8_t>(kMessageLen, static_cast<uint8_t>(message_num)),
+        messages[i]);
+  }
+}
+
+TEST_F(MessageBufferTest, ConsumeNextMessageSkipsEvictedMessages) {
+  constexpr uint16_t kMessageLen = kBufferSizeBytes / 4 - kHeaderSizeBytes;
+  for (uint8_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(AppendFilledMessage(i, kMessageLen));
+  }
+  ASSERT_EQ(std::vector<uint8_t>(kMessageLen, 0), GetNextMessageAsByteVector());
+
+  // Evicts messages 0 and 1. The reader was positioned at message 1, so it
+  // should resume with message 2.
+  ASSERT_TRUE(AppendFilledMessage(4, kMessageLen));
+  ASSERT_TRUE(AppendFilledMessage(5, kMessageLen));
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 2), GetNextMessageAsByteVector());
+}
+
+TEST_F(MessageBufferTest, ConsumeNextMessageDoesNotRepeatMessagesAfterWrap) {
+  constexpr uint16_t kMessageLen = kBufferSizeBytes / 4 - kHeaderSizeBytes;
+  for (uint8_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(AppendFilledMessage(i, kMessageLen));
+  }
+  for (uint8_t i = 0; i < 4; ++i) {
+    ASSERT_EQ(std::vector<uint8_t>(kMessageLen, i),
+              GetNextMessageAsByteVector());
+  }
+
+  ASSERT_TRUE(AppendFilledMessage(4, kMessageLen));
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 4), GetNextMessageAsByteVector());
+  constexpr std::tuple<const uint8_t*, size_t> expected{nullptr, 0};
+  EXPECT_EQ(expected, buffer_.ConsumeNextMessage());
+}
+
 TEST_F(MessageBufferTest, AppendLargerThanBufferFails) {
   constexpr std::array<uint8_t, kBufferSizeBytes + 1> oversized_message{};
   EXPECT_FALSE(
@@ -108,6 +228,56 @@ TEST_F(MessageBufferTest, AppendMultipleMessagesToFillBufferDoesNotCrash) {
   FillBufferWithMultipleMessages();
 }
 
+TEST_F(MessageBufferTest, ReserveOnEmptyBufferSucceeds) {
+  EXPECT_NE(nullptr, buffer_.Reserve(kLargestMessage.size()));
+}
+
+TEST_F(MessageBufferTest, ReserveLargerThanBufferFails) {
+  EXPECT_EQ(nullptr, buffer_.Reserve(kLargestMessage.size() + 1));
+}
+
+TEST_F(MessageBufferTest, ReservedMessageIsNotVisibleUntilCommitted) {
+  uint8_t* reserved = buffer_.Reserve(kSmallestMessage.size());
+  ASSERT_NE(nullptr, reserved);
+  constexpr std::tuple<const uint8_t*, size_t> expected{nullptr, 0};
+  EXPECT_EQ(expected, buffer_.ConsumeNextMessage());
+
+  *reserved = 'x';
+  buffer_.Commit(kSmallestMessage.size());
+  EXPECT_EQ(std::vector<uint8_t>{'x'}, GetNextMessageAsByteVector());
+}
+
+TEST_F(MessageBufferTest, CommitCanShortenReservedMessage) {
+  uint8_t* reserved = buffer_.Reserve(kLargestMessage.size());
+  ASSERT_NE(nullptr, reserved);
+  reserved[0] = 'h';
+  reserved[1] = 'i';
+  buffer_.Commit(2);
+  EXPECT_EQ((std::vector<uint8_t>{'h', 'i'}), GetNextMessageAsByteVector());
+  EXPECT_EQ(kBufferSizeBytes - kHeaderSizeBytes - 2, buffer_.GetFreeSize());
+}
+
+TEST_F(MessageBufferTest, ReserveAfterWrapDoesNotExposePaddingBeforeCommit) {
+  constexpr uint16_t kMessageLen = kBufferSizeBytes / 3 - kHeaderSizeBytes - 1;
+  for (uint8_t i = 0; i < 3; ++i) {
+    ASSERT_TRUE(AppendFilledMessage(i, kMessageLen));
+  }
+  for (uint8_t i = 0; i < 3; ++i) {
+    ASSERT_EQ(std::vector<uint8_t>(kMessageLen, i),
+              GetNextMessageAsByteVector());
+  }
+
+  // The reservation wraps to the start of the storage.
+  uint8_t* reserved = buffer_.Reserve(kMessageLen);
+  ASSERT_NE(nullptr, reserved);
+  constexpr std::tuple<const uint8_t*, size_t> expected{nullptr, 0};
+  EXPECT_EQ(expected, buffer_.ConsumeNextMessage());
+
+  std::fill(reserved, reserved + kMessageLen, 3);
+  buffer_.Commit(kMessageLen);
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 3), GetNextMessageAsByteVector());
+}
+
 TEST_F(MessageBufferTest, CanFitNowIsCorrectOnFreshBuffer) {
   EXPECT_TRUE(buffer_.CanFitNow(kLargestMessage.size()));
   EXPECT_FALSE(buffer_.CanFitNow(kLargestMessage.size() + 1));
@@ -277,6 +447,54 @@ TEST_F(MessageBufferTest, ConsumeNextMessageReturnsOurMessages) {
   EXPECT_EQ(message2, GetNextMessageAsByteVector());
 }
 
+TEST_F(MessageBufferTest, GetLastMessageReturnsNullOnFreshBuffer) {
+  EXPECT_EQ(nullptr, std::get<0>(buffer_.GetLastMessage()));
+}
+
+TEST_F(MessageBufferTest, GetLastMessageReturnsNullAfterClear) {
+  ASSERT_TRUE(AppendFilledMessage('a', 2));
+  buffer_.Clear();
+  EXPECT_EQ(nullptr, std::get<0>(buffer_.GetLastMessage()));
+}
+
+TEST_F(MessageBufferTest, GetLastMessageReturnsNewestMessage) {
+  ASSERT_TRUE(AppendFilledMessage('a', 2));
+  ASSERT_TRUE(AppendFilledMessage('b', 3));
+  uint8_t* start;
+  size_t len;
+  std::tie(start, len) = buffer_.GetLastMessage();
+  EXPECT_EQ(std::vector<uint8_t>(3, 'b'),
+            std::vector<uint8_t>(start, start + len));
+}
+
+TEST_F(MessageBufferTest, GetLastMessageIgnoresOutstandingReservation) {
+  ASSERT_TRUE(AppendFilledMessage('a', 2));
+  ASSERT_NE(nullptr, buffer_.Reserve(3));
+  EXPECT_EQ(2U, std::get<1>(buffer_.GetLastMessage()));
+}
+
+TEST_F(MessageBufferTest, GetLastMessageSurvivesEvictionOfOlderMessages) {
+  FillBufferWithMultipleMessages();
+  ASSERT_TRUE(AppendFilledMessage('z', kHeaderSizeBytes));
+  uint8_t* start;
+  size_t len;
+  std::tie(start, len) = buffer_.GetLastMessage();
+  EXPECT_EQ(std::vector<uint8_t>(kHeaderSizeBytes, 'z'),
+            std::vector<uint8_t>(start, start + len));
+}
+
+TEST_F(MessageBufferTest, GetLastMessageCanBeModifiedInPlace) {
+  ASSERT_TRUE(AppendFilledMessage('a', 2));
+  ASSERT_TRUE(AppendFilledMessage('b', 3));
+  uint8_t* start;
+  size_t len;
+  std::tie(start, len) = buffer_.GetLastMessage();
+  std::fill(start, start + len, 'c');
+
+  EXPECT_EQ(std::vector<uint8_t>(2, 'a'), GetNextMessageAsByteVector());
+  EXPECT_EQ(std::vector<uint8_t>(3, 'c'), GetNextMessageAsByteVector());
+}
+
 TEST_F(MessageBufferTest, GetFreeSizeIsCorrectOnFreshBuffer) {
   EXPECT_EQ(kBufferSizeBytes, buffer_.GetFreeSize());
 }
@@ -298,12 +516,172 @@ TEST_F(MessageBufferTest, GetFreeSizeIsCorrectAfterRewindOfFullBuffer) {
   EXPECT_EQ(0U, buffer_.GetFreeSize());
 }
 
+TEST_F(MessageBufferTest, GetFreeSizeIsCorrectAfterEviction) {
+  FillBufferWithMultipleMessages();
+  ASSERT_TRUE(buffer_.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+  // FillBufferWithMultipleMessages() writes messages of kHeaderSizeBytes.
+  constexpr size_t kEvictedRecordSize = kHeaderSizeBytes + kHeaderSizeBytes;
+  constexpr size_t kNewRecordSize = kHeaderSizeBytes + kSmallestMessage.size();
+  EXPECT_EQ(kEvictedRecordSize - kNewRecordSize, buffer_.GetFreeSize());
+}
+
 TEST_F(MessageBufferTest, GetFreeSizeIsCorrectAfterClear) {
   ASSERT_TRUE(buffer_.Append(kLargestMessage.data(), kLargestMessage.size()));
   buffer_.Clear();
   EXPECT_EQ(kBufferSizeBytes, buffer_.GetFreeSize());
 }
 
+TEST_F(MessageBufferTest, GetUsedSizeIsCorrectAfterSmallWrite) {
+  ASSERT_TRUE(buffer_.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+  EXPECT_EQ(kHeaderSizeBytes + kSmallestMessage.size(), buffer_.GetUsedSize());
+  EXPECT_EQ(kBufferSizeBytes, buffer_.GetUsedSize() + buffer_.GetFreeSize());
+}
+
+TEST_F(MessageBufferTest, CanConstructBufferLargerThanItsContents) {
+  // Storage is committed lazily, so a large buffer should cost little
+  // until it is written to.
+  constexpr size_t kLargeBufferSize = 256 * 1024 * 1024;
+  MessageBuffer large_buffer(kLargeBufferSize);
+  ASSERT_TRUE(
+      large_buffer.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+  EXPECT_EQ(kLargeBufferSize - kHeaderSizeBytes - kSmallestMessage.size(),
+            large_buffer.GetFreeSize());
+}
+
+TEST_F(MessageBufferTest, GetNumEvictedIsZeroInitially) {
+  EXPECT_EQ(0U, buffer_.GetNumEvicted());
+}
+
+TEST_F(MessageBufferTest, GetNumEvictedCountsMessagesEvictedByAppend) {
+  const size_t n_written = FillBufferWithMultipleMessages();
+  EXPECT_EQ(0U, buffer_.GetNumEvicted());
+
+  // A message twice the size of the others evicts two of them.
+  ASSERT_TRUE(AppendFilledMessage(0, 2 * kHeaderSizeBytes + kHeaderSizeBytes));
+  EXPECT_EQ(2U, buffer_.GetNumEvicted());
+  EXPECT_GT(n_written, buffer_.GetNumEvicted());
+}
+
+TEST_F(MessageBufferTest, GetNumEvictedCountsMessagesEvictedByShrink) {
+  const size_t n_written = FillBufferWithMultipleMessages();
+  buffer_.Shrink(0);
+  EXPECT_EQ(n_written, buffer_.GetNumEvicted());
+}
+
+TEST_F(MessageBufferTest, GetNumEvictedCountsMessagesDiscardedByClear) {
+  const size_t n_written = FillBufferWithMultipleMessages();
+  buffer_.Clear();
+  EXPECT_EQ(n_written, buffer_.GetNumEvicted());
+
+  // Clearing an empty buffer evicts nothing more.
+  buffer_.Clear();
+  EXPECT_EQ(n_written, buffer_.GetNumEvicted());
+}
+
+TEST_F(MessageBufferTest, EvictionHandlerSeesMessagesEvictedByAppend) {
+  std::vector<std::vector<uint8_t>> evicted;
+  buffer_.SetEvictionHandler(
+      [&evicted](const uint8_t* message, size_t message_len) {
+        evicted.emplace_back(message, message + message_len);
+      });
+  constexpr uint16_t kMessageLen = kBufferSizeBytes / 4 - kHeaderSizeBytes;
+  for (uint8_t i = 0; i < 6; ++i) {
+    ASSERT_TRUE(AppendFilledMessage(i, kMessageLen));
+  }
+  ASSERT_EQ(2U, evicted.size());
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 0), evicted[0]);
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 1), evicted[1]);
+}
+
+TEST_F(MessageBufferTest, EvictionHandlerSeesMessagesEvictedByShrink) {
+  size_t n_evicted = 0;
+  buffer_.SetEvictionHandler(
+      [&n_evicted](const uint8_t* /* message */, size_t /* message_len */) {
+        ++n_evicted;
+      });
+  const size_t n_written = FillBufferWithMultipleMessages();
+  buffer_.Shrink(0);
+  EXPECT_EQ(n_written, n_evicted);
+}
+
+TEST_F(MessageBufferTest, EvictionHandlerSeesMessagesDiscardedByClear) {
+  size_t n_evicted = 0;
+  buffer_.SetEvictionHandler(
+      [&n_evicted](const uint8_t* /* message */, size_t /* message_len */) {
+        ++n_evicted;
+      });
+  const size_t n_written = FillBufferWithMultipleMessages();
+  buffer_.Clear();
+  EXPECT_EQ(n_written, n_evicted);
+  EXPECT_EQ(n_written, buffer_.GetNumEvicted());
+}
+
+TEST_F(MessageBufferTest, ShrinkEvictsOldestMessages) {
+  constexpr uint16_t kMessageLen = kBufferSizeBytes / 4 - kHeaderSizeBytes;
+  for (uint8_t i = 0; i < 4; ++i) {
+    ASSERT_TRUE(AppendFilledMessage(i, kMessageLen));
+  }
+
+  buffer_.Shrink(kBufferSizeBytes / 2);
+  EXPECT_EQ(kBufferSizeBytes / 2, buffer_.GetUsedSize());
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 2), GetNextMessageAsByteVector());
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 3), GetNextMessageAsByteVector());
+  EXPECT_EQ(nullptr, std::get<0>(buffer_.ConsumeNextMessage()));
+}
+
+TEST_F(MessageBufferTest, ShrinkToZeroEmptiesBuffer) {
+  FillBufferWithMultipleMessages();
+  buffer_.Shrink(0);
+  EXPECT_EQ(kBufferSizeBytes, buffer_.GetFreeSize());
+  EXPECT_EQ(nullptr, std::get<0>(buffer_.ConsumeNextMessage()));
+}
+
+TEST_F(MessageBufferTest, ShrinkPreservesMessagesSpanningManyPages) {
+  // Use a buffer that spans several pages, so that Shrink() actually
+  // releases memory. Messages on either side of the released pages must
+  // survive, as must messages written into the released pages later.
+  const size_t page_size = getpagesize();
+  const uint16_t message_len = page_size / 2 - kHeaderSizeBytes;
+  MessageBuffer buffer(8 * page_size);
+  const auto append = [&buffer, message_len](uint8_t fill) {
+    const std::vector<uint8_t> message(message_len, fill);
+    return buffer.Append(message.data(), message_len);
+  };
+  const auto consume = [&buffer]() {
+    const uint8_t* data;
+    size_t len;
+    std::tie(data, len) = buffer.ConsumeNextMessage();
+    return data ? std::vector<uint8_t>(data, data + len)
+                : std::vector<uint8_t>();
+  };
+
+  for (uint8_t i = 0; i < 20; ++i) {  // Wraps around the storage.
+    ASSERT_TRUE(append(i));
+  }
+  buffer.Shrink(3 * page_size);
+  for (uint8_t i = 20; i < 24; ++i) {
+    ASSERT_TRUE(append(i));
+  }
+
+  for (uint8_t i = 14; i < 24; ++i) {
+    EXPECT_EQ(std::vector<uint8_t>(message_len, i), consume()) << +i;
+  }
+  EXPECT_TRUE(consume().empty());
+}
+
+TEST_F(MessageBufferTest, RewindReturnsToOldestSurvivingMessage) {
+  constexpr uint16_t kMessageLen = kBufferSizeBytes / 4 - kHeaderSizeBytes;
+  for (uint8_t i = 0; i < 6; ++i) {
+    ASSERT_TRUE(AppendFilledMessage(i, kMessageLen));
+  }
+  while (std::get<0>(buffer_.ConsumeNextMessage())) {
+    // Silently consume message
+  }
+
+  buffer_.Rewind();
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, 2), GetNextMessageAsByteVector());
+}
+
 TEST_F(MessageBufferTest, RewindDoesNotAffectWritePointer) {
   const std::vector<uint8_t> message1{{'h', 'e', 'l', 'l', 'o'}};
   ASSERT_TRUE(
@@ -318,6 +696,291 @@ TEST_F(MessageBufferTest, RewindDoesNotAffectWritePointer) {
   EXPECT_EQ(message2, GetNextMessageAsByteVector());
 }
 
+// The tests below use a backing file. Note that the destructor does nothing
+// to the file beyond unmapping it, so destroying a buffer stands in for a
+// crash of the process.
+TEST_F(MessageBufferTest, BufferWithoutBackingFileHasNoGeneration) {
+  EXPECT_EQ(0U, buffer_.GetGeneration());
+  EXPECT_EQ(0U, buffer_.GetNumRecovered());
+}
+
+TEST_F(MessageBufferTest, NewBackingFileIsInitialized) {
+  TemporaryFile backing_file;
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  EXPECT_EQ(1U, buffer.GetGeneration());
+  EXPECT_EQ(0U, buffer.GetNumRecovered());
+  EXPECT_EQ(0U, buffer.GetUsedSize());
+}
+
+TEST_F(MessageBufferTest, BackingFileRecoversMessages) {
+  TemporaryFile backing_file;
+  const std::vector<uint8_t> message1{1, 2, 3};
+  const std::vector<uint8_t> message2{4, 5};
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+    ASSERT_TRUE(buffer.Append(message1.data(), message1.size()));
+    ASSERT_TRUE(buffer.Append(message2.data(), message2.size()));
+  }
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  EXPECT_EQ(2U, buffer.GetGeneration());
+  EXPECT_EQ(2U, buffer.GetNumRecovered());
+  const uint8_t* start;
+  size_t len;
+  std::tie(start, len) = buffer.ConsumeNextMessage();
+  EXPECT_EQ(message1, std::vector<uint8_t>(start, start + len));
+  std::tie(start, len) = buffer.ConsumeNextMessage();
+  EXPECT_EQ(message2, std::vector<uint8_t>(start, start + len));
+  EXPECT_EQ(nullptr, std::get<0>(buffer.ConsumeNextMessage()));
+}
+
+TEST_F(MessageBufferTest, BackingFileRecoversLastMessage) {
+  TemporaryFile backing_file;
+  const std::vector<uint8_t> message1{1, 2, 3};
+  const std::vector<uint8_t> message2{4, 5};
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+    ASSERT_TRUE(buffer.Append(message1.data(), message1.size()));
+    ASSERT_TRUE(buffer.Append(message2.data(), message2.size()));
+  }
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  uint8_t* start;
+  size_t len;
+  std::tie(start, len) = buffer.GetLastMessage();
+  EXPECT_EQ(message2, std::vector<uint8_t>(start, start + len));
+}
+
+TEST_F(MessageBufferTest, BackingFileRecoversMessagesAfterWrap) {
+  TemporaryFile backing_file;
+  constexpr uint16_t kMessageLen = kBufferSizeBytes / 3;
+  std::vector<uint8_t> last_message;
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+    for (uint8_t i = 0; i < 10; ++i) {
+      last_message.assign(kMessageLen, i);
+      ASSERT_TRUE(buffer.Append(last_message.data(), last_message.size()));
+    }
+  }
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  EXPECT_EQ(2U, buffer.GetNumRecovered());
+  std::get<0>(buffer.ConsumeNextMessage());
+  const uint8_t* start;
+  size_t len;
+  std::tie(start, len) = buffer.ConsumeNextMessage();
+  EXPECT_EQ(last_message, std::vector<uint8_t>(start, start + len));
+
+  // Appending continues after the recovered messages.
+  ASSERT_TRUE(buffer.Append(last_message.data(), last_message.size()));
+  EXPECT_EQ(1U, buffer.GetNumEvicted());
+}
+
+TEST_F(MessageBufferTest, BackingFileDoesNotRecoverUncommittedMessage) {
+  TemporaryFile backing_file;
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+    ASSERT_TRUE(
+        buffer.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+    uint8_t* const reserved = buffer.Reserve(kLargestMessage.size() / 2);
+    ASSERT_NE(nullptr, reserved);
+    std::memset(reserved, 0xff, kLargestMessage.size() / 2);
+  }
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  EXPECT_EQ(1U, buffer.GetNumRecovered());
+  EXPECT_EQ(kHeaderSizeBytes + kSmallestMessage.size(), buffer.GetUsedSize());
+}
+
+TEST_F(MessageBufferTest, BackingFileOfDifferentSizeIsReinitialized) {
+  TemporaryFile backing_file;
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+    ASSERT_TRUE(
+        buffer.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+  }
+
+  MessageBuffer buffer(2 * kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  EXPECT_EQ(1U, buffer.GetGeneration());
+  EXPECT_EQ(0U, buffer.GetNumRecovered());
+  EXPECT_EQ(nullptr, std::get<0>(buffer.ConsumeNextMessage()));
+}
+
+TEST_F(MessageBufferTest, BackingFileWithCorruptMessagesIsReinitialized) {
+  TemporaryFile backing_file;
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+    ASSERT_TRUE(
+        buffer.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+  }
+  // Overwrite the first message's header with a length that runs past the
+  // end of the messages.
+  const uint16_t corrupt_len = kBufferSizeBytes - kHeaderSizeBytes;
+  ASSERT_EQ(static_cast<ssize_t>(sizeof(corrupt_len)),
+            pwrite(backing_file.fd, &corrupt_len, sizeof(corrupt_len),
+                   getpagesize()));
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  EXPECT_EQ(1U, buffer.GetGeneration());
+  EXPECT_EQ(0U, buffer.GetNumRecovered());
+}
+
+TEST_F(MessageBufferTest, BackingFileWithGarbageHeaderIsReinitialized) {
+  TemporaryFile backing_file;
+  const std::vector<uint8_t> garbage(getpagesize(), 0xa5);
+  ASSERT_EQ(static_cast<ssize_t>(garbage.size()),
+            write(backing_file.fd, garbage.data(), garbage.size()));
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  EXPECT_EQ(1U, buffer.GetGeneration());
+  EXPECT_EQ(0U, buffer.GetNumRecovered());
+}
+
+TEST_F(MessageBufferTest, BackingFileRecoversMessagesRetainedByShrink) {
+  TemporaryFile backing_file;
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+    for (size_t i = 0; i < 4; ++i) {
+      ASSERT_TRUE(
+          buffer.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+    }
+    buffer.Shrink(2 * (kHeaderSizeBytes + kSmallestMessage.size()));
+  }
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+  EXPECT_EQ(2U, buffer.GetNumRecovered());
+}
+
+TEST_F(MessageBufferTest, BackingFileRecoversAlignedMessages) {
+  TemporaryFile backing_file;
+  const std::vector<uint8_t> message{1, 2, 3};
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)),
+                         MessageBuffer::Framing::kAligned);
+    ASSERT_TRUE(buffer.Append(message.data(), message.size()));
+  }
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)),
+                       MessageBuffer::Framing::kAligned);
+  EXPECT_EQ(1U, buffer.GetNumRecovered());
+  const uint8_t* start;
+  size_t len;
+  std::tie(start, len) = buffer.ConsumeNextMessage();
+  EXPECT_EQ(message, std::vector<uint8_t>(start, start + len));
+}
+
+TEST_F(MessageBufferTest, BackingFileOfDifferentFramingIsReinitialized) {
+  TemporaryFile backing_file;
+  {
+    MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)));
+    ASSERT_TRUE(
+        buffer.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+  }
+
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(dup(backing_file.fd)),
+                       MessageBuffer::Framing::kAligned);
+  EXPECT_EQ(1U, buffer.GetGeneration());
+  EXPECT_EQ(0U, buffer.GetNumRecovered());
+}
+
+TEST_F(MessageBufferTest, AlignedBufferAlignsMessages) {
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(),
+                       MessageBuffer::Framing::kAligned);
+  std::vector<std::vector<uint8_t>> messages;
+  for (uint8_t len = 1; len <= 2 * MessageBuffer::kRecordAlignment; ++len) {
+    messages.emplace_back(len, len);
+    ASSERT_TRUE(buffer.Append(messages.back().data(), len));
+  }
+
+  for (const auto& message : messages) {
+    const uint8_t* start;
+    size_t len;
+    std::tie(start, len) = buffer.ConsumeNextMessage();
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(start) %
+                      MessageBuffer::kRecordAlignment);
+    EXPECT_EQ(message, std::vector<uint8_t>(start, start + len));
+  }
+}
+
+TEST_F(MessageBufferTest, AlignedBufferCountsPaddingAsUsed) {
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(),
+                       MessageBuffer::Framing::kAligned);
+  ASSERT_TRUE(buffer.Append(kSmallestMessage.data(), kSmallestMessage.size()));
+  EXPECT_EQ(2 * MessageBuffer::kRecordAlignment, buffer.GetUsedSize());
+  EXPECT_EQ(buffer.GetRecordLen(kSmallestMessage.size()),
+            buffer.GetUsedSize());
+  EXPECT_EQ(kHeaderSizeBytes + kSmallestMessage.size(),
+            buffer_.GetRecordLen(kSmallestMessage.size()));
+}
+
+TEST_F(MessageBufferTest, AlignedBufferIgnoresUnalignedPartOfSize) {
+  MessageBuffer buffer(kBufferSizeBytes + MessageBuffer::kRecordAlignment - 1,
+                       unique_fd(), MessageBuffer::Framing::kAligned);
+  EXPECT_EQ(kBufferSizeBytes, buffer.GetFreeSize());
+  EXPECT_TRUE(
+      buffer.CanFitEver(kBufferSizeBytes - MessageBuffer::kRecordAlignment));
+  EXPECT_FALSE(buffer.CanFitEver(kBufferSizeBytes -
+                                 MessageBuffer::kRecordAlignment + 1));
+}
+
+TEST_F(MessageBufferTest, AlignedBufferWrapsAroundEndOfStorage) {
+  MessageBuffer buffer(kBufferSizeBytes, unique_fd(),
+                       MessageBuffer::Framing::kAligned);
+  // An odd length, so that every message carries padding.
+  constexpr uint16_t kMessageLen = 101;
+  constexpr uint8_t kNumMessages = 50;
+  for (uint8_t i = 0; i < kNumMessages; ++i) {
+    const std::vector<uint8_t> message(kMessageLen, i);
+    ASSERT_TRUE(buffer.Append(message.data(), message.size()));
+  }
+  ASSERT_LT(0U, buffer.GetNumEvicted());
+
+  std::vector<uint8_t> last_message;
+  while (true) {
+    const uint8_t* start;
+    size_t len;
+    std::tie(start, len) = buffer.ConsumeNextMessage();
+    if (!start) {
+      break;
+    }
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(start) %
+                      MessageBuffer::kRecordAlignment);
+    last_message.assign(start, start + len);
+  }
+  EXPECT_EQ(std::vector<uint8_t>(kMessageLen, kNumMessages - 1),
+            last_message);
+}
+
+TEST_F(MessageBufferTest, ConsumeNextMessagesReturnsUpToMaxMessages) {
+  const size_t n_written = FillBufferWithMultipleMessages();
+  std::vector<std::tuple<const uint8_t*, size_t>> batch(n_written / 2 + 1);
+  EXPECT_EQ(batch.size(),
+            buffer_.ConsumeNextMessages(batch.data(), batch.size()));
+  EXPECT_EQ(n_written - batch.size(),
+            buffer_.ConsumeNextMessages(batch.data(), batch.size()));
+  EXPECT_EQ(0U, buffer_.ConsumeNextMessages(batch.data(), batch.size()));
+}
+
+TEST_F(MessageBufferTest, ConsumeNextMessagesReturnsOurMessages) {
+  ASSERT_TRUE(AppendFilledMessage(1, 10));
+  ASSERT_TRUE(AppendFilledMessage(2, 20));
+  std::array<std::tuple<const uint8_t*, size_t>, 3> batch;
+  ASSERT_EQ(2U, buffer_.ConsumeNextMessages(batch.data(), batch.size()));
+  const uint8_t* start;
+  size_t len;
+  std::tie(start, len) = batch[0];
+  EXPECT_EQ(std::vector<uint8_t>(10, 1),
+            std::vector<uint8_t>(start, start + len));
+  std::tie(start, len) = batch[1];
+  EXPECT_EQ(std::vector<uint8_t>(20, 2),
+            std::vector<uint8_t>(start, start + len));
+}
+
+TEST_F(MessageBufferTest, ConsumeNextMessagesReturnsZeroOnFreshBuffer) {
+  std::tuple<const uint8_t*, size_t> message;
+  EXPECT_EQ(0U, buffer_.ConsumeNextMessages(&message, 1));
+}
+
 // Per
 // github.com/google/googletest/blob/master/googletest/docs/AdvancedGuide.md#death-tests,
 // death tests should be specially named.
@@ -328,6 +991,36 @@ TEST_F(MessageBufferDeathTest, AppendZeroBytesCausesDeath) {
   EXPECT_DEATH(buffer_.Append(message.data(), 0), "Check failed");
 }
 
+TEST_F(MessageBufferDeathTest, ReserveZeroBytesCausesDeath) {
+  EXPECT_DEATH(buffer_.Reserve(0), "Check failed");
+}
+
+TEST_F(MessageBufferDeathTest, ReserveWithOutstandingReservationCausesDeath) {
+  ASSERT_NE(nullptr, buffer_.Reserve(kSmallestMessage.size()));
+  EXPECT_DEATH(buffer_.Reserve(kSmallestMessage.size()), "Check failed");
+}
+
+TEST_F(MessageBufferDeathTest, AppendWithOutstandingReservationCausesDeath) {
+  ASSERT_NE(nullptr, buffer_.Reserve(kSmallestMessage.size()));
+  EXPECT_DEATH(
+      buffer_.Append(kSmallestMessage.data(), kSmallestMessage.size()),
+      "Check failed");
+}
+
+TEST_F(MessageBufferDeathTest, CommitWithoutReservationCausesDeath) {
+  EXPECT_DEATH(buffer_.Commit(kSmallestMessage.size()), "Check failed");
+}
+
+TEST_F(MessageBufferDeathTest, CommitLargerThanReservationCausesDeath) {
+  ASSERT_NE(nullptr, buffer_.Reserve(kSmallestMessage.size()));
+  EXPECT_DEATH(buffer_.Commit(kSmallestMessage.size() + 1), "Check failed");
+}
+
+TEST_F(MessageBufferDeathTest, ShrinkWithOutstandingReservationCausesDeath) {
+  ASSERT_NE(nullptr, buffer_.Reserve(kSmallestMessage.size()));
+  EXPECT_DEATH(buffer_.Shrink(0), "Check failed");
+}
+
 TEST_F(MessageBufferDeathTest, ConstructionOfUselesslySmallBufferCausesDeath) {
   EXPECT_DEATH(MessageBuffer{kHeaderSizeBytes}, "Check failed");
 }
@@ -32,6 +32,11 @@ class MockCommandProcessor : public CommandProcessor {
 
   MOCK_METHOD3(ProcessCommand,
                bool(const void* input_buf, size_t n_bytes_read, int fd));
+  MOCK_METHOD4(ProcessTimestampedCommand,
+               bool(const TimestampHeader& tstamp_header,
+                    const void* input_buf, size_t n_bytes_read, int fd));
+  MOCK_METHOD0(DoIdleWork, bool());
+  MOCK_METHOD0(ShrinkBuffers, void());
 
  private:
   DISALLOW_COPY_AND_ASSIGN(MockCommandProcessor);
@@ -33,12 +33,29 @@ class MockOs : public Os {
   MockOs();
   ~MockOs() override;
 
+  MOCK_METHOD0(CreateEpoll, std::tuple<int, Errno>());
+  MOCK_METHOD2(AddEpollFd, Errno(int epoll_fd, int fd));
+  MOCK_METHOD2(RemoveEpollFd, Errno(int epoll_fd, int fd));
+  MOCK_METHOD4(WaitForReadableFds,
+               std::tuple<size_t, Errno>(int epoll_fd, int* ready_fds,
+                                         size_t max_fds, int timeout_msec));
+  MOCK_METHOD0(CreateEventFd, std::tuple<int, Errno>());
+  MOCK_METHOD1(SignalEventFd, Errno(int event_fd));
+  MOCK_METHOD1(ClearEventFd, Errno(int event_fd));
   MOCK_CONST_METHOD1(GetTimestamp, Timestamp(clockid_t clock_id));
   MOCK_METHOD1(GetControlSocket,
                std::tuple<int, Errno>(const std::string& socket_name));
+  MOCK_METHOD2(MapSharedMemory,
+               std::tuple<void*, Errno>(int fd, size_t len));
+  MOCK_METHOD2(UnmapSharedMemory, void(void* addr, size_t len));
   MOCK_METHOD1(Nanosleep, void(uint32_t sleep_time_nsec));
   MOCK_METHOD3(ReceiveDatagram,
                std::tuple<size_t, Errno>(int fd, void* buf, size_t buflen));
+  MOCK_METHOD6(ReceiveDatagrams,
+               std::tuple<size_t, Errno>(int fd, uint8_t* bufs, size_t buflen,
+                                         size_t n_bufs, size_t* datagram_lens,
+                                         int* datagram_fds));
+  MOCK_METHOD1(SetNonBlocking, Errno(int fd));
   MOCK_METHOD3(Write, std::tuple<size_t, Os::Errno>(int fd, const void* buf,
                                                     size_t buflen));
 
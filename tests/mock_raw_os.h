@@ -32,10 +32,26 @@ class MockRawOs : public RawOs {
 
   MOCK_CONST_METHOD2(ClockGettime,
                      int(clockid_t clock_id, struct timespec* tspec));
+  MOCK_METHOD1(EpollCreate1, int(int flags));
+  MOCK_METHOD4(EpollCtl,
+               int(int epfd, int op, int fd, struct epoll_event* event));
+  MOCK_METHOD4(EpollWait, int(int epfd, struct epoll_event* events,
+                              int maxevents, int timeout));
+  MOCK_METHOD2(Eventfd, int(unsigned int initval, int flags));
+  MOCK_METHOD2(Fcntl, int(int fd, int cmd));
+  MOCK_METHOD3(Fcntl, int(int fd, int cmd, int arg));
+  MOCK_METHOD2(Fstat, int(int fd, struct stat* statbuf));
   MOCK_METHOD1(GetControlSocket, int(const char* socket_name));
+  MOCK_METHOD6(Mmap, void*(void* addr, size_t length, int prot, int flags,
+                           int fd, off_t offset));
+  MOCK_METHOD2(Munmap, int(void* addr, size_t length));
   MOCK_METHOD2(Nanosleep,
                int(const struct timespec* req, struct timespec* rem));
+  MOCK_METHOD3(Read, ssize_t(int fd, void* buf, size_t buflen));
   MOCK_METHOD4(Recv, ssize_t(int sockfd, void* buf, size_t buflen, int flags));
+  MOCK_METHOD5(RecvMmsg,
+               int(int sockfd, struct mmsghdr* msgvec, unsigned int vlen,
+                   int flags, struct timespec* timeout));
   MOCK_METHOD3(Write, ssize_t(int fd, const void* buf, size_t buflen));
 
  private:
@@ -14,7 +14,15 @@
  * limitations under the License.
  */
 
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+
 #include <array>
+#include <cstring>
 #include <iostream>
 #include <memory>
 #include <tuple>
@@ -54,6 +62,8 @@ using ::testing::StrictMock;
 
 using local_utils::GetMaxVal;
 
+constexpr size_t kDatagramBufferSize = 512;
+
 class OsTest : public ::testing::Test {
  public:
   OsTest() {
@@ -93,6 +103,158 @@ Matcher<const timespec&> EqualsTimespec(const timespec& expected) {
 
 }  // namespace
 
+TEST_F(OsTest, CreateEpollReturnsEpollFd) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, EpollCreate1(EPOLL_CLOEXEC)).WillOnce(Return(kFakeFd));
+
+  const std::tuple<int, Os::Errno> expected_result{kFakeFd, 0};
+  EXPECT_EQ(expected_result, os_->CreateEpoll());
+}
+
+TEST_F(OsTest, CreateEpollReturnsErrorOnFailure) {
+  EXPECT_CALL(*raw_os_, EpollCreate1(_))
+      .WillOnce(SetErrnoAndReturn(EMFILE, -1));
+
+  const std::tuple<int, Os::Errno> expected_result{-1, EMFILE};
+  EXPECT_EQ(expected_result, os_->CreateEpoll());
+}
+
+TEST_F(OsTest, AddEpollFdWatchesFdForInput) {
+  constexpr int kFakeEpollFd = 100;
+  constexpr int kFakeFd = 101;
+  EXPECT_CALL(*raw_os_, EpollCtl(kFakeEpollFd, EPOLL_CTL_ADD, kFakeFd,
+                                 NotNull()))
+      .WillOnce(Invoke([](int /* epfd */, int /* op */, int fd,
+                          struct epoll_event* event) {
+        EXPECT_EQ(static_cast<uint32_t>(EPOLLIN), event->events);
+        EXPECT_EQ(fd, event->data.fd);
+        return 0;
+      }));
+  EXPECT_EQ(0, os_->AddEpollFd(kFakeEpollFd, kFakeFd));
+}
+
+TEST_F(OsTest, AddEpollFdReturnsErrorOnFailure) {
+  EXPECT_CALL(*raw_os_, EpollCtl(_, _, _, _))
+      .WillOnce(SetErrnoAndReturn(EEXIST, -1));
+  EXPECT_EQ(EEXIST, os_->AddEpollFd(100, 101));
+}
+
+TEST_F(OsTest, RemoveEpollFdStopsWatchingFd) {
+  constexpr int kFakeEpollFd = 100;
+  constexpr int kFakeFd = 101;
+  EXPECT_CALL(*raw_os_, EpollCtl(kFakeEpollFd, EPOLL_CTL_DEL, kFakeFd, _))
+      .WillOnce(Return(0));
+  EXPECT_EQ(0, os_->RemoveEpollFd(kFakeEpollFd, kFakeFd));
+}
+
+TEST_F(OsTest, RemoveEpollFdReturnsErrorOnFailure) {
+  EXPECT_CALL(*raw_os_, EpollCtl(_, _, _, _))
+      .WillOnce(SetErrnoAndReturn(ENOENT, -1));
+  EXPECT_EQ(ENOENT, os_->RemoveEpollFd(100, 101));
+}
+
+TEST_F(OsTest, WaitForReadableFdsReturnsReadyFds) {
+  constexpr int kFakeEpollFd = 100;
+  constexpr int kTimeoutMsec = 10;
+  EXPECT_CALL(*raw_os_, EpollWait(kFakeEpollFd, NotNull(), 2, kTimeoutMsec))
+      .WillOnce(Invoke([](int /* epfd */, struct epoll_event* events,
+                          int /* maxevents */, int /* timeout */) {
+        events[0].data.fd = 101;
+        events[1].data.fd = 102;
+        return 2;
+      }));
+
+  std::array<int, 2> ready_fds{};
+  const std::tuple<size_t, Os::Errno> expected_result{2, 0};
+  EXPECT_EQ(expected_result,
+            os_->WaitForReadableFds(kFakeEpollFd, ready_fds.data(),
+                                    ready_fds.size(), kTimeoutMsec));
+  EXPECT_EQ(101, ready_fds[0]);
+  EXPECT_EQ(102, ready_fds[1]);
+}
+
+TEST_F(OsTest, WaitForReadableFdsReturnsZeroOnTimeout) {
+  EXPECT_CALL(*raw_os_, EpollWait(_, _, _, _)).WillOnce(Return(0));
+
+  std::array<int, 1> ready_fds{};
+  const std::tuple<size_t, Os::Errno> expected_result{0, 0};
+  EXPECT_EQ(expected_result, os_->WaitForReadableFds(100, ready_fds.data(),
+                                                     ready_fds.size(), 0));
+}
+
+TEST_F(OsTest, WaitForReadableFdsReturnsErrorOnFailure) {
+  EXPECT_CALL(*raw_os_, EpollWait(_, _, _, _))
+      .WillOnce(SetErrnoAndReturn(EINTR, -1));
+
+  std::array<int, 1> ready_fds{};
+  const std::tuple<size_t, Os::Errno> expected_result{0, EINTR};
+  EXPECT_EQ(expected_result, os_->WaitForReadableFds(100, ready_fds.data(),
+                                                     ready_fds.size(), -1));
+}
+
+TEST_F(OsTest, CreateEventFdReturnsNonBlockingEventFd) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK))
+      .WillOnce(Return(kFakeFd));
+
+  const std::tuple<int, Os::Errno> expected_result{kFakeFd, 0};
+  EXPECT_EQ(expected_result, os_->CreateEventFd());
+}
+
+TEST_F(OsTest, CreateEventFdReturnsErrorOnFailure) {
+  EXPECT_CALL(*raw_os_, Eventfd(_, _)).WillOnce(SetErrnoAndReturn(EMFILE, -1));
+
+  const std::tuple<int, Os::Errno> expected_result{-1, EMFILE};
+  EXPECT_EQ(expected_result, os_->CreateEventFd());
+}
+
+TEST_F(OsTest, SignalEventFdIncrementsCounter) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Write(kFakeFd, NotNull(), sizeof(uint64_t)))
+      .WillOnce(Invoke([](int /* fd */, const void* buf, size_t buflen) {
+        uint64_t increment;
+        std::memcpy(&increment, buf, sizeof(increment));
+        EXPECT_EQ(1U, increment);
+        return buflen;
+      }));
+  EXPECT_EQ(0, os_->SignalEventFd(kFakeFd));
+}
+
+TEST_F(OsTest, SignalEventFdIgnoresSaturatedCounter) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Write(kFakeFd, _, _))
+      .WillOnce(SetErrnoAndReturn(EAGAIN, -1));
+  EXPECT_EQ(0, os_->SignalEventFd(kFakeFd));
+}
+
+TEST_F(OsTest, SignalEventFdReturnsErrorOnFailure) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Write(kFakeFd, _, _))
+      .WillOnce(SetErrnoAndReturn(EBADF, -1));
+  EXPECT_EQ(EBADF, os_->SignalEventFd(kFakeFd));
+}
+
+TEST_F(OsTest, ClearEventFdReadsCounter) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Read(kFakeFd, NotNull(), sizeof(uint64_t)))
+      .WillOnce(Return(sizeof(uint64_t)));
+  EXPECT_EQ(0, os_->ClearEventFd(kFakeFd));
+}
+
+TEST_F(OsTest, ClearEventFdIgnoresUnsignalledEventFd) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Read(kFakeFd, _, _))
+      .WillOnce(SetErrnoAndReturn(EAGAIN, -1));
+  EXPECT_EQ(0, os_->ClearEventFd(kFakeFd));
+}
+
+TEST_F(OsTest, ClearEventFdReturnsErrorOnFailure) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Read(kFakeFd, _, _))
+      .WillOnce(SetErrnoAndReturn(EBADF, -1));
+  EXPECT_EQ(EBADF, os_->ClearEventFd(kFakeFd));
+}
+
 TEST_F(OsTest, GetControlSocketReturnsFdAndZeroOnSuccess) {
   constexpr char kSocketName[] = "fake-daemon";
   constexpr int kFakeValidFd = 100;
@@ -125,6 +287,79 @@ TEST_F(OsTest, GetTimestampSucceeds) {
   EXPECT_EQ(kFakeNsecs, received.nsecs);
 }
 
+TEST_F(OsTest, MapSharedMemoryMapsSealedMemory) {
+  constexpr int kFakeFd = 100;
+  constexpr size_t kMappingLen = 8192;
+  uint8_t fake_mapping;
+  struct stat fake_stat {};
+  fake_stat.st_size = kMappingLen;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GET_SEALS))
+      .WillOnce(Return(F_SEAL_SHRINK | F_SEAL_SEAL));
+  EXPECT_CALL(*raw_os_, Fstat(kFakeFd, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(fake_stat), Return(0)));
+  EXPECT_CALL(*raw_os_, Mmap(nullptr, kMappingLen, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, kFakeFd, 0))
+      .WillOnce(Return(&fake_mapping));
+
+  const std::tuple<void*, Os::Errno> expected_result{&fake_mapping, 0};
+  EXPECT_EQ(expected_result, os_->MapSharedMemory(kFakeFd, kMappingLen));
+}
+
+TEST_F(OsTest, MapSharedMemoryRejectsMemoryWhichCanShrink) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GET_SEALS))
+      .WillOnce(Return(F_SEAL_GROW));
+
+  const std::tuple<void*, Os::Errno> expected_result{nullptr, EPERM};
+  EXPECT_EQ(expected_result, os_->MapSharedMemory(kFakeFd, 8192));
+}
+
+TEST_F(OsTest, MapSharedMemoryRejectsMemoryShorterThanMapping) {
+  constexpr int kFakeFd = 100;
+  constexpr size_t kMappingLen = 8192;
+  struct stat fake_stat {};
+  fake_stat.st_size = kMappingLen - 1;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GET_SEALS))
+      .WillOnce(Return(F_SEAL_SHRINK));
+  EXPECT_CALL(*raw_os_, Fstat(kFakeFd, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(fake_stat), Return(0)));
+
+  const std::tuple<void*, Os::Errno> expected_result{nullptr, EPERM};
+  EXPECT_EQ(expected_result, os_->MapSharedMemory(kFakeFd, kMappingLen));
+}
+
+TEST_F(OsTest, MapSharedMemoryReturnsErrorIfSealsCannotBeRead) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GET_SEALS))
+      .WillOnce(SetErrnoAndReturn(EINVAL, -1));
+
+  const std::tuple<void*, Os::Errno> expected_result{nullptr, EINVAL};
+  EXPECT_EQ(expected_result, os_->MapSharedMemory(kFakeFd, 8192));
+}
+
+TEST_F(OsTest, MapSharedMemoryReturnsErrorIfMmapFails) {
+  constexpr int kFakeFd = 100;
+  constexpr size_t kMappingLen = 8192;
+  struct stat fake_stat {};
+  fake_stat.st_size = kMappingLen;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GET_SEALS))
+      .WillOnce(Return(F_SEAL_SHRINK));
+  EXPECT_CALL(*raw_os_, Fstat(kFakeFd, _))
+      .WillOnce(DoAll(SetArgumentPointee<1>(fake_stat), Return(0)));
+  EXPECT_CALL(*raw_os_, Mmap(_, _, _, _, _, _))
+      .WillOnce(SetErrnoAndReturn(ENOMEM, MAP_FAILED));
+
+  const std::tuple<void*, Os::Errno> expected_result{nullptr, ENOMEM};
+  EXPECT_EQ(expected_result, os_->MapSharedMemory(kFakeFd, kMappingLen));
+}
+
+TEST_F(OsTest, UnmapSharedMemoryUnmapsMemory) {
+  constexpr size_t kMappingLen = 8192;
+  uint8_t fake_mapping;
+  EXPECT_CALL(*raw_os_, Munmap(&fake_mapping, kMappingLen)).WillOnce(Return(0));
+  os_->UnmapSharedMemory(&fake_mapping, kMappingLen);
+}
+
 TEST_F(OsTest, NanosleepPassesNormalValueToSyscall) {
   constexpr auto kSleepTimeNsec = 100;
   EXPECT_CALL(*raw_os_,
@@ -251,6 +486,141 @@ TEST_F(OsTest, ReceieveDatagramReturnsCorrectValueOnFailure) {
             os_->ReceiveDatagram(kFakeFd, buffer.data(), buffer.size()));
 }
 
+TEST_F(OsTest, ReceiveDatagramsPassesBuffersToSyscall) {
+  constexpr int kFakeFd = 100;
+  constexpr size_t kNumBuffers = 3;
+  std::array<uint8_t, kDatagramBufferSize * kNumBuffers> buffers{};
+  std::array<size_t, kNumBuffers> datagram_lens{};
+  std::array<int, kNumBuffers> datagram_fds{};
+  EXPECT_CALL(*raw_os_,
+              RecvMmsg(kFakeFd, NotNull(), kNumBuffers,
+                       MSG_TRUNC | MSG_WAITFORONE | MSG_CMSG_CLOEXEC, nullptr))
+      .WillOnce(Invoke([&buffers](int /* sockfd */, struct mmsghdr* msgvec,
+                                  unsigned int vlen, int /* flags */,
+                                  struct timespec* /* timeout */) {
+        for (size_t i = 0; i < vlen; ++i) {
+          EXPECT_EQ(1U, msgvec[i].msg_hdr.msg_iovlen);
+          EXPECT_EQ(buffers.data() + i * kDatagramBufferSize,
+                    msgvec[i].msg_hdr.msg_iov->iov_base);
+          EXPECT_EQ(kDatagramBufferSize, msgvec[i].msg_hdr.msg_iov->iov_len);
+          EXPECT_NE(nullptr, msgvec[i].msg_hdr.msg_control);
+          EXPECT_GE(msgvec[i].msg_hdr.msg_controllen, CMSG_SPACE(sizeof(int)));
+        }
+        return 0;
+      }));
+  os_->ReceiveDatagrams(kFakeFd, buffers.data(), kDatagramBufferSize,
+                        kNumBuffers, datagram_lens.data(), datagram_fds.data());
+}
+
+TEST_F(OsTest, ReceiveDatagramsReturnsCorrectValuesForPartialBatch) {
+  constexpr int kFakeFd = 100;
+  constexpr size_t kNumBuffers = 3;
+  std::array<uint8_t, kDatagramBufferSize * kNumBuffers> buffers{};
+  std::array<size_t, kNumBuffers> datagram_lens{};
+  std::array<int, kNumBuffers> datagram_fds{};
+  EXPECT_CALL(*raw_os_, RecvMmsg(kFakeFd, _, kNumBuffers, _, _))
+      .WillOnce(Invoke([](int /* sockfd */, struct mmsghdr* msgvec,
+                          unsigned int /* vlen */, int /* flags */,
+                          struct timespec* /* timeout */) {
+        msgvec[0].msg_len = kDatagramBufferSize;
+        msgvec[0].msg_hdr.msg_controllen = 0;
+        msgvec[1].msg_len = kDatagramBufferSize * 2;  // Oversized datagram.
+        msgvec[1].msg_hdr.msg_controllen = 0;
+        return 2;
+      }));
+
+  constexpr std::tuple<size_t, Os::Errno> kExpectedResult{2, 0};
+  EXPECT_EQ(kExpectedResult,
+            os_->ReceiveDatagrams(kFakeFd, buffers.data(), kDatagramBufferSize,
+                                  kNumBuffers, datagram_lens.data(),
+                                  datagram_fds.data()));
+  EXPECT_EQ(kDatagramBufferSize, datagram_lens[0]);
+  EXPECT_EQ(kDatagramBufferSize * 2, datagram_lens[1]);
+  EXPECT_EQ(Os::kInvalidFd, datagram_fds[0]);
+  EXPECT_EQ(Os::kInvalidFd, datagram_fds[1]);
+}
+
+TEST_F(OsTest, ReceiveDatagramsReturnsPassedFileDescriptor) {
+  constexpr int kFakeFd = 100;
+  constexpr int kPassedFd = 200;
+  constexpr size_t kNumBuffers = 2;
+  std::array<uint8_t, kDatagramBufferSize * kNumBuffers> buffers{};
+  std::array<size_t, kNumBuffers> datagram_lens{};
+  std::array<int, kNumBuffers> datagram_fds{};
+  EXPECT_CALL(*raw_os_, RecvMmsg(kFakeFd, _, kNumBuffers, _, _))
+      .WillOnce(Invoke([](int /* sockfd */, struct mmsghdr* msgvec,
+                          unsigned int /* vlen */, int /* flags */,
+                          struct timespec* /* timeout */) {
+        // The first datagram carries no descriptor.
+        msgvec[0].msg_len = 1;
+        msgvec[0].msg_hdr.msg_controllen = 0;
+
+        // The second datagram carries a descriptor.
+        msgvec[1].msg_len = 1;
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgvec[1].msg_hdr);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        const int passed_fd = kPassedFd;
+        std::memcpy(CMSG_DATA(cmsg), &passed_fd, sizeof(passed_fd));
+        msgvec[1].msg_hdr.msg_controllen = CMSG_SPACE(sizeof(int));
+        return 2;
+      }));
+
+  constexpr std::tuple<size_t, Os::Errno> kExpectedResult{2, 0};
+  EXPECT_EQ(kExpectedResult,
+            os_->ReceiveDatagrams(kFakeFd, buffers.data(), kDatagramBufferSize,
+                                  kNumBuffers, datagram_lens.data(),
+                                  datagram_fds.data()));
+  EXPECT_EQ(Os::kInvalidFd, datagram_fds[0]);
+  EXPECT_EQ(kPassedFd, datagram_fds[1]);
+}
+
+TEST_F(OsTest, ReceiveDatagramsReturnsCorrectValueOnFailure) {
+  constexpr int kFakeFd = 100;
+  constexpr Os::Errno kError = EBADF;
+  std::array<uint8_t, 512> buffer{};
+  size_t datagram_len = 0;
+  int datagram_fd = Os::kInvalidFd;
+  EXPECT_CALL(*raw_os_, RecvMmsg(kFakeFd, _, 1, _, _))
+      .WillOnce(SetErrnoAndReturn(kError, -1));
+
+  constexpr std::tuple<size_t, Os::Errno> kExpectedResult{0, kError};
+  EXPECT_EQ(kExpectedResult,
+            os_->ReceiveDatagrams(kFakeFd, buffer.data(), buffer.size(), 1,
+                                  &datagram_len, &datagram_fd));
+}
+
+TEST_F(OsTest, SetNonBlockingSetsFlag) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GETFL)).WillOnce(Return(O_WRONLY));
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_SETFL, O_WRONLY | O_NONBLOCK))
+      .WillOnce(Return(0));
+  EXPECT_EQ(0, os_->SetNonBlocking(kFakeFd));
+}
+
+TEST_F(OsTest, SetNonBlockingSkipsFdWhichIsAlreadyNonBlocking) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GETFL))
+      .WillOnce(Return(O_WRONLY | O_NONBLOCK));
+  EXPECT_EQ(0, os_->SetNonBlocking(kFakeFd));
+}
+
+TEST_F(OsTest, SetNonBlockingReturnsErrorIfFlagsCannotBeRead) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GETFL))
+      .WillOnce(SetErrnoAndReturn(EBADF, -1));
+  EXPECT_EQ(EBADF, os_->SetNonBlocking(kFakeFd));
+}
+
+TEST_F(OsTest, SetNonBlockingReturnsErrorIfFlagsCannotBeSet) {
+  constexpr int kFakeFd = 100;
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_GETFL)).WillOnce(Return(O_WRONLY));
+  EXPECT_CALL(*raw_os_, Fcntl(kFakeFd, F_SETFL, _))
+      .WillOnce(SetErrnoAndReturn(EINVAL, -1));
+  EXPECT_EQ(EINVAL, os_->SetNonBlocking(kFakeFd));
+}
+
 TEST_F(OsTest, WriteReturnsCorrectValueForSuccessfulWrite) {
   constexpr int kFakeFd = 100;
   constexpr std::array<uint8_t, 8192> buffer{};
@@ -328,6 +698,30 @@ TEST_F(OsDeathTest, NanosleepUnexpectedErrorCausesDeath) {
   EXPECT_DEATH(os_->Nanosleep(Os::kMaxNanos), "Unexpected error");
 }
 
+TEST_F(OsDeathTest, UnmapSharedMemoryUnexpectedErrorCausesDeath) {
+  uint8_t fake_mapping;
+  ON_CALL(*raw_os_, Munmap(_, _)).WillByDefault(SetErrnoAndReturn(EINVAL, -1));
+  EXPECT_DEATH(os_->UnmapSharedMemory(&fake_mapping, 1), "Unexpected error");
+}
+
+TEST_F(OsDeathTest, WaitForReadableFdsWithZeroFdsCausesDeath) {
+  int ready_fd;
+  EXPECT_DEATH(os_->WaitForReadableFds(100, &ready_fd, 0, -1), "Check failed");
+}
+
+TEST_F(OsDeathTest, WaitForReadableFdsWithTooManyFdsCausesDeath) {
+  std::array<int, Os::kMaxReadyFds + 1> ready_fds{};
+  EXPECT_DEATH(os_->WaitForReadableFds(100, ready_fds.data(),
+                                       ready_fds.size(), -1),
+               "Check failed");
+}
+
+TEST_F(OsDeathTest, WaitForReadableFdsWithOverrunCausesDeath) {
+  int ready_fd;
+  ON_CALL(*raw_os_, EpollWait(_, _, 1, _)).WillByDefault(Return(2));
+  EXPECT_DEATH(os_->WaitForReadableFds(100, &ready_fd, 1, -1), "Check failed");
+}
+
 TEST_F(OsDeathTest, ReceiveDatagramWithOverlyLargeBufferCausesDeath) {
   constexpr int kFakeFd = 100;
   std::array<uint8_t, 8192> buffer{};
@@ -336,6 +730,38 @@ TEST_F(OsDeathTest, ReceiveDatagramWithOverlyLargeBufferCausesDeath) {
       "Check failed");
 }
 
+TEST_F(OsDeathTest, ReceiveDatagramsWithZeroBuffersCausesDeath) {
+  constexpr int kFakeFd = 100;
+  std::array<uint8_t, 512> buffer{};
+  size_t datagram_len;
+  int datagram_fd;
+  EXPECT_DEATH(os_->ReceiveDatagrams(kFakeFd, buffer.data(), buffer.size(), 0,
+                                     &datagram_len, &datagram_fd),
+               "Check failed");
+}
+
+TEST_F(OsDeathTest, ReceiveDatagramsWithTooManyBuffersCausesDeath) {
+  constexpr int kFakeFd = 100;
+  std::array<uint8_t, 512> buffer{};
+  size_t datagram_len;
+  int datagram_fd;
+  EXPECT_DEATH(os_->ReceiveDatagrams(kFakeFd, buffer.data(), 1,
+                                     Os::kMaxDatagramBatchSize + 1,
+                                     &datagram_len, &datagram_fd),
+               "Check failed");
+}
+
+TEST_F(OsDeathTest, ReceiveDatagramsWithOverrunCausesDeath) {
+  constexpr int kFakeFd = 100;
+  std::array<uint8_t, 512> buffer{};
+  size_t datagram_len;
+  int datagram_fd;
+  ON_CALL(*raw_os_, RecvMmsg(kFakeFd, _, 1, _, _)).WillByDefault(Return(2));
+  EXPECT_DEATH(os_->ReceiveDatagrams(kFakeFd, buffer.data(), buffer.size(), 1,
+                                     &datagram_len, &datagram_fd),
+               "Check failed");
+}
+
 TEST_F(OsDeathTest, WriteWithOverlyLargeBufferCausesDeath) {
   constexpr int kFakeFd = 100;
   constexpr std::array<uint8_t, 8192> buffer{};
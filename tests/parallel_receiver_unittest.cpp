@@ -0,0 +1,240 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstring>
+#include <memory>
+#include <vector>
+
+#include "android-base/unique_fd.h"
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "wifilogd/tests/mock_command_processor.h"
+
+#include "wifilogd/command_processor.h"
+#include "wifilogd/os.h"
+#include "wifilogd/parallel_receiver.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using ::android::base::unique_fd;
+using ::testing::_;
+using ::testing::AnyNumber;
+using ::testing::Invoke;
+using ::testing::StrictMock;
+
+constexpr size_t kBufferSizeBytes = protocol::kMaxMessageSize * 16;
+constexpr size_t kReceiveBatchSize = 4;
+constexpr int kWaitTimeoutMsec = 5000;
+
+// Returns a minimal kWriteAsciiMessage command, with no tag or data.
+std::vector<uint8_t> BuildEmptyAsciiMessageCommand() {
+  const auto ascii_message = protocol::AsciiMessage();
+  const auto command = protocol::Command()
+                           .set_opcode(protocol::Opcode::kWriteAsciiMessage)
+                           .set_payload_len(sizeof(ascii_message));
+  std::vector<uint8_t> buf(sizeof(command) + sizeof(ascii_message));
+  std::memcpy(buf.data(), &command, sizeof(command));
+  std::memcpy(buf.data() + sizeof(command), &ascii_message,
+              sizeof(ascii_message));
+  return buf;
+}
+
+class ParallelReceiverTest : public ::testing::Test {
+ public:
+  ParallelReceiverTest() : os_(), control_socket_(), client_socket_() {
+    int socket_fds[2];
+    EXPECT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0,
+                            socket_fds));
+    control_socket_.reset(socket_fds[0]);
+    client_socket_.reset(socket_fds[1]);
+    EXPECT_EQ(0, os_.SetNonBlocking(control_socket_.get()));
+  }
+
+ protected:
+  std::unique_ptr<ParallelReceiver> MakeReceiver(size_t n_threads) {
+    return std::make_unique<ParallelReceiver>(
+        &os_, control_socket_.get(), n_threads, kReceiveBatchSize,
+        Timestamper::Mode::kReadAllClocks);
+  }
+
+  void SendDatagram(const std::vector<uint8_t>& buf) {
+    ASSERT_EQ(static_cast<ssize_t>(buf.size()),
+              send(client_socket_.get(), buf.data(), buf.size(), 0));
+  }
+
+  // Sends |buf|, with a duplicate of |fd| as SCM_RIGHTS ancillary data.
+  void SendDatagramWithFd(const std::vector<uint8_t>& buf, int fd) {
+    union {
+      struct cmsghdr align;
+      uint8_t buf[CMSG_SPACE(sizeof(int))];
+    } control_buf{};
+    struct iovec iov {};
+    iov.iov_base = const_cast<uint8_t*>(buf.data());
+    iov.iov_len = buf.size();
+    struct msghdr msg {};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control_buf.buf;
+    msg.msg_controllen = sizeof(control_buf.buf);
+    struct cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(fd));
+    ASSERT_EQ(static_cast<ssize_t>(buf.size()),
+              sendmsg(client_socket_.get(), &msg, 0));
+  }
+
+  // Processes staged commands, as they arrive, until |n_commands| have
+  // been processed. Returns the number processed, which is smaller than
+  // |n_commands| only if we gave up waiting.
+  size_t ProcessCommands(ParallelReceiver* receiver,
+                         CommandProcessor* command_processor,
+                         size_t n_commands) {
+    size_t n_processed = 0;
+    while (n_processed < n_commands) {
+      struct pollfd wakeup {};
+      wakeup.fd = receiver->GetWakeupFd();
+      wakeup.events = POLLIN;
+      if (poll(&wakeup, 1, kWaitTimeoutMsec) != 1) {
+        break;
+      }
+      n_processed += receiver->ProcessStagedCommands(command_processor);
+    }
+    return n_processed;
+  }
+
+  Os os_;
+  unique_fd control_socket_;
+  unique_fd client_socket_;
+};
+
+}  // namespace
+
+TEST_F(ParallelReceiverTest, ProcessesEveryCommand) {
+  constexpr size_t kNumCommands = 200;
+  CommandProcessor command_processor(kBufferSizeBytes);
+  auto receiver = MakeReceiver(4);
+  const auto command = BuildEmptyAsciiMessageCommand();
+  for (size_t i = 0; i < kNumCommands; ++i) {
+    SendDatagram(command);
+  }
+  EXPECT_EQ(kNumCommands,
+            ProcessCommands(receiver.get(), &command_processor, kNumCommands));
+  EXPECT_EQ(kNumCommands, command_processor.GetStats().n_messages_logged);
+  EXPECT_EQ(kNumCommands, receiver->GetNumDatagramsReceived());
+  EXPECT_LE(receiver->GetNumBatchesReceived(), kNumCommands);
+}
+
+TEST_F(ParallelReceiverTest, ProcessesCommandsInTimestampOrder) {
+  constexpr size_t kNumCommands = 200;
+  StrictMock<MockCommandProcessor> command_processor;
+  int64_t last_boottime_nsec = 0;
+  size_t n_out_of_order = 0;
+  EXPECT_CALL(command_processor, ProcessTimestampedCommand(_, _, _, _))
+      .Times(AnyNumber())
+      .WillRepeatedly(Invoke([&last_boottime_nsec, &n_out_of_order](
+          const TimestampHeader& tstamp_header, const void* /* input_buf */,
+          size_t /* n_bytes_read */, int /* fd */) {
+        const int64_t boottime_nsec =
+            tstamp_header.since_boot_with_sleep.ToNsec();
+        if (boottime_nsec < last_boottime_nsec) {
+          ++n_out_of_order;
+        }
+        last_boottime_nsec = boottime_nsec;
+        return true;
+      }));
+
+  auto receiver = MakeReceiver(4);
+  const auto command = BuildEmptyAsciiMessageCommand();
+  for (size_t i = 0; i < kNumCommands; ++i) {
+    SendDatagram(command);
+  }
+  // Wait for every command to be staged before processing any, so that
+  // a single call merges them all.
+  size_t n_staged = 0;
+  while (n_staged < kNumCommands) {
+    struct pollfd wakeup {};
+    wakeup.fd = receiver->GetWakeupFd();
+    wakeup.events = POLLIN;
+    ASSERT_EQ(1, poll(&wakeup, 1, kWaitTimeoutMsec));
+    n_staged += receiver->ProcessStagedCommands(&command_processor);
+  }
+  EXPECT_EQ(0U, n_out_of_order);
+}
+
+TEST_F(ParallelReceiverTest, PassesReceivedFdToCommandProcessor) {
+  int pipe_fds[2];
+  ASSERT_EQ(0, pipe(pipe_fds));
+  unique_fd read_end(pipe_fds[0]);
+  unique_fd write_end(pipe_fds[1]);
+
+  StrictMock<MockCommandProcessor> command_processor;
+  int received_fd = Os::kInvalidFd;
+  EXPECT_CALL(command_processor, ProcessTimestampedCommand(_, _, _, _))
+      .WillOnce(Invoke([&received_fd](const TimestampHeader& /* header */,
+                                      const void* /* input_buf */,
+                                      size_t /* n_bytes_read */, int fd) {
+        received_fd = fd;
+        return true;
+      }));
+  auto receiver = MakeReceiver(1);
+  SendDatagramWithFd(BuildEmptyAsciiMessageCommand(), write_end.get());
+  ASSERT_EQ(1U, ProcessCommands(receiver.get(), &command_processor, 1));
+  EXPECT_NE(Os::kInvalidFd, received_fd);
+  unique_fd wrapped_received_fd(received_fd);
+}
+
+TEST_F(ParallelReceiverTest, CountsTruncatedDatagrams) {
+  CommandProcessor command_processor(kBufferSizeBytes);
+  auto receiver = MakeReceiver(2);
+  auto command = BuildEmptyAsciiMessageCommand();
+  command.resize(protocol::kMaxMessageSize + 1);
+  SendDatagram(command);
+  ASSERT_EQ(1U, ProcessCommands(receiver.get(), &command_processor, 1));
+  EXPECT_EQ(1U, command_processor.GetStats().n_datagrams_truncated);
+}
+
+TEST_F(ParallelReceiverTest, DestructorClosesFdsOfUnprocessedCommands) {
+  int pipe_fds[2];
+  ASSERT_EQ(0, pipe(pipe_fds));
+  unique_fd read_end(pipe_fds[0]);
+  unique_fd write_end(pipe_fds[1]);
+
+  auto receiver = MakeReceiver(1);
+  SendDatagramWithFd(BuildEmptyAsciiMessageCommand(), write_end.get());
+  write_end.reset();
+  struct pollfd wakeup {};
+  wakeup.fd = receiver->GetWakeupFd();
+  wakeup.events = POLLIN;
+  ASSERT_EQ(1, poll(&wakeup, 1, kWaitTimeoutMsec));
+  receiver.reset();
+
+  // With every copy of the write end closed, the read end sees EOF.
+  char byte;
+  EXPECT_EQ(0, read(read_end.get(), &byte, sizeof(byte)));
+}
+
+}  // namespace wifilogd
+}  // namespace android
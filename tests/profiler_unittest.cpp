@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/profiler.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+class ProfilerTest : public ::testing::Test {
+ public:
+  ProfilerTest() : profiler_() {}
+
+ protected:
+  Profiler profiler_;
+};
+
+}  // namespace
+
+TEST_F(ProfilerTest, NewProfilerHasNoCalls) {
+  for (size_t i = 0; i < kNumProfiledStages; ++i) {
+    const StageProfile profile =
+        profiler_.GetStageProfile(static_cast<ProfiledStage>(i));
+    EXPECT_EQ(0U, profile.n_calls);
+    EXPECT_EQ(0U, profile.total_nsec);
+    EXPECT_EQ(0U, profile.max_nsec);
+  }
+}
+
+TEST_F(ProfilerTest, RecordAccumulatesPerStage) {
+  profiler_.Record(ProfiledStage::kCopyCommandToLog, 10);
+  profiler_.Record(ProfiledStage::kCopyCommandToLog, 30);
+  profiler_.Record(ProfiledStage::kDumpWrite, 5);
+
+  const StageProfile copy_profile =
+      profiler_.GetStageProfile(ProfiledStage::kCopyCommandToLog);
+  EXPECT_EQ(2U, copy_profile.n_calls);
+  EXPECT_EQ(40U, copy_profile.total_nsec);
+  EXPECT_EQ(30U, copy_profile.max_nsec);
+
+  const StageProfile write_profile =
+      profiler_.GetStageProfile(ProfiledStage::kDumpWrite);
+  EXPECT_EQ(1U, write_profile.n_calls);
+  EXPECT_EQ(5U, write_profile.max_nsec);
+  EXPECT_EQ(0U, profiler_.GetStageProfile(ProfiledStage::kDumpFormat).n_calls);
+}
+
+TEST_F(ProfilerTest, MaxDoesNotDecrease) {
+  profiler_.Record(ProfiledStage::kGetTimestamps, 30);
+  profiler_.Record(ProfiledStage::kGetTimestamps, 10);
+  EXPECT_EQ(30U,
+            profiler_.GetStageProfile(ProfiledStage::kGetTimestamps).max_nsec);
+}
+
+TEST_F(ProfilerTest, ScopeRecordsOneCall) {
+  const int64_t start_nsec = Profiler::GetTimeNsec();
+  { Profiler::Scope scope(&profiler_, ProfiledStage::kReceiveDatagram); }
+  const int64_t elapsed_nsec = Profiler::GetTimeNsec() - start_nsec;
+
+  const StageProfile profile =
+      profiler_.GetStageProfile(ProfiledStage::kReceiveDatagram);
+  EXPECT_EQ(1U, profile.n_calls);
+  EXPECT_LE(profile.total_nsec, static_cast<uint64_t>(elapsed_nsec));
+}
+
+TEST_F(ProfilerTest, RecordIsSafeAcrossThreads) {
+  constexpr size_t kNumThreads = 4;
+  constexpr size_t kNumRecordsPerThread = 1000;
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < kNumThreads; ++i) {
+    threads.emplace_back([this, i]() {
+      for (size_t j = 0; j < kNumRecordsPerThread; ++j) {
+        profiler_.Record(ProfiledStage::kBufferReserve, i + 1);
+      }
+    });
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  const StageProfile profile =
+      profiler_.GetStageProfile(ProfiledStage::kBufferReserve);
+  EXPECT_EQ(kNumThreads * kNumRecordsPerThread, profile.n_calls);
+  EXPECT_EQ((1 + 2 + 3 + 4) * kNumRecordsPerThread, profile.total_nsec);
+  EXPECT_EQ(kNumThreads, profile.max_nsec);
+}
+
+TEST(ProfilerStageNameTest, EveryStageHasAName) {
+  for (size_t i = 0; i < kNumProfiledStages; ++i) {
+    const char* const name =
+        GetProfiledStageName(static_cast<ProfiledStage>(i));
+    EXPECT_STRNE("unknown", name);
+    EXPECT_LE(std::strlen(name), kMaxProfiledStageNameLen);
+  }
+}
+
+TEST(ProfilerStageNameTest, NumProfiledStagesCoversEveryStage) {
+  EXPECT_EQ(kNumProfiledStages - 1,
+            static_cast<size_t>(ProfiledStage::kDumpWrite));
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -70,6 +70,154 @@ TEST(ProtocolTest, AsciiMessageLayoutIsUnchanged) {
   EXPECT_EQ(4U, sizeof(AsciiMessage));
 }
 
+TEST(ProtocolTest, StructuredMessageChainingWorks) {
+  using protocol::MessageSeverity;
+  using protocol::StructuredMessage;
+  const auto structured_message_header =
+      StructuredMessage().set_format_id(5).set_tag_len(3).set_severity(
+          MessageSeverity::kWarning);
+  EXPECT_EQ(5U, structured_message_header.format_id);
+  EXPECT_EQ(3U, structured_message_header.tag_len);
+  EXPECT_EQ(MessageSeverity::kWarning, structured_message_header.severity);
+}
+
+TEST(ProtocolTest, StructuredMessageLayoutIsUnchanged) {
+  using protocol::StructuredMessage;
+  ASSERT_TRUE(std::is_standard_layout<StructuredMessage>::value);
+
+  EXPECT_EQ(0U, offsetof(StructuredMessage, format_id));
+  EXPECT_EQ(2U, sizeof(StructuredMessage::format_id));
+
+  EXPECT_EQ(2U, offsetof(StructuredMessage, tag_len));
+  EXPECT_EQ(1U, sizeof(StructuredMessage::tag_len));
+
+  EXPECT_EQ(3U, offsetof(StructuredMessage, severity));
+  EXPECT_EQ(1U, sizeof(StructuredMessage::severity));
+
+  EXPECT_EQ(4U, sizeof(StructuredMessage));
+}
+
+TEST(ProtocolTest, DumpCursorChainingWorks) {
+  using protocol::DumpCursor;
+  const auto cursor =
+      DumpCursor().set_next_record(0, 5).set_next_record(4, 7);
+  EXPECT_EQ(5U, cursor.next_record[0]);
+  EXPECT_EQ(0U, cursor.next_record[1]);
+  EXPECT_EQ(7U, cursor.next_record[4]);
+}
+
+TEST(ProtocolTest, DumpCursorLayoutIsUnchanged) {
+  using protocol::DumpCursor;
+  ASSERT_TRUE(std::is_standard_layout<DumpCursor>::value);
+
+  EXPECT_EQ(0U, offsetof(DumpCursor, next_record));
+  EXPECT_EQ(40U, sizeof(DumpCursor::next_record));
+  EXPECT_EQ(40U, sizeof(DumpCursor));
+}
+
+TEST(ProtocolTest, DumpQueryChainingWorks) {
+  using protocol::DumpQuery;
+  using protocol::MessageSeverity;
+  const auto query = DumpQuery()
+                         .set_min_boottime_nsec(1)
+                         .set_max_boottime_nsec(2)
+                         .set_min_realtime_nsec(3)
+                         .set_max_realtime_nsec(4)
+                         .set_min_severity(MessageSeverity::kTrace)
+                         .set_tag_len(5);
+  EXPECT_EQ(1U, query.min_boottime_nsec);
+  EXPECT_EQ(2U, query.max_boottime_nsec);
+  EXPECT_EQ(3U, query.min_realtime_nsec);
+  EXPECT_EQ(4U, query.max_realtime_nsec);
+  EXPECT_EQ(MessageSeverity::kTrace, query.min_severity);
+  EXPECT_EQ(5U, query.tag_len);
+}
+
+TEST(ProtocolTest, DumpQueryLayoutIsUnchanged) {
+  using protocol::DumpQuery;
+  ASSERT_TRUE(std::is_standard_layout<DumpQuery>::value);
+
+  EXPECT_EQ(0U, offsetof(DumpQuery, min_boottime_nsec));
+  EXPECT_EQ(8U, sizeof(DumpQuery::min_boottime_nsec));
+
+  EXPECT_EQ(8U, offsetof(DumpQuery, max_boottime_nsec));
+  EXPECT_EQ(8U, sizeof(DumpQuery::max_boottime_nsec));
+
+  EXPECT_EQ(16U, offsetof(DumpQuery, min_realtime_nsec));
+  EXPECT_EQ(8U, sizeof(DumpQuery::min_realtime_nsec));
+
+  EXPECT_EQ(24U, offsetof(DumpQuery, max_realtime_nsec));
+  EXPECT_EQ(8U, sizeof(DumpQuery::max_realtime_nsec));
+
+  EXPECT_EQ(32U, offsetof(DumpQuery, min_severity));
+  EXPECT_EQ(1U, sizeof(DumpQuery::min_severity));
+
+  EXPECT_EQ(33U, offsetof(DumpQuery, tag_len));
+  EXPECT_EQ(1U, sizeof(DumpQuery::tag_len));
+
+  EXPECT_EQ(34U, offsetof(DumpQuery, reserved));
+  EXPECT_EQ(6U, sizeof(DumpQuery::reserved));
+
+  EXPECT_EQ(40U, sizeof(DumpQuery));
+}
+
+TEST(ProtocolTest, RepeatedMessageChainingWorks) {
+  using protocol::RepeatedMessage;
+  const auto repeated_message_header =
+      RepeatedMessage().set_n_repeats(5).set_tag_len(3);
+  EXPECT_EQ(5U, repeated_message_header.n_repeats);
+  EXPECT_EQ(3U, repeated_message_header.tag_len);
+}
+
+TEST(ProtocolTest, RepeatedMessageLayoutIsUnchanged) {
+  using protocol::RepeatedMessage;
+  ASSERT_TRUE(std::is_standard_layout<RepeatedMessage>::value);
+
+  EXPECT_EQ(0U, offsetof(RepeatedMessage, n_repeats));
+  EXPECT_EQ(4U, sizeof(RepeatedMessage::n_repeats));
+
+  EXPECT_EQ(4U, offsetof(RepeatedMessage, tag_len));
+  EXPECT_EQ(1U, sizeof(RepeatedMessage::tag_len));
+
+  EXPECT_EQ(5U, offsetof(RepeatedMessage, reserved));
+  EXPECT_EQ(3U, sizeof(RepeatedMessage::reserved));
+
+  EXPECT_EQ(8U, sizeof(RepeatedMessage));
+}
+
+TEST(ProtocolTest, StructuredArgTypesAreUnchanged) {
+  using protocol::StructuredArgType;
+  EXPECT_EQ(1U, sizeof(StructuredArgType));
+  EXPECT_EQ(0U, static_cast<uint8_t>(StructuredArgType::kInt32));
+  EXPECT_EQ(1U, static_cast<uint8_t>(StructuredArgType::kUint32));
+  EXPECT_EQ(2U, static_cast<uint8_t>(StructuredArgType::kInt64));
+  EXPECT_EQ(3U, static_cast<uint8_t>(StructuredArgType::kUint64));
+  EXPECT_EQ(4U, static_cast<uint8_t>(StructuredArgType::kMacAddress));
+  EXPECT_EQ(5U, static_cast<uint8_t>(StructuredArgType::kBytes));
+}
+
+TEST(ProtocolTest, BinaryDumpFormatIsUnchanged) {
+  EXPECT_EQ(0x474f4c57U, protocol::kBinaryDumpMagic);
+  EXPECT_EQ(2U, protocol::kBinaryDumpVersion);
+  EXPECT_EQ(1U, protocol::kBinaryDumpVersionWithoutStats);
+}
+
+TEST(ProtocolTest, BinaryDumpPreambleLayoutIsUnchanged) {
+  using protocol::BinaryDumpPreamble;
+  ASSERT_TRUE(std::is_standard_layout<BinaryDumpPreamble>::value);
+
+  EXPECT_EQ(0U, offsetof(BinaryDumpPreamble, magic));
+  EXPECT_EQ(4U, sizeof(BinaryDumpPreamble::magic));
+
+  EXPECT_EQ(4U, offsetof(BinaryDumpPreamble, version));
+  EXPECT_EQ(2U, sizeof(BinaryDumpPreamble::version));
+
+  EXPECT_EQ(6U, offsetof(BinaryDumpPreamble, reserved));
+  EXPECT_EQ(2U, sizeof(BinaryDumpPreamble::reserved));
+
+  EXPECT_EQ(8U, sizeof(BinaryDumpPreamble));
+}
+
 TEST(ProtocolTest, CommandLayoutIsUnchanged) {
   using protocol::Command;
   ASSERT_TRUE(std::is_standard_layout<Command>::value);
@@ -94,6 +242,21 @@ TEST(ProtocolTest, CommandLayoutIsUnchanged) {
   EXPECT_EQ(16U, sizeof(Command));
 }
 
+TEST(ProtocolTest, StatsLayoutIsUnchanged) {
+  using protocol::Stats;
+  ASSERT_TRUE(std::is_standard_layout<Stats>::value);
+
+  EXPECT_EQ(0U, offsetof(Stats, n_messages_logged));
+  EXPECT_EQ(8U, offsetof(Stats, n_messages_evicted));
+  EXPECT_EQ(16U, offsetof(Stats, n_messages_missing));
+  EXPECT_EQ(24U, offsetof(Stats, n_datagrams_truncated));
+  EXPECT_EQ(32U, offsetof(Stats, n_commands_rejected));
+  EXPECT_EQ(40U, offsetof(Stats, n_ring_records_dropped));
+  EXPECT_EQ(48U, offsetof(Stats, n_receive_enomem_errors));
+  EXPECT_EQ(56U, offsetof(Stats, n_receive_eintr_errors));
+  EXPECT_EQ(64U, sizeof(Stats));
+}
+
 TEST(ProtocolTest, MaxMessageSizeHasNotShrunk) {
   EXPECT_GE(protocol::kMaxMessageSize, 4096U);
 }
@@ -111,7 +274,55 @@ TEST(ProtocolTest, OpcodesAreUnchanged) {
   using protocol::Opcode;
   EXPECT_EQ(2U, sizeof(Opcode));
   EXPECT_EQ(0U, static_cast<uint16_t>(Opcode::kWriteAsciiMessage));
+  EXPECT_EQ(1U, static_cast<uint16_t>(Opcode::kWriteStructuredMessage));
   EXPECT_EQ(0x20U, static_cast<uint16_t>(Opcode::kDumpBuffers));
+  EXPECT_EQ(0x21U, static_cast<uint16_t>(Opcode::kDumpBuffersBinary));
+  EXPECT_EQ(0x22U, static_cast<uint16_t>(Opcode::kDumpStats));
+  EXPECT_EQ(0x23U, static_cast<uint16_t>(Opcode::kDumpBuffersSince));
+  EXPECT_EQ(0x24U, static_cast<uint16_t>(Opcode::kDumpBuffersQuery));
+  EXPECT_EQ(0x25U, static_cast<uint16_t>(Opcode::kSubscribe));
+  EXPECT_EQ(0x40U, static_cast<uint16_t>(Opcode::kRegisterSharedRing));
+  EXPECT_EQ(0x41U, static_cast<uint16_t>(Opcode::kDrainSharedRings));
+  EXPECT_EQ(0x60U, static_cast<uint16_t>(Opcode::kRepeatedMessage));
+}
+
+TEST(ProtocolTest, SharedRingRegistrationLayoutIsUnchanged) {
+  using protocol::SharedRingRegistration;
+  EXPECT_EQ(0U, offsetof(SharedRingRegistration, mapping_len));
+  EXPECT_EQ(4U, sizeof(SharedRingRegistration::mapping_len));
+
+  EXPECT_EQ(4U, offsetof(SharedRingRegistration, reserved));
+  EXPECT_EQ(4U, sizeof(SharedRingRegistration::reserved));
+
+  EXPECT_EQ(8U, sizeof(SharedRingRegistration));
+}
+
+TEST(ProtocolTest, SharedRingHeaderLayoutIsUnchanged) {
+  using protocol::SharedRingHeader;
+  EXPECT_EQ(0U, offsetof(SharedRingHeader, magic));
+  EXPECT_EQ(4U, sizeof(SharedRingHeader::magic));
+
+  EXPECT_EQ(4U, offsetof(SharedRingHeader, version));
+  EXPECT_EQ(2U, sizeof(SharedRingHeader::version));
+
+  EXPECT_EQ(6U, offsetof(SharedRingHeader, reserved));
+  EXPECT_EQ(2U, sizeof(SharedRingHeader::reserved));
+
+  EXPECT_EQ(8U, offsetof(SharedRingHeader, data_len));
+  EXPECT_EQ(4U, sizeof(SharedRingHeader::data_len));
+
+  // The producer's and consumer's fields are on separate cache lines.
+  EXPECT_EQ(64U, offsetof(SharedRingHeader, write_pos));
+  EXPECT_EQ(4U, sizeof(SharedRingHeader::write_pos));
+
+  EXPECT_EQ(128U, offsetof(SharedRingHeader, read_pos));
+  EXPECT_EQ(4U, sizeof(SharedRingHeader::read_pos));
+
+  EXPECT_EQ(132U, offsetof(SharedRingHeader, reader_waiting));
+  EXPECT_EQ(4U, sizeof(SharedRingHeader::reader_waiting));
+
+  // The data starts on a cache line of its own.
+  EXPECT_EQ(192U, sizeof(SharedRingHeader));
 }
 
 }  // namespace wifilogd
@@ -0,0 +1,153 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <tuple>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/byte_buffer.h"
+#include "wifilogd/local_utils.h"
+#include "wifilogd/record_layout.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using local_utils::GetMaxVal;
+
+struct Header {
+  uint8_t a;
+  uint64_t b;
+};
+using TestLayout = RecordLayout<uint8_t, Header, uint16_t>;
+
+static_assert(TestLayout::kNumFields == 3, "wrong number of fields");
+static_assert(TestLayout::kSize ==
+                  sizeof(uint8_t) + sizeof(Header) + sizeof(uint16_t),
+              "fields must be packed back to back");
+static_assert(TestLayout::GetOffset<0>() == 0, "wrong offset for field 0");
+static_assert(TestLayout::GetOffset<1>() == sizeof(uint8_t),
+              "wrong offset for field 1");
+static_assert(TestLayout::GetOffset<2>() == sizeof(uint8_t) + sizeof(Header),
+              "wrong offset for field 2");
+static_assert(RecordHeaderLayout::kSize ==
+                  sizeof(TimestampHeader) + sizeof(protocol::Command),
+              "RecordHeaderLayout must match the records in a log buffer");
+
+constexpr uint8_t kFirstField = 1;
+constexpr Header kSecondField{2, GetMaxVal<uint64_t>()};
+constexpr uint16_t kThirdField = GetMaxVal<uint16_t>();
+
+// Returns the fields of TestLayout, as they would be written by a client
+// which appends each field in turn.
+auto MakeTestRecord() {
+  return ByteBuffer<TestLayout::kSize>()
+      .AppendOrDie(&kFirstField, sizeof(kFirstField))
+      .AppendOrDie(&kSecondField, sizeof(kSecondField))
+      .AppendOrDie(&kThirdField, sizeof(kThirdField));
+}
+
+}  // namespace
+
+TEST(RecordLayoutTest, ReadOrDieCopiesEveryField) {
+  const auto& record = MakeTestRecord();
+  uint8_t first_field;
+  Header second_field;
+  uint16_t third_field;
+  std::tie(first_field, second_field, third_field) =
+      TestLayout::ReadOrDie(record.data(), record.size());
+  EXPECT_EQ(kFirstField, first_field);
+  EXPECT_EQ(kSecondField.a, second_field.a);
+  EXPECT_EQ(kSecondField.b, second_field.b);
+  EXPECT_EQ(kThirdField, third_field);
+}
+
+TEST(RecordLayoutTest, ReadFieldOrDieCopiesOneField) {
+  const auto& record = MakeTestRecord();
+  const auto& second_field =
+      TestLayout::ReadFieldOrDie<1>(record.data(), record.size());
+  EXPECT_EQ(kSecondField.a, second_field.a);
+  EXPECT_EQ(kSecondField.b, second_field.b);
+}
+
+TEST(RecordLayoutTest, ReadFieldOrDieDoesNotRequireLaterFields) {
+  const auto& record = MakeTestRecord();
+  EXPECT_EQ(kFirstField,
+            TestLayout::ReadFieldOrDie<0>(record.data(), sizeof(uint8_t)));
+}
+
+TEST(RecordLayoutTest, WriteOrDieWritesFieldsBackToBack) {
+  std::array<uint8_t, TestLayout::kSize> record{};
+  TestLayout::WriteOrDie(record.data(), record.size(), kFirstField,
+                         kSecondField, kThirdField);
+  const auto& expected_record = MakeTestRecord();
+  EXPECT_EQ(0, std::memcmp(expected_record.data(), record.data(),
+                           record.size()));
+}
+
+TEST(RecordLayoutTest, WriteOrDieReturnsEndOfFields) {
+  std::array<uint8_t, TestLayout::kSize + 1> record{};
+  EXPECT_EQ(record.data() + TestLayout::kSize,
+            TestLayout::WriteOrDie(record.data(), record.size(), kFirstField,
+                                   kSecondField, kThirdField));
+}
+
+TEST(RecordLayoutTest, WriteFieldOrDieOverwritesOnlyThatField) {
+  auto record = MakeTestRecord();
+  std::array<uint8_t, TestLayout::kSize> buf;
+  std::memcpy(buf.data(), record.data(), buf.size());
+  constexpr uint16_t kNewThirdField = 3;
+  TestLayout::WriteFieldOrDie<2>(buf.data(), buf.size(), kNewThirdField);
+  EXPECT_EQ(kFirstField, TestLayout::ReadFieldOrDie<0>(buf.data(), buf.size()));
+  EXPECT_EQ(kSecondField.b,
+            TestLayout::ReadFieldOrDie<1>(buf.data(), buf.size()).b);
+  EXPECT_EQ(kNewThirdField,
+            TestLayout::ReadFieldOrDie<2>(buf.data(), buf.size()));
+}
+
+TEST(RecordLayoutTest, ReadOrDieHandlesUnalignedBuffer) {
+  const auto& record = MakeTestRecord();
+  std::array<uint8_t, TestLayout::kSize + 1> buf{};
+  std::memcpy(buf.data() + 1, record.data(), record.size());
+  const auto& fields = TestLayout::ReadOrDie(buf.data() + 1, record.size());
+  EXPECT_EQ(kSecondField.b, std::get<1>(fields).b);
+}
+
+TEST(RecordLayoutDeathTest, ReadOrDieAbortsOnShortBuffer) {
+  const auto& record = MakeTestRecord();
+  EXPECT_DEATH(TestLayout::ReadOrDie(record.data(), record.size() - 1),
+               "Check failed");
+}
+
+TEST(RecordLayoutDeathTest, ReadFieldOrDieAbortsOnShortBuffer) {
+  const auto& record = MakeTestRecord();
+  EXPECT_DEATH(TestLayout::ReadFieldOrDie<2>(record.data(), record.size() - 1),
+               "Check failed");
+}
+
+TEST(RecordLayoutDeathTest, WriteOrDieAbortsOnShortBuffer) {
+  std::array<uint8_t, TestLayout::kSize - 1> record{};
+  EXPECT_DEATH(TestLayout::WriteOrDie(record.data(), record.size(),
+                                      kFirstField, kSecondField, kThirdField),
+               "Check failed");
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/sequence_tracker.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+class SequenceTrackerTest : public ::testing::Test {
+ public:
+  SequenceTrackerTest() : tracker_() {}
+
+ protected:
+  uint16_t Track(const std::string& tag, uint16_t sequence_num) {
+    return tracker_.Track(reinterpret_cast<const uint8_t*>(tag.data()),
+                          tag.size(), sequence_num);
+  }
+
+  SequenceTracker tracker_;
+};
+
+}  // namespace
+
+TEST_F(SequenceTrackerTest, FirstMessageForTagHasNoGap) {
+  EXPECT_EQ(0U, Track("tag", 42));
+}
+
+TEST_F(SequenceTrackerTest, ConsecutiveMessagesHaveNoGap) {
+  EXPECT_EQ(0U, Track("tag", 1));
+  EXPECT_EQ(0U, Track("tag", 2));
+  EXPECT_EQ(0U, Track("tag", 3));
+}
+
+TEST_F(SequenceTrackerTest, SkippedMessagesAreCounted) {
+  EXPECT_EQ(0U, Track("tag", 1));
+  EXPECT_EQ(3U, Track("tag", 5));
+  EXPECT_EQ(0U, Track("tag", 6));
+}
+
+TEST_F(SequenceTrackerTest, SequenceNumbersWrapAround) {
+  EXPECT_EQ(0U, Track("tag", 0xffff));
+  EXPECT_EQ(0U, Track("tag", 0));
+  EXPECT_EQ(1U, Track("tag", 2));
+}
+
+TEST_F(SequenceTrackerTest, TagsAreTrackedSeparately) {
+  EXPECT_EQ(0U, Track("tag1", 1));
+  EXPECT_EQ(0U, Track("tag2", 100));
+  EXPECT_EQ(0U, Track("tag1", 2));
+  EXPECT_EQ(0U, Track("tag2", 101));
+}
+
+TEST_F(SequenceTrackerTest, BackwardsSequenceNumberRestartsTracking) {
+  EXPECT_EQ(0U, Track("tag", 100));
+  EXPECT_EQ(0U, Track("tag", 1));  // E.g., the writer restarted.
+  EXPECT_EQ(0U, Track("tag", 2));
+  EXPECT_EQ(1U, Track("tag", 4));
+}
+
+TEST_F(SequenceTrackerTest, UnsetSequenceNumbersHaveNoGaps) {
+  EXPECT_EQ(0U, Track("tag", 0));
+  EXPECT_EQ(0U, Track("tag", 0));
+  EXPECT_EQ(0U, Track("tag", 0));
+}
+
+TEST_F(SequenceTrackerTest, TrackingRestartsWhenTooManyTags) {
+  EXPECT_EQ(0U, Track("tag", 1));
+  for (size_t i = 0; i < SequenceTracker::kMaxTrackedTags; ++i) {
+    Track("other" + std::to_string(i), 1);
+  }
+  // The skipped message is not counted, as tracking restarted for "tag".
+  EXPECT_EQ(0U, Track("tag", 3));
+  EXPECT_EQ(1U, Track("tag", 5));
+}
+
+}  // namespace wifilogd
+}  // namespace android
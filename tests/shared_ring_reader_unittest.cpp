@@ -0,0 +1,231 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <array>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <tuple>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/protocol.h"
+#include "wifilogd/shared_ring_reader.h"
+#include "wifilogd/shared_ring_writer.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using protocol::SharedRingHeader;
+using WriteResult = SharedRingWriter::WriteResult;
+
+constexpr size_t kMappingLen = SharedRingWriter::GetMinMappingLen();
+constexpr size_t kDataLen = protocol::kMinSharedRingDataLen;
+
+class SharedRingReaderTest : public ::testing::Test {
+ public:
+  SharedRingReaderTest()
+      : mapping_{},
+        writer_(mapping_.data(), mapping_.size()),
+        reader_(SharedRingReader::Create(mapping_.data(), mapping_.size())) {}
+
+ protected:
+  SharedRingHeader* GetHeader() {
+    return reinterpret_cast<SharedRingHeader*>(mapping_.data());
+  }
+
+  uint8_t* GetData() { return mapping_.data() + sizeof(SharedRingHeader); }
+
+  WriteResult WriteRecord(const std::string& record) {
+    return writer_.Write(record.data(), record.size());
+  }
+
+  // Returns the next record, as a string. Returns an empty string if
+  // there is no next record.
+  std::string ConsumeNextRecord() {
+    const uint8_t* record;
+    size_t record_len;
+    std::tie(record, record_len) = reader_->ConsumeNextRecord();
+    return record ? std::string(reinterpret_cast<const char*>(record),
+                                record_len)
+                  : std::string();
+  }
+
+  alignas(protocol::kSharedRingCacheLineSize)
+      std::array<uint8_t, kMappingLen> mapping_;
+  SharedRingWriter writer_;
+  std::unique_ptr<SharedRingReader> reader_;
+};
+
+}  // namespace
+
+TEST_F(SharedRingReaderTest, CreateSucceedsForValidRing) {
+  ASSERT_NE(nullptr, reader_);
+  EXPECT_FALSE(reader_->IsCorrupt());
+  EXPECT_EQ(kDataLen, reader_->GetDataLen());
+}
+
+TEST_F(SharedRingReaderTest, CreateFailsForBadMagic) {
+  ++GetHeader()->magic;
+  EXPECT_EQ(nullptr, SharedRingReader::Create(mapping_.data(), kMappingLen));
+}
+
+TEST_F(SharedRingReaderTest, CreateFailsForUnsupportedVersion) {
+  ++GetHeader()->version;
+  EXPECT_EQ(nullptr, SharedRingReader::Create(mapping_.data(), kMappingLen));
+}
+
+TEST_F(SharedRingReaderTest, CreateFailsForDataLenNotPowerOfTwo) {
+  GetHeader()->data_len = kDataLen - 1;
+  EXPECT_EQ(nullptr, SharedRingReader::Create(mapping_.data(), kMappingLen));
+}
+
+TEST_F(SharedRingReaderTest, CreateFailsForDataLenTooSmall) {
+  GetHeader()->data_len = kDataLen / 2;
+  EXPECT_EQ(nullptr, SharedRingReader::Create(mapping_.data(), kMappingLen));
+}
+
+TEST_F(SharedRingReaderTest, CreateFailsIfDataExceedsMapping) {
+  EXPECT_EQ(nullptr,
+            SharedRingReader::Create(mapping_.data(), kMappingLen - 1));
+}
+
+TEST_F(SharedRingReaderTest, CreateFailsForMisalignedMapping) {
+  EXPECT_EQ(nullptr,
+            SharedRingReader::Create(mapping_.data() + 1, kMappingLen - 1));
+}
+
+TEST_F(SharedRingReaderTest, CreateFailsIfWriterIsTooFarAhead) {
+  GetHeader()->write_pos.store(kDataLen + 1);
+  EXPECT_EQ(nullptr, SharedRingReader::Create(mapping_.data(), kMappingLen));
+}
+
+TEST_F(SharedRingReaderTest, ConsumeNextRecordReturnsNullForEmptyRing) {
+  EXPECT_EQ(nullptr, std::get<0>(reader_->ConsumeNextRecord()));
+  EXPECT_FALSE(reader_->IsCorrupt());
+}
+
+TEST_F(SharedRingReaderTest, ConsumeNextRecordReturnsRecordsInOrder) {
+  ASSERT_EQ(WriteResult::kOk, WriteRecord("first"));
+  ASSERT_EQ(WriteResult::kOk, WriteRecord("second"));
+  EXPECT_EQ("first", ConsumeNextRecord());
+  EXPECT_EQ("second", ConsumeNextRecord());
+  EXPECT_EQ("", ConsumeNextRecord());
+}
+
+TEST_F(SharedRingReaderTest, ConsumeNextRecordReturnsRecordsWrittenLater) {
+  EXPECT_EQ("", ConsumeNextRecord());
+  ASSERT_EQ(WriteResult::kOk, WriteRecord("record"));
+  EXPECT_EQ("record", ConsumeNextRecord());
+}
+
+TEST_F(SharedRingReaderTest, ConsumeNextRecordReadsAcrossManyWraps) {
+  // Record sizes which don't divide the data area evenly, so that the
+  // writer has to skip space at the end of the data area.
+  const std::string kRecord(999, 'x');
+  for (size_t i = 0; i < 10 * kDataLen / kRecord.size(); ++i) {
+    ASSERT_EQ(WriteResult::kOk, WriteRecord(kRecord + std::to_string(i)));
+    ASSERT_EQ(kRecord + std::to_string(i), ConsumeNextRecord());
+    ASSERT_EQ("", ConsumeNextRecord());  // Releases the consumed space.
+  }
+  EXPECT_FALSE(reader_->IsCorrupt());
+}
+
+TEST_F(SharedRingReaderTest, ConsumingRecordsFreesSpaceForWriter) {
+  const std::string kRecord(1000, 'x');
+  while (WriteRecord(kRecord) == WriteResult::kOk) {
+  }
+  while (!ConsumeNextRecord().empty()) {
+  }
+  EXPECT_EQ(WriteResult::kOk, WriteRecord(kRecord));
+}
+
+TEST_F(SharedRingReaderTest, ArmWakeupReturnsTrueForEmptyRing) {
+  EXPECT_TRUE(reader_->ArmWakeup());
+  EXPECT_NE(0U, GetHeader()->reader_waiting.load());
+}
+
+TEST_F(SharedRingReaderTest, ArmWakeupReturnsFalseIfRecordsArePending) {
+  ASSERT_EQ(WriteResult::kOk, WriteRecord("record"));
+  EXPECT_FALSE(reader_->ArmWakeup());
+  EXPECT_EQ("record", ConsumeNextRecord());
+  EXPECT_TRUE(reader_->ArmWakeup());
+}
+
+TEST_F(SharedRingReaderTest, ArmWakeupCausesWriterToRequestWakeup) {
+  ASSERT_TRUE(reader_->ArmWakeup());
+  EXPECT_EQ(WriteResult::kOkWakeupNeeded, WriteRecord("record"));
+  EXPECT_EQ(WriteResult::kOk, WriteRecord("record"));
+}
+
+TEST_F(SharedRingReaderTest, ArmWakeupReleasesConsumedSpace) {
+  ASSERT_EQ(WriteResult::kOk, WriteRecord("record"));
+  EXPECT_EQ("record", ConsumeNextRecord());
+  EXPECT_EQ(0U, GetHeader()->read_pos.load());
+  EXPECT_TRUE(reader_->ArmWakeup());
+  EXPECT_EQ(GetHeader()->write_pos.load(), GetHeader()->read_pos.load());
+}
+
+TEST_F(SharedRingReaderTest, ReaderIgnoresChangesToSharedReadPos) {
+  ASSERT_EQ(WriteResult::kOk, WriteRecord("record"));
+  GetHeader()->read_pos.store(GetHeader()->write_pos.load());
+  EXPECT_EQ("record", ConsumeNextRecord());
+}
+
+TEST_F(SharedRingReaderTest, WriterTooFarAheadMarksRingCorrupt) {
+  GetHeader()->write_pos.store(kDataLen + 1);
+  EXPECT_EQ("", ConsumeNextRecord());
+  EXPECT_TRUE(reader_->IsCorrupt());
+}
+
+TEST_F(SharedRingReaderTest, RecordLongerThanPublishedDataMarksRingCorrupt) {
+  ASSERT_EQ(WriteResult::kOk, WriteRecord("record"));
+  const uint16_t kBadLen = 100;
+  std::memcpy(GetData(), &kBadLen, sizeof(kBadLen));
+  EXPECT_EQ("", ConsumeNextRecord());
+  EXPECT_TRUE(reader_->IsCorrupt());
+}
+
+TEST_F(SharedRingReaderTest, RecordWrappingAroundEndMarksRingCorrupt) {
+  // Publish the whole data area, as a single record which is too long to
+  // fit in the data area.
+  const uint16_t kBadLen = kDataLen;
+  std::memcpy(GetData(), &kBadLen, sizeof(kBadLen));
+  GetHeader()->write_pos.store(kDataLen);
+  EXPECT_EQ("", ConsumeNextRecord());
+  EXPECT_TRUE(reader_->IsCorrupt());
+}
+
+TEST_F(SharedRingReaderTest, SkipMarkerBeyondPublishedDataMarksRingCorrupt) {
+  // A zero length means "skip to the start", but the writer hasn't
+  // published the space up to the end.
+  GetHeader()->write_pos.store(sizeof(uint16_t));
+  EXPECT_EQ("", ConsumeNextRecord());
+  EXPECT_TRUE(reader_->IsCorrupt());
+}
+
+TEST_F(SharedRingReaderTest, CorruptRingReturnsNoFurtherRecords) {
+  GetHeader()->write_pos.store(kDataLen + 1);
+  EXPECT_EQ("", ConsumeNextRecord());
+  GetHeader()->write_pos.store(0);
+  ASSERT_EQ(WriteResult::kOk, WriteRecord("record"));
+  EXPECT_EQ("", ConsumeNextRecord());
+  EXPECT_TRUE(reader_->ArmWakeup());
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,215 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <array>
+#include <cstring>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/protocol.h"
+#include "wifilogd/shared_ring_writer.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using protocol::SharedRingHeader;
+using WriteResult = SharedRingWriter::WriteResult;
+
+constexpr size_t kMappingLen = SharedRingWriter::GetMinMappingLen();
+constexpr size_t kDataLen = protocol::kMinSharedRingDataLen;
+constexpr size_t kRecordHeaderLen = sizeof(uint16_t);
+
+class SharedRingWriterTest : public ::testing::Test {
+ public:
+  SharedRingWriterTest()
+      : mapping_{}, writer_(mapping_.data(), mapping_.size()) {}
+
+ protected:
+  SharedRingHeader* GetHeader() {
+    return reinterpret_cast<SharedRingHeader*>(mapping_.data());
+  }
+
+  const uint8_t* GetData() const {
+    return mapping_.data() + sizeof(SharedRingHeader);
+  }
+
+  // Reads the record length stored at |offset| in the data area.
+  uint16_t GetRecordLenAt(size_t offset) const {
+    uint16_t record_len;
+    std::memcpy(&record_len, GetData() + offset, sizeof(record_len));
+    return record_len;
+  }
+
+  // Writes a record of |len| bytes, with every byte set to |fill|.
+  WriteResult WriteFilledRecord(uint8_t fill, uint16_t len) {
+    const std::vector<uint8_t> record(len, fill);
+    return writer_.Write(record.data(), len);
+  }
+
+  // Writes records which occupy exactly |len| bytes of the data area
+  // (including length prefixes). |len| must be 0, or at least 3.
+  void WriteRecordsOccupying(size_t len) {
+    constexpr size_t kMaxTotalLen =
+        kRecordHeaderLen + protocol::kMaxMessageSize;
+    while (len) {
+      size_t total_len = std::min(len, kMaxTotalLen);
+      if (len - total_len && len - total_len <= kRecordHeaderLen) {
+        total_len -= kRecordHeaderLen + 1;  // Leave room for a final record.
+      }
+      ASSERT_EQ(WriteResult::kOk,
+                WriteFilledRecord('a', total_len - kRecordHeaderLen));
+      len -= total_len;
+    }
+  }
+
+  // Marks everything written so far as consumed.
+  void ConsumeAll() {
+    GetHeader()->read_pos.store(GetHeader()->write_pos.load());
+  }
+
+  alignas(protocol::kSharedRingCacheLineSize)
+      std::array<uint8_t, kMappingLen> mapping_;
+  SharedRingWriter writer_;
+};
+
+}  // namespace
+
+TEST_F(SharedRingWriterTest, CtorLaysOutEmptyRing) {
+  EXPECT_EQ(protocol::kSharedRingMagic, GetHeader()->magic);
+  EXPECT_EQ(protocol::kSharedRingVersion, GetHeader()->version);
+  EXPECT_EQ(0U, GetHeader()->reserved);
+  EXPECT_EQ(kDataLen, GetHeader()->data_len);
+  EXPECT_EQ(0U, GetHeader()->write_pos.load());
+  EXPECT_EQ(0U, GetHeader()->read_pos.load());
+  EXPECT_EQ(0U, GetHeader()->reader_waiting.load());
+  EXPECT_EQ(kDataLen, writer_.GetDataLen());
+}
+
+TEST(SharedRingWriterSizingTest, CtorRoundsDataLenDownToPowerOfTwo) {
+  constexpr size_t kLargeMappingLen =
+      sizeof(SharedRingHeader) + 3 * protocol::kMinSharedRingDataLen;
+  alignas(protocol::kSharedRingCacheLineSize)
+      std::array<uint8_t, kLargeMappingLen> mapping;
+  SharedRingWriter writer(mapping.data(), mapping.size());
+  EXPECT_EQ(2 * protocol::kMinSharedRingDataLen, writer.GetDataLen());
+}
+
+TEST_F(SharedRingWriterTest, WriteStoresLengthPrefixedRecord) {
+  constexpr std::array<uint8_t, 3> kRecord{{'a', 'b', 'c'}};
+  EXPECT_EQ(WriteResult::kOk, writer_.Write(kRecord.data(), kRecord.size()));
+  EXPECT_EQ(kRecordHeaderLen + kRecord.size(), GetHeader()->write_pos.load());
+  EXPECT_EQ(kRecord.size(), GetRecordLenAt(0));
+  EXPECT_EQ(0, std::memcmp(kRecord.data(), GetData() + kRecordHeaderLen,
+                           kRecord.size()));
+}
+
+TEST_F(SharedRingWriterTest, WriteAcceptsMaximalRecord) {
+  EXPECT_EQ(WriteResult::kOk,
+            WriteFilledRecord('x', protocol::kMaxMessageSize));
+}
+
+TEST_F(SharedRingWriterTest, WriteRejectsOversizedRecord) {
+  EXPECT_EQ(WriteResult::kRecordTooLarge,
+            WriteFilledRecord('x', protocol::kMaxMessageSize + 1));
+  EXPECT_EQ(0U, GetHeader()->write_pos.load());
+}
+
+TEST_F(SharedRingWriterTest, WriteReportsFullRingWithoutPublishing) {
+  constexpr size_t kRecordLen = 1000;
+  size_t n_written = 0;
+  while (WriteFilledRecord('x', kRecordLen) == WriteResult::kOk) {
+    ++n_written;
+  }
+  EXPECT_EQ(kDataLen / (kRecordHeaderLen + kRecordLen), n_written);
+  EXPECT_EQ(n_written * (kRecordHeaderLen + kRecordLen),
+            GetHeader()->write_pos.load());
+}
+
+TEST_F(SharedRingWriterTest, WriteSucceedsOnceReaderFreesSpace) {
+  constexpr size_t kRecordLen = 1000;
+  while (WriteFilledRecord('x', kRecordLen) == WriteResult::kOk) {
+  }
+  ConsumeAll();
+  EXPECT_EQ(WriteResult::kOk, WriteFilledRecord('x', kRecordLen));
+}
+
+TEST_F(SharedRingWriterTest, WriteSkipsToStartIfRecordWouldWrap) {
+  // Leave 100 bytes at the end of the data area.
+  WriteRecordsOccupying(kDataLen - 100);
+  ConsumeAll();
+
+  ASSERT_EQ(WriteResult::kOk, WriteFilledRecord('b', 200));
+  EXPECT_EQ(0U, GetRecordLenAt(kDataLen - 100));  // Skip marker.
+  EXPECT_EQ(200U, GetRecordLenAt(0));
+  EXPECT_EQ('b', GetData()[kRecordHeaderLen]);
+  EXPECT_EQ(kDataLen + kRecordHeaderLen + 200, GetHeader()->write_pos.load());
+}
+
+TEST_F(SharedRingWriterTest, WriteSkipsToStartIfNoRoomForSkipMarker) {
+  // Leave a single byte at the end of the data area.
+  WriteRecordsOccupying(kDataLen - 1);
+  ConsumeAll();
+
+  ASSERT_EQ(WriteResult::kOk, WriteFilledRecord('b', 1));
+  EXPECT_EQ(1U, GetRecordLenAt(0));
+  EXPECT_EQ(kDataLen + kRecordHeaderLen + 1, GetHeader()->write_pos.load());
+}
+
+TEST_F(SharedRingWriterTest, WriteCountsSkippedSpaceAgainstFreeSpace) {
+  // Leave 100 bytes at the end, but don't free any space at the start.
+  WriteRecordsOccupying(kDataLen - 100);
+  EXPECT_EQ(WriteResult::kRingFull, WriteFilledRecord('b', 200));
+}
+
+TEST_F(SharedRingWriterTest, WriteRequestsWakeupOnlyIfReaderIsWaiting) {
+  EXPECT_EQ(WriteResult::kOk, WriteFilledRecord('a', 1));
+
+  GetHeader()->reader_waiting.store(1);
+  EXPECT_EQ(WriteResult::kOkWakeupNeeded, WriteFilledRecord('a', 1));
+  EXPECT_EQ(0U, GetHeader()->reader_waiting.load());
+
+  EXPECT_EQ(WriteResult::kOk, WriteFilledRecord('a', 1));
+}
+
+TEST_F(SharedRingWriterTest, WriteTreatsInvalidReadPosAsFullRing) {
+  GetHeader()->read_pos.store(1);  // The reader is ahead of the writer.
+  EXPECT_EQ(WriteResult::kRingFull, WriteFilledRecord('a', 1));
+}
+
+// Per
+// github.com/google/googletest/blob/master/googletest/docs/AdvancedGuide.md#death-tests,
+// death tests should be specially named.
+using SharedRingWriterDeathTest = SharedRingWriterTest;
+
+TEST_F(SharedRingWriterDeathTest, CtorWithMisalignedMappingCausesDeath) {
+  EXPECT_DEATH(SharedRingWriter(mapping_.data() + 1, mapping_.size() - 1),
+               "Check failed");
+}
+
+TEST_F(SharedRingWriterDeathTest, CtorWithUndersizedMappingCausesDeath) {
+  EXPECT_DEATH(SharedRingWriter(mapping_.data(), mapping_.size() - 1),
+               "Check failed");
+}
+
+TEST_F(SharedRingWriterDeathTest, WriteOfEmptyRecordCausesDeath) {
+  EXPECT_DEATH(writer_.Write(mapping_.data(), 0), "Check failed");
+}
+
+}  // namespace wifilogd
+}  // namespace android
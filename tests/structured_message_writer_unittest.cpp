@@ -0,0 +1,188 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/protocol.h"
+#include "wifilogd/structured_formats.h"
+#include "wifilogd/structured_message_writer.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using local_utils::CopyFromBufferOrDie;
+using protocol::StructuredArgType;
+using structured_formats::FormatId;
+
+constexpr char kTag[] = "tag";
+constexpr size_t kHeadersLen =
+    sizeof(protocol::Command) + sizeof(protocol::StructuredMessage);
+
+class StructuredMessageWriterTest : public ::testing::Test {
+ public:
+  StructuredMessageWriterTest()
+      : writer_(FormatId::kRssiPoll, kTag, sizeof(kTag) - 1,
+                protocol::MessageSeverity::kWarning) {}
+
+ protected:
+  protocol::Command GetCommand() const {
+    return CopyFromBufferOrDie<protocol::Command>(writer_.data(),
+                                                  writer_.size());
+  }
+
+  protocol::StructuredMessage GetStructuredMessage() const {
+    return CopyFromBufferOrDie<protocol::StructuredMessage>(
+        writer_.data() + sizeof(protocol::Command),
+        writer_.size() - sizeof(protocol::Command));
+  }
+
+  // Returns the bytes following the tag.
+  std::string GetArgs() const {
+    const size_t args_start = kHeadersLen + GetStructuredMessage().tag_len;
+    return std::string(
+        reinterpret_cast<const char*>(writer_.data()) + args_start,
+        writer_.size() - args_start);
+  }
+
+  StructuredMessageWriter writer_;
+};
+
+}  // namespace
+
+TEST_F(StructuredMessageWriterTest, ConstructorWritesHeaders) {
+  const protocol::Command command = GetCommand();
+  EXPECT_EQ(protocol::Opcode::kWriteStructuredMessage, command.opcode);
+  EXPECT_EQ(0U, command.sequence_num);
+  EXPECT_EQ(0U, command.src_boottime_nsec);
+  EXPECT_EQ(0U, command.reserved);
+  EXPECT_EQ(writer_.size() - sizeof(protocol::Command), command.payload_len);
+
+  const protocol::StructuredMessage structured_message =
+      GetStructuredMessage();
+  EXPECT_EQ(local_utils::CastEnumToInteger(FormatId::kRssiPoll),
+            structured_message.format_id);
+  EXPECT_EQ(sizeof(kTag) - 1, structured_message.tag_len);
+  EXPECT_EQ(protocol::MessageSeverity::kWarning, structured_message.severity);
+  EXPECT_EQ(kTag,
+            std::string(reinterpret_cast<const char*>(writer_.data()) +
+                            kHeadersLen,
+                        sizeof(kTag) - 1));
+  EXPECT_EQ(kHeadersLen + sizeof(kTag) - 1, writer_.size());
+  EXPECT_EQ(0U, writer_.GetNumArgs());
+}
+
+TEST_F(StructuredMessageWriterTest, SettersUpdateCommandHeader) {
+  writer_.set_sequence_num(7).set_src_boottime_nsec(1234);
+  EXPECT_EQ(7U, GetCommand().sequence_num);
+  EXPECT_EQ(1234U, GetCommand().src_boottime_nsec);
+}
+
+TEST_F(StructuredMessageWriterTest, AddUint32WritesTypeAndValue) {
+  writer_.AddUint32(0x01020304);
+  const uint32_t value = 0x01020304;
+  std::string expected(1, static_cast<char>(StructuredArgType::kUint32));
+  expected.append(reinterpret_cast<const char*>(&value), sizeof(value));
+  EXPECT_EQ(expected, GetArgs());
+  EXPECT_EQ(writer_.size() - sizeof(protocol::Command),
+            GetCommand().payload_len);
+  EXPECT_EQ(1U, writer_.GetNumArgs());
+}
+
+TEST_F(StructuredMessageWriterTest, AddMacAddressWritesTypeAndValue) {
+  const uint8_t mac_address[protocol::kMacAddressLen] = {1, 2, 3, 4, 5, 6};
+  writer_.AddMacAddress(mac_address);
+  EXPECT_EQ(std::string(1, static_cast<char>(StructuredArgType::kMacAddress)) +
+                "\x01\x02\x03\x04\x05\x06",
+            GetArgs());
+}
+
+TEST_F(StructuredMessageWriterTest, AddBytesWritesTypeLengthAndValue) {
+  writer_.AddBytes("home", 4);
+  EXPECT_EQ(std::string(1, static_cast<char>(StructuredArgType::kBytes)) +
+                "\x04" + "home",
+            GetArgs());
+}
+
+TEST_F(StructuredMessageWriterTest, ArgsBeyondMaxAreDropped) {
+  for (size_t i = 0; i < protocol::kMaxStructuredArgs; ++i) {
+    writer_.AddUint32(i);
+  }
+  const size_t size_at_max = writer_.size();
+  writer_.AddUint32(0);
+  EXPECT_EQ(size_at_max, writer_.size());
+  EXPECT_EQ(protocol::kMaxStructuredArgs, writer_.GetNumArgs());
+}
+
+TEST_F(StructuredMessageWriterTest, ArgWhichDoesNotFitIsDropped) {
+  const std::string tag(300, 't');
+  StructuredMessageWriter writer(FormatId::kScanStarted, tag.data(),
+                                 tag.size(),
+                                 protocol::MessageSeverity::kInformational);
+  const std::string bytes(255, 'b');
+  while (writer.size() + 2 + bytes.size() <= protocol::kMaxMessageSize) {
+    writer.AddBytes(bytes.data(), bytes.size());
+  }
+  const size_t n_args = writer.GetNumArgs();
+  writer.AddBytes(bytes.data(), bytes.size());
+  EXPECT_EQ(n_args, writer.GetNumArgs());
+  EXPECT_LE(writer.size(), protocol::kMaxMessageSize);
+}
+
+TEST_F(StructuredMessageWriterTest, LongTagIsTruncated) {
+  const std::string tag(300, 't');
+  StructuredMessageWriter writer(FormatId::kScanStarted, tag.data(),
+                                 tag.size(),
+                                 protocol::MessageSeverity::kInformational);
+  EXPECT_EQ(kHeadersLen + local_utils::GetMaxVal<uint8_t>(), writer.size());
+}
+
+TEST_F(StructuredMessageWriterTest, StructuredMessageIsSmallerThanAscii) {
+  const uint8_t mac_address[protocol::kMacAddressLen] = {};
+  writer_.AddMacAddress(mac_address)
+      .AddInt32(-70)
+      .AddUint32(866700)
+      .AddUint32(866700);
+  const std::string ascii_text(
+      "rssi poll bssid=00:00:00:00:00:00 rssi_dbm=-70 tx_kbps=866700"
+      " rx_kbps=866700");
+  EXPECT_LT(writer_.size() * 2,
+            sizeof(protocol::Command) + sizeof(protocol::AsciiMessage) +
+                sizeof(kTag) - 1 + ascii_text.size());
+}
+
+TEST(StructuredFormatsTest, KnownFormatsHaveFormatStrings) {
+  for (uint16_t i = 0;
+       i <= local_utils::CastEnumToInteger(FormatId::kRoamStarted); ++i) {
+    const char* const format = structured_formats::GetFormatString(i);
+    ASSERT_NE(nullptr, format);
+    EXPECT_LE(std::strlen(format), structured_formats::kMaxFormatStringLen);
+  }
+}
+
+TEST(StructuredFormatsTest, UnknownFormatHasNoFormatString) {
+  EXPECT_EQ(nullptr,
+            structured_formats::GetFormatString(
+                local_utils::CastEnumToInteger(FormatId::kRoamStarted) + 1));
+}
+
+}  // namespace wifilogd
+}  // namespace android
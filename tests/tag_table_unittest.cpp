@@ -0,0 +1,116 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+#include <string>
+#include <tuple>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/tag_table.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+class TagTableTest : public ::testing::Test {
+ public:
+  TagTableTest() : table_() {}
+
+ protected:
+  uint16_t Acquire(const std::string& tag) {
+    return table_.Acquire(reinterpret_cast<const uint8_t*>(tag.data()),
+                          tag.size());
+  }
+
+  std::string GetTag(uint16_t tag_id) {
+    const uint8_t* tag;
+    size_t tag_len;
+    std::tie(tag, tag_len) = table_.GetTag(tag_id);
+    return std::string(reinterpret_cast<const char*>(tag), tag_len);
+  }
+
+  TagTable table_;
+};
+
+}  // namespace
+
+TEST_F(TagTableTest, AcquireInternsTag) {
+  const uint16_t tag_id = Acquire("WifiHAL");
+  ASSERT_NE(TagTable::kNoTagId, tag_id);
+  EXPECT_EQ("WifiHAL", GetTag(tag_id));
+  EXPECT_EQ(1U, table_.GetNumTags());
+}
+
+TEST_F(TagTableTest, AcquireReturnsSameIdForSameTag) {
+  EXPECT_EQ(Acquire("WifiHAL"), Acquire("WifiHAL"));
+  EXPECT_EQ(1U, table_.GetNumTags());
+}
+
+TEST_F(TagTableTest, AcquireReturnsDifferentIdsForDifferentTags) {
+  const uint16_t first_id = Acquire("WifiHAL");
+  const uint16_t second_id = Acquire("wpa_supplicant");
+  EXPECT_NE(first_id, second_id);
+  EXPECT_EQ("WifiHAL", GetTag(first_id));
+  EXPECT_EQ("wpa_supplicant", GetTag(second_id));
+}
+
+TEST_F(TagTableTest, AcquireDoesNotInternEmptyTag) {
+  EXPECT_EQ(TagTable::kNoTagId, Acquire(""));
+  EXPECT_EQ(0U, table_.GetNumTags());
+}
+
+TEST_F(TagTableTest, AcquireFailsWhenTableIsFull) {
+  for (size_t i = 0; i < TagTable::kMaxTags; ++i) {
+    ASSERT_NE(TagTable::kNoTagId, Acquire(std::to_string(i)));
+  }
+  EXPECT_EQ(TagTable::kNoTagId, Acquire("one too many"));
+  // Tags that are already interned can still be acquired.
+  EXPECT_NE(TagTable::kNoTagId, Acquire("0"));
+}
+
+TEST_F(TagTableTest, TagRemainsInternedUntilLastRelease) {
+  const uint16_t tag_id = Acquire("WifiHAL");
+  ASSERT_EQ(tag_id, Acquire("WifiHAL"));
+  table_.Release(tag_id);
+  EXPECT_EQ(1U, table_.GetNumTags());
+  EXPECT_EQ("WifiHAL", GetTag(tag_id));
+  table_.Release(tag_id);
+  EXPECT_EQ(0U, table_.GetNumTags());
+}
+
+TEST_F(TagTableTest, ReleasedIdIsReused) {
+  for (size_t i = 0; i < TagTable::kMaxTags; ++i) {
+    ASSERT_NE(TagTable::kNoTagId, Acquire(std::to_string(i)));
+  }
+  const uint16_t released_id = Acquire("0");
+  table_.Release(released_id);
+  table_.Release(released_id);
+  EXPECT_EQ(released_id, Acquire("new tag"));
+  EXPECT_EQ("new tag", GetTag(released_id));
+}
+
+// Per
+// github.com/google/googletest/blob/master/googletest/docs/AdvancedGuide.md#death-tests,
+// death tests should be specially named.
+using TagTableDeathTest = TagTableTest;
+
+TEST_F(TagTableDeathTest, ReleaseOfUnreferencedIdCausesDeath) {
+  EXPECT_DEATH(table_.Release(0), "Check failed");
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,111 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <cstdint>
+
+#include "gtest/gtest.h"
+
+#include "wifilogd/time_index.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+constexpr uint64_t kRecordsPerEntry = TimeIndex::kRecordsPerEntry;
+
+class TimeIndexTest : public ::testing::Test {
+ public:
+  TimeIndexTest() : index_() {}
+
+ protected:
+  // Adds records |first_record| through |end_record - 1|, where each
+  // record's timestamp is ten times its number.
+  void AddRecords(uint64_t first_record, uint64_t end_record) {
+    for (uint64_t i = first_record; i < end_record; ++i) {
+      index_.Add(i, 10 * i);
+    }
+  }
+
+  TimeIndex index_;
+};
+
+}  // namespace
+
+TEST_F(TimeIndexTest, SeekOnEmptyIndexReturnsFirstRecord) {
+  EXPECT_EQ(0U, index_.Seek(1000, 0));
+  EXPECT_EQ(7U, index_.Seek(1000, 7));
+}
+
+TEST_F(TimeIndexTest, AddKeepsOneEntryPerInterval) {
+  AddRecords(0, 1);
+  EXPECT_EQ(1U, index_.GetNumEntries());
+  AddRecords(1, kRecordsPerEntry);
+  EXPECT_EQ(1U, index_.GetNumEntries());
+  AddRecords(kRecordsPerEntry, 10 * kRecordsPerEntry);
+  EXPECT_EQ(10U, index_.GetNumEntries());
+}
+
+TEST_F(TimeIndexTest, SeekReturnsEntryBeforeTimestamp) {
+  AddRecords(0, 10 * kRecordsPerEntry);
+  // Record 3 * kRecordsPerEntry + 5 is the first at or after the timestamp.
+  EXPECT_EQ(3 * kRecordsPerEntry,
+            index_.Seek(10 * (3 * kRecordsPerEntry + 5), 0));
+  // The entry for a record with the timestamp itself must not be skipped.
+  EXPECT_EQ(2 * kRecordsPerEntry,
+            index_.Seek(10 * (3 * kRecordsPerEntry), 0));
+}
+
+TEST_F(TimeIndexTest, SeekBeforeFirstEntryReturnsFirstRecord) {
+  AddRecords(0, 10 * kRecordsPerEntry);
+  EXPECT_EQ(0U, index_.Seek(0, 0));
+  EXPECT_EQ(0U, index_.Seek(-1, 0));
+}
+
+TEST_F(TimeIndexTest, SeekAfterLastEntryReturnsLastEntry) {
+  AddRecords(0, 10 * kRecordsPerEntry);
+  EXPECT_EQ(9 * kRecordsPerEntry, index_.Seek(INT64_MAX, 0));
+}
+
+TEST_F(TimeIndexTest, SeekDoesNotReturnEvictedRecords) {
+  AddRecords(0, 10 * kRecordsPerEntry);
+  EXPECT_EQ(100U, index_.Seek(10 * 50, 100));
+}
+
+TEST_F(TimeIndexTest, EvictBeforeDropsOlderEntries) {
+  AddRecords(0, 10 * kRecordsPerEntry);
+  index_.EvictBefore(3 * kRecordsPerEntry + 1);
+  EXPECT_EQ(6U, index_.GetNumEntries());
+  EXPECT_EQ(4 * kRecordsPerEntry,
+            index_.Seek(10 * (5 * kRecordsPerEntry), 3 * kRecordsPerEntry + 1));
+  EXPECT_EQ(3 * kRecordsPerEntry + 1,
+            index_.Seek(10 * (4 * kRecordsPerEntry), 3 * kRecordsPerEntry + 1));
+}
+
+TEST_F(TimeIndexTest, SeekIsSafeWhenClockStepsBack) {
+  // Records 0 through 2 * kRecordsPerEntry - 1 are logged at 1000, and the
+  // rest at 0.
+  for (uint64_t i = 0; i < 2 * kRecordsPerEntry; ++i) {
+    index_.Add(i, 1000);
+  }
+  for (uint64_t i = 2 * kRecordsPerEntry; i < 4 * kRecordsPerEntry; ++i) {
+    index_.Add(i, 0);
+  }
+  // Seeking to 500 must not skip the records logged at 1000.
+  EXPECT_EQ(0U, index_.Seek(500, 0));
+}
+
+}  // namespace wifilogd
+}  // namespace android
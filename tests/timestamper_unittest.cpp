@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2016, The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+
+#include <cstdint>
+
+#include "gmock/gmock.h"
+#include "gtest/gtest.h"
+
+#include "wifilogd/tests/mock_os.h"
+
+#include "wifilogd/timestamper.h"
+
+namespace android {
+namespace wifilogd {
+namespace {
+
+using ::testing::_;
+using ::testing::AnyNumber;
+using ::testing::Invoke;
+using ::testing::StrictMock;
+
+constexpr int64_t kNsecPerSec = 1000 * 1000 * 1000;
+constexpr int64_t kNsecPerMsec = 1000 * 1000;
+
+// A simulated set of clocks. The offsets are chosen so that converting
+// between clocks requires carrying between the seconds and nanoseconds
+// fields.
+struct FakeClocks {
+  Os::Timestamp Get(clockid_t clock_id) const {
+    switch (clock_id) {
+      case CLOCK_MONOTONIC:
+        return ToTimestamp(boottime_nsec - slept_nsec);
+      case CLOCK_BOOTTIME:
+        return ToTimestamp(boottime_nsec);
+      case CLOCK_REALTIME:
+        return ToTimestamp(boottime_nsec + epoch_offset_nsec);
+    }
+    ADD_FAILURE() << "Unexpected clock " << clock_id;
+    return {0, 0};
+  }
+
+  static Os::Timestamp ToTimestamp(int64_t nsec) {
+    return {static_cast<uint32_t>(nsec / kNsecPerSec),
+            static_cast<uint32_t>(nsec % kNsecPerSec)};
+  }
+
+  int64_t boottime_nsec = 12 * kNsecPerSec + 345 * kNsecPerMsec;
+  int64_t slept_nsec = 3 * kNsecPerSec + 700 * kNsecPerMsec;
+  int64_t epoch_offset_nsec = 1'500'000'000 * kNsecPerSec + 800 * kNsecPerMsec;
+};
+
+// Returns an action which reads from |clocks|.
+auto ReadFrom(const FakeClocks* clocks) {
+  return Invoke([clocks](clockid_t clock_id) { return clocks->Get(clock_id); });
+}
+
+class TimestamperTest : public ::testing::Test {
+ public:
+  TimestamperTest()
+      : all_clocks_timestamper_(&os_, Timestamper::Mode::kReadAllClocks),
+        derived_timestamper_(&os_, Timestamper::Mode::kDeriveFromBoottime) {
+    EXPECT_CALL(os_, GetTimestamp(_))
+        .Times(AnyNumber())
+        .WillRepeatedly(ReadFrom(&clocks_));
+  }
+
+ protected:
+  void ExpectOnlyBoottimeRead() {
+    EXPECT_CALL(os_, GetTimestamp(CLOCK_MONOTONIC)).Times(0);
+    EXPECT_CALL(os_, GetTimestamp(CLOCK_REALTIME)).Times(0);
+  }
+
+  void ExpectTimestampsMatchClocks(const Timestamper::Timestamps& actual) {
+    ExpectTimestampsEqual(clocks_.Get(CLOCK_MONOTONIC),
+                          actual.since_boot_awake_only);
+    ExpectTimestampsEqual(clocks_.Get(CLOCK_BOOTTIME),
+                          actual.since_boot_with_sleep);
+    ExpectTimestampsEqual(clocks_.Get(CLOCK_REALTIME), actual.since_epoch);
+  }
+
+  static void ExpectTimestampsEqual(const Os::Timestamp& expected,
+                                    const Os::Timestamp& actual) {
+    EXPECT_EQ(expected.secs, actual.secs);
+    EXPECT_EQ(expected.nsecs, actual.nsecs);
+  }
+
+  FakeClocks clocks_;
+  StrictMock<MockOs> os_;
+  Timestamper all_clocks_timestamper_;
+  Timestamper derived_timestamper_;
+};
+
+}  // namespace
+
+TEST_F(TimestamperTest, ReadAllClocksModeReadsEveryClockOnEveryCall) {
+  EXPECT_CALL(os_, GetTimestamp(CLOCK_MONOTONIC))
+      .Times(2)
+      .WillRepeatedly(ReadFrom(&clocks_));
+  EXPECT_CALL(os_, GetTimestamp(CLOCK_BOOTTIME))
+      .Times(2)
+      .WillRepeatedly(ReadFrom(&clocks_));
+  EXPECT_CALL(os_, GetTimestamp(CLOCK_REALTIME))
+      .Times(2)
+      .WillRepeatedly(ReadFrom(&clocks_));
+  all_clocks_timestamper_.GetTimestamps();
+  all_clocks_timestamper_.GetTimestamps();
+}
+
+TEST_F(TimestamperTest, DeriveModeReadsEveryClockOnFirstCall) {
+  EXPECT_CALL(os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(ReadFrom(&clocks_));
+  EXPECT_CALL(os_, GetTimestamp(CLOCK_REALTIME)).WillOnce(ReadFrom(&clocks_));
+  ExpectTimestampsMatchClocks(derived_timestamper_.GetTimestamps());
+}
+
+TEST_F(TimestamperTest, DeriveModeReadsOnlyBoottimeBetweenRefreshes) {
+  derived_timestamper_.GetTimestamps();
+
+  ExpectOnlyBoottimeRead();
+  EXPECT_CALL(os_, GetTimestamp(CLOCK_BOOTTIME))
+      .Times(2)
+      .WillRepeatedly(ReadFrom(&clocks_));
+  clocks_.boottime_nsec += kNsecPerMsec;
+  derived_timestamper_.GetTimestamps();
+  clocks_.boottime_nsec += kNsecPerMsec;
+  derived_timestamper_.GetTimestamps();
+}
+
+TEST_F(TimestamperTest, DeriveModeAgreesWithReadAllClocksMode) {
+  constexpr int64_t kStepNsec = 7 * kNsecPerMsec + 1;
+  for (int64_t elapsed_nsec = 0; elapsed_nsec < kNsecPerSec;
+       elapsed_nsec += kStepNsec) {
+    const auto& expected = all_clocks_timestamper_.GetTimestamps();
+    const auto& actual = derived_timestamper_.GetTimestamps();
+    ExpectTimestampsEqual(expected.since_boot_awake_only,
+                          actual.since_boot_awake_only);
+    ExpectTimestampsEqual(expected.since_boot_with_sleep,
+                          actual.since_boot_with_sleep);
+    ExpectTimestampsEqual(expected.since_epoch, actual.since_epoch);
+    clocks_.boottime_nsec += kStepNsec;
+  }
+}
+
+TEST_F(TimestamperTest, DeriveModeRefreshesOffsetsAfterInterval) {
+  derived_timestamper_.GetTimestamps();
+
+  EXPECT_CALL(os_, GetTimestamp(CLOCK_MONOTONIC))
+      .WillOnce(ReadFrom(&clocks_));
+  EXPECT_CALL(os_, GetTimestamp(CLOCK_REALTIME)).WillOnce(ReadFrom(&clocks_));
+  clocks_.boottime_nsec += Timestamper::kOffsetRefreshIntervalNsec;
+  derived_timestamper_.GetTimestamps();
+}
+
+TEST_F(TimestamperTest, DeriveModeIsAccurateAfterSuspend) {
+  derived_timestamper_.GetTimestamps();
+
+  constexpr int64_t kSuspendNsec = 10 * kNsecPerSec;
+  clocks_.boottime_nsec += kSuspendNsec;
+  clocks_.slept_nsec += kSuspendNsec;
+  ExpectTimestampsMatchClocks(derived_timestamper_.GetTimestamps());
+}
+
+TEST_F(TimestamperTest, DeriveModeIsAccurateAfterBoottimeGoesBackwards) {
+  derived_timestamper_.GetTimestamps();
+
+  clocks_.boottime_nsec -= kNsecPerMsec;
+  clocks_.slept_nsec -= kNsecPerMsec;
+  ExpectTimestampsMatchClocks(derived_timestamper_.GetTimestamps());
+}
+
+TEST_F(TimestamperTest, DeriveModeIsAccurateAfterInvalidateOffsets) {
+  derived_timestamper_.GetTimestamps();
+
+  clocks_.epoch_offset_nsec += kNsecPerSec;
+  derived_timestamper_.InvalidateOffsets();
+  ExpectTimestampsMatchClocks(derived_timestamper_.GetTimestamps());
+}
+
+TEST_F(TimestamperTest, DeriveModeMissesWallClockChangeWithinInterval) {
+  // This test documents a known limitation, rather than desired behavior.
+  const auto& before = derived_timestamper_.GetTimestamps();
+
+  clocks_.epoch_offset_nsec += kNsecPerSec;
+  ExpectTimestampsEqual(before.since_epoch,
+                        derived_timestamper_.GetTimestamps().since_epoch);
+}
+
+}  // namespace wifilogd
+}  // namespace android
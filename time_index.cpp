@@ -0,0 +1,61 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <algorithm>
+#include <iterator>
+
+#include "wifilogd/time_index.h"
+
+namespace android {
+namespace wifilogd {
+
+constexpr uint64_t TimeIndex::kRecordsPerEntry;
+
+TimeIndex::TimeIndex()
+    : entries_(), max_timestamp_nsec_(0), have_timestamp_(false) {}
+
+void TimeIndex::Add(uint64_t record_number, int64_t timestamp_nsec) {
+  if (!have_timestamp_ || timestamp_nsec > max_timestamp_nsec_) {
+    max_timestamp_nsec_ = timestamp_nsec;
+    have_timestamp_ = true;
+  }
+  if (record_number % kRecordsPerEntry == 0) {
+    entries_.push_back({max_timestamp_nsec_, record_number});
+  }
+}
+
+void TimeIndex::EvictBefore(uint64_t first_record) {
+  while (!entries_.empty() && entries_.front().record_number < first_record) {
+    entries_.pop_front();
+  }
+}
+
+uint64_t TimeIndex::Seek(int64_t timestamp_nsec, uint64_t first_record) const {
+  // Find the last entry with a timestamp before |timestamp_nsec|. Every
+  // record before that entry's record is at least as old as the entry.
+  const auto first_later = std::lower_bound(
+      entries_.begin(), entries_.end(), timestamp_nsec,
+      [](const Entry& entry, int64_t timestamp_nsec) {
+        return entry.max_timestamp_nsec < timestamp_nsec;
+      });
+  if (first_later == entries_.begin()) {
+    return first_record;
+  }
+  return std::max(std::prev(first_later)->record_number, first_record);
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIME_INDEX_H_
+#define TIME_INDEX_H_
+
+#include <cstdint>
+#include <deque>
+
+#include "android-base/macros.h"
+
+namespace android {
+namespace wifilogd {
+
+// A sparse index from timestamps to the records of a log buffer, so that a
+// query for the records logged after a given time can start near the first
+// such record, rather than reading every older record. Records are named by
+// their numbers, as described for LogBuffer::GetNumAppended().
+//
+// The index holds an entry for every kRecordsPerEntry-th record. Each entry
+// holds the latest timestamp of any record up to, and including, its own.
+// So the entries are ordered by timestamp, even if the clock steps back.
+class TimeIndex {
+ public:
+  static constexpr uint64_t kRecordsPerEntry = 32;
+
+  TimeIndex();
+
+  // Notes that record |record_number|, the record after the last one noted
+  // (if any), was logged at |timestamp_nsec|.
+  void Add(uint64_t record_number, int64_t timestamp_nsec);
+
+  // Drops the entries for records before |first_record| (e.g., because
+  // those records have been evicted).
+  void EvictBefore(uint64_t first_record);
+
+  // Returns the number of a record, no earlier than |first_record|, such
+  // that every noted record before it was logged before |timestamp_nsec|.
+  uint64_t Seek(int64_t timestamp_nsec, uint64_t first_record) const;
+
+  // Returns the number of entries in the index.
+  size_t GetNumEntries() const { return entries_.size(); }
+
+ private:
+  struct Entry {
+    int64_t max_timestamp_nsec;
+    uint64_t record_number;
+  };
+
+  std::deque<Entry> entries_;
+  int64_t max_timestamp_nsec_;  // Over every record noted so far.
+  bool have_timestamp_;
+
+  DISALLOW_COPY_AND_ASSIGN(TimeIndex);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // TIME_INDEX_H_
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIMESTAMP_HEADER_H_
+#define TIMESTAMP_HEADER_H_
+
+#include "wifilogd/os.h"
+
+namespace android {
+namespace wifilogd {
+
+// The header that CommandProcessor prepends to each command that it logs.
+// The header is also part of the byte stream produced in response to
+// protocol::Opcode::kDumpBuffersBinary, so changes to its layout require a
+// new protocol::kBinaryDumpVersion.
+class TimestampHeader {
+ public:
+  TimestampHeader& set_since_boot_awake_only(Os::Timestamp new_value) {
+    since_boot_awake_only = new_value;
+    return *this;
+  }
+
+  TimestampHeader& set_since_boot_with_sleep(Os::Timestamp new_value) {
+    since_boot_with_sleep = new_value;
+    return *this;
+  }
+
+  TimestampHeader& set_since_epoch(Os::Timestamp new_value) {
+    since_epoch = new_value;
+    return *this;
+  }
+
+  Os::Timestamp since_boot_awake_only;
+  Os::Timestamp since_boot_with_sleep;
+  Os::Timestamp since_epoch;  // non-monotonic
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // TIMESTAMP_HEADER_H_
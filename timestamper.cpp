@@ -0,0 +1,103 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <time.h>
+
+#include <cstdint>
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/profiler.h"
+#include "wifilogd/timestamper.h"
+
+namespace android {
+namespace wifilogd {
+
+using local_utils::GetMaxVal;
+
+namespace {
+
+constexpr int64_t kNsecPerSec = 1000 * 1000 * 1000;
+constexpr int64_t kMaxTimestampNsec =
+    GetMaxVal<decltype(Os::Timestamp::secs)>() * kNsecPerSec + Os::kMaxNanos;
+
+Os::Timestamp NsecToTimestamp(int64_t nsec) {
+  const int64_t clamped_nsec =
+      SAFELY_CLAMP(nsec, int64_t, 0, kMaxTimestampNsec);
+  Os::Timestamp timestamp;
+  timestamp.secs = SAFELY_CLAMP(clamped_nsec / kNsecPerSec, uint32_t, 0,
+                                GetMaxVal<uint32_t>());
+  timestamp.nsecs = SAFELY_CLAMP(clamped_nsec % kNsecPerSec, uint32_t, 0,
+                                 Os::kMaxNanos);
+  return timestamp;
+}
+
+}  // namespace
+
+constexpr int64_t Timestamper::kOffsetRefreshIntervalNsec;
+
+Timestamper::Timestamper(const Os* os, Mode mode)
+    : os_(os),
+      mode_(mode),
+      have_offsets_(false),
+      last_refresh_boottime_nsec_(0),
+      awake_offset_nsec_(0),
+      epoch_offset_nsec_(0) {}
+
+Timestamper::Timestamps Timestamper::GetTimestamps() {
+  WIFILOGD_PROFILE_SCOPE(ProfiledStage::kGetTimestamps);
+  if (mode_ == Mode::kReadAllClocks) {
+    return ReadAllClocks();
+  }
+
+  const Os::Timestamp boottime = os_->GetTimestamp(CLOCK_BOOTTIME);
+  const int64_t boottime_nsec = boottime.ToNsec();
+  // The last condition guards against a (buggy) clock that goes backwards.
+  if (!have_offsets_ ||
+      boottime_nsec - last_refresh_boottime_nsec_ >=
+          kOffsetRefreshIntervalNsec ||
+      boottime_nsec < last_refresh_boottime_nsec_) {
+    const Timestamps& timestamps = ReadAllClocks();
+    const int64_t refresh_boottime_nsec =
+        timestamps.since_boot_with_sleep.ToNsec();
+    have_offsets_ = true;
+    last_refresh_boottime_nsec_ = refresh_boottime_nsec;
+    awake_offset_nsec_ =
+        timestamps.since_boot_awake_only.ToNsec() - refresh_boottime_nsec;
+    epoch_offset_nsec_ =
+        timestamps.since_epoch.ToNsec() - refresh_boottime_nsec;
+    return timestamps;
+  }
+
+  Timestamps timestamps;
+  timestamps.since_boot_awake_only =
+      NsecToTimestamp(boottime_nsec + awake_offset_nsec_);
+  timestamps.since_boot_with_sleep = boottime;
+  timestamps.since_epoch = NsecToTimestamp(boottime_nsec + epoch_offset_nsec_);
+  return timestamps;
+}
+
+// Private methods below.
+
+Timestamper::Timestamps Timestamper::ReadAllClocks() const {
+  Timestamps timestamps;
+  timestamps.since_boot_awake_only = os_->GetTimestamp(CLOCK_MONOTONIC);
+  timestamps.since_boot_with_sleep = os_->GetTimestamp(CLOCK_BOOTTIME);
+  timestamps.since_epoch = os_->GetTimestamp(CLOCK_REALTIME);
+  return timestamps;
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,86 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TIMESTAMPER_H_
+#define TIMESTAMPER_H_
+
+#include <cstdint>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/os.h"
+
+namespace android {
+namespace wifilogd {
+
+// Reports the current time, according to each of the clocks that wifilogd
+// records for a message (CLOCK_MONOTONIC, CLOCK_BOOTTIME, and CLOCK_REALTIME).
+//
+// The user must ensure that |os| outlives the Timestamper.
+class Timestamper {
+ public:
+  enum class Mode {
+    // Reads every clock, on every call to GetTimestamps().
+    kReadAllClocks,
+    // Reads only CLOCK_BOOTTIME, on most calls to GetTimestamps(). The times
+    // for the other clocks are derived from their offsets relative to
+    // CLOCK_BOOTTIME. The offsets are refreshed (by reading every clock) at
+    // least once per kOffsetRefreshIntervalNsec of CLOCK_BOOTTIME.
+    //
+    // Because CLOCK_BOOTTIME advances during suspend, the first call after
+    // a suspend of kOffsetRefreshIntervalNsec or more always refreshes the
+    // offsets. Hence, the derived times may be off by up to
+    // kOffsetRefreshIntervalNsec, after a short suspend, or after a change to
+    // the wall clock. Callers which learn of a clock change can use
+    // InvalidateOffsets() to avoid the error.
+    kDeriveFromBoottime,
+  };
+
+  struct Timestamps {
+    Os::Timestamp since_boot_awake_only;  // CLOCK_MONOTONIC
+    Os::Timestamp since_boot_with_sleep;  // CLOCK_BOOTTIME
+    Os::Timestamp since_epoch;            // CLOCK_REALTIME
+  };
+
+  static constexpr int64_t kOffsetRefreshIntervalNsec = 100 * 1000 * 1000;
+
+  Timestamper(NONNULL const Os* os, Mode mode);
+
+  // Returns the current time, according to each clock.
+  Timestamps GetTimestamps();
+
+  // Forces the next call to GetTimestamps() to read every clock.
+  void InvalidateOffsets() { have_offsets_ = false; }
+
+ private:
+  // Reads every clock.
+  Timestamps ReadAllClocks() const;
+
+  const Os* const os_;  // non-owned
+  const Mode mode_;
+  bool have_offsets_;
+  int64_t last_refresh_boottime_nsec_;
+  int64_t awake_offset_nsec_;  // CLOCK_MONOTONIC - CLOCK_BOOTTIME
+  int64_t epoch_offset_nsec_;  // CLOCK_REALTIME - CLOCK_BOOTTIME
+
+  DISALLOW_COPY_AND_ASSIGN(Timestamper);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // TIMESTAMPER_H_
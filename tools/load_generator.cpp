@@ -0,0 +1,305 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cinttypes>
+#include <cstdio>
+#include <cstring>
+#include <mutex>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+#include "android-base/logging.h"
+#include "android-base/unique_fd.h"
+
+#include "wifilogd/tools/load_generator.h"
+
+namespace android {
+namespace wifilogd {
+
+using ::android::base::unique_fd;
+
+namespace {
+
+constexpr int64_t kNsecPerMsec = 1000 * 1000;
+constexpr int64_t kNsecPerSec = 1000 * 1000 * 1000;
+constexpr char kStatsPrefix[] = "# stats ";
+constexpr char kLatencyPrefix[] = "# latency ";
+
+int64_t GetTimeNsec(clockid_t clock_id) {
+  struct timespec now;
+  clock_gettime(clock_id, &now);
+  return static_cast<int64_t>(now.tv_sec) * kNsecPerSec + now.tv_nsec;
+}
+
+void SleepUntil(int64_t deadline_nsec) {
+  struct timespec deadline;
+  deadline.tv_sec = deadline_nsec / kNsecPerSec;
+  deadline.tv_nsec = deadline_nsec % kNsecPerSec;
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline,
+                         nullptr) == EINTR) {
+  }
+}
+
+// Sends |len| bytes at |buf| on |sock_fd|, along with |fd_to_pass|.
+bool SendWithFd(int sock_fd, const void* buf, size_t len, int fd_to_pass) {
+  struct iovec iov;
+  iov.iov_base = const_cast<void*>(buf);
+  iov.iov_len = len;
+  alignas(struct cmsghdr) std::array<uint8_t, CMSG_SPACE(sizeof(int))>
+      control_buf{};
+  struct msghdr msg {};
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = control_buf.data();
+  msg.msg_controllen = control_buf.size();
+  struct cmsghdr* const cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  std::memcpy(CMSG_DATA(cmsg), &fd_to_pass, sizeof(fd_to_pass));
+  return TEMP_FAILURE_RETRY(sendmsg(sock_fd, &msg, 0)) ==
+         static_cast<ssize_t>(len);
+}
+
+// Reads |fd| until EOF. Returns what was read.
+std::string ReadUntilEof(int fd) {
+  std::string contents;
+  std::array<char, 64 * 1024> buf;
+  while (true) {
+    const ssize_t n_read = TEMP_FAILURE_RETRY(read(fd, buf.data(), buf.size()));
+    if (n_read <= 0) {
+      break;
+    }
+    contents.append(buf.data(), n_read);
+  }
+  return contents;
+}
+
+}  // namespace
+
+LoadGenerator::LoadGenerator(const Options& options) : options_(options) {
+  CHECK(options_.n_writers > 0);
+  CHECK(options_.n_tags_per_writer > 0);
+}
+
+LoadGenerator::Report LoadGenerator::Run() {
+  Report report{};
+  std::string unused_latency_summary;
+  if (!ParseStatsResponse(SendDumpCommand(protocol::Opcode::kDumpStats),
+                          &report.stats_before, &unused_latency_summary)) {
+    LOG(FATAL) << "Failed to read stats from " << options_.socket_path;
+  }
+
+  const int64_t start_nsec = GetTimeNsec(CLOCK_MONOTONIC);
+  const int64_t deadline_nsec =
+      start_nsec + options_.duration_msec * kNsecPerMsec;
+  std::vector<uint64_t> n_sent(options_.n_writers);
+  std::vector<uint64_t> n_send_failures(options_.n_writers);
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < options_.n_writers; ++i) {
+    threads.emplace_back(&LoadGenerator::RunWriter, this, i, deadline_nsec,
+                         &n_sent[i], &n_send_failures[i]);
+  }
+  if (options_.dump_interval_msec) {
+    threads.emplace_back(&LoadGenerator::RunDumper, this, deadline_nsec,
+                         &report.n_dumps, &report.n_dump_bytes);
+  }
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  report.elapsed_nsec = GetTimeNsec(CLOCK_MONOTONIC) - start_nsec;
+  for (size_t i = 0; i < options_.n_writers; ++i) {
+    report.n_sent += n_sent[i];
+    report.n_send_failures += n_send_failures[i];
+  }
+
+  if (!ParseStatsResponse(SendDumpCommand(protocol::Opcode::kDumpStats),
+                          &report.stats_after, &report.latency_summary)) {
+    LOG(FATAL) << "Failed to read stats from " << options_.socket_path;
+  }
+  return report;
+}
+
+size_t LoadGenerator::BuildMessage(const std::string& tag,
+                                   uint16_t sequence_num,
+                                   uint64_t src_boottime_nsec,
+                                   size_t message_len, uint8_t* buf) {
+  constexpr size_t kHeadersLen =
+      sizeof(protocol::Command) + sizeof(protocol::AsciiMessage);
+  const size_t tag_len = std::min<size_t>(
+      {tag.length(), protocol::kMaxMessageSize - kHeadersLen,
+       local_utils::GetMaxVal<decltype(protocol::AsciiMessage::tag_len)>()});
+  const size_t data_len = std::min(
+      message_len, protocol::kMaxMessageSize - kHeadersLen - tag_len);
+  const auto command =
+      protocol::Command()
+          .set_opcode(protocol::Opcode::kWriteAsciiMessage)
+          .set_payload_len(sizeof(protocol::AsciiMessage) + tag_len + data_len)
+          .set_sequence_num(sequence_num)
+          .set_src_boottime_nsec(src_boottime_nsec);
+  const auto ascii_message_header =
+      protocol::AsciiMessage()
+          .set_tag_len(tag_len)
+          .set_data_len(data_len)
+          .set_severity(protocol::MessageSeverity::kInformational);
+
+  uint8_t* out = buf;
+  std::memcpy(out, &command, sizeof(command));
+  out += sizeof(command);
+  std::memcpy(out, &ascii_message_header, sizeof(ascii_message_header));
+  out += sizeof(ascii_message_header);
+  std::memcpy(out, tag.data(), tag_len);
+  out += tag_len;
+  // Vary the text with the sequence number, as real messages vary.
+  for (size_t i = 0; i < data_len; ++i) {
+    *out++ = 'a' + (sequence_num + i) % 26;
+  }
+  return out - buf;
+}
+
+bool LoadGenerator::ParseStatsResponse(const std::string& response,
+                                       protocol::Stats* stats,
+                                       std::string* latency_summary) {
+  bool found_stats = false;
+  latency_summary->clear();
+  std::istringstream lines(response);
+  std::string line;
+  while (std::getline(lines, line)) {
+    if (line.compare(0, sizeof(kLatencyPrefix) - 1, kLatencyPrefix) == 0) {
+      latency_summary->append(line).append("\n");
+      continue;
+    }
+    if (line.compare(0, sizeof(kStatsPrefix) - 1, kStatsPrefix) != 0) {
+      continue;
+    }
+    found_stats =
+        std::sscanf(line.c_str(),
+                    "# stats logged=%" SCNu64 " evicted=%" SCNu64
+                    " missing=%" SCNu64 " truncated=%" SCNu64
+                    " rejected=%" SCNu64 " ring_dropped=%" SCNu64
+                    " enomem=%" SCNu64 " eintr=%" SCNu64,
+                    &stats->n_messages_logged, &stats->n_messages_evicted,
+                    &stats->n_messages_missing, &stats->n_datagrams_truncated,
+                    &stats->n_commands_rejected,
+                    &stats->n_ring_records_dropped,
+                    &stats->n_receive_enomem_errors,
+                    &stats->n_receive_eintr_errors) == 8;
+  }
+  return found_stats;
+}
+
+// Private methods below.
+
+void LoadGenerator::RunWriter(size_t writer_index, int64_t deadline_nsec,
+                              uint64_t* n_sent, uint64_t* n_send_failures) {
+  unique_fd sock_fd(ConnectOrDie());
+  std::vector<std::string> tags;
+  for (size_t i = 0; i < options_.n_tags_per_writer; ++i) {
+    std::ostringstream tag;
+    // Include our pid, so that a later run does not continue the sequence
+    // numbers of an earlier run's tags.
+    tag << "loadgen" << getpid() << "." << writer_index << "." << i;
+    tags.push_back(tag.str());
+  }
+  std::vector<uint16_t> sequence_nums(tags.size());
+  std::array<uint8_t, protocol::kMaxMessageSize> buf;
+
+  const int64_t period_nsec =
+      options_.messages_per_sec ? kNsecPerSec / options_.messages_per_sec : 0;
+  int64_t next_send_nsec = GetTimeNsec(CLOCK_MONOTONIC);
+  for (size_t i = 0; next_send_nsec < deadline_nsec; ++i) {
+    const size_t tag_index = i % tags.size();
+    const size_t len = BuildMessage(
+        tags[tag_index], sequence_nums[tag_index]++,
+        GetTimeNsec(CLOCK_BOOTTIME), options_.message_len, buf.data());
+    if (TEMP_FAILURE_RETRY(send(sock_fd.get(), buf.data(), len,
+                                MSG_DONTWAIT)) == static_cast<ssize_t>(len)) {
+      ++*n_sent;
+    } else {
+      ++*n_send_failures;
+    }
+
+    if (period_nsec) {
+      next_send_nsec += period_nsec;
+      SleepUntil(next_send_nsec);
+    } else {
+      next_send_nsec = GetTimeNsec(CLOCK_MONOTONIC);
+    }
+  }
+}
+
+void LoadGenerator::RunDumper(int64_t deadline_nsec, uint64_t* n_dumps,
+                              uint64_t* n_dump_bytes) {
+  const int64_t interval_nsec = options_.dump_interval_msec * kNsecPerMsec;
+  for (int64_t next_dump_nsec =
+           GetTimeNsec(CLOCK_MONOTONIC) + interval_nsec;
+       next_dump_nsec < deadline_nsec; next_dump_nsec += interval_nsec) {
+    SleepUntil(next_dump_nsec);
+    const std::string dump = SendDumpCommand(protocol::Opcode::kDumpBuffers);
+    // An empty response means that the daemon rejected the dump.
+    if (!dump.empty()) {
+      ++*n_dumps;
+      *n_dump_bytes += dump.size();
+    }
+  }
+}
+
+std::string LoadGenerator::SendDumpCommand(protocol::Opcode opcode) {
+  int pipe_fds[2];
+  PCHECK(pipe2(pipe_fds, O_CLOEXEC) == 0);
+  unique_fd read_end(pipe_fds[0]);
+  unique_fd write_end(pipe_fds[1]);
+
+  unique_fd sock_fd(ConnectOrDie());
+  const auto command = protocol::Command().set_opcode(opcode);
+  if (!SendWithFd(sock_fd.get(), &command, sizeof(command), write_end.get())) {
+    PLOG(ERROR) << "Failed to send dump command";
+    return "";
+  }
+  // The daemon holds the other copy of |write_end|, and closes it when the
+  // dump is complete.
+  write_end.reset();
+  return ReadUntilEof(read_end.get());
+}
+
+int LoadGenerator::ConnectOrDie() const {
+  const int sock_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+  PCHECK(sock_fd >= 0);
+  struct sockaddr_un addr {};
+  addr.sun_family = AF_UNIX;
+  CHECK(options_.socket_path.size() < sizeof(addr.sun_path));
+  std::memcpy(addr.sun_path, options_.socket_path.c_str(),
+              options_.socket_path.size() + 1);
+  if (TEMP_FAILURE_RETRY(connect(sock_fd,
+                                 reinterpret_cast<struct sockaddr*>(&addr),
+                                 sizeof(addr))) != 0) {
+    PLOG(FATAL) << "Failed to connect to " << options_.socket_path;
+  }
+  return sock_fd;
+}
+
+}  // namespace wifilogd
+}  // namespace android
@@ -0,0 +1,122 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef TOOLS_LOAD_GENERATOR_H_
+#define TOOLS_LOAD_GENERATOR_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include "android-base/macros.h"
+
+#include "wifilogd/local_utils.h"
+#include "wifilogd/protocol.h"
+
+namespace android {
+namespace wifilogd {
+
+// Floods wifilogd with kWriteAsciiMessage commands, from several writer
+// threads, to check that the daemon keeps up with bursts of logging. Each
+// writer logs under its own tags, and numbers the messages for each tag
+// from zero, so that wifilogd can count messages that go missing. Each
+// message also carries its send time, so that wifilogd can measure
+// latency.
+//
+// Writers send without blocking. A send that fails because the socket's
+// queue is full is counted as a drop, and the writer moves on to its next
+// message (as a well-behaved client would).
+class LoadGenerator {
+ public:
+  struct Options {
+    std::string socket_path{protocol::kServiceSocketPath};
+    size_t n_writers{4};
+    size_t n_tags_per_writer{4};
+    // Per writer. Zero sends as fast as possible.
+    uint32_t messages_per_sec{1000};
+    // The length of each message's text. (The tag is extra.)
+    size_t message_len{64};
+    uint32_t duration_msec{10 * 1000};
+    // How often to request a kDumpBuffers, concurrently with the writers.
+    // Zero disables dumps.
+    uint32_t dump_interval_msec{0};
+  };
+
+  struct Report {
+    uint64_t n_sent;
+    uint64_t n_send_failures;
+    uint64_t n_dumps;
+    uint64_t n_dump_bytes;
+    int64_t elapsed_nsec;
+    // The daemon's stats, from before and after the run.
+    protocol::Stats stats_before;
+    protocol::Stats stats_after;
+    // The daemon's latency summary, from after the run. (As reported by
+    // kDumpStats. This covers every message the daemon has logged, not just
+    // those sent by this run.)
+    std::string latency_summary;
+  };
+
+  explicit LoadGenerator(const Options& options);
+
+  // Runs the load, and returns the results. Dies if the daemon's socket
+  // cannot be reached.
+  Report Run();
+
+  // Writes a kWriteAsciiMessage command for |tag|, with |sequence_num|,
+  // |src_boottime_nsec|, and |message_len| bytes of text, to |buf|. |buf|
+  // must have room for protocol::kMaxMessageSize bytes. Returns the length
+  // of the command, which is truncated to fit protocol::kMaxMessageSize.
+  static size_t BuildMessage(const std::string& tag, uint16_t sequence_num,
+                             uint64_t src_boottime_nsec, size_t message_len,
+                             NONNULL uint8_t* buf);
+
+  // Parses the response to kDumpStats, filling in |stats| from the
+  // "# stats" line, and |latency_summary| with the "# latency" lines.
+  // Returns false if there is no "# stats" line.
+  static bool ParseStatsResponse(const std::string& response,
+                                 NONNULL protocol::Stats* stats,
+                                 NONNULL std::string* latency_summary);
+
+ private:
+  // Sends messages until |deadline_nsec|, for writer
+  // |writer_index|. Adds the counts of messages sent, and of failed sends,
+  // to |n_sent| and |n_send_failures|.
+  void RunWriter(size_t writer_index, int64_t deadline_nsec,
+                 NONNULL uint64_t* n_sent, NONNULL uint64_t* n_send_failures);
+
+  // Requests a dump every |options_.dump_interval_msec|, until
+  // |deadline_nsec|, and reads each dump. Adds to |n_dumps| and
+  // |n_dump_bytes|.
+  void RunDumper(int64_t deadline_nsec, NONNULL uint64_t* n_dumps,
+                 NONNULL uint64_t* n_dump_bytes);
+
+  // Sends |opcode| to the daemon, with a pipe for the response, and returns
+  // the response.
+  std::string SendDumpCommand(protocol::Opcode opcode);
+
+  // Returns a socket connected to the daemon.
+  int ConnectOrDie() const;
+
+  const Options options_;
+
+  DISALLOW_COPY_AND_ASSIGN(LoadGenerator);
+};
+
+}  // namespace wifilogd
+}  // namespace android
+
+#endif  // TOOLS_LOAD_GENERATOR_H_
@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2016 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <getopt.h>
+
+#include <algorithm>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "android-base/logging.h"
+
+#include "wifilogd/tools/load_generator.h"
+
+namespace {
+
+using ::android::wifilogd::LoadGenerator;
+
+constexpr double kNsecPerSec = 1000.0 * 1000.0 * 1000.0;
+
+void PrintUsageAndExit(const char* program_name) {
+  std::fprintf(stderr,
+               "Usage: %s [--writers=N] [--tags=N] [--rate=MSGS_PER_SEC]\n"
+               "    [--size=BYTES] [--duration_ms=MSEC] "
+               "[--dump_interval_ms=MSEC]\n"
+               "    [--socket=PATH]\n",
+               program_name);
+  std::exit(EXIT_FAILURE);
+}
+
+unsigned long ParseUnsignedOrDie(const char* program_name, const char* arg) {
+  char* end = nullptr;
+  const unsigned long value = std::strtoul(arg, &end, 10);
+  if (*arg == '\0' || *end != '\0') {
+    PrintUsageAndExit(program_name);
+  }
+  return value;
+}
+
+void PrintReport(const LoadGenerator::Report& report) {
+  const uint64_t n_logged = report.stats_after.n_messages_logged -
+                            report.stats_before.n_messages_logged;
+  const uint64_t n_missing = report.stats_after.n_messages_missing -
+                             report.stats_before.n_messages_missing;
+  const uint64_t n_attempted = report.n_sent + report.n_send_failures;
+  // A failed send also leaves a gap in its tag's sequence numbers, so the
+  // daemon's missing count includes our send failures. Measure drops as
+  // the messages which were attempted, but never logged.
+  const uint64_t n_dropped = n_attempted - std::min(n_logged, n_attempted);
+  const double elapsed_sec = report.elapsed_nsec / kNsecPerSec;
+  std::printf("sent=%" PRIu64 " send_failures=%" PRIu64 " elapsed_sec=%.3f"
+              " sent_per_sec=%.0f\n",
+              report.n_sent, report.n_send_failures, elapsed_sec,
+              elapsed_sec > 0 ? report.n_sent / elapsed_sec : 0);
+  std::printf("daemon_logged=%" PRIu64 " daemon_missing=%" PRIu64
+              " drop_rate=%.6f\n",
+              n_logged, n_missing,
+              n_attempted ? static_cast<double>(n_dropped) / n_attempted : 0);
+  std::printf("dumps=%" PRIu64 " dump_bytes=%" PRIu64 "\n", report.n_dumps,
+              report.n_dump_bytes);
+  std::printf("%s", report.latency_summary.c_str());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  android::base::InitLogging(argv, android::base::StderrLogger);
+
+  const struct option long_options[] = {
+      {"writers", required_argument, nullptr, 'w'},
+      {"tags", required_argument, nullptr, 't'},
+      {"rate", required_argument, nullptr, 'r'},
+      {"size", required_argument, nullptr, 's'},
+      {"duration_ms", required_argument, nullptr, 'd'},
+      {"dump_interval_ms", required_argument, nullptr, 'i'},
+      {"socket", required_argument, nullptr, 'p'},
+      {nullptr, 0, nullptr, 0},
+  };
+  LoadGenerator::Options options;
+  int opt;
+  while ((opt = getopt_long(argc, argv, "", long_options, nullptr)) != -1) {
+    switch (opt) {
+      case 'w':
+        options.n_writers = ParseUnsignedOrDie(argv[0], optarg);
+        break;
+      case 't':
+        options.n_tags_per_writer = ParseUnsignedOrDie(argv[0], optarg);
+        break;
+      case 'r':
+        options.messages_per_sec = ParseUnsignedOrDie(argv[0], optarg);
+        break;
+      case 's':
+        options.message_len = ParseUnsignedOrDie(argv[0], optarg);
+        break;
+      case 'd':
+        options.duration_msec = ParseUnsignedOrDie(argv[0], optarg);
+        break;
+      case 'i':
+        options.dump_interval_msec = ParseUnsignedOrDie(argv[0], optarg);
+        break;
+      case 'p':
+        options.socket_path = optarg;
+        break;
+      default:
+        PrintUsageAndExit(argv[0]);
+    }
+  }
+  if (optind != argc || !options.n_writers || !options.n_tags_per_writer) {
+    PrintUsageAndExit(argv[0]);
+  }
+
+  PrintReport(LoadGenerator(options).Run());
+  return EXIT_SUCCESS;
+}